@@ -22,6 +22,12 @@
 #include <linux/platform_device.h>
 #include <linux/spinlock.h>
 #include <linux/sysfs.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 
@@ -36,11 +42,19 @@ struct adc_device {
 	void __iomem *mem;
 	int irq;
 	spinlock_t lock;
-	wait_queue_head_t wait;
-	wait_queue_head_t meas_busy;
-	bool busy;
-	bool conversion_finished;
 	uint show_sample;
+
+	/* request queue, ordered by priority, and the request being
+	 * converted, all protected by lock */
+	struct list_head queue;
+	int queued;
+	struct adc_request *current_req;
+	uint current_show;
+
+	/* registered clients, for statistics */
+	struct mutex clients_lock;
+	struct list_head clients;
+	struct dentry *debug;
 };
 
 extern int lf1000_CalcDivider(unsigned int rate_hz, unsigned int desired_mhz);
@@ -49,86 +63,234 @@ static struct adc_device adc = {
 	.mem = NULL,
 	.irq = -1,
 	.lock = SPIN_LOCK_UNLOCKED,
-	.busy = 0,
-	.conversion_finished = 1,
 	.show_sample = 0,	/* toggle GPIO pin when ADC is sampled */
+	.queue = LIST_HEAD_INIT(adc.queue),
+	.clients_lock = __MUTEX_INITIALIZER(adc.clients_lock),
+	.clients = LIST_HEAD_INIT(adc.clients),
 };
 
-static int adc_available(void)
-{
-	unsigned long flags;
-	int ret;
-
-	spin_lock_irqsave(&adc.lock, flags);
-	ret = !adc.busy;
-	spin_unlock_irqrestore(&adc.lock, flags);
-
-	return ret;
-}
-
-/*********************
- * ADC API Functions *
- *********************/
+/* client for callers of the plain adc_GetReading() API */
+static struct adc_client adc_default_client = {
+	.name = "default",
+};
 
-int adc_GetReading(u8 channel)
+/* Start a conversion on a channel.  Called with adc.lock held. */
+static void adc_start(u8 channel)
 {
-	unsigned long flags;
 	u16 tmp;
-	int show_sample;
-	int reading;
 
-	if (channel > LF1000_ADC_MAX_CHANNEL)
-		return -EINVAL;
-
-	show_sample = adc.show_sample; /* value could change during reading */
-	
-	/* wait for the ADC */
-	spin_lock_irqsave(&adc.lock, flags);
-	while (adc.busy) {
-		spin_unlock_irqrestore(&adc.lock, flags);
-		if (wait_event_interruptible(adc.wait, (adc_available())))
-			return -ERESTARTSYS;
-		spin_lock_irqsave(&adc.lock, flags);
-	}
-	adc.busy = 1;
-	spin_unlock_irqrestore(&adc.lock, flags);
-
-	/* Setup ADC */
 	tmp = readw(adc.mem + ADCCON);
 	tmp &= ~(0x7<<ASEL);
 	tmp |= (channel<<ASEL);
 	writew(tmp, adc.mem + ADCCON);
-	adc.conversion_finished = 0;
 	writew(1, adc.mem + ADCINTCLR);
 	writew((u16)(1), adc.mem + ADCINTENB);
 	tmp |= (1<<ADEN);
 
 	/* GPIO pin goes high showing sample started */
-	if (show_sample & (1 << channel))
+	if (adc.current_show & (1 << channel))
         	gpio_configure_pin(lf1000_l2p_port(DOCK_POWER),
 			lf1000_l2p_pin(DOCK_POWER), GPIO_GPIOFN, 1, 0, 1);	
 		
 	writew(tmp, adc.mem + ADCCON); /* start conversion */
+}
 
-	/* wait for conversion to finish */
-	if (wait_event_interruptible(adc.meas_busy, adc.conversion_finished))
-		return -ERESTARTSYS;
+/* Start on the next queued request, if any.  Called with adc.lock held. */
+static void adc_next(void)
+{
+	struct adc_request *req;
+
+	if (list_empty(&adc.queue)) {
+		adc.current_req = NULL;
+		writew((u16)(0), adc.mem + ADCINTENB); /* disable interrupt */
+		return;
+	}
+
+	req = list_first_entry(&adc.queue, struct adc_request, list);
+	list_del(&req->list);
+	adc.queued--;
+
+	adc.current_req = req;
+	adc.current_show = adc.show_sample; /* value could change */
+	adc_start(req->channels[0]);
+}
+
+/*********************
+ * ADC API Functions *
+ *********************/
+
+int adc_RegisterClient(struct adc_client *client)
+{
+	client->requests = 0;
+	client->conversions = 0;
+	client->pending = 0;
+	client->queue_max = 0;
+	client->latency_max_us = 0;
+	client->latency_total_us = 0;
+
+	mutex_lock(&adc.clients_lock);
+	list_add_tail(&client->list, &adc.clients);
+	mutex_unlock(&adc.clients_lock);
+	return 0;
+}
+EXPORT_SYMBOL(adc_RegisterClient);
+
+void adc_UnregisterClient(struct adc_client *client)
+{
+	mutex_lock(&adc.clients_lock);
+	list_del(&client->list);
+	mutex_unlock(&adc.clients_lock);
+}
+EXPORT_SYMBOL(adc_UnregisterClient);
+
+/*
+ * Queue a list of conversions.  Requests are served in order of their
+ * client's priority, then in order of submission, and the conversions of one
+ * request are chained back to back from the interrupt handler.  The complete
+ * callback runs in interrupt context once req->readings[] is filled in, and
+ * may submit another request.
+ */
+int adc_Submit(struct adc_request *req)
+{
+	struct adc_client *client = req->client;
+	struct adc_request *pos;
+	unsigned long flags;
+	int depth;
+	int i;
+
+	if (!adc.mem)
+		return -ENODEV;
+	if (req->count <= 0 || !req->complete)
+		return -EINVAL;
+	for (i = 0; i < req->count; i++)
+		if (req->channels[i] > LF1000_ADC_MAX_CHANNEL)
+			return -EINVAL;
+
+	req->index = 0;
+	req->status = 0;
+	req->submitted = ktime_get();
 
-	/* release ADC */
 	spin_lock_irqsave(&adc.lock, flags);
-	reading = readw(adc.mem + ADCDAT);
-	/* GPIO pin goes low showing sample started */
-	if (show_sample & (1 << channel))
-        	gpio_configure_pin(lf1000_l2p_port(DOCK_POWER),
-			lf1000_l2p_pin(DOCK_POWER), GPIO_GPIOFN, 1, 0, 0);	
-		
-	adc.busy = 0;
+
+	depth = adc.queued + (adc.current_req ? 1 : 0);
+	client->requests++;
+	client->pending++;
+	if (depth > client->queue_max)
+		client->queue_max = depth;
+
+	/* go in behind requests of the same or higher priority */
+	list_for_each_entry(pos, &adc.queue, list)
+		if (pos->client->priority < client->priority)
+			break;
+	list_add_tail(&req->list, &pos->list);
+	adc.queued++;
+
+	if (!adc.current_req)
+		adc_next();
+
 	spin_unlock_irqrestore(&adc.lock, flags);
-	wake_up_interruptible(&adc.wait);
+	return 0;
+}
+EXPORT_SYMBOL(adc_Submit);
+
+static void adc_sync_complete(struct adc_request *req)
+{
+	complete((struct completion *)req->context);
+}
+
+/* Convert a list of channels for a client and wait for the readings. */
+int adc_GetClientReadings(struct adc_client *client, const u8 *channels,
+		int *readings, int count)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct adc_request req = {
+		.client		= client,
+		.channels	= channels,
+		.readings	= readings,
+		.count		= count,
+		.complete	= adc_sync_complete,
+		.context	= &done,
+	};
+	int ret;
+
+	ret = adc_Submit(&req);
+	if (ret)
+		return ret;
+
+	/* Not interruptible: the interrupt handler writes to readings[] and
+	 * req lives on this stack.  A conversion only takes microseconds. */
+	wait_for_completion(&done);
+	return req.status;
+}
+EXPORT_SYMBOL(adc_GetClientReadings);
+
+int adc_GetClientReading(struct adc_client *client, u8 channel)
+{
+	int reading;
+	int ret;
+
+	ret = adc_GetClientReadings(client, &channel, &reading, 1);
+	if (ret < 0)
+		return ret;
 	return reading;
 }
+EXPORT_SYMBOL(adc_GetClientReading);
+
+int adc_GetReadings(const u8 *channels, int *readings, int count)
+{
+	return adc_GetClientReadings(&adc_default_client, channels, readings,
+			count);
+}
+EXPORT_SYMBOL(adc_GetReadings);
+
+int adc_GetReading(u8 channel)
+{
+	return adc_GetClientReading(&adc_default_client, channel);
+}
 EXPORT_SYMBOL(adc_GetReading);
 
+/*
+ * debugfs Interface
+ */
+
+static int adc_clients_show(struct seq_file *s, void *v)
+{
+	struct adc_client *client;
+
+	seq_printf(s, "%-16s %4s %10s %10s %7s %9s %10s %10s\n", "client",
+			"prio", "requests", "convs", "pending", "queue_max",
+			"lat_avg_us", "lat_max_us");
+
+	mutex_lock(&adc.clients_lock);
+	list_for_each_entry(client, &adc.clients, list) {
+		u32 done = client->requests - client->pending;
+
+		seq_printf(s, "%-16s %4d %10u %10u %7u %9u %10u %10u\n",
+				client->name, client->priority,
+				client->requests, client->conversions,
+				client->pending, client->queue_max,
+				done ? (u32)div_u64(client->latency_total_us,
+					done) : 0,
+				client->latency_max_us);
+	}
+	mutex_unlock(&adc.clients_lock);
+
+	return 0;
+}
+
+static int adc_clients_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, adc_clients_show, inode->i_private);
+}
+
+static const struct file_operations adc_clients_fops = {
+	.owner		= THIS_MODULE,
+	.open		= adc_clients_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 /*
  * sysfs Interface
  */
@@ -239,14 +401,49 @@ static struct attribute_group adc_attr_group = {
 
 static irqreturn_t adc_irq(int irq, void *dev_id)
 {
+	struct adc_request *req;
+	struct adc_client *client;
+	u8 channel;
+	u32 latency;
+
 	/* clear the pending interrupt */
 	writew(1, adc.mem + ADCINTCLR);
-	/* disable interrupt */
-	writew((u16)(0), adc.mem + ADCINTENB); 
 
-	adc.conversion_finished = 1;
+	spin_lock(&adc.lock);
+	req = adc.current_req;
+	if (!req) {
+		writew((u16)(0), adc.mem + ADCINTENB); /* disable interrupt */
+		spin_unlock(&adc.lock);
+		return IRQ_HANDLED;
+	}
 
-	wake_up_interruptible(&adc.meas_busy);
+	channel = req->channels[req->index];
+	req->readings[req->index++] = readw(adc.mem + ADCDAT);
+	/* GPIO pin goes low showing sample finished */
+	if (adc.current_show & (1 << channel))
+        	gpio_configure_pin(lf1000_l2p_port(DOCK_POWER),
+			lf1000_l2p_pin(DOCK_POWER), GPIO_GPIOFN, 1, 0, 0);	
+
+	/* chain the next conversion of this request */
+	if (req->index < req->count) {
+		adc_start(req->channels[req->index]);
+		spin_unlock(&adc.lock);
+		return IRQ_HANDLED;
+	}
+
+	client = req->client;
+	latency = ktime_us_delta(ktime_get(), req->submitted);
+	client->pending--;
+	client->conversions += req->count;
+	client->latency_total_us += latency;
+	if (latency > client->latency_max_us)
+		client->latency_max_us = latency;
+
+	/* and go straight on to the next request */
+	adc_next();
+	spin_unlock(&adc.lock);
+
+	req->complete(req);
 	return IRQ_HANDLED;
 }
 
@@ -255,6 +452,9 @@ static int lf1000_adc_remove(struct platform_device *pdev)
 	struct resource *res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 
 	sysfs_remove_group(&pdev->dev.kobj, &adc_attr_group);
+	adc_UnregisterClient(&adc_default_client);
+	if (adc.debug)
+		debugfs_remove_recursive(adc.debug);
 
 	if (adc.irq != -1)
 		free_irq(adc.irq, NULL);
@@ -313,8 +513,7 @@ static int lf1000_adc_probe(struct platform_device *pdev)
 		goto fail_irq;
 	}
 
-	init_waitqueue_head(&adc.wait);
-	init_waitqueue_head(&adc.meas_busy);
+	adc_RegisterClient(&adc_default_client);
 
 	/* set up the hardware */
 
@@ -337,6 +536,13 @@ static int lf1000_adc_probe(struct platform_device *pdev)
 	writew(tmp, adc.mem + ADCCON);
 
 	sysfs_create_group(&pdev->dev.kobj, &adc_attr_group);
+
+	adc.debug = debugfs_create_dir(DRIVER_NAME, NULL);
+	if (IS_ERR(adc.debug))
+		adc.debug = NULL;
+	if (adc.debug)
+		debugfs_create_file("clients", S_IRUSR, adc.debug, NULL,
+				&adc_clients_fops);
 	return 0;
 
 fail_irq:
@@ -18,6 +18,7 @@
 #include <linux/platform_device.h>
 #include <linux/io.h>
 #include <linux/sysfs.h>
+#include <linux/cpufreq.h>
 
 #include <mach/core.h>
 #include <mach/clkpwr.h>
@@ -42,11 +43,26 @@ static ssize_t set_cpu_freq_in_hz(struct device *dev,
 	struct device_attribute *attr, const char *buf, size_t count)
 {
 	unsigned int value;
+#ifdef CONFIG_CPU_FREQ_LF1000
+	struct cpufreq_policy *policy;
+	int ret;
+#endif
 
 	if (sscanf(buf, "%u", &value) != 1)
 		return -EINVAL;
 
+#ifdef CONFIG_CPU_FREQ_LF1000
+	/* the CPU clock belongs to cpufreq: pick from its table */
+	policy = cpufreq_cpu_get(0);
+	if (!policy)
+		return -ENODEV;
+	ret = cpufreq_driver_target(policy, value / 1000, CPUFREQ_RELATION_L);
+	cpufreq_cpu_put(policy);
+	if (ret)
+		return ret;
+#else
 	set_cpu_freq(value);
+#endif
 
 	return count;
 }
@@ -127,6 +143,10 @@ static ssize_t set_pll0(struct device *pdev, struct device_attribute *attr,
 	int ret;
 	struct lf1000_clk *clkdev = dev_get_drvdata(pdev);
 
+#ifdef CONFIG_CPU_FREQ_LF1000
+	/* cpufreq's frequency table is worked out from PLL0 */
+	return -EBUSY;
+#endif
 	ret = set_pll(clkdev, buf, 0);
 	if (ret)
 		return ret;
@@ -14,6 +14,8 @@
 #include <linux/sysdev.h>
 #include <linux/interrupt.h>
 #include <linux/console.h>
+#include <linux/clocksource.h>
+#include <linux/clockchips.h>
 #include <linux/amba/bus.h>
 #include <linux/amba/clcd.h>
 #include <linux/mtd/physmap.h>
@@ -495,17 +497,24 @@ struct platform_device lf1000_pwm_device = {
 	.resource		= &lf1000_pwm_resource,
 };
 
-struct resource lf1000_ga3d_resource = {
-	.start			= LF1000_GA3D_BASE,
-	.end			= LF1000_GA3D_END,
-	.flags			= IORESOURCE_MEM,
+struct resource lf1000_ga3d_resources[] = {
+	[0] = {
+		.start		= LF1000_GA3D_BASE,
+		.end		= LF1000_GA3D_END,
+		.flags		= IORESOURCE_MEM,
+	},
+	[1] = {
+		.start		= IRQ_GRP3D,
+		.end		= IRQ_GRP3D,
+		.flags		= IORESOURCE_IRQ,
+	},
 };
 
 struct platform_device lf1000_ga3d_device = {
 	.name			= "lf1000-ga3d",
 	.id			= -1,
-	.num_resources		= 1,
-	.resource		= &lf1000_ga3d_resource,
+	.num_resources		= ARRAY_SIZE(lf1000_ga3d_resources),
+	.resource		= lf1000_ga3d_resources,
 };
 
 struct resource lf1000_idct_resource = {
@@ -905,42 +914,173 @@ void __init lf1000_clock_init( void)
 #define LF1000_TIMER3_VA_BASE		IO_ADDRESS(LF1000_TIMER3_BASE)
 
 /*
- * Returns number of usecs since last clock interrupt.  Note that interrupts
- * will have been disabled by do_gettimeoffset()
+ * Timekeeping
  *
- * Preserve tick resolution by scaling tick count up then dividing.
+ * LF1000_FREE_TIMER runs free and is the clocksource, LF1000_SYS_TIMER is a
+ * one-shot (or periodic) clock event device.  The timers count up from zero
+ * and clear themselves when they reach TMRMATCH, setting INTPEND.
+ *
+ * Both are clocked from TIMER_PLL, which can be changed at run time (see
+ * lf1000_pll1_clock_changed()).  The clocksource keeps the rate it was
+ * registered with: timer counts are scaled to that nominal rate, carrying the
+ * fraction, so a PLL change never shows up as a step or a change of speed in
+ * the system time.  The free timer wraps at TIMER_FREE_RUN rather than 2^32,
+ * which costs one count every wrap.
  */
 
-static unsigned long lf1000_gettimeoffset(void)
+#define LF1000_CS_SHIFT		16
+#define LF1000_CE_MIN_DELTA	4
+
+static struct {
+	u32	hw;		/* timer count at the last read */
+	u32	cycles;		/* nominal cycles at the last read */
+	u32	frac;		/* fraction of a cycle, LF1000_CS_SHIFT bits */
+	u32	mult;		/* nominal cycles per count, LF1000_CS_SHIFT bits */
+	u32	rate;		/* nominal rate in Hz */
+} lf1000_cs_state;
+
+static u32 lf1000_ce_period;	/* counts per jiffy in periodic mode */
+#ifdef CONFIG_LF1000_IRQ_LATENCY
+static u32 lf1000_ce_ns;	/* ns per count, LF1000_CS_SHIFT bits */
+#endif
+
+static u32 lf1000_timer_rate(void)
 {
-	unsigned long ticks;
+	return get_pll_freq(TIMER_PLL) / TIMER_DIV;
+}
 
-	/*
-	 * Number of ticks since last interrupt.
-	 */
-	ticks = get_timer_cnt(LF1000_INTERTICK_TIMER);
+static inline u32 lf1000_timer_read(struct lf1000_timer *timer_p)
+{
+	u32 ctrl = ioread32(&timer_p->tmrcontrol) & ~(1<<INTPEND);
 
-	/*
-	 * Convert the ticks to usecs.
-	 */
+	iowrite32(ctrl | (1<<LDCNT), &timer_p->tmrcontrol);	// latch count
+	return ioread32(&timer_p->tmrcount);
+}
+
+static cycle_t lf1000_cs_read(struct clocksource *cs)
+{
+	unsigned long flags;
+	u32 hw, delta, cycles;
+	u64 scaled;
+
+	raw_local_irq_save(flags);
+	hw = lf1000_timer_read(get_timer_pnt(LF1000_FREE_TIMER));
+	delta = hw - lf1000_cs_state.hw;
+	lf1000_cs_state.hw = hw;
 
-	return ((ticks * LF1000_INTERVAL_IN_USEC) / TIMER_SYS_TICK);
+	if (lf1000_cs_state.mult == (1 << LF1000_CS_SHIFT)) {
+		lf1000_cs_state.cycles += delta;
+	} else {
+		scaled = (u64)delta * lf1000_cs_state.mult +
+			lf1000_cs_state.frac;
+		lf1000_cs_state.cycles += (u32)(scaled >> LF1000_CS_SHIFT);
+		lf1000_cs_state.frac = scaled & ((1 << LF1000_CS_SHIFT) - 1);
+	}
+	cycles = lf1000_cs_state.cycles;
+	raw_local_irq_restore(flags);
+
+	return cycles;
+}
+
+static struct clocksource lf1000_cs = {
+	.name		= "lf1000-timer",
+	.rating		= 200,
+	.read		= lf1000_cs_read,
+	.mask		= CLOCKSOURCE_MASK(32),
+	.shift		= 20,
+	.flags		= CLOCK_SOURCE_IS_CONTINUOUS,
+};
+
+static void lf1000_ce_stop(struct lf1000_timer *timer_p)
+{
+	u32 ctrl = ioread32(&timer_p->tmrcontrol);
+
+	ctrl &= ~((1<<RUN)|(1<<INTENB_T));
+	iowrite32(ctrl | (1<<INTPEND), &timer_p->tmrcontrol);	// clear pend
+}
+
+static void lf1000_ce_start(struct lf1000_timer *timer_p, u32 match)
+{
+	u32 ctrl = ioread32(&timer_p->tmrcontrol) & ~(1<<RUN);
+
+	iowrite32(ctrl & ~(1<<INTPEND), &timer_p->tmrcontrol);
+	iowrite32(0, &timer_p->tmrcount);
+	iowrite32(match, &timer_p->tmrmatch);
+	iowrite32(ctrl|(1<<RUN)|(1<<INTENB_T)|(1<<INTPEND),
+			&timer_p->tmrcontrol);
+}
+
+static int lf1000_ce_set_next_event(unsigned long delta,
+		struct clock_event_device *evt)
+{
+	lf1000_ce_start(get_timer_pnt(LF1000_SYS_TIMER), delta);
+	return 0;
+}
+
+static void lf1000_ce_set_mode(enum clock_event_mode mode,
+		struct clock_event_device *evt)
+{
+	struct lf1000_timer *timer_p = get_timer_pnt(LF1000_SYS_TIMER);
+
+	switch (mode) {
+	case CLOCK_EVT_MODE_PERIODIC:
+		lf1000_ce_start(timer_p, lf1000_ce_period);
+		break;
+	case CLOCK_EVT_MODE_ONESHOT:
+	case CLOCK_EVT_MODE_UNUSED:
+	case CLOCK_EVT_MODE_SHUTDOWN:
+		lf1000_ce_stop(timer_p);
+		break;
+	case CLOCK_EVT_MODE_RESUME:
+		break;
+	}
+}
+
+static struct clock_event_device lf1000_ce = {
+	.name		= "lf1000-timer",
+	.features	= CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+	.shift		= 32,
+	.rating		= 200,
+	.set_next_event	= lf1000_ce_set_next_event,
+	.set_mode	= lf1000_ce_set_mode,
+};
+
+static void lf1000_ce_set_rate(u32 rate)
+{
+	lf1000_ce.mult = div_sc(rate, NSEC_PER_SEC, lf1000_ce.shift);
+	lf1000_ce.max_delta_ns = clockevent_delta2ns(0x7fffffff, &lf1000_ce);
+	lf1000_ce.min_delta_ns =
+		clockevent_delta2ns(LF1000_CE_MIN_DELTA, &lf1000_ce) + 1;
+	lf1000_ce_period = DIV_ROUND_CLOSEST(rate, HZ);
+#ifdef CONFIG_LF1000_IRQ_LATENCY
+	lf1000_ce_ns = div_u64((u64)NSEC_PER_SEC << LF1000_CS_SHIFT, rate);
+#endif
 }
 
 /*
  * PLL1 changed, adjust other dependent timers
  *
- * currently have only the Linux system timer
+ * The time counted so far is folded into the clocksource at the old scale
+ * before switching to the new one.  An event already programmed runs out at
+ * the new rate; the tick code copes with it arriving a little early or late.
  */
 void lf1000_pll1_clock_changed(void)
 {
-	struct lf1000_timer* timer_p = get_timer_pnt(LF1000_SYS_TIMER);
-
-	/* update Linux system timer */
-	iowrite32(TIMER_SYS_TICK, &timer_p->tmrmatch);
-	iowrite32(0, &timer_p->tmrcount);
-	printk(KERN_INFO "%s.%d TIMER_SYS_TICK=%ld\n",
-		__FUNCTION__, __LINE__, TIMER_SYS_TICK);
+	unsigned long flags;
+	u32 rate = lf1000_timer_rate();
+
+	raw_local_irq_save(flags);
+	lf1000_cs_read(&lf1000_cs);
+	lf1000_cs_state.mult = div_u64((u64)lf1000_cs_state.rate <<
+			LF1000_CS_SHIFT, rate);
+	lf1000_ce_set_rate(rate);
+	if (lf1000_ce.mode == CLOCK_EVT_MODE_PERIODIC)
+		lf1000_ce_start(get_timer_pnt(LF1000_SYS_TIMER),
+				lf1000_ce_period);
+	raw_local_irq_restore(flags);
+
+	printk(KERN_INFO "%s.%d timer clock %u Hz\n",
+		__FUNCTION__, __LINE__, rate);
 }
 EXPORT_SYMBOL(lf1000_pll1_clock_changed);
 
@@ -949,46 +1089,22 @@ EXPORT_SYMBOL(lf1000_pll1_clock_changed);
  */
 static irqreturn_t lf1000_timer_interrupt(int irq, void *dev_id)
 {
-	unsigned int timer_control, intertick_control;
-	unsigned int timer_count, intertick_count;
-	struct lf1000_timer* timer_p = get_timer_pnt(LF1000_SYS_TIMER);
-	struct lf1000_timer* tick_p = get_timer_pnt(LF1000_INTERTICK_TIMER);
-	
-	// ...clear the interrupt
-	clear_timer_irq(irq);
-
-	/* setup for TIMER count read */
-	timer_control = ioread32(&timer_p->tmrcontrol);
-	timer_control &= ~(1<<INTPEND);    // do not clear pend
-	timer_control |=  (1<<LDCNT);      // latch count
-	iowrite32( timer_control, &timer_p->tmrcontrol);
-	timer_count = ioread32(&timer_p->tmrcount);
-
-	/* setup for TICK count read */
-	intertick_control = ioread32(&tick_p->tmrcontrol);
-	intertick_control &= ~(1<<INTPEND);	// do not clear pend
-	intertick_control |=  (1<<LDCNT);	// latch count
-
-	/* read current TICK count */
-	iowrite32(intertick_control, &tick_p->tmrcontrol);// snapshot tick count
-	intertick_count = ioread32(&tick_p->tmrcount);
-
-	/* update TICK count with TIMER count */	
-	iowrite32(timer_control, &timer_p->tmrcontrol); // snapshot timer count
-	timer_count = ioread32(&timer_p->tmrcount);
-	iowrite32(timer_count, &tick_p->tmrcount);	// catchup to SYS_TIMER
-	
-	/* 
-	 * have at least one timer tick, account for additional
-	 * ticks recorded by intertick timer
-	 */
-	do {
-		timer_tick();
-		if (intertick_count > TIMER_SYS_TICK)
-			intertick_count -= TIMER_SYS_TICK;
-	} while (intertick_count > TIMER_SYS_TICK);
+	struct clock_event_device *evt = dev_id;
+	struct lf1000_timer *timer_p = get_timer_pnt(LF1000_SYS_TIMER);
+	u32 ctrl = ioread32(&timer_p->tmrcontrol);
+
+#ifdef CONFIG_LF1000_IRQ_LATENCY
+	/* the count restarted from zero when the interrupt was raised */
+	mes_irq_latency(((u64)lf1000_timer_read(timer_p) * lf1000_ce_ns) >>
+			LF1000_CS_SHIFT);
+#endif
 
-	// write_sequnlock(&xtime_lock);
+	/* the count has already restarted from zero: stop it if one-shot */
+	if (evt->mode != CLOCK_EVT_MODE_PERIODIC)
+		ctrl &= ~(1<<RUN);
+	iowrite32(ctrl | (1<<INTPEND), &timer_p->tmrcontrol);	// clear pend
+
+	evt->event_handler(evt);
 
 	return IRQ_HANDLED;
 }
@@ -997,6 +1113,7 @@ static struct irqaction lf1000_timer_irq = {
 	.name		= "Lf1000 Timer Tick",
 	.flags		= IRQF_DISABLED | IRQF_TIMER,
 	.handler	= lf1000_timer_interrupt,
+	.dev_id		= &lf1000_ce,
 };
 
 /*
@@ -1006,6 +1123,7 @@ static void __init lf1000_timer_init(void)
 {
 	int i=0;
 	volatile struct lf1000_timer* timer_p;
+	u32 rate;
 
 	while((timer_p = get_timer_pnt(i))) {
 		/* enable writes to timer module */
@@ -1024,15 +1142,13 @@ static void __init lf1000_timer_init(void)
 			((CLKDIVR<<TCLKDIV)|(TIMER_PLL<<TCLKSRCSEL)),
 			&timer_p->tmrclkgen);
 
-		/* 
-		 * Make IRQs happen for the system timer
+		/*
+		 * The system timer is left stopped for the clock event
+		 * device to program
 		 */
 		if(LF1000_SYS_TIMER == i) {
-			iowrite32(TIMER_SYS_TICK, &timer_p->tmrmatch);
-			setup_irq(get_timer_irq(i), &lf1000_timer_irq);
-			/* run timer with interrupts enabled */
-			iowrite32(ioread32(&timer_p->tmrcontrol)|
-				((1<<RUN)|(1<<INTPEND)|(1<<INTENB_T)),
+			iowrite32(TIMER_FREE_RUN, &timer_p->tmrmatch);
+			iowrite32(ioread32(&timer_p->tmrcontrol)|(1<<INTPEND),
 				&timer_p->tmrcontrol);
 		} else {
 			iowrite32(TIMER_FREE_RUN, &timer_p->tmrmatch);
@@ -1046,9 +1162,19 @@ static void __init lf1000_timer_init(void)
 		i++;
 	}
 	printk("\n");
+
+	rate = lf1000_timer_rate();
+	lf1000_cs_state.rate = rate;
+	lf1000_cs_state.mult = 1 << LF1000_CS_SHIFT;
+	lf1000_cs.mult = clocksource_hz2mult(rate, lf1000_cs.shift);
+	clocksource_register(&lf1000_cs);
+
+	lf1000_ce_set_rate(rate);
+	lf1000_ce.cpumask = cpumask_of(0);
+	setup_irq(get_timer_irq(LF1000_SYS_TIMER), &lf1000_timer_irq);
+	clockevents_register_device(&lf1000_ce);
 }
 
 struct sys_timer lf1000_timer = {
 	.init		= lf1000_timer_init,
-	.offset		= lf1000_gettimeoffset,
 };
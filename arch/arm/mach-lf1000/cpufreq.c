@@ -0,0 +1,174 @@
+/*
+ * arch/arm/mach-lf1000/cpufreq.c
+ *
+ * Copyright 2010 LeapFrog Enterprises Inc.
+ *
+ * CPU frequency scaling for the LF1000.
+ *
+ * The CPU runs from PLL0 through the CPU divider in CLKMODEREG, and the CPU
+ * bus clock (HCLK) is divided again from that.  PLL0 also feeds BCLK and so
+ * PCLK, so rather than relocking PLL0, which would take the memory bus and
+ * every peripheral on PCLK with it, we only change the CPU divider.  The
+ * HCLK divider is changed along with it so HCLK stays where the boot loader
+ * put it, which limits the table to the divisors of the total HCLK divider.
+ * Timers, UARTs, SDRAM, SPI and the display clock run from PLL1 or the
+ * crystal and are not touched by a transition; loops_per_jiffy is updated by
+ * the cpufreq core from the transition notifiers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/io.h>
+
+#include <mach/platform.h>
+#include <mach/clkpwr.h>
+
+#define LF1000_CPUFREQ_MAX_STEPS	16
+#define CPUDIV_MASK			0xF
+
+/* upper bound for rewriting CLKMODEREG and the CHGPLL handshake */
+#define LF1000_CPUFREQ_LATENCY		(100 * 1000)	/* ns */
+
+static struct cpufreq_frequency_table
+		lf1000_freq_table[LF1000_CPUFREQ_MAX_STEPS + 1];
+static unsigned int lf1000_hclk_div;	/* (CPU div + 1) * (HCLK div + 1) */
+
+static int lf1000_cpufreq_verify(struct cpufreq_policy *policy)
+{
+	if (policy->cpu != 0)
+		return -EINVAL;
+
+	return cpufreq_frequency_table_verify(policy, lf1000_freq_table);
+}
+
+static unsigned int lf1000_cpufreq_get(unsigned int cpu)
+{
+	if (cpu != 0)
+		return 0;
+
+	return get_cpu_freq() / 1000;
+}
+
+/* switch to CPU = PLL0 / cpudiv with HCLK unchanged */
+static void lf1000_cpufreq_set_div(unsigned int cpudiv)
+{
+	unsigned long flags;
+	u32 reg;
+
+	local_irq_save(flags);
+	reg = readl(&clock_p->clkmodereg);
+	reg &= ~((CPUDIV_MASK<<CLKDIVCPU0)|(CPUDIV_MASK<<CLKDIV2CPU0));
+	reg |= ((cpudiv - 1)<<CLKDIVCPU0) |
+		((lf1000_hclk_div / cpudiv - 1)<<CLKDIV2CPU0);
+	writel(reg, &clock_p->clkmodereg);
+
+	/* clock mode changes are applied the same way as PLL changes */
+	writel(readl(&clock_p->pwrmode)|(1<<CHGPLL), &clock_p->pwrmode);
+	while (readl(&clock_p->pwrmode) & (1<<CHGPLL))
+		cpu_relax();
+	local_irq_restore(flags);
+}
+
+static int lf1000_cpufreq_target(struct cpufreq_policy *policy,
+		unsigned int target_freq, unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+	unsigned int i;
+	int ret;
+
+	ret = cpufreq_frequency_table_target(policy, lf1000_freq_table,
+			target_freq, relation, &i);
+	if (ret)
+		return ret;
+
+	freqs.cpu = 0;
+	freqs.old = lf1000_cpufreq_get(0);
+	freqs.new = lf1000_freq_table[i].frequency;
+	freqs.flags = 0;
+
+	if (freqs.old == freqs.new)
+		return 0;
+
+	pr_debug("cpufreq: transition %u-%ukHz\n", freqs.old, freqs.new);
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+	lf1000_cpufreq_set_div(lf1000_freq_table[i].index);
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+
+	return 0;
+}
+
+/* Build the table from the dividers the boot loader left in CLKMODEREG. */
+static void lf1000_cpufreq_build_table(void)
+{
+	u32 reg = readl(&clock_p->clkmodereg);
+	unsigned int pll = get_pll_freq((reg >> CLKSELCPU0) & 0x3);
+	unsigned int n, i = 0;
+
+	lf1000_hclk_div = (((reg >> CLKDIVCPU0) & CPUDIV_MASK) + 1) *
+		(((reg >> CLKDIV2CPU0) & CPUDIV_MASK) + 1);
+
+	for (n = 1; n <= LF1000_CPUFREQ_MAX_STEPS; n++) {
+		if (lf1000_hclk_div % n || lf1000_hclk_div / n > 16)
+			continue;
+		lf1000_freq_table[i].index = n;
+		lf1000_freq_table[i].frequency = pll / n / 1000;
+		i++;
+	}
+	lf1000_freq_table[i].index = 0;
+	lf1000_freq_table[i].frequency = CPUFREQ_TABLE_END;
+}
+
+static int lf1000_cpufreq_driver_init(struct cpufreq_policy *policy)
+{
+	int ret;
+
+	if (policy->cpu != 0)
+		return -EINVAL;
+
+	lf1000_cpufreq_build_table();
+
+	policy->cur = lf1000_cpufreq_get(0);
+	policy->cpuinfo.transition_latency = LF1000_CPUFREQ_LATENCY;
+
+	ret = cpufreq_frequency_table_cpuinfo(policy, lf1000_freq_table);
+	if (ret) {
+		pr_err("cpufreq: failed to configure frequency table: %d\n",
+				ret);
+		return ret;
+	}
+	cpufreq_frequency_table_get_attr(lf1000_freq_table, policy->cpu);
+
+	pr_info("cpufreq: LF1000 %u-%ukHz, HCLK divider %u\n",
+			policy->cpuinfo.min_freq, policy->cpuinfo.max_freq,
+			lf1000_hclk_div);
+	return 0;
+}
+
+static struct freq_attr *lf1000_cpufreq_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	NULL,
+};
+
+static struct cpufreq_driver lf1000_cpufreq_driver = {
+	.owner		= THIS_MODULE,
+	.flags		= 0,
+	.verify		= lf1000_cpufreq_verify,
+	.target		= lf1000_cpufreq_target,
+	.get		= lf1000_cpufreq_get,
+	.init		= lf1000_cpufreq_driver_init,
+	.name		= "lf1000",
+	.attr		= lf1000_cpufreq_attr,
+};
+
+static int __init lf1000_cpufreq_init(void)
+{
+	return cpufreq_register_driver(&lf1000_cpufreq_driver);
+}
+arch_initcall(lf1000_cpufreq_init);
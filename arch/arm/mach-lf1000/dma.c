@@ -19,12 +19,19 @@
 #include <linux/dma-mapping.h>
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
+#include <linux/irq.h>
 #include <linux/platform_device.h>
 #include <linux/clk.h>
 #include <linux/device.h>
 #include <linux/io.h>
 #include <linux/list.h>
 #include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#ifdef CONFIG_LF1000_DMA_ENGINE
+#include <linux/dmaengine.h>
+#endif
 #include <mach/dma.h>
 #include <mach/irqs.h>
 #include <mach/platform.h>
@@ -41,7 +48,7 @@
 
 #define MAX_DMA_CHANNELS		8
 
-#define DEFAULT_MAX_NODE		32
+#define DEFAULT_MAX_NODE		CONFIG_LF1000_DMA_NODES
 
 /* Register offset */
 #define DMASRCADDR			0x00
@@ -108,12 +115,70 @@ struct dmachannel {
 	struct item_node	*cur_node;	// indicates item_node of
 						// current dma transfer
 	int			num_node;	// transfer count
+	unsigned int		irqs;		// interrupts taken
+	unsigned int		completions;	// transfers (nodes or items)
+						// finished
+#ifdef CONFIG_LF1000_DMA_ENGINE
+	struct lf1000_dma_chan	*engine;	// owner, if it's a dmaengine
+						// client
+#endif
+};
+
+#ifdef CONFIG_LF1000_DMA_ENGINE
+struct lf1000_dma_desc;
+
+/* one hardware transfer; a dmaengine descriptor is a list of these */
+struct lf1000_dma_item {
+	struct list_head	link;
+	struct lf1000_dma_desc	*desc;
+	unsigned int 		src_addr;	// source address
+	unsigned int 		dst_addr;	// destination address
+	unsigned short		size;		// size of transfer - 1
+	unsigned short		req_id;
+	unsigned int 		op_mode;
+	unsigned int		last;		// ends a transfer or a period
+	unsigned int		int_flag;	// was given to the channel
+						// with MODE_INTENB
+};
+
+struct lf1000_dma_desc {
+	struct dma_async_tx_descriptor	txd;
+	struct list_head	link;
+	struct list_head	items;		// until issued
+	int			cyclic;
 };
 
+struct lf1000_dma_chan {
+	struct dma_chan		chan;
+	struct dmachannel	*dmach;
+	spinlock_t		lock;
+	dma_cookie_t		completed;
+	unsigned int		depth;		// size of each pool
+	struct list_head	free_items;
+	struct list_head	free_descs;
+	struct list_head	queue;		// submitted, not yet issued
+	struct list_head	active;		// issued
+	struct list_head	done;		// finished, callback not yet run
+	struct list_head	pending;	// items waiting for the channel
+	struct list_head	running;	// items in the channel registers
+						// or its command buffer
+	unsigned int		periods;	// cyclic periods not yet reported
+	struct tasklet_struct	tasklet;
+};
+
+static irqreturn_t lf1000_dmae_irq(struct dmachannel *dmach);
+#endif
+
 struct dma_info {
 	void __iomem		*reg;
 	unsigned int		num_active_channel;
 	struct dmachannel	dmach[MAX_DMA_CHANNELS];
+#ifdef CONFIG_LF1000_DMA_ENGINE
+	struct device		*dev;
+	struct dma_device	engine;
+	struct lf1000_dma_chan	echan[MAX_DMA_CHANNELS];
+#endif
+	struct dentry		*debug;
 };
 
 static struct dma_info	*dmadev = NULL;
@@ -144,6 +209,12 @@ static irqreturn_t dma_irq_handler(int irq, void *dev_id)
 	dmach = &dmadev->dmach[dma];
 	if (!dmach->device_id)
 		return IRQ_NONE;
+	dmach->irqs++;
+
+#ifdef CONFIG_LF1000_DMA_ENGINE
+	if (dmach->engine)
+		return lf1000_dmae_irq(dmach);
+#endif
 
 #if 0
 	// process interrupt
@@ -183,12 +254,16 @@ static irqreturn_t dma_irq_handler(int irq, void *dev_id)
 	if (dmach->state == DMAC_STOP) {
 		goto irq_exit;
 	}
+	dmach->completions++;
 
 	// transfer next node
 	if (list_is_last((struct list_head*)dmach->cur_node,
 		&dmach->active_nodes)) {
 		if (dmach->mode == DMA_MEM_IO) {
-			// transfer complete.
+			// transfer complete. nothing reloads DMAMODE, so
+			// acknowledge the interrupt here.
+			writel((readl(dmach->reg + DMAMODE) & ~MODE_RUN) |
+				MODE_INTPEND, dmach->reg + DMAMODE);
 			dmach->state = DMAC_STOP;
 			goto irq_exit;
 		} else {
@@ -481,6 +556,52 @@ int dma_stop(unsigned int ch)
 }
 EXPORT_SYMBOL(dma_stop);
 
+/*******************************************************************************
+  * Function Name       : dma_abort
+  * Input Parameter(s)  : unsigned int ch
+  * Output Parameter(s) : NIL
+  * Return Value        : int - bytes the current item had left, 0 if the
+  			  channel wasn't running, else failure
+  * Description         : dma_stop() for callers that can't sleep (interrupt
+  			  handlers, or with interrupts off): busy-wait a
+  			  bounded time for the channel to stop, then read
+  			  what it had left from DMALENGTH.  The addresses
+  			  only hold the item's start, so they can't tell how
+  			  far it got.
+  *****************************************************************************/
+int dma_abort(unsigned int ch)
+{
+	struct dmachannel *dmach = (struct dmachannel *)ch;
+	unsigned int regs, loop;
+	unsigned long flags;
+	int left = 0;
+
+	if (!dmach->device_id)
+		return (-EINVAL);
+
+	local_irq_save(flags);
+
+	dmach->state = DMAC_STOP;
+
+	regs = readl(dmach->reg + DMAMODE);
+	if (regs & MODE_RUN) {
+		writel(regs | MODE_STOP, dmach->reg + DMAMODE);
+		loop = 1000;
+		while (((regs = readl(dmach->reg + DMAMODE)) & MODE_RUN) &&
+			(loop-- > 0))
+			udelay(1);
+		writel(regs & ~MODE_STOP, dmach->reg + DMAMODE);
+
+		// DMALENGTH holds the bytes left less one
+		left = readw(dmach->reg + DMALENGTH) + 1;
+	}
+
+	local_irq_restore(flags);
+
+	return left;
+}
+EXPORT_SYMBOL(dma_abort);
+
 /*******************************************************************************
   * Function Name       : dma_reset
   * Input Parameter(s)  : unsigned int ch
@@ -694,6 +815,16 @@ int dma_transfer_insert(unsigned int ch, unsigned int src, unsigned int dest,
 		node->op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
 			set_src_io_width(ctrl->src_width) | MODE_DSTNOTREQCHK;
 		break;
+	case DMA_FIFO_TO_MEM:
+		node->op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
+			MODE_SRCNOTREQCHK | set_src_io_width(ctrl->src_width) |
+			MODE_DSTNOTREQCHK;
+		break;
+	case DMA_MEM_TO_FIFO:
+		node->op_mode = MODE_INTENB | MODE_SRCNOTREQCHK |
+			MODE_DSTIOMODE | MODE_DSTNOTINC | MODE_DSTNOTREQCHK |
+			set_dst_io_width(ctrl->dest_width);
+		break;
 	default:
 		return (-EINVAL);
 	}
@@ -750,6 +881,16 @@ int dma_sg_write(unsigned int ch, struct scatterlist *sg, unsigned int dest,
 		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
 			set_src_io_width(ctrl->src_width) | MODE_DSTNOTREQCHK;
 		break;
+	case DMA_FIFO_TO_MEM:
+		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
+			MODE_SRCNOTREQCHK | set_src_io_width(ctrl->src_width) |
+			MODE_DSTNOTREQCHK;
+		break;
+	case DMA_MEM_TO_FIFO:
+		op_mode = MODE_INTENB | MODE_SRCNOTREQCHK | MODE_DSTIOMODE |
+			MODE_DSTNOTINC | MODE_DSTNOTREQCHK |
+			set_dst_io_width(ctrl->dest_width);
+		break;
 	default:
 		return (-EINVAL);
 	}
@@ -827,6 +968,16 @@ int dma_sg_read(unsigned int ch, unsigned int src, struct scatterlist *sg,
 		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
 			set_src_io_width(ctrl->src_width) | MODE_DSTNOTREQCHK;
 		break;
+	case DMA_FIFO_TO_MEM:
+		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
+			MODE_SRCNOTREQCHK | set_src_io_width(ctrl->src_width) |
+			MODE_DSTNOTREQCHK;
+		break;
+	case DMA_MEM_TO_FIFO:
+		op_mode = MODE_INTENB | MODE_SRCNOTREQCHK | MODE_DSTIOMODE |
+			MODE_DSTNOTINC | MODE_DSTNOTREQCHK |
+			set_dst_io_width(ctrl->dest_width);
+		break;
 	default:
 		return (-EINVAL);
 	}
@@ -900,6 +1051,16 @@ int dma_circ_write(unsigned int ch, unsigned int *src_list, unsigned int dest,
 		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
 			set_src_io_width(ctrl->src_width) | MODE_DSTNOTREQCHK;
 		break;
+	case DMA_FIFO_TO_MEM:
+		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
+			MODE_SRCNOTREQCHK | set_src_io_width(ctrl->src_width) |
+			MODE_DSTNOTREQCHK;
+		break;
+	case DMA_MEM_TO_FIFO:
+		op_mode = MODE_INTENB | MODE_SRCNOTREQCHK | MODE_DSTIOMODE |
+			MODE_DSTNOTINC | MODE_DSTNOTREQCHK |
+			set_dst_io_width(ctrl->dest_width);
+		break;
 	default:
 		return (-EINVAL);
 	}
@@ -981,6 +1142,16 @@ int dma_circ_read(unsigned int ch, unsigned int src, unsigned int *dest_list, in
 		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
 			set_src_io_width(ctrl->src_width) | MODE_DSTNOTREQCHK;
 		break;
+	case DMA_FIFO_TO_MEM:
+		op_mode = MODE_INTENB | MODE_SRCIOMODE | MODE_SRCNOTINC |
+			MODE_SRCNOTREQCHK | set_src_io_width(ctrl->src_width) |
+			MODE_DSTNOTREQCHK;
+		break;
+	case DMA_MEM_TO_FIFO:
+		op_mode = MODE_INTENB | MODE_SRCNOTREQCHK | MODE_DSTIOMODE |
+			MODE_DSTNOTINC | MODE_DSTNOTREQCHK |
+			set_dst_io_width(ctrl->dest_width);
+		break;
 	default:
 		return (-EINVAL);
 	}
@@ -1017,6 +1188,774 @@ int dma_circ_read(unsigned int ch, unsigned int src, unsigned int *dest_list, in
 }
 EXPORT_SYMBOL(dma_circ_read);
 
+#ifdef CONFIG_LF1000_DMA_ENGINE
+/*
+ * dmaengine interface
+ *
+ * Every hardware channel is also a dmaengine channel (DMA_SLAVE and
+ * DMA_MEMCPY, private only).  A channel belongs either to a dma_request()
+ * client or to a dmaengine client: both sides claim it through device_id.
+ *
+ * A transfer is split into items of at most 64KB.  The first item goes into
+ * the channel registers; the items after it are written to the *_WB
+ * registers, which queue them in the channel's command buffer (DMACMDSPACE
+ * says how much room is left).  The channel then moves from one item to
+ * the next by itself.  Only the last item of a transfer (or of a period of
+ * a cyclic transfer) and the last item that fit in the command buffer ask
+ * for an interrupt.
+ */
+#define ITEM_MAX_LEN	0x10000
+
+#define to_lf1000_dma_chan(c)	container_of(c, struct lf1000_dma_chan, chan)
+#define to_lf1000_dma_desc(t)	container_of(t, struct lf1000_dma_desc, txd)
+
+static int dma_op_mode(enum dma_transfer_type transfer, unsigned int src_width,
+	unsigned int dest_width)
+{
+	switch(transfer) {
+	case DMA_MEM_TO_MEM:
+		return MODE_SRCNOTREQCHK | MODE_DSTNOTREQCHK;
+	case DMA_MEM_TO_IO:
+		return MODE_SRCNOTREQCHK | MODE_DSTIOMODE | MODE_DSTNOTINC |
+			set_dst_io_width(dest_width);
+	case DMA_IO_TO_MEM:
+		return MODE_SRCIOMODE | MODE_SRCNOTINC |
+			set_src_io_width(src_width) | MODE_DSTNOTREQCHK;
+	case DMA_FIFO_TO_MEM:
+		return MODE_SRCIOMODE | MODE_SRCNOTINC | MODE_SRCNOTREQCHK |
+			set_src_io_width(src_width) | MODE_DSTNOTREQCHK;
+	case DMA_MEM_TO_FIFO:
+		return MODE_SRCNOTREQCHK | MODE_DSTIOMODE | MODE_DSTNOTINC |
+			MODE_DSTNOTREQCHK | set_dst_io_width(dest_width);
+	}
+	return -EINVAL;
+}
+
+static int lf1000_dmae_hw_idle(void __iomem *reg)
+{
+	return !(readl(reg + DMAMODE) & MODE_RUN) && !readl(reg + DMACMDBUSY);
+}
+
+/* give the channel as many pending items as it has room for */
+static void lf1000_dmae_push(struct lf1000_dma_chan *lc)
+{
+	void __iomem *reg = lc->dmach->reg;
+	struct lf1000_dma_item *item;
+	unsigned int space, mode;
+	int idle = list_empty(&lc->running);
+
+	if (list_empty(&lc->pending))
+		return;
+
+	if (idle)
+		space = readl(reg + DMACMDSPACE) + 1;
+	else if (lf1000_dmae_hw_idle(reg))
+		return;		// finished; the interrupt will restart it
+	else
+		space = readl(reg + DMACMDSPACE);
+
+	while (space && !list_empty(&lc->pending)) {
+		item = list_first_entry(&lc->pending, struct lf1000_dma_item,
+			link);
+		list_move_tail(&item->link, &lc->running);
+		space--;
+
+		item->int_flag = item->last || !space ||
+			list_empty(&lc->pending);
+		mode = item->op_mode | MODE_RUN;
+		if (item->int_flag)
+			mode |= MODE_INTENB;
+
+		if (idle) {
+			writel(item->src_addr, reg + DMASRCADDR);
+			writel(item->dst_addr, reg + DMADSTADDR);
+			writew(item->size, reg + DMALENGTH);
+			writew(item->req_id, reg + DMAREQID);
+			writel(mode, reg + DMAMODE);
+			idle = 0;
+		} else {
+			writel(item->src_addr, reg + DMASRCADDR_WB);
+			writel(item->dst_addr, reg + DMADSTADDR_WB);
+			writew(item->size, reg + DMALENGTH_WB);
+			writew(item->req_id, reg + DMAREQID_WB);
+			writel(mode, reg + DMAMODE_WB);
+		}
+	}
+}
+
+static void lf1000_dmae_retire(struct lf1000_dma_chan *lc,
+	struct lf1000_dma_item *item)
+{
+	struct lf1000_dma_desc *desc = item->desc;
+
+	if (desc->cyclic) {
+		list_move_tail(&item->link, &lc->pending);
+		if (item->last)
+			lc->periods++;
+		return;
+	}
+
+	list_move_tail(&item->link, &lc->free_items);
+	if (item->last) {
+		lc->completed = desc->txd.cookie;
+		list_move_tail(&desc->link, &lc->done);
+	}
+}
+
+/*
+ * Retire the items the channel has finished.  Interrupts don't count items:
+ * INTPEND merges the completions that land before it is acknowledged, and
+ * the poll sweep can call us for a channel that raised nothing, so this
+ * goes by the hardware.  Once the channel is idle every item has finished;
+ * otherwise the item in the channel registers is the one being worked on
+ * and the items queued ahead of it are done.
+ */
+static void lf1000_dmae_reap(struct lf1000_dma_chan *lc)
+{
+	struct dmachannel *dmach = lc->dmach;
+	void __iomem *reg = dmach->reg;
+	struct lf1000_dma_item *item, *tmp, *cur = NULL;
+	unsigned int src, dst;
+	unsigned short len;
+
+	if (!lf1000_dmae_hw_idle(reg)) {
+		// as in lf1000_dma_position(): make sure both addresses
+		// belong to the same item
+		do {
+			len = readw(reg + DMALENGTH);
+			src = readl(reg + DMASRCADDR);
+			dst = readl(reg + DMADSTADDR);
+		} while (readw(reg + DMALENGTH) > len);
+
+		list_for_each_entry(item, &lc->running, link) {
+			if (item->src_addr == src && item->dst_addr == dst) {
+				cur = item;
+				break;
+			}
+		}
+		// between two items, or it has just gone idle: either way
+		// another interrupt is on its way
+		if (!cur)
+			return;
+	}
+
+	list_for_each_entry_safe(item, tmp, &lc->running, link) {
+		if (item == cur)
+			break;
+		lf1000_dmae_retire(lc, item);
+		dmach->completions++;
+	}
+}
+
+static irqreturn_t lf1000_dmae_irq(struct dmachannel *dmach)
+{
+	struct lf1000_dma_chan *lc = dmach->engine;
+	void __iomem *reg = dmach->reg;
+	unsigned int mode;
+
+	spin_lock(&lc->lock);
+
+	// acknowledge first, so that an item finishing from here on raises
+	// a new interrupt; don't touch RUN while the command buffer is
+	// feeding the channel
+	mode = readl(reg + DMAMODE);
+	if (lf1000_dmae_hw_idle(reg))
+		mode &= ~MODE_RUN;
+	writel(mode | MODE_INTPEND, reg + DMAMODE);
+
+	lf1000_dmae_reap(lc);
+	lf1000_dmae_push(lc);
+
+	if (!list_empty(&lc->done) || lc->periods)
+		tasklet_schedule(&lc->tasklet);
+
+	spin_unlock(&lc->lock);
+
+	return IRQ_HANDLED;
+}
+
+static void lf1000_dmae_tasklet(unsigned long data)
+{
+	struct lf1000_dma_chan *lc = (struct lf1000_dma_chan *)data;
+	struct lf1000_dma_desc *desc, *tmp, *cyclic = NULL;
+	dma_async_tx_callback callback = NULL;
+	void *param = NULL;
+	unsigned int periods;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&lc->lock, flags);
+	list_splice_init(&lc->done, &done);
+	periods = lc->periods;
+	lc->periods = 0;
+	if (periods && !list_empty(&lc->active)) {
+		cyclic = list_first_entry(&lc->active, struct lf1000_dma_desc,
+			link);
+		callback = cyclic->txd.callback;
+		param = cyclic->txd.callback_param;
+	}
+	spin_unlock_irqrestore(&lc->lock, flags);
+
+	list_for_each_entry(desc, &done, link) {
+		if (desc->txd.callback)
+			desc->txd.callback(desc->txd.callback_param);
+	}
+	while (callback && periods--)
+		callback(param);
+
+	spin_lock_irqsave(&lc->lock, flags);
+	list_for_each_entry_safe(desc, tmp, &done, link) {
+		list_splice_init(&desc->items, &lc->free_items);
+		list_move(&desc->link, &lc->free_descs);
+	}
+	spin_unlock_irqrestore(&lc->lock, flags);
+}
+
+static dma_cookie_t lf1000_dmae_tx_submit(struct dma_async_tx_descriptor *tx)
+{
+	struct lf1000_dma_desc *desc = to_lf1000_dma_desc(tx);
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(tx->chan);
+	dma_cookie_t cookie;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lc->lock, flags);
+	cookie = lc->chan.cookie + 1;
+	if (cookie < 0)
+		cookie = 1;
+	lc->chan.cookie = desc->txd.cookie = cookie;
+	list_add_tail(&desc->link, &lc->queue);
+	spin_unlock_irqrestore(&lc->lock, flags);
+
+	return cookie;
+}
+
+/* called with lc->lock held */
+static struct lf1000_dma_desc *lf1000_dmae_desc_get(struct lf1000_dma_chan *lc)
+{
+	struct lf1000_dma_desc *desc;
+
+	if (list_empty(&lc->free_descs))
+		return NULL;
+
+	desc = list_first_entry(&lc->free_descs, struct lf1000_dma_desc, link);
+	list_del(&desc->link);
+	INIT_LIST_HEAD(&desc->items);
+	desc->cyclic = 0;
+	desc->txd.callback = NULL;
+	desc->txd.callback_param = NULL;
+	return desc;
+}
+
+/* called with lc->lock held */
+static void lf1000_dmae_desc_put(struct lf1000_dma_chan *lc,
+	struct lf1000_dma_desc *desc)
+{
+	list_splice_init(&desc->items, &lc->free_items);
+	list_add(&desc->link, &lc->free_descs);
+}
+
+/* Append items moving 'len' bytes to 'desc'.  Called with lc->lock held. */
+static int lf1000_dmae_add_items(struct lf1000_dma_chan *lc,
+	struct lf1000_dma_desc *desc, unsigned int src, unsigned int dest,
+	size_t len, unsigned int op_mode, enum dma_request_id req_id, int last)
+{
+	struct lf1000_dma_item *item = NULL;
+	size_t size;
+
+	while (len) {
+		if (list_empty(&lc->free_items))
+			return -ENOMEM;
+		item = list_first_entry(&lc->free_items,
+			struct lf1000_dma_item, link);
+		list_move_tail(&item->link, &desc->items);
+
+		size = min_t(size_t, len, ITEM_MAX_LEN);
+		item->desc = desc;
+		item->src_addr = src;
+		item->dst_addr = dest;
+		item->size = size - 1;
+		item->req_id = req_id;
+		item->op_mode = op_mode;
+		item->last = 0;
+
+		if (!(op_mode & MODE_SRCNOTINC))
+			src += size;
+		if (!(op_mode & MODE_DSTNOTINC))
+			dest += size;
+		len -= size;
+	}
+	if (item)
+		item->last = last;
+	return 0;
+}
+
+static struct dma_async_tx_descriptor *lf1000_dmae_prep_memcpy(
+	struct dma_chan *chan, dma_addr_t dest, dma_addr_t src, size_t len,
+	unsigned long flags)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	struct lf1000_dma_desc *desc;
+	unsigned long irqflags;
+
+	if (!len)
+		return NULL;
+
+	spin_lock_irqsave(&lc->lock, irqflags);
+	desc = lf1000_dmae_desc_get(lc);
+	if (desc && lf1000_dmae_add_items(lc, desc, src, dest, len,
+			dma_op_mode(DMA_MEM_TO_MEM, 4, 4), 0, 1)) {
+		lf1000_dmae_desc_put(lc, desc);
+		desc = NULL;
+	}
+	spin_unlock_irqrestore(&lc->lock, irqflags);
+
+	if (!desc)
+		return NULL;
+	desc->txd.flags = flags;
+	return &desc->txd;
+}
+
+static int lf1000_dmae_slave_mode(struct lf1000_dma_slave *slave,
+	enum dma_data_direction direction)
+{
+	if (direction == DMA_TO_DEVICE)
+		return dma_op_mode(slave->no_req ? DMA_MEM_TO_FIFO :
+			DMA_MEM_TO_IO, slave->width, slave->width);
+	return dma_op_mode(slave->no_req ? DMA_FIFO_TO_MEM : DMA_IO_TO_MEM,
+		slave->width, slave->width);
+}
+
+static struct dma_async_tx_descriptor *lf1000_dmae_prep_slave_sg(
+	struct dma_chan *chan, struct scatterlist *sgl, unsigned int sg_len,
+	enum dma_data_direction direction, unsigned long flags)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	struct lf1000_dma_slave *slave = chan->private;
+	struct lf1000_dma_desc *desc;
+	struct scatterlist *sg;
+	unsigned long irqflags;
+	unsigned int i, op_mode;
+	int ret = 0;
+
+	if (!slave || !sg_len)
+		return NULL;
+	op_mode = lf1000_dmae_slave_mode(slave, direction);
+
+	spin_lock_irqsave(&lc->lock, irqflags);
+	desc = lf1000_dmae_desc_get(lc);
+	if (!desc)
+		goto out;
+
+	for_each_sg(sgl, sg, sg_len, i) {
+		if (direction == DMA_TO_DEVICE)
+			ret = lf1000_dmae_add_items(lc, desc,
+				sg_dma_address(sg), slave->fifo,
+				sg_dma_len(sg), op_mode, slave->request_id,
+				i == sg_len - 1);
+		else
+			ret = lf1000_dmae_add_items(lc, desc, slave->fifo,
+				sg_dma_address(sg), sg_dma_len(sg), op_mode,
+				slave->request_id, i == sg_len - 1);
+		if (ret)
+			break;
+	}
+	if (ret) {
+		lf1000_dmae_desc_put(lc, desc);
+		desc = NULL;
+	}
+out:
+	spin_unlock_irqrestore(&lc->lock, irqflags);
+
+	if (!desc)
+		return NULL;
+	desc->txd.flags = flags;
+	return &desc->txd;
+}
+
+/*******************************************************************************
+  * Function Name       : lf1000_dma_prep_cyclic
+  * Input Parameter(s)  : struct dma_chan *chan
+  			  dma_addr_t buf
+  			  size_t buf_len
+  			  size_t period_len
+  			  size_t start
+  			  enum dma_data_direction direction
+  * Output Parameter(s) : NIL
+  * Return Value        : descriptor, NULL on failure
+  * Description         : Prepare a ring buffer transfer between 'buf' and
+  			  the slave's FIFO that runs until
+  			  dmaengine_terminate_all().  The descriptor's
+  			  callback runs once per period.  The ring starts
+  			  with the period at offset 'start', so a stopped
+  			  stream can carry on where it was.
+  *****************************************************************************/
+struct dma_async_tx_descriptor *lf1000_dma_prep_cyclic(struct dma_chan *chan,
+	dma_addr_t buf, size_t buf_len, size_t period_len, size_t start,
+	enum dma_data_direction direction)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	struct lf1000_dma_slave *slave = chan->private;
+	struct lf1000_dma_desc *desc;
+	unsigned long irqflags;
+	unsigned int op_mode;
+	size_t n, offset;
+	int ret = 0;
+
+	if (!slave || !period_len || !buf_len || buf_len % period_len ||
+	    start >= buf_len || start % period_len)
+		return NULL;
+	op_mode = lf1000_dmae_slave_mode(slave, direction);
+
+	spin_lock_irqsave(&lc->lock, irqflags);
+	desc = lf1000_dmae_desc_get(lc);
+	if (!desc)
+		goto out;
+	desc->cyclic = 1;
+
+	for (n = 0; n < buf_len && !ret; n += period_len) {
+		offset = (start + n) % buf_len;
+		if (direction == DMA_TO_DEVICE)
+			ret = lf1000_dmae_add_items(lc, desc, buf + offset,
+				slave->fifo, period_len, op_mode,
+				slave->request_id, 1);
+		else
+			ret = lf1000_dmae_add_items(lc, desc, slave->fifo,
+				buf + offset, period_len, op_mode,
+				slave->request_id, 1);
+	}
+	if (ret) {
+		lf1000_dmae_desc_put(lc, desc);
+		desc = NULL;
+	}
+out:
+	spin_unlock_irqrestore(&lc->lock, irqflags);
+
+	if (desc)
+		desc->txd.flags = DMA_CTRL_ACK;
+	return desc ? &desc->txd : NULL;
+}
+EXPORT_SYMBOL(lf1000_dma_prep_cyclic);
+
+/*******************************************************************************
+  * Function Name       : lf1000_dma_position
+  * Input Parameter(s)  : struct dma_chan *chan
+  * Output Parameter(s) : unsigned int *addr
+  * Return Value        : int - 0 success else failure
+  * Description         : Memory address the channel has got to in the item
+  			  it is working on: the item's start address (which
+  			  is all DMASRCADDR/DMADSTADDR show) plus the bytes
+  			  DMALENGTH has counted off.
+  *****************************************************************************/
+int lf1000_dma_position(struct dma_chan *chan, unsigned int *addr)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	void __iomem *reg = lc->dmach->reg;
+	struct lf1000_dma_item *item;
+	unsigned int src, dst, start;
+	unsigned short len;
+	unsigned long flags;
+	int ret = -EINVAL;
+
+	spin_lock_irqsave(&lc->lock, flags);
+
+	// read the length on both sides of the addresses so that all three
+	// belong to the same item
+	do {
+		len = readw(reg + DMALENGTH);
+		src = readl(reg + DMASRCADDR);
+		dst = readl(reg + DMADSTADDR);
+	} while (readw(reg + DMALENGTH) > len);
+
+	list_for_each_entry(item, &lc->running, link) {
+		if (item->src_addr != src || item->dst_addr != dst)
+			continue;
+		start = (item->op_mode & MODE_SRCNOTINC) ? dst : src;
+		*addr = start + item->size - min(len, item->size);
+		ret = 0;
+		break;
+	}
+
+	spin_unlock_irqrestore(&lc->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(lf1000_dma_position);
+
+static void lf1000_dmae_issue_pending(struct dma_chan *chan)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	struct lf1000_dma_desc *desc, *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lc->lock, flags);
+	list_for_each_entry_safe(desc, tmp, &lc->queue, link) {
+		list_splice_tail_init(&desc->items, &lc->pending);
+		list_move_tail(&desc->link, &lc->active);
+	}
+	lf1000_dmae_push(lc);
+	spin_unlock_irqrestore(&lc->lock, flags);
+}
+
+static void lf1000_dmae_terminate_all(struct dma_chan *chan)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	void __iomem *reg = lc->dmach->reg;
+	struct lf1000_dma_desc *desc, *tmp;
+	unsigned int regs, loop;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lc->lock, flags);
+
+	// same as dma_stop(), but may be called with interrupts off
+	writel(readl(reg + DMAMODE) | MODE_STOP, reg + DMAMODE);
+	loop = 1000;
+	while (((regs = readl(reg + DMAMODE)) & MODE_RUN) && (loop-- > 0))
+		udelay(1);
+	writel(regs & ~(MODE_STOP | MODE_INTENB), reg + DMAMODE);
+
+	list_splice_init(&lc->running, &lc->free_items);
+	list_splice_init(&lc->pending, &lc->free_items);
+	list_splice_init(&lc->done, &lc->queue);
+	list_splice_init(&lc->active, &lc->queue);
+	list_for_each_entry_safe(desc, tmp, &lc->queue, link)
+		lf1000_dmae_desc_put(lc, desc);
+	INIT_LIST_HEAD(&lc->queue);
+	lc->periods = 0;
+	lc->completed = lc->chan.cookie;
+
+	spin_unlock_irqrestore(&lc->lock, flags);
+}
+
+static enum dma_status lf1000_dmae_is_tx_complete(struct dma_chan *chan,
+	dma_cookie_t cookie, dma_cookie_t *done, dma_cookie_t *used)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	dma_cookie_t last_used = chan->cookie;
+	dma_cookie_t last_complete = lc->completed;
+
+	if (done)
+		*done = last_complete;
+	if (used)
+		*used = last_used;
+	return dma_async_is_complete(cookie, last_complete, last_used);
+}
+
+static void lf1000_dmae_free_pools(struct lf1000_dma_chan *lc)
+{
+	struct lf1000_dma_item *item, *itmp;
+	struct lf1000_dma_desc *desc, *dtmp;
+
+	list_for_each_entry_safe(item, itmp, &lc->free_items, link)
+		kfree(item);
+	list_for_each_entry_safe(desc, dtmp, &lc->free_descs, link)
+		kfree(desc);
+	INIT_LIST_HEAD(&lc->free_items);
+	INIT_LIST_HEAD(&lc->free_descs);
+	lc->depth = 0;
+}
+
+/*
+ * The DMA sub-interrupts' irq_chip masks by clearing INTENB and unmasks by
+ * setting it, and handle_level_irq() does both around every interrupt.
+ * INTENB is per item here (only the items that asked for it should
+ * interrupt), so an engine channel's interrupt goes through
+ * handle_simple_irq(), which leaves DMAMODE to lf1000_dmae_irq().
+ */
+static void lf1000_dmae_set_flow(struct dmachannel *dmach, int engine)
+{
+	set_irq_handler(dma_to_irq(dmach - dmadev->dmach),
+		engine ? handle_simple_irq : handle_level_irq);
+}
+
+static int lf1000_dmae_alloc_chan_resources(struct dma_chan *chan)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	struct lf1000_dma_slave *slave = chan->private;
+	struct dmachannel *dmach = lc->dmach;
+	struct lf1000_dma_item *item;
+	struct lf1000_dma_desc *desc;
+	unsigned long flags;
+	unsigned int depth, i;
+	char *name;
+
+	depth = (slave && slave->pool_depth) ? slave->pool_depth :
+		DEFAULT_MAX_NODE;
+
+	name = kstrdup("dmaengine", GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+
+	local_irq_save(flags);
+	if (dmach->device_id) {
+		local_irq_restore(flags);
+		kfree(name);
+		return -EBUSY;
+	}
+	dmach->device_id = name;
+	dmach->state = DMAC_STOP;
+	dmach->engine = lc;
+	lf1000_dmae_set_flow(dmach, 1);
+	local_irq_restore(flags);
+
+	for (i = 0; i < depth; i++) {
+		item = kzalloc(sizeof(*item), GFP_KERNEL);
+		desc = kzalloc(sizeof(*desc), GFP_KERNEL);
+		if (!item || !desc) {
+			kfree(item);
+			kfree(desc);
+			goto error;
+		}
+		list_add_tail(&item->link, &lc->free_items);
+
+		dma_async_tx_descriptor_init(&desc->txd, chan);
+		desc->txd.tx_submit = lf1000_dmae_tx_submit;
+		INIT_LIST_HEAD(&desc->items);
+		list_add_tail(&desc->link, &lc->free_descs);
+	}
+	lc->depth = depth;
+	lc->completed = chan->cookie = 1;
+
+	return depth;
+error:
+	lf1000_dmae_free_pools(lc);
+	local_irq_save(flags);
+	lf1000_dmae_set_flow(dmach, 0);
+	dmach->engine = NULL;
+	dmach->device_id = NULL;
+	local_irq_restore(flags);
+	kfree(name);
+	return -ENOMEM;
+}
+
+static void lf1000_dmae_free_chan_resources(struct dma_chan *chan)
+{
+	struct lf1000_dma_chan *lc = to_lf1000_dma_chan(chan);
+	struct dmachannel *dmach = lc->dmach;
+	unsigned long flags;
+	char *name;
+
+	lf1000_dmae_terminate_all(chan);
+	tasklet_kill(&lc->tasklet);
+	lf1000_dmae_free_pools(lc);
+
+	local_irq_save(flags);
+	name = dmach->device_id;
+	dmach->device_id = NULL;
+	lf1000_dmae_set_flow(dmach, 0);
+	dmach->engine = NULL;
+	local_irq_restore(flags);
+	kfree(name);
+}
+
+/*******************************************************************************
+  * Function Name       : lf1000_dma_filter
+  * Input Parameter(s)  : struct dma_chan *chan
+  			  void *param - struct lf1000_dma_slave, or NULL
+  * Output Parameter(s) : NIL
+  * Return Value        : true if 'chan' suits 'param'
+  * Description         : dma_request_channel() filter for LF1000 channels.
+  			  Accepts a free channel of the slave's priority and
+  			  attaches the slave data to it.
+  *****************************************************************************/
+bool lf1000_dma_filter(struct dma_chan *chan, void *param)
+{
+	struct lf1000_dma_slave *slave = param;
+	struct dmachannel *dmach;
+
+	if (!dmadev || chan->device != &dmadev->engine)
+		return false;
+
+	dmach = to_lf1000_dma_chan(chan)->dmach;
+	if (dmach->device_id)
+		return false;
+	if (slave && slave->priority && !(dmach->priority & slave->priority))
+		return false;
+
+	chan->private = slave;
+	return true;
+}
+EXPORT_SYMBOL(lf1000_dma_filter);
+
+/*
+ * dmaengine's device class is registered at arch_initcall time too, after
+ * this driver has probed, so the channels are registered a level later.
+ */
+static int __init lf1000_dmae_init(void)
+{
+	struct dma_device *dd;
+	struct lf1000_dma_chan *lc;
+	int i;
+
+	if (!dmadev)
+		return -ENODEV;
+
+	dd = &dmadev->engine;
+	INIT_LIST_HEAD(&dd->channels);
+
+	for (i = 0; i < MAX_DMA_CHANNELS; i++) {
+		lc = &dmadev->echan[i];
+		lc->chan.device = dd;
+		lc->dmach = &dmadev->dmach[i];
+		spin_lock_init(&lc->lock);
+		INIT_LIST_HEAD(&lc->free_items);
+		INIT_LIST_HEAD(&lc->free_descs);
+		INIT_LIST_HEAD(&lc->queue);
+		INIT_LIST_HEAD(&lc->active);
+		INIT_LIST_HEAD(&lc->done);
+		INIT_LIST_HEAD(&lc->pending);
+		INIT_LIST_HEAD(&lc->running);
+		tasklet_init(&lc->tasklet, lf1000_dmae_tasklet,
+			(unsigned long)lc);
+		list_add_tail(&lc->chan.device_node, &dd->channels);
+	}
+	dd->chancnt = MAX_DMA_CHANNELS;
+
+	dma_cap_set(DMA_SLAVE, dd->cap_mask);
+	dma_cap_set(DMA_MEMCPY, dd->cap_mask);
+	dma_cap_set(DMA_PRIVATE, dd->cap_mask);
+	dd->dev = dmadev->dev;
+	dd->device_alloc_chan_resources = lf1000_dmae_alloc_chan_resources;
+	dd->device_free_chan_resources = lf1000_dmae_free_chan_resources;
+	dd->device_prep_dma_memcpy = lf1000_dmae_prep_memcpy;
+	dd->device_prep_slave_sg = lf1000_dmae_prep_slave_sg;
+	dd->device_terminate_all = lf1000_dmae_terminate_all;
+	dd->device_is_tx_complete = lf1000_dmae_is_tx_complete;
+	dd->device_issue_pending = lf1000_dmae_issue_pending;
+
+	return dma_async_device_register(dd);
+}
+subsys_initcall(lf1000_dmae_init);
+#endif /* CONFIG_LF1000_DMA_ENGINE */
+
+/* per-channel interrupt and completion counts, in debugfs */
+static int lf1000_dma_stats_show(struct seq_file *s, void *v)
+{
+	struct dmachannel *dmach;
+	int i;
+
+	seq_printf(s, "ch owner       irqs       completions\n");
+	for (i = 0; i < MAX_DMA_CHANNELS; i++) {
+		dmach = &dmadev->dmach[i];
+		seq_printf(s, "%2d %-10s %10u %10u\n", i,
+			dmach->device_id ? dmach->device_id : "-",
+			dmach->irqs, dmach->completions);
+	}
+	return 0;
+}
+
+static int lf1000_dma_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lf1000_dma_stats_show, NULL);
+}
+
+static const struct file_operations lf1000_dma_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lf1000_dma_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 /*******************************************************************************
   * Function Name       : lf1000_dma_remove
   * Input Parameter(s)  : struct platform_device *pdev
@@ -1034,6 +1973,13 @@ static int __devexit lf1000_dma_remove(struct platform_device *pdev)
 	if(!dmadev)
 		return 0;
 
+#ifdef CONFIG_LF1000_DMA_ENGINE
+	if (dmadev->engine.dev)
+		dma_async_device_unregister(&dmadev->engine);
+#endif
+	if (dmadev->debug)
+		debugfs_remove_recursive(dmadev->debug);
+
 	for(i = 0; i < MAX_DMA_CHANNELS; i++) {
 
 		if (dma_is_enabled((unsigned int)&dmadev->dmach[i]))
@@ -1141,8 +2087,18 @@ static int __devinit lf1000_dma_probe(struct platform_device *pdev)
 		spin_lock_init(&dmadev->dmach[i].lock);
 	}
 
+#ifdef CONFIG_LF1000_DMA_ENGINE
+	dmadev->dev = &pdev->dev;
+#endif
 	dev_set_drvdata(&(pdev->dev), dmadev);
 
+	dmadev->debug = debugfs_create_dir(DRIVER_NAME, NULL);
+	if (IS_ERR(dmadev->debug))
+		dmadev->debug = NULL;
+	if (dmadev->debug)
+		debugfs_create_file("channels", S_IRUSR, dmadev->debug, NULL,
+			&lf1000_dma_stats_fops);
+
 	return 0;	
 err:
 	for (i = 0; i < MAX_DMA_CHANNELS; i++) {
@@ -0,0 +1,101 @@
+/*
+ * arch/arm/mach-lf1000/fence.c
+ *
+ * Copyright 2010 LeapFrog Enterprises Inc.
+ *
+ * GA3D command list fences, shared between the 3D engine driver which
+ * signals them and the frame buffer which holds flips back until the frame
+ * they show has been rendered.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/notifier.h>
+#include <linux/poll.h>
+
+#include <mach/fence.h>
+
+static u32 fence_last;
+static u32 fence_issued;
+static DECLARE_WAIT_QUEUE_HEAD(fence_wait);
+static ATOMIC_NOTIFIER_HEAD(fence_notifier);
+
+bool lf1000_fence_done(u32 fence)
+{
+	return (s32)(fence_last - fence) >= 0;
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_done);
+
+u32 lf1000_fence_last(void)
+{
+	return fence_last;
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_last);
+
+/* Hand out the next fence.  The caller serializes this and signals the
+ * fences it issues in the same order. */
+u32 lf1000_fence_issue(void)
+{
+	if (++fence_issued == 0)
+		fence_issued = 1;
+	return fence_issued;
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_issue);
+
+u32 lf1000_fence_issued(void)
+{
+	return fence_issued;
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_issued);
+
+/* A fence that hasn't been handed out yet would never be signalled. */
+bool lf1000_fence_valid(u32 fence)
+{
+	return (s32)(fence_issued - fence) >= 0;
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_valid);
+
+/* Returns 0 once the fence is done, -ETIMEDOUT or -ERESTARTSYS. */
+int lf1000_fence_wait(u32 fence, long timeout)
+{
+	long ret;
+
+	ret = wait_event_interruptible_timeout(fence_wait,
+			lf1000_fence_done(fence), timeout);
+	if (ret < 0)
+		return ret;
+	return ret ? 0 : -ETIMEDOUT;
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_wait);
+
+void lf1000_fence_poll_wait(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &fence_wait, wait);
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_poll_wait);
+
+/* Fences are signalled in order, by the one driver that hands them out. */
+void lf1000_fence_signal(u32 fence)
+{
+	fence_last = fence;
+	wake_up_interruptible(&fence_wait);
+	atomic_notifier_call_chain(&fence_notifier, fence, NULL);
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_signal);
+
+int lf1000_fence_register_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&fence_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_register_notifier);
+
+int lf1000_fence_unregister_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&fence_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(lf1000_fence_unregister_notifier);
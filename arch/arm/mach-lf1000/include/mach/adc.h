@@ -54,6 +54,49 @@
 /*
  * Driver API
  */
+#include <linux/list.h>
+#include <linux/ktime.h>
+
+/* adc_client.priority: higher priority requests are converted first */
+#define ADC_PRIORITY_NORMAL	0
+#define ADC_PRIORITY_HIGH	1
+
+struct adc_client {
+	const char		*name;
+	int			priority;
+
+	/* private: statistics, see debugfs lf1000-adc/clients */
+	struct list_head	list;
+	u32			requests;
+	u32			conversions;
+	u32			pending;
+	u32			queue_max;	/* requests ahead on submit */
+	u32			latency_max_us;	/* submit to completion */
+	u64			latency_total_us;
+};
+
+struct adc_request {
+	struct adc_client	*client;
+	const u8		*channels;
+	int			*readings;	/* one per channel */
+	int			count;
+	void			(*complete)(struct adc_request *req);
+	void			*context;
+	int			status;
+
+	/* private */
+	struct list_head	list;
+	int			index;
+	ktime_t			submitted;
+};
+
+int adc_RegisterClient(struct adc_client *client);
+void adc_UnregisterClient(struct adc_client *client);
+int adc_Submit(struct adc_request *req);
+int adc_GetClientReadings(struct adc_client *client, const u8 *channels,
+		int *readings, int count);
+int adc_GetClientReading(struct adc_client *client, u8 channel);
+int adc_GetReadings(const u8 *channels, int *readings, int count);
 int adc_GetReading(u8 channel);
 
 #endif
@@ -46,6 +46,8 @@ enum dma_transfer_type {
 	DMA_MEM_TO_MEM		= 0,
 	DMA_MEM_TO_IO		= 1,
 	DMA_IO_TO_MEM		= 2,
+	DMA_FIFO_TO_MEM		= 3,	// fixed-address register, no DMA request
+	DMA_MEM_TO_FIFO		= 4,	// (e.g. NAND data register)
 };
 
 enum dma_request_id {
@@ -91,6 +93,7 @@ int dma_request (char *name, enum dma_priority priority, irq_handler_t handler,
 int dma_release(unsigned int ch);
 int dma_start(unsigned int ch);
 int dma_stop(unsigned int ch);
+int dma_abort(unsigned int ch);
 int dma_reset(unsigned int ch);
 int dma_is_active(unsigned int ch);
 int dma_is_enabled(unsigned int ch);
@@ -111,5 +114,31 @@ int dma_circ_write(unsigned int ch, unsigned int *src_list, unsigned int dest,
 int dma_circ_read(unsigned int ch, unsigned int src, unsigned int *dest_list,
 	int count, unsigned int block_size, struct dma_control *ctrl);
 
+#ifdef CONFIG_LF1000_DMA_ENGINE
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+
+/* dmaengine slave data: pass to dma_request_channel() along with
+ * lf1000_dma_filter(), which attaches it to the channel it picks.
+ */
+struct lf1000_dma_slave {
+	enum dma_priority	priority;	// channel group, 0 for any
+	enum dma_request_id	request_id;
+	unsigned int		fifo;		// physical address of the
+						// peripheral data register
+	unsigned int		width;		// 1, 2, 4 bytes
+	int			no_req;		// register has no DMA request
+						// line (e.g. NAND data)
+	unsigned int		pool_depth;	// transfer items to preallocate,
+						// 0 for CONFIG_LF1000_DMA_NODES
+};
+
+bool lf1000_dma_filter(struct dma_chan *chan, void *param);
+struct dma_async_tx_descriptor *lf1000_dma_prep_cyclic(struct dma_chan *chan,
+	dma_addr_t buf, size_t buf_len, size_t period_len, size_t start,
+	enum dma_data_direction direction);
+int lf1000_dma_position(struct dma_chan *chan, unsigned int *addr);
+#endif
+
 #endif
 
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2010 LeapFrog Enterprises Inc.
+ *
+ * GA3D command list fences.  Every command list submitted to the 3D engine
+ * gets the next number on a single timeline, and the fence is signalled
+ * once the list has run.  Fence 0 is never used and is always done, so it
+ * can stand for "no fence".
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef __LF1000_FENCE_H__
+#define __LF1000_FENCE_H__
+
+#include <linux/notifier.h>
+#include <linux/poll.h>
+
+bool lf1000_fence_done(u32 fence);
+u32 lf1000_fence_last(void);
+u32 lf1000_fence_issue(void);
+u32 lf1000_fence_issued(void);
+bool lf1000_fence_valid(u32 fence);
+int lf1000_fence_wait(u32 fence, long timeout);
+void lf1000_fence_poll_wait(struct file *file, poll_table *wait);
+void lf1000_fence_signal(u32 fence);
+
+/* Called from the signalling context, with the fence as the action. */
+int lf1000_fence_register_notifier(struct notifier_block *nb);
+int lf1000_fence_unregister_notifier(struct notifier_block *nb);
+
+#endif /* __LF1000_FENCE_H__ */
@@ -377,12 +377,12 @@ struct lf1000_timer_init {
 
 #define	TIMER_PLL		PLL1		/* timer clock source is PLL1 */
 
-#define	LF1000_SYS_TIMER	0		/* system   timer is TIMER0   */
+#define	LF1000_SYS_TIMER	0		/* clock event timer is TIMER0 */
 #define LF1000_SYS_TIMER_IRQ	LF1000_TIMER0_IRQ
 #define	LF1000_FREE_TIMER	1		/* free run timer is TIMER1   */
+						/* and is the clocksource     */
 
-#define LF1000_INTERTICK_TIMER	2		/* Time since SYS_TIMER tick  */
-						/* reset in SYS_TIMER isr     */
+#define LF1000_INTERTICK_TIMER	2		/* unused since clockevents   */
 
 #define	LF1000_INTERVAL_IN_USEC	(USEC_PER_SEC/HZ) /* system timer cycle */
 
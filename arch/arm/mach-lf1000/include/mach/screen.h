@@ -34,5 +34,6 @@ struct lf1000_screen_info *lf1000_get_screen_info(void);
 void lf1000_dpc_enable_int(bool en);
 bool lf1000_dpc_int_pending(void);
 void lf1000_dpc_clear_int(void);
+unsigned int lf1000_dpc_set_refresh_div(unsigned int n);
 
 #endif /* __LF1000_SCREEN_H__ */
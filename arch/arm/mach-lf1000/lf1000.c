@@ -28,13 +28,27 @@
 #include <asm/irq.h>
 #include <asm/mach-types.h>
 #include <asm/mach/arch.h>
+#include <asm/mach/irq.h>
 
 #include <mach/core.h>
 #include <plat/irq.h>
 
+/* audio DMA and the display are served ahead of everything else */
+static const unsigned int lf1000_irq_priority[] __initdata = {
+	IRQ_DMA,
+	IRQ_AUDIOIF,
+	IRQ_PDISPLAY,
+	IRQ_SDIPLAY,
+};
+
 static void __init lf1000_init_irq(void)
 {
 	mes_irq_init(__io(IO_ADDRESS(LF1000_IC_BASE)));
+	mes_irq_set_priority(lf1000_irq_priority,
+			ARRAY_SIZE(lf1000_irq_priority));
+
+	/* the ga3d driver enables its interrupt only while a wait is armed */
+	set_irq_flags(IRQ_GRP3D, IRQF_VALID | IRQF_NOAUTOEN);
 }
 
 MACHINE_START(DIDJ, "ARM-LF1000")
@@ -111,6 +111,7 @@ __setup("screen_module=", screen_module_name);
 static struct dpc_priv {
 	void __iomem			*mem;
 	int				div;
+	u32				refresh_div;	/* clock slowed by */
 	struct lf1000_screen_info	*screen;
 	unsigned			tvout : 1;
 	struct dentry			*debug;
@@ -341,6 +342,28 @@ void lf1000_dpc_enable_int(bool en)
 }
 EXPORT_SYMBOL_GPL(lf1000_dpc_enable_int);
 
+/* Run the LCD at 1/n of its pixel clock, and so of its refresh rate, to cut
+ * the MLC's memory traffic while the picture isn't changing.  n = 1 is full
+ * speed.  Returns the divider actually used, which is limited by the width of
+ * the clock divider. */
+unsigned int lf1000_dpc_set_refresh_div(unsigned int n)
+{
+	unsigned int div = dpc.div > 0 ? dpc.div : 1;
+	u32 reg;
+
+	if (n < 1)
+		n = 1;
+	if (div * n > 0x40)
+		n = 0x40 / div;
+
+	reg = readl(dpc.mem + DPCCLKGEN0) & ~(0x3F<<CLKDIV0);
+	writel(reg | ((div * n - 1)<<CLKDIV0), dpc.mem + DPCCLKGEN0);
+	dpc.refresh_div = n;
+
+	return n;
+}
+EXPORT_SYMBOL_GPL(lf1000_dpc_set_refresh_div);
+
 static void lf1000_dpc_set_enable(u8 index, bool en)
 {
 	void __iomem *mem = index ? dpc.mem + 0x400 : dpc.mem;
@@ -699,6 +722,7 @@ static int lf1000_dpc_probe(struct platform_device *pdev)
 	dev_info(&pdev->dev, "screen: %dx%d\n", screen->xres, screen->yres);
 
 	dpc.screen = screen;
+	dpc.refresh_div = 1;
 
 	lf1000_dpc_configure();
 
@@ -719,6 +743,8 @@ static int lf1000_dpc_probe(struct platform_device *pdev)
 		debugfs_create_file("screen", S_IRUSR, dir, &dpc,
 				&lf1000_dpc_screen_fops);
 		debugfs_create_u32("div", S_IRUSR, dir, (u32 *)&dpc.div);
+		debugfs_create_u32("refresh_div", S_IRUSR, dir,
+				&dpc.refresh_div);
 	}
 
 	return 0;
@@ -13,4 +13,13 @@
 
 void mes_irq_init(void __iomem *base);
 
+/* IRQs given here are decoded and served ahead of all others */
+extern u32 mes_irq_priority[2];
+void mes_irq_set_priority(const unsigned int *irqs, int count);
+
+#ifdef CONFIG_LF1000_IRQ_LATENCY
+/* record one IRQ entry latency sample */
+void mes_irq_latency(unsigned int ns);
+#endif
+
 #endif /* __PLAT_IRQ_H__ */
@@ -21,13 +21,20 @@
  */
 
 #include <linux/init.h>
+#include <linux/module.h>
 #include <linux/list.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/ctype.h>
+#include <linux/interrupt.h>
 
 #include <asm/io.h>
 #include <asm/mach/irq.h>
 #include <asm/hardware/vic.h>
 #include <mach/platform.h>
 #include <mach/ic.h>
+#include <plat/irq.h>
 
 /* FIXME: IRQ Base */
 #define MES_INT_BASE	0xC0000800
@@ -42,6 +49,28 @@
 #define DMA_INTENB	(1<<18)
 #define DMA_INTPEND	(1<<17)
 
+/*
+ * Sources served first by get_irqnr_and_base (see entry-macro.S), one bit per
+ * IRQ as in INTPENDL and INTPENDH.
+ */
+u32 mes_irq_priority[2];
+
+void mes_irq_set_priority(const unsigned int *irqs, int count)
+{
+	unsigned long flags;
+	u32 prio[2] = { 0, 0 };
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (irqs[i] < NR_HW_IRQS)
+			prio[irqs[i] / 32] |= 1 << (irqs[i] & 31);
+
+	local_irq_save(flags);
+	mes_irq_priority[0] = prio[0];
+	mes_irq_priority[1] = prio[1];
+	local_irq_restore(flags);
+}
+
 static __inline void mes_irq_clear(unsigned int irq)
 {
 	if (irq < 32)
@@ -120,17 +149,108 @@ static void mes_dma_irq_unmask(unsigned int irq)
 	writel(val, IO_ADDRESS(MES_DMA_BASE + DMAMODE + (0x80 * dma)));
 }
 
+/*
+ * DMA interrupt mitigation.  While IRQ_DMA comes in more often than
+ * mes_dma_poll.threshold times a second, it is masked at the controller and
+ * the channels are swept from a tasklet instead, up to a budget of
+ * completions per run, the way NAPI polls a network device: completions that
+ * arrive while a sweep is running are reaped without an interrupt of their
+ * own.  IRQ_DMA is unmasked once a sweep finds less than its budget, and the
+ * rate falling back under the threshold returns to one interrupt per block.
+ */
+static struct {
+	u32 threshold;		/* interrupts per second, 0 never polls */
+	u32 budget;		/* completions per tasklet run */
+	unsigned long window;	/* jiffy being counted */
+	u32 rate;		/* IRQ_DMA interrupts in it */
+	u32 irqs;		/* IRQ_DMA interrupts */
+	u32 polled;		/* of those, handed to the tasklet */
+	u32 polls;		/* tasklet runs */
+	u32 reaped;		/* completions handled by the tasklet */
+	u32 rescheduled;	/* runs that used up their budget */
+} mes_dma_poll = {
+	.threshold	= 1000,
+	.budget		= 16,
+};
+
+static void mes_dma_poll_tasklet(unsigned long data);
+static DECLARE_TASKLET(mes_dma_poll_task, mes_dma_poll_tasklet, 0);
+
+static int mes_dma_pending(int i)
+{
+	return readl(IO_ADDRESS(MES_DMA_BASE + DMAMODE + (0x80 * i))) &
+		DMA_INTPEND;
+}
+
+/* handle pending channels until there are none or 'budget' are done */
+static int mes_dma_sweep(int budget)
+{
+	int i, found, work = 0;
+
+	do {
+		found = 0;
+		for (i = 0; i < NR_DMA_IRQS && work < budget; ++i) {
+			if (mes_dma_pending(i)) {
+				generic_handle_irq(dma_to_irq(i));
+				found = 1;
+				work++;
+			}
+		}
+	} while (found && work < budget);
+
+	return work;
+}
+
+static void mes_dma_poll_tasklet(unsigned long data)
+{
+	int budget = max_t(u32, mes_dma_poll.budget, 1);
+	int i, work;
+
+	local_irq_disable();
+	work = mes_dma_sweep(budget);
+	mes_dma_poll.polls++;
+	mes_dma_poll.reaped += work;
+
+	if (work >= budget) {
+		mes_dma_poll.rescheduled++;
+		tasklet_schedule(&mes_dma_poll_task);
+	} else {
+		/* unmasking clears IRQ_DMA's pending bit: look again */
+		mes_irq_unmask(IRQ_DMA);
+		for (i = 0; i < NR_DMA_IRQS; ++i) {
+			if (mes_dma_pending(i)) {
+				mes_irq_mask(IRQ_DMA);
+				tasklet_schedule(&mes_dma_poll_task);
+				break;
+			}
+		}
+	}
+	local_irq_enable();
+}
+
 static void mes_dma_irq_handler(unsigned int irq, struct irq_desc *desc)
 {
-	void __iomem *mode = (void __iomem *)IO_ADDRESS(MES_DMA_BASE + DMAMODE);
-	unsigned long val;
 	int i;
 
+	mes_dma_poll.irqs++;
+	if (mes_dma_poll.window != jiffies) {
+		mes_dma_poll.window = jiffies;
+		mes_dma_poll.rate = 0;
+	}
+	if (mes_dma_poll.threshold &&
+	    ++mes_dma_poll.rate * HZ > mes_dma_poll.threshold) {
+		mes_irq_mask(IRQ_DMA);
+		mes_dma_poll.polled++;
+		tasklet_schedule(&mes_dma_poll_task);
+		return;
+	}
+
+	/* the channels' irq_chip clears this too, but a channel handled
+	 * with handle_simple_irq() doesn't call it */
+	mes_irq_clear(IRQ_DMA);
 	for (i = 0; i < NR_DMA_IRQS; ++i) {
-		val = readl(mode + (0x80 * i));
-		if (val & DMA_INTPEND) {		   /* int pending ? */
+		if (mes_dma_pending(i))			/* int pending ? */
 			generic_handle_irq(dma_to_irq(i)); /* software int  */
-		}
 	}
 }
 
@@ -168,3 +288,178 @@ void __init mes_irq_init(void __iomem *base)
 		set_irq_flags(i, IRQF_VALID);
 	} 
 }
+
+#ifdef CONFIG_LF1000_IRQ_LATENCY
+/*
+ * IRQ entry latency, in buckets of powers of two microseconds.  Samples come
+ * from the system timer, which knows how long ago its interrupt was raised.
+ */
+#define MES_IRQ_LAT_BUCKETS	12
+
+static struct {
+	u32 count;
+	u32 max;		/* ns */
+	u64 sum;		/* ns */
+	u32 hist[MES_IRQ_LAT_BUCKETS];
+} mes_irq_lat;
+
+void mes_irq_latency(unsigned int ns)
+{
+	unsigned int b = fls(ns / 1000);
+
+	if (b >= MES_IRQ_LAT_BUCKETS)
+		b = MES_IRQ_LAT_BUCKETS - 1;
+	mes_irq_lat.hist[b]++;
+	mes_irq_lat.count++;
+	mes_irq_lat.sum += ns;
+	if (ns > mes_irq_lat.max)
+		mes_irq_lat.max = ns;
+}
+
+static int mes_irq_latency_show(struct seq_file *s, void *v)
+{
+	u32 avg = mes_irq_lat.count ?
+		div_u64(mes_irq_lat.sum, mes_irq_lat.count) : 0;
+	int i;
+
+	seq_printf(s, "samples %u, avg %u ns, max %u ns\n",
+			mes_irq_lat.count, avg, mes_irq_lat.max);
+	seq_printf(s, "     < 1 us: %u\n", mes_irq_lat.hist[0]);
+	for (i = 1; i < MES_IRQ_LAT_BUCKETS - 1; i++)
+		seq_printf(s, "%4u-%4u us: %u\n", 1 << (i - 1), 1 << i,
+				mes_irq_lat.hist[i]);
+	seq_printf(s, "  >= %4u us: %u\n", 1 << (i - 1),
+			mes_irq_lat.hist[i]);
+	return 0;
+}
+
+static int mes_irq_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mes_irq_latency_show, NULL);
+}
+
+/* any write clears the histogram */
+static ssize_t mes_irq_latency_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	memset(&mes_irq_lat, 0, sizeof(mes_irq_lat));
+	local_irq_restore(flags);
+	return count;
+}
+
+static const struct file_operations mes_irq_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mes_irq_latency_open,
+	.read		= seq_read,
+	.write		= mes_irq_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif /* CONFIG_LF1000_IRQ_LATENCY */
+
+static int mes_dma_poll_show(struct seq_file *s, void *v)
+{
+	seq_printf(s, "threshold %u/s, budget %u\n", mes_dma_poll.threshold,
+			mes_dma_poll.budget);
+	seq_printf(s, "irqs %u, polled %u\n", mes_dma_poll.irqs,
+			mes_dma_poll.polled);
+	seq_printf(s, "polls %u, reaped %u, rescheduled %u\n",
+			mes_dma_poll.polls, mes_dma_poll.reaped,
+			mes_dma_poll.rescheduled);
+	return 0;
+}
+
+static int mes_dma_poll_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mes_dma_poll_show, NULL);
+}
+
+static const struct file_operations mes_dma_poll_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mes_dma_poll_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int mes_irq_priority_show(struct seq_file *s, void *v)
+{
+	int i;
+
+	for (i = 0; i < NR_HW_IRQS; i++)
+		if (mes_irq_priority[i / 32] & (1 << (i & 31)))
+			seq_printf(s, "%d ", i);
+	seq_printf(s, "\n");
+	return 0;
+}
+
+static int mes_irq_priority_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mes_irq_priority_show, NULL);
+}
+
+/* takes a list of IRQ numbers to serve first, replacing the current one */
+static ssize_t mes_irq_priority_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	unsigned int irqs[NR_HW_IRQS];
+	char str[128], *p, *end;
+	int n = 0;
+
+	if (count >= sizeof(str))
+		return -EINVAL;
+	if (copy_from_user(str, buf, count))
+		return -EFAULT;
+	str[count] = '\0';
+
+	for (p = str; *p; p = end) {
+		while (*p && !isdigit(*p))
+			p++;
+		if (!*p)
+			break;
+		irqs[n] = simple_strtoul(p, &end, 0);
+		if (irqs[n] >= NR_HW_IRQS)
+			return -EINVAL;
+		if (++n == NR_HW_IRQS)
+			break;
+	}
+
+	mes_irq_set_priority(irqs, n);
+	return count;
+}
+
+static const struct file_operations mes_irq_priority_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mes_irq_priority_open,
+	.read		= seq_read,
+	.write		= mes_irq_priority_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init mes_irq_debug_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("mes_irq", NULL);
+	if (IS_ERR(dir) || !dir)
+		return 0;
+
+	debugfs_create_file("priority", S_IRUSR|S_IWUSR, dir, NULL,
+			&mes_irq_priority_fops);
+	debugfs_create_file("dma_poll", S_IRUSR, dir, NULL,
+			&mes_dma_poll_fops);
+	debugfs_create_u32("dma_poll_threshold", S_IRUSR|S_IWUSR, dir,
+			&mes_dma_poll.threshold);
+	debugfs_create_u32("dma_poll_budget", S_IRUSR|S_IWUSR, dir,
+			&mes_dma_poll.budget);
+#ifdef CONFIG_LF1000_IRQ_LATENCY
+	debugfs_create_file("latency", S_IRUSR|S_IWUSR, dir, NULL,
+			&mes_irq_latency_fops);
+#endif
+	return 0;
+}
+late_initcall(mes_irq_debug_init);
@@ -120,6 +120,11 @@ struct lf1000_hwmon {
 
 static struct lf1000_hwmon *hwmon_dev = NULL;
 
+static struct adc_client battery_adc = {
+	.name		= "battery",
+	.priority	= ADC_PRIORITY_NORMAL,
+};
+
 /* return battery reading in millivolts */
 static int lf1000_get_battery_mv(struct lf1000_hwmon *hwmon_dev)
 {
@@ -130,7 +135,7 @@ static int lf1000_get_battery_mv(struct lf1000_hwmon *hwmon_dev)
 	    (gpio_have_gpio_dev() || gpio_have_gpio_didj()))
 		return (987654321);
 
-	reading = adc_GetReading(LF1000_ADC_VBATSENSE);
+	reading = adc_GetClientReading(&battery_adc, LF1000_ADC_VBATSENSE);
 	if(reading < 0) /* pass the error code down */
 		return reading;
 	return ((hwmon_dev->adc_slope_256 * reading / 256) +
@@ -171,13 +176,15 @@ static enum lf1000_power_source lf1000_get_power_source(unsigned int on_battery)
 				lf1000_l2p_pin(BATTERY_PACK), 0);
 
 		udelay(10);		/* 10 us settling time */
-		adc_val_0 = adc_GetReading(LF1000_ADC_BATT_TEMP);
+		adc_val_0 = adc_GetClientReading(&battery_adc,
+				LF1000_ADC_BATT_TEMP);
 
 		gpio_set_val(lf1000_l2p_port(BATTERY_PACK),	/* set pin high */
 				lf1000_l2p_pin(BATTERY_PACK), 1);
 
 		udelay(10);		/* 10 us settling time */
-		adc_val_1 = adc_GetReading(LF1000_ADC_BATT_TEMP);
+		adc_val_1 = adc_GetClientReading(&battery_adc,
+				LF1000_ADC_BATT_TEMP);
 
 		if (adc_val_0 < BATTERY_PACK_LOW && 
 				adc_val_1 < BATTERY_PACK_LOW)
@@ -1048,6 +1055,7 @@ static int lf1000_power_probe(struct platform_device *pdev)
 	ret = setup_power_button(pdev);
 	if(ret)
 		goto fail_button;
+	adc_RegisterClient(&battery_adc);
 	sysfs_create_group(&pdev->dev.kobj, &power_attr_group);
 	return 0;
 
@@ -1083,6 +1091,7 @@ static int lf1000_power_remove(struct platform_device *pdev)
 	destroy_workqueue(priv->power_button_tasks);
 
 	sysfs_remove_group(&pdev->dev.kobj, &power_attr_group);
+	adc_UnregisterClient(&battery_adc);
 
 	input_unregister_device(priv->input);
 
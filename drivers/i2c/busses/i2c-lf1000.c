@@ -29,6 +29,9 @@
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
 #include <linux/platform_device.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/io.h>
 #include <mach/platform.h>
@@ -41,6 +44,18 @@
 #define LF1000_I2C_TIMEOUT	10 /* (in jiffies) */
 #define LF1000_I2C_RATE_HZ	100000
 
+/*
+ * Transfers of up to poll_max bytes on the wire (addresses included) are
+ * polled rather than interrupt driven.  A byte takes about 90us at 100kHz,
+ * so this only pays for the very shortest ones, like a register write.
+ */
+#define LF1000_I2C_POLL_MAX	3
+#define LF1000_I2C_POLL_US	1000 /* per byte */
+
+/* latency histogram buckets: <128us, <256us, ... >=8ms */
+#define LF1000_I2C_HIST		8
+#define LF1000_I2C_HIST_SHIFT	7
+
 /* FIXME: add channel 0 settings, choose based on I2C_CHANNEL */
 #define I2C_SCL0_PORT	GPIO_PORT_A
 #define I2C_SCL0_PIN	GPIO_PIN26
@@ -80,37 +95,61 @@ struct lf1000_i2c {
 	unsigned long		iosize;
 
 	int			irq;
+
+	/* transfer engine, stepped from the IRQ or by polling */
+	struct i2c_msg		*msgs;
+	int			num;
+	int			cur;		/* message on the bus */
+	int			pos;		/* bytes of it handed over */
+	enum lf1000_i2c_state	state;
+	int			active;
+	int			xfer_ret;
+
+	/* statistics, see debugfs */
+	struct dentry		*debug;
+	u32			poll_max;
+	u32			transfers;
+	u32			polled;
+	u32			irqs;
+	u32			errors;
+	u32			timeouts;
+	u32			hist[2][LF1000_I2C_HIST];	/* irq, polled */
 };
 
-static irqreturn_t lf1000_i2c_irq(int irq, void *dev_id)
+static int lf1000_i2c_step(struct lf1000_i2c *i2c);
+
+/* clear the byte done condition, returns 0 if it wasn't pending */
+static int lf1000_i2c_ack_irq(struct lf1000_i2c *i2c)
 {
-	struct lf1000_i2c *i2c = dev_id;
 	u32 tmp = ioread32(i2c->reg_base+IRQ_PEND);
 
-	if(!(tmp & (1<<PEND))) /* sanity check */
-		return IRQ_NONE;
+	if(!(tmp & (1<<PEND)))
+		return 0;
 
-	/* clear pending interrupt */
 	tmp |= (1<<PEND);
 	iowrite32(tmp, i2c->reg_base+IRQ_PEND);
-
-	i2c->ready = 1;
-	wake_up_interruptible(&i2c->wait); /* wake up anyone that is waiting */
-	return IRQ_HANDLED;
+	return 1;
 }
 
-static int lf1000_i2c_wait(struct lf1000_i2c *i2c)
+/*
+ * The whole transfer runs from here, one step per byte, and the caller is
+ * only woken once it's finished.  That is still one interrupt per byte; only
+ * the wakeups per byte are gone.
+ */
+static irqreturn_t lf1000_i2c_irq(int irq, void *dev_id)
 {
-	int ret = wait_event_interruptible_timeout(i2c->wait, (i2c->ready),
-						   LF1000_I2C_TIMEOUT);
+	struct lf1000_i2c *i2c = dev_id;
 
-	if(unlikely(ret < 0))
-		printk(KERN_INFO "i2c: interrupted\n");
-	else if(unlikely(!(i2c->ready)))
-		return -ETIMEDOUT;
+	if(!lf1000_i2c_ack_irq(i2c)) /* sanity check */
+		return IRQ_NONE;
 
-	i2c->ready = 0;
-	return 0;
+	i2c->irqs++;
+	if(i2c->active && lf1000_i2c_step(i2c)) {
+		i2c->active = 0;
+		i2c->ready = 1;
+		wake_up(&i2c->wait); /* wake up anyone that is waiting */
+	}
+	return IRQ_HANDLED;
 }
 
 static int i2c_bus_available(struct lf1000_i2c *i2c)
@@ -189,119 +228,150 @@ static void xfer_stop(struct lf1000_i2c *i2c, bool transmit)
 	start_stop_condition(i2c); /* STOP */
 }
 
-/* write to a slave device, see page 17-6 in the MP2530 data book */
-static int xfer_write(struct lf1000_i2c *i2c, unsigned char *buf, int length)
+/* address the current message, with a START or repeated START */
+static void msg_start(struct lf1000_i2c *i2c)
 {
+	struct i2c_msg *msg = &i2c->msgs[i2c->cur];
+	u32 rw = (msg->flags & I2C_M_RD) ? 1 : 0;
+
+	if(msg->flags & I2C_M_REV_DIR_ADDR)
+		rw ^= 1;
+
+	/* set slave device address */
+	iowrite32(msg->addr | rw, i2c->reg_base+IDSR);
+
+	i2c->pos = 0;
+	i2c->state = I2C_SEND_ADDR;
+	xfer_start(i2c, (msg->flags & I2C_M_RD) ? 0 : 1);
+}
+
+/* hand the next byte to the controller, see page 17-6 in the data book */
+static void msg_data(struct lf1000_i2c *i2c)
+{
+	struct i2c_msg *msg = &i2c->msgs[i2c->cur];
 	u32 tmp;
-	int ret;
-	enum lf1000_i2c_state state = I2C_SEND_ADDR;
-
-	while(1) {
-		switch(state) {
-			case I2C_SEND_ADDR:
-			ret = lf1000_i2c_wait(i2c);
-			if (ret != 0)
-				goto done_write;
-
-			tmp = readl(i2c->reg_base+ICSR);
-			if (tmp & (1<<ACK_STATUS)) {
-				dev_err(&i2c->adap.dev, "no ACK in %s\n",
-						__FUNCTION__);
-				ret = -EFAULT;
-				goto done_write;
-			}
 
-			state = I2C_SEND_DATA;
-			break;
-
-			case I2C_SEND_DATA:
-			writel(*buf++, i2c->reg_base+IDSR); /* write data */
-			start_stop_condition(i2c); /* START */
-			ret = lf1000_i2c_wait(i2c); /* wait for IRQ */
-			if (ret != 0)
-				goto done_write;
-
-			tmp = readl(i2c->reg_base+ICSR);
-			if (tmp & (1<<ACK_STATUS)) {
-				dev_err(&i2c->adap.dev, "no DATA ACK in %s\n",
-						__FUNCTION__);
-				ret = -EFAULT;
-				goto done_write;
-			}
+	if(msg->flags & I2C_M_RD) {
+		msg->buf[i2c->pos++] = ioread32(i2c->reg_base+IDSR);
+		/* master stops generating ACK on last byte */
+		if(i2c->pos == msg->len) {
+			tmp = readl(i2c->reg_base+ICCR);
+			tmp &= ~(1<<ACK_GEN);
+			writel(tmp, i2c->reg_base+ICCR);
+		}
+	} else {
+		writel(msg->buf[i2c->pos++], i2c->reg_base+IDSR);
+	}
+	start_stop_condition(i2c); /* START (next byte) */
+}
+
+/*
+ * Move on from a finished message.  A write flagged I2C_M_NOSTART that
+ * follows a write continues the same write (a register address and its
+ * data can come from separate buffers); anything else gets a repeated
+ * START.  Returns 1 when the last message is done.
+ */
+static int msg_next(struct lf1000_i2c *i2c)
+{
+	struct i2c_msg *msg;
 
-			if (--length <= 0)
-				state = I2C_SEND_DONE;
-			break;
+	while(++i2c->cur < i2c->num) {
+		msg = &i2c->msgs[i2c->cur];
 
-			case I2C_SEND_DONE:
-			ret = 0;
-			goto done_write;
+		if(!(msg->flags & I2C_M_NOSTART) || (msg->flags & I2C_M_RD) ||
+		   (i2c->msgs[i2c->cur-1].flags & I2C_M_RD)) {
+			msg_start(i2c);
+			return 0;
+		}
+		i2c->pos = 0;
+		if(msg->len) {
+			msg_data(i2c);
+			return 0;
 		}
 	}
 
-done_write:
-	return 0;
+	i2c->cur = i2c->num - 1;
+	i2c->xfer_ret = i2c->num;
+	return 1;
 }
 
-/* read from a slave device, see page 17-7 in the MP2530 data book */
-static int xfer_read(struct lf1000_i2c *i2c, unsigned char *buf, int length)
+/*
+ * Handle one byte done condition (address or data).  Slaves ACK addresses
+ * and written bytes; the master ACKs all read bytes but the last.  Returns
+ * 1 when the transfer is over, with the result in xfer_ret.
+ */
+static int lf1000_i2c_step(struct lf1000_i2c *i2c)
 {
+	struct i2c_msg *msg = &i2c->msgs[i2c->cur];
 	u32 tmp;
-	int ret;
-	enum lf1000_i2c_state state = I2C_SEND_ADDR;
-
-	while(1) {
-		switch(state) {
-			case I2C_SEND_ADDR:
-			ret = lf1000_i2c_wait(i2c);
-			if(ret != 0)
-				goto done_read;
-			tmp = ioread32(i2c->reg_base+ICSR); /* check for an ACK */
-			if(tmp & (1<<ACK_STATUS)) {
-				printk(KERN_INFO "i2c: no ACK in xfer_read\n");
-				ret = -EFAULT;
-				goto done_read;
-			}
+
+	if((i2c->state == I2C_SEND_ADDR || !(msg->flags & I2C_M_RD)) &&
+	   !(msg->flags & I2C_M_IGNORE_NAK)) {
+		tmp = readl(i2c->reg_base+ICSR);
+		if(tmp & (1<<ACK_STATUS)) {
+			dev_err(&i2c->adap.dev, "no %s ACK from 0x%02X\n",
+				i2c->state == I2C_SEND_ADDR ? "address" :
+				"DATA", msg->addr);
+			i2c->xfer_ret = -EFAULT;
+			return 1;
+		}
+	}
+
+	if(i2c->state == I2C_SEND_ADDR) {
+		i2c->state = I2C_SEND_DATA;
+		if((msg->flags & I2C_M_RD) && !(msg->flags & I2C_M_NO_RD_ACK)) {
 			/* master generates ACK for received bytes */
 			tmp = readl(i2c->reg_base+ICCR);
 			tmp |= (1<<ACK_GEN);
 			writel(tmp, i2c->reg_base+ICCR);
-			state = I2C_SEND_DATA;
-			break;
-
-			case I2C_SEND_DATA:
-			*buf++ = ioread32(i2c->reg_base+IDSR); /* get data */
-			/* master stops generating ACK on last byte */
-			if (length <= 1) {
-				tmp = readl(i2c->reg_base+ICCR);
-				tmp &= ~(1<<ACK_GEN);
-				writel(tmp, i2c->reg_base+ICCR);
-			}
-			start_stop_condition(i2c); /* START (request more data) */
-			ret = lf1000_i2c_wait(i2c); /* wait for IRQ */
-			if(ret != 0)
-				goto done_read;
-
-			if(--length <= 0)
-				state = I2C_SEND_DONE;
-			break;
-
-			case I2C_SEND_DONE:
-			ret = 0;
-			goto done_read;
 		}
 	}
 
-done_read:
-	return ret;
+	if(i2c->pos >= msg->len)
+		return msg_next(i2c);
+
+	msg_data(i2c);
+	return 0;
+}
+
+/* run the transfer with the controller's IRQ masked, for short transfers */
+static void lf1000_i2c_poll(struct lf1000_i2c *i2c)
+{
+	int us;
+
+	while(i2c->active) {
+		for(us = 0; !lf1000_i2c_ack_irq(i2c); us++) {
+			if(us >= LF1000_I2C_POLL_US) {
+				i2c->xfer_ret = -ETIMEDOUT;
+				i2c->active = 0;
+				return;
+			}
+			udelay(1);
+		}
+		if(lf1000_i2c_step(i2c))
+			i2c->active = 0;
+	}
 }
 
 /* generic I2C master transfer entrypoint */
 static int lf1000_xfer(struct i2c_adapter *adap, struct i2c_msg msgs[], int num)
 {
 	struct lf1000_i2c *i2c = adap->algo_data;
-	int i, ret;
+	int i, ret, bytes = 0, polled;
 	unsigned long flags;
+	ktime_t start;
+	s64 us;
+
+	if(num <= 0)
+		return 0;
+
+	for(i = 0; i < num; i++) {
+		if(msgs[i].len && !msgs[i].buf)
+			return -EINVAL;
+		bytes += msgs[i].len;
+		if(i == 0 || !(msgs[i].flags & I2C_M_NOSTART))
+			bytes++; /* address */
+	}
 
 	/* wait to get access to the bus */
 	spin_lock_irqsave(&i2c->bus_access, flags);
@@ -316,39 +386,61 @@ static int lf1000_xfer(struct i2c_adapter *adap, struct i2c_msg msgs[], int num)
 	i2c->busy = 1; /* got the bus */
 	spin_unlock_irqrestore(&i2c->bus_access, flags);
 
+	start = ktime_get();
+	polled = bytes <= i2c->poll_max;
+	if(polled)
+		disable_irq(i2c->irq);
+
 	lf1000_i2c_clock(i2c, 1);
 
 	lf1000_i2c_hwinit(i2c);
 
-	for(i = 0; i < num; i++) {
-		/* set slave device address */
-		iowrite32(msgs[i].addr | ((msgs[i].flags & I2C_M_RD) ? 1 : 0), 
-				  i2c->reg_base+IDSR);
-
-		/* signal start for each message part */
-		xfer_start(i2c, (msgs[i].flags & I2C_M_RD) ? 0 : 1);
-
-		if(msgs[i].len && msgs[i].buf) {
-			if(msgs[i].flags & I2C_M_RD) 
-				ret = xfer_read(i2c, msgs[i].buf, msgs[i].len);
-			else
-				ret = xfer_write(i2c, msgs[i].buf, msgs[i].len);
-
-			if(ret != 0)
-				goto xfer_done;
+	i2c->msgs = msgs;
+	i2c->num = num;
+	i2c->cur = 0;
+	i2c->xfer_ret = 0;
+	i2c->ready = 0;
+	i2c->active = 1;
+	msg_start(i2c);
+
+	if(polled) {
+		lf1000_i2c_poll(i2c);
+	} else if(!wait_event_timeout(i2c->wait, i2c->ready,
+				LF1000_I2C_TIMEOUT * bytes)) {
+		local_irq_save(flags);
+		if(!i2c->ready) {
+			i2c->active = 0;
+			i2c->xfer_ret = -ETIMEDOUT;
 		}
+		local_irq_restore(flags);
 	}
-	ret = i;
+	ret = i2c->xfer_ret;
 
-xfer_done:
 	/* signal stop at end of message */
-	xfer_stop(i2c, (msgs[i].flags & I2C_M_RD) ? 0 : 1);
+	xfer_stop(i2c, (msgs[i2c->cur].flags & I2C_M_RD) ? 0 : 1);
 
 	/* turn off I2C controller */
 	iowrite32(0, i2c->reg_base+ICSR);
 
 	lf1000_i2c_clock(i2c, 0);
 
+	if(polled) {
+		lf1000_i2c_ack_irq(i2c);
+		enable_irq(i2c->irq);
+	}
+
+	us = ktime_us_delta(ktime_get(), start) >> LF1000_I2C_HIST_SHIFT;
+	for(i = 0; us && i < LF1000_I2C_HIST - 1; i++)
+		us >>= 1;
+	i2c->hist[polled][i]++;
+	i2c->transfers++;
+	if(polled)
+		i2c->polled++;
+	if(ret < 0)
+		i2c->errors++;
+	if(ret == -ETIMEDOUT)
+		i2c->timeouts++;
+
 	/* realease the bus */
 	spin_lock_irqsave(&i2c->bus_access, flags);
 	i2c->busy = 0;
@@ -361,7 +453,7 @@ xfer_done:
  */
 static u32 lf1000_func(struct i2c_adapter *adapter)
 {
-    return I2C_FUNC_I2C;
+    return I2C_FUNC_I2C | I2C_FUNC_PROTOCOL_MANGLING;
 }
 
 static struct i2c_algorithm lf1000_algorithm = {
@@ -369,6 +461,46 @@ static struct i2c_algorithm lf1000_algorithm = {
     .functionality  = lf1000_func,
 };
 
+/*
+ * debugfs Interface
+ */
+static int lf1000_i2c_latency_show(struct seq_file *s, void *v)
+{
+	struct lf1000_i2c *i2c = s->private;
+	int i;
+
+	seq_printf(s, "transfers: %u\n", i2c->transfers);
+	seq_printf(s, "polled:    %u\n", i2c->polled);
+	seq_printf(s, "irqs:      %u\n", i2c->irqs);
+	seq_printf(s, "errors:    %u\n", i2c->errors);
+	seq_printf(s, "timeouts:  %u\n", i2c->timeouts);
+
+	seq_printf(s, "\n%10s %10s %10s\n", "usec", "irq", "polled");
+	for(i = 0; i < LF1000_I2C_HIST; i++) {
+		if(i < LF1000_I2C_HIST - 1)
+			seq_printf(s, "     <%-4u", 1 << (LF1000_I2C_HIST_SHIFT+i));
+		else
+			seq_printf(s, "    >=%-4u",
+				1 << (LF1000_I2C_HIST_SHIFT+i-1));
+		seq_printf(s, " %10u %10u\n", i2c->hist[0][i],
+				i2c->hist[1][i]);
+	}
+	return 0;
+}
+
+static int lf1000_i2c_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lf1000_i2c_latency_show, inode->i_private);
+}
+
+static const struct file_operations lf1000_i2c_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lf1000_i2c_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 #define res_len(r)              ((r)->end - (r)->start + 1)
 static int lf1000_i2c_probe(struct platform_device *dev)
 {
@@ -405,6 +537,7 @@ static int lf1000_i2c_probe(struct platform_device *dev)
 
 	i2c->adap.owner   = THIS_MODULE;
 	i2c->adap.retries = 5;
+	i2c->poll_max     = LF1000_I2C_POLL_MAX;
 	
 	/* set up I2C IRQ wait queue */
 	init_waitqueue_head(&i2c->wait);
@@ -489,6 +622,16 @@ static int lf1000_i2c_probe(struct platform_device *dev)
 		goto fail_register;
 	}
 
+	i2c->debug = debugfs_create_dir(dev_name(&dev->dev), NULL);
+	if(IS_ERR(i2c->debug))
+		i2c->debug = NULL;
+	if(i2c->debug) {
+		debugfs_create_file("latency", S_IRUGO, i2c->debug, i2c,
+				&lf1000_i2c_latency_fops);
+		debugfs_create_u32("poll_max", S_IRUGO|S_IWUSR, i2c->debug,
+				&i2c->poll_max);
+	}
+
 	return 0;
 
 fail_register:
@@ -513,6 +656,8 @@ static int lf1000_i2c_remove(struct platform_device *dev)
 
 	platform_set_drvdata(dev, NULL);
 
+	if(i2c->debug)
+		debugfs_remove_recursive(i2c->debug);
 	i2c_del_adapter(&i2c->adap);
 	free_irq(i2c->irq, i2c);
 	
@@ -30,7 +30,7 @@
 #define BUTTON_DELAY		4
 #define BRIGHTNESS_DELAY	20
 
-#define INPUT_SAMPLING_J	HZ / 200
+#define INPUT_SAMPLING_J	max(HZ / 200, 1)
 
 /*
  * Key Map
@@ -47,6 +47,9 @@ struct button_entry {
 	enum gpio_interrupt_mode push;		/* IRQ for 'pushed' */
 	enum gpio_interrupt_mode release;	/* IRQ for 'released' */
 	unsigned int debounce;			/* int count		*/
+
+	unsigned int irq;			/* pin IRQ claimed	*/
+	unsigned int sampling;			/* sampled by the timer	*/
 };
 
 /* the physical button map
@@ -94,18 +97,63 @@ struct lf1000_kp {
 	unsigned int keycode[ARRAY_SIZE(lf1000_keycode)];
 	struct input_dev *input;
 	struct timer_list input_timer;
+	unsigned int polled;			/* buttons without an IRQ */
+	unsigned int wakeups;			/* button IRQs taken	*/
 };
 
+/*
+ * Each button waits on a level interrupt for the level that would change
+ * its debounced state: 'push' while released, 'release' while pushed.
+ * Debounce bit 4 is set while released.
+ */
+static void button_arm(struct button_entry *bme)
+{
+	gpio_set_int_mode(bme->port, bme->pin,
+		(bme->debounce & 0x10) ? bme->push : bme->release);
+	gpio_clear_pend(bme->port, bme->pin);
+	gpio_set_int(bme->port, bme->pin, 1);
+}
+
+static irqreturn_t button_irq(enum gpio_port port, enum gpio_pin pin,
+			      void *priv)
+{
+	struct lf1000_kp *i_dev = priv;
+	struct button_entry *bme;
+	int i;
+
+	if (!gpio_get_pend(port, pin))
+		return IRQ_NONE;
+
+	gpio_set_int(port, pin, 0);
+	gpio_clear_pend(port, pin);
+
+	for(i = 0; i < ARRAY_SIZE(button_map); i++) {
+		bme = &button_map[i];
+		if (bme->irq && bme->port == port && bme->pin == pin)
+			bme->sampling = 1;
+	}
+	i_dev->wakeups++;
+
+	/* debounce from the timer, which only runs after an edge */
+	if (!timer_pending(&i_dev->input_timer))
+		mod_timer(&i_dev->input_timer, jiffies + INPUT_SAMPLING_J);
+	return IRQ_HANDLED;
+}
+
 static void input_monitor_task(unsigned long data)
 {
 	struct lf1000_kp *i_dev = (struct lf1000_kp *)data;
 	struct button_entry *bme;
+	unsigned long flags;
 	int i;
 	int val;
 	int old;
+	int busy = i_dev->polled;
 
 	for(i = 0; i < ARRAY_SIZE(button_map); i++) {
 		bme = &button_map[i];
+		if (!bme->sampling)
+			continue;
 
 		/* assume push GPIO is normally low, invert if needed	*/
 		val = gpio_get_val(bme->port, bme->pin) ^ bme->push;
@@ -122,14 +170,35 @@ static void input_monitor_task(unsigned long data)
 			bme->debounce = 0x0C;
 			break;
 		}
+
+		if (!bme->irq)
+			continue;
+
+		/* settled, whether it changed state or bounced back */
+		if (bme->debounce == 0x13 || bme->debounce == 0x0C ||
+		    bme->debounce == 0x1F || bme->debounce == 0x00) {
+			local_irq_save(flags);
+			bme->sampling = 0;
+			button_arm(bme);
+			local_irq_restore(flags);
+		} else {
+			busy = 1;
+		}
 	}
 
-	i_dev->input_timer.expires += INPUT_SAMPLING_J;
-	i_dev->input_timer.function = input_monitor_task;
-	i_dev->input_timer.data = data;
-	add_timer(&i_dev->input_timer);
+	if (busy)
+		mod_timer(&i_dev->input_timer, jiffies + INPUT_SAMPLING_J);
 }
 
+static ssize_t show_wakeups(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct lf1000_kp *i_dev = dev_get_drvdata(dev);
+	return sprintf(buf, "%u\n", i_dev->wakeups);
+}
+
+static DEVICE_ATTR(wakeups, S_IRUSR|S_IRGRP|S_IROTH, show_wakeups, NULL);
+
 /*
  * platform device
  */
@@ -205,14 +274,36 @@ static int lf1000_kp_probe(struct platform_device *pdev)
 				button_map[i].release = GPIO_IMODE_LOW_LEVEL;
 			}
 		}
+		button_map[i].irq = 0;
+		button_map[i].sampling = 0;
+		if (button_map[i].port < 0)
+			continue;	/* not on this board */
 		gpio_configure_pin(button_map[i].port, button_map[i].pin,
 			GPIO_GPIOFN, 0, 0, 0);
 	}
 	setup_timer(&lf1000_kp_dev->input_timer, input_monitor_task, (unsigned long)lf1000_kp_dev);
-	lf1000_kp_dev->input_timer.expires = get_jiffies_64() + INPUT_SAMPLING_J;
-	lf1000_kp_dev->input_timer.function = input_monitor_task;
-	lf1000_kp_dev->input_timer.data = (unsigned long)lf1000_kp_dev;
-	add_timer(&lf1000_kp_dev->input_timer);
+
+	/*
+	 * Buttons are sampled only while debouncing after an interrupt.  A
+	 * pin whose IRQ is taken by another driver is sampled all the time.
+	 */
+	for(i = 0; i < ARRAY_SIZE(button_map); i++) {
+		if (button_map[i].port < 0)
+			continue;
+		button_map[i].sampling = 1;
+		if (gpio_request_irq(button_map[i].port, button_map[i].pin,
+				     button_irq, lf1000_kp_dev)) {
+			dev_info(&pdev->dev, "polling key %d\n",
+				 button_map[i].key);
+			lf1000_kp_dev->polled++;
+		} else {
+			button_map[i].irq = 1;
+		}
+	}
+	/* pick up the initial state, then arm the interrupts */
+	mod_timer(&lf1000_kp_dev->input_timer, jiffies + INPUT_SAMPLING_J);
+
+	device_create_file(&pdev->dev, &dev_attr_wakeups);
 
 	return 0;
 
@@ -226,7 +317,17 @@ fail_input:
 static int lf1000_kp_remove(struct platform_device *pdev)
 {
 	struct lf1000_kp *lf1000_kp_dev = platform_get_drvdata(pdev);
+	int i;
 
+	device_remove_file(&pdev->dev, &dev_attr_wakeups);
+	for(i = 0; i < ARRAY_SIZE(button_map); i++) {
+		if (!button_map[i].irq)
+			continue;
+		gpio_set_int(button_map[i].port, button_map[i].pin, 0);
+		gpio_free_irq(button_map[i].port, button_map[i].pin,
+			      button_irq);
+		button_map[i].irq = 0;
+	}
 	del_timer_sync(&lf1000_kp_dev->input_timer);
 	input_unregister_device(lf1000_kp_dev->input);
 	kfree(lf1000_kp_dev);
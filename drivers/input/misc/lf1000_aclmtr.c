@@ -21,6 +21,8 @@
 #include <linux/input.h>
 #include <linux/platform_device.h>
 #include <linux/i2c.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 
 #include <mach/platform.h>
 #include <mach/gpio.h>
@@ -32,7 +34,9 @@
  */
 
 #define INPUT_SAMPLING_HZ		10
-#define INPUT_SAMPLING_JIFFIES	(HZ / INPUT_SAMPLING_HZ)
+#define INPUT_SAMPLING_MAX_HZ		400	/* above HZ needs hrtimers */
+#define INPUT_IDLE_HZ			2
+#define INPUT_BATCH_MAX			32
 
 #define BMA150_ADDR			0x70
 #define BMA220_ADDR			0x16
@@ -43,9 +47,15 @@
 #define MIN_PHI				0x00
 #define MAX_PHI				0x07
 
+/* one reported sample, timestamped when it was read */
+struct aclmtr_sample {
+	int	x, y, z, phi;
+	u32	usec;
+};
+
 struct lf1000_aclmtr {
 	struct input_dev *input;
-	struct timer_list input_timer;
+	struct hrtimer input_timer;
 
 	struct	workqueue_struct *input_tasks;
 	struct	work_struct       input_work;
@@ -59,10 +69,30 @@ struct lf1000_aclmtr {
 	unsigned int do_orient;
 	unsigned int do_tick;
 	unsigned int rate;
-	unsigned int rate_jiffies;
 	unsigned int average;
 	int biasx, biasy, biasz;
 	int	x, y, z, phi;
+
+	/*
+	 * Streaming: samples are reported "batch" at a time, each with its
+	 * own MSC_TIMESTAMP, so readers wake once per batch.  After a second
+	 * without motion above motion_threshold, sampling drops to idle_rate
+	 * until the next movement.
+	 */
+	unsigned int batch;
+	unsigned int nsamples;
+	struct aclmtr_sample samples[INPUT_BATCH_MAX];
+	unsigned int idle_rate;
+	unsigned int motion_threshold;
+	unsigned int still;
+	int idle;
+	int lastx, lasty, lastz;
+
+	/* statistics */
+	unsigned int stat_samples;
+	unsigned int stat_batches;
+	unsigned int stat_idle;
+	unsigned int stat_errors;
 };
 
 static int bma_write_reg(struct lf1000_aclmtr *dev, unsigned int reg,
@@ -127,6 +157,48 @@ static unsigned int bma_read_reg(struct lf1000_aclmtr *dev,
 	return (ret < 0) ? ret : buf[1];
 }
 
+/*
+ * Read count consecutive registers in one combined transfer.  As in
+ * bma_read_reg(), the first byte back from the controller isn't data.
+ */
+static int bma_read_block(struct lf1000_aclmtr *dev, unsigned int reg,
+		u8 *data, int count)
+{
+	struct i2c_adapter *adapter = i2c_get_adapter(dev->i2c_bus);
+	struct i2c_msg msg[2];
+	u8 buf[INPUT_BATCH_MAX+1];
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	/* BMA220 left-justified index */
+	if (BMA220_ADDR == dev->i2c_addr)
+		reg <<= 1;
+
+	buf[0] = reg & 0xFF;
+
+	msg[0].addr = dev->i2c_addr;
+	msg[0].buf = buf;
+	msg[0].len = 1;
+	msg[0].flags = 0; /* write */
+
+	msg[1].addr = dev->i2c_addr;
+	msg[1].buf = buf;
+	msg[1].len = count + 1;
+	msg[1].flags = I2C_M_RD;
+
+	ret = i2c_transfer(adapter, msg, 2);
+
+	i2c_put_adapter(adapter);
+
+	if (ret < 0)
+		return ret;
+
+	memcpy(data, buf + 1, count);
+	return 0;
+}
+
 static int bma_detect(struct lf1000_aclmtr* dev)
 {
 	int id[2];
@@ -143,6 +215,7 @@ static int bma_detect(struct lf1000_aclmtr* dev)
 			printk(KERN_INFO "%s: BMA220 device found\n", __FUNCTION__);
 			bma_write_reg(dev, 0x0D, 0xC0);	/* data mode enable */
 			bma_write_reg(dev, 0x0F, 0x07);	/* x,y,z axis enable */
+			dev->motion_threshold = 1;
 			return 1;
 		}
 	}
@@ -156,6 +229,7 @@ static int bma_detect(struct lf1000_aclmtr* dev)
 
 		if (0x02 == id[0] && 0x11 == id[1]) {
 			printk(KERN_INFO "%s: BMA150 device found\n", __FUNCTION__);
+			dev->motion_threshold = 8;
 			return 1;
 		}
 	}
@@ -164,11 +238,16 @@ static int bma_detect(struct lf1000_aclmtr* dev)
 	return 0;
 }
 
-static void bma150_get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
+/* X, Y and Z LSB/MSB pairs are read in one burst, 0x02 to 0x07 */
+static int bma150_get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
 {
-	*x = (bma_read_reg(dev, 0x02) >> 6) | (bma_read_reg(dev, 0x03) << 2);
-	*y = (bma_read_reg(dev, 0x04) >> 6) | (bma_read_reg(dev, 0x05) << 2);
-	*z = (bma_read_reg(dev, 0x06) >> 6) | (bma_read_reg(dev, 0x07) << 2);
+	u8 r[6];
+
+	if (bma_read_block(dev, 0x02, r, 6))
+		return -EIO;
+	*x = (r[0] >> 6) | (r[1] << 2);
+	*y = (r[2] >> 6) | (r[3] << 2);
+	*z = (r[4] >> 6) | (r[5] << 2);
 	if (*x > 0x01FF)
 		*x -= 0x3FF+1;
 	if (*y > 0x01FF)
@@ -178,13 +257,19 @@ static void bma150_get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
 	dev->x = *x;
 	dev->y = *y;
 	dev->z = *z;
+	return 0;
 }
 
-static void bma220_get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
+/* X, Y and Z are read in one burst, 0x02 to 0x04 */
+static int bma220_get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
 {
-	*x = bma_read_reg(dev, 0x02) >> 2;
-	*y = bma_read_reg(dev, 0x03) >> 2;
-	*z = bma_read_reg(dev, 0x04) >> 2;
+	u8 r[3];
+
+	if (bma_read_block(dev, 0x02, r, 3))
+		return -EIO;
+	*x = r[0] >> 2;
+	*y = r[1] >> 2;
+	*z = r[2] >> 2;
 	if (*x > 0x001F)
 		*x -= 0x03F+1;
 	if (*y > 0x001F)
@@ -194,6 +279,7 @@ static void bma220_get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
 	dev->x = *x;
 	dev->y = *y;
 	dev->z = *z;
+	return 0;
 }
 
 static void get_orient(struct lf1000_aclmtr* dev, int* orient)
@@ -207,7 +293,7 @@ static void get_orient(struct lf1000_aclmtr* dev, int* orient)
 	*orient = 0;
 }
 
-static void get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
+static int get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
 {
 	switch (dev->i2c_addr) {
 	case BMA150_ADDR:
@@ -216,20 +302,87 @@ static void get_xyz(struct lf1000_aclmtr* dev, int* x, int* y, int* z)
 		return bma220_get_xyz(dev, x, y, z);
 	}
 	*x = *y = *z = 0;
+	return 0;
+}
+
+static ktime_t sample_period(struct lf1000_aclmtr *dev)
+{
+	unsigned int rate = dev->idle ? dev->idle_rate : dev->rate;
+
+	return ktime_set(0, NSEC_PER_SEC / rate);
+}
+
+/* report the queued samples in one go */
+static void flush_samples(struct lf1000_aclmtr *i_dev)
+{
+	struct aclmtr_sample *s;
+	static int tick=0;
+	int i;
+
+	for (i = 0; i < i_dev->nsamples; i++) {
+		s = &i_dev->samples[i];
+		input_event(i_dev->input, EV_MSC, MSC_TIMESTAMP, s->usec);
+		input_report_abs(i_dev->input, ABS_X, s->x);
+		input_report_abs(i_dev->input, ABS_Y, s->y);
+		input_report_abs(i_dev->input, ABS_Z, s->z);
+		/* orientation is optional */
+		if (i_dev->do_orient)
+			input_report_abs(i_dev->input, ABS_MISC, s->phi);
+		/* Force at least one changing value to get a new event every sample */
+		if (i_dev->do_tick)
+			input_report_abs(i_dev->input, ABS_WHEEL, tick++);
+		input_sync(i_dev->input);
+	}
+	if (i_dev->nsamples)
+		i_dev->stat_batches++;
+	i_dev->nsamples = 0;
+}
+
+/*
+ * Movement by more than motion_threshold on any axis since the last sample
+ * keeps the full rate; a second without it switches to idle_rate.
+ */
+static void check_motion(struct lf1000_aclmtr *i_dev, int x, int y, int z)
+{
+	int d = max(abs(x - i_dev->lastx),
+		max(abs(y - i_dev->lasty), abs(z - i_dev->lastz)));
+
+	i_dev->lastx = x;
+	i_dev->lasty = y;
+	i_dev->lastz = z;
+
+	if (d > i_dev->motion_threshold) {
+		i_dev->still = 0;
+		if (i_dev->idle) {
+			i_dev->idle = 0;
+			hrtimer_start(&i_dev->input_timer, sample_period(i_dev),
+					HRTIMER_MODE_REL);
+		}
+	} else if (!i_dev->idle && i_dev->idle_rate &&
+		   ++i_dev->still >= i_dev->rate) {
+		i_dev->idle = 1;
+		i_dev->stat_idle++;
+		flush_samples(i_dev);
+	}
 }
 
 static struct lf1000_aclmtr* g_dev = NULL;	/* not cached in work_struct */
 static void input_work_task(struct	work_struct *work)
 {
 	struct lf1000_aclmtr *i_dev = g_dev;
+	struct aclmtr_sample *s;
 	int x, y, z;
 	int orient = 0;
-	static int tick=0;
 	static int acount=0;
 	static int sx=0, sy=0, sz=0;
 
 	/* get x,y,z from device */
-	get_xyz(i_dev, &x, &y, &z);
+	if (get_xyz(i_dev, &x, &y, &z)) {
+		i_dev->stat_errors++;
+		return;
+	}
+	i_dev->stat_samples++;
+	check_motion(i_dev, x, y, z);
 
 	/* get orientation from device */
 	if (i_dev->do_orient)
@@ -260,32 +413,33 @@ static void input_work_task(struct	work_struct *work)
 		z -= i_dev->biasz;
 	}
 		
-	/* report input data */
-	input_report_abs(i_dev->input, ABS_X, x);
-	input_report_abs(i_dev->input, ABS_Y, y);
-	input_report_abs(i_dev->input, ABS_Z, z);
-	/* orientation is optional */
-	if (i_dev->do_orient)
-		input_report_abs(i_dev->input, ABS_MISC, orient);
-	/* Force at least one changing value to get a new event every sample */
-	if (i_dev->do_tick)
-		input_report_abs(i_dev->input, ABS_WHEEL, tick++);
-	input_sync(i_dev->input);
+	/* queue input data, report when the batch is full */
+	s = &i_dev->samples[i_dev->nsamples++];
+	s->x = x;
+	s->y = y;
+	s->z = z;
+	s->phi = orient;
+	s->usec = (u32)ktime_to_us(ktime_get());
+	if (i_dev->idle || i_dev->nsamples >= i_dev->batch ||
+	    i_dev->nsamples >= INPUT_BATCH_MAX)
+		flush_samples(i_dev);
 }
 
-static void input_monitor_task(unsigned long data)
+static enum hrtimer_restart input_monitor_task(struct hrtimer *timer)
 {
-	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)data;
+	struct lf1000_aclmtr *i_dev =
+		container_of(timer, struct lf1000_aclmtr, input_timer);
+
+	/* the timer only runs while enabled */
+	if (!i_dev->do_enable)
+		return HRTIMER_NORESTART;
 
 	/* defer input sampling to work queue */
-	if (i_dev->do_enable)
-		queue_work(i_dev->input_tasks, &i_dev->input_work);
+	queue_work(i_dev->input_tasks, &i_dev->input_work);
 
 	/* reset task timer */
-	i_dev->input_timer.expires += i_dev->rate_jiffies;
-	i_dev->input_timer.function = input_monitor_task;
-	i_dev->input_timer.data = data;
-	add_timer(&i_dev->input_timer);
+	hrtimer_forward_now(timer, sample_period(i_dev));
+	return HRTIMER_RESTART;
 }
 
 /*
@@ -326,10 +480,9 @@ static ssize_t set_rate(struct device *dev, struct device_attribute *attr,
 	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
 	if(sscanf(buf, "%u", &temp) != 1)
 		return -EINVAL;
-	if (temp <= 0 || temp > HZ)
+	if (temp <= 0 || temp > INPUT_SAMPLING_MAX_HZ)
 		return -EINVAL;
 	i_dev->rate = temp;
-	i_dev->rate_jiffies = HZ / temp;
 	return(count);
 }
 
@@ -393,7 +546,14 @@ static ssize_t set_enable(struct device *dev, struct device_attribute *attr,
 		return -EINVAL;
 	if (temp < 0)
 		return -EINVAL;
-	i_dev->do_enable = temp;
+	if (temp && !i_dev->do_enable) {
+		i_dev->idle = 0;
+		i_dev->still = 0;
+		i_dev->do_enable = temp;
+		hrtimer_start(&i_dev->input_timer, sample_period(i_dev),
+				HRTIMER_MODE_REL);
+	} else
+		i_dev->do_enable = temp;
 	return(count);
 }
 
@@ -438,6 +598,85 @@ static ssize_t show_raw_phi(struct device *dev, struct device_attribute *attr,
 
 static DEVICE_ATTR(raw_phi, S_IRUSR|S_IRGRP|S_IROTH, show_raw_phi, NULL);
 
+static ssize_t show_batch(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
+	return sprintf(buf, "%d\n", i_dev->batch);
+}
+static ssize_t set_batch(struct device *dev, struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	int temp;
+	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
+	if(sscanf(buf, "%u", &temp) != 1)
+		return -EINVAL;
+	if (temp <= 0 || temp > INPUT_BATCH_MAX)
+		return -EINVAL;
+	i_dev->batch = temp;
+	return(count);
+}
+
+static DEVICE_ATTR(batch, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH, show_batch, set_batch);
+
+static ssize_t show_idle_rate(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
+	return sprintf(buf, "%d\n", i_dev->idle_rate);
+}
+static ssize_t set_idle_rate(struct device *dev, struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	int temp;
+	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
+	if(sscanf(buf, "%u", &temp) != 1)
+		return -EINVAL;
+	/* 0 samples at the full rate all the time */
+	if (temp < 0 || temp > INPUT_SAMPLING_MAX_HZ)
+		return -EINVAL;
+	i_dev->idle_rate = temp;
+	i_dev->still = 0;
+	if (!temp)
+		i_dev->idle = 0;
+	return(count);
+}
+
+static DEVICE_ATTR(idle_rate, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH, show_idle_rate, set_idle_rate);
+
+static ssize_t show_motion_threshold(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
+	return sprintf(buf, "%d\n", i_dev->motion_threshold);
+}
+static ssize_t set_motion_threshold(struct device *dev,
+			struct device_attribute *attr, const char *buf,
+			size_t count)
+{
+	int temp;
+	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
+	if(sscanf(buf, "%u", &temp) != 1)
+		return -EINVAL;
+	if (temp < 0)
+		return -EINVAL;
+	i_dev->motion_threshold = temp;
+	return(count);
+}
+
+static DEVICE_ATTR(motion_threshold, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH, show_motion_threshold, set_motion_threshold);
+
+static ssize_t show_stats(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct lf1000_aclmtr *i_dev = (struct lf1000_aclmtr *)dev->driver_data;
+	return sprintf(buf, "samples %u\nbatches %u\nidle %u\nerrors %u\n",
+		       i_dev->stat_samples, i_dev->stat_batches,
+		       i_dev->stat_idle, i_dev->stat_errors);
+}
+
+static DEVICE_ATTR(stats, S_IRUSR|S_IRGRP|S_IROTH, show_stats, NULL);
+
 static struct attribute *aclmtr_attributes[] = {
 	&dev_attr_tick.attr,
 	&dev_attr_rate.attr,
@@ -447,6 +686,10 @@ static struct attribute *aclmtr_attributes[] = {
 	&dev_attr_orient.attr,
 	&dev_attr_raw_xyz.attr,
 	&dev_attr_raw_phi.attr,
+	&dev_attr_batch.attr,
+	&dev_attr_idle_rate.attr,
+	&dev_attr_motion_threshold.attr,
+	&dev_attr_stats.attr,
 	NULL
 };
 
@@ -489,14 +732,16 @@ static int lf1000_aclmtr_probe(struct platform_device *pdev)
 	lf1000_aclmtr_dev->do_orient = 0;
 	lf1000_aclmtr_dev->do_tick = 0;
 	lf1000_aclmtr_dev->rate = INPUT_SAMPLING_HZ;
-	lf1000_aclmtr_dev->rate_jiffies = INPUT_SAMPLING_JIFFIES;
 	lf1000_aclmtr_dev->average = 1;
+	lf1000_aclmtr_dev->batch = 1;
+	lf1000_aclmtr_dev->idle_rate = INPUT_IDLE_HZ;
 	lf1000_aclmtr_dev->biasx = 0;
 	lf1000_aclmtr_dev->biasy = 0;
 	lf1000_aclmtr_dev->biasz = 0;
 	
 	/* event types that we support */
-	input_dev->evbit[0] = BIT(EV_KEY) | BIT(EV_ABS);
+	input_dev->evbit[0] = BIT(EV_KEY) | BIT(EV_ABS) | BIT(EV_MSC);
+	input_dev->mscbit[0] = BIT_MASK(MSC_TIMESTAMP);
 	input_dev->absbit[0] = BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) |
 		BIT_MASK(ABS_Z) | BIT_MASK(ABS_WHEEL) | BIT_MASK(ABS_MISC);
 	input_set_abs_params(input_dev, ABS_X, MIN_XYZ, MAX_XYZ, 0, 0);
@@ -521,14 +766,10 @@ static int lf1000_aclmtr_probe(struct platform_device *pdev)
 	INIT_WORK(&lf1000_aclmtr_dev->input_work, input_work_task);
 	g_dev = lf1000_aclmtr_dev;
 
-	/* create periodic input task */
-	setup_timer(&lf1000_aclmtr_dev->input_timer, input_monitor_task, (unsigned long)lf1000_aclmtr_dev);
-	lf1000_aclmtr_dev->input_timer.expires = get_jiffies_64() + 
-		lf1000_aclmtr_dev->rate_jiffies;
+	/* periodic input task, started by the "enable" attribute */
+	hrtimer_init(&lf1000_aclmtr_dev->input_timer, CLOCK_MONOTONIC,
+			HRTIMER_MODE_REL);
 	lf1000_aclmtr_dev->input_timer.function = input_monitor_task;
-	lf1000_aclmtr_dev->input_timer.data = (unsigned long)lf1000_aclmtr_dev;
-	add_timer(&lf1000_aclmtr_dev->input_timer);
-
 
 	sysfs_create_group(&pdev->dev.kobj, &aclmtr_attr_group);
 
@@ -548,7 +789,8 @@ static int lf1000_aclmtr_remove(struct platform_device *pdev)
 	struct lf1000_aclmtr *lf1000_aclmtr_dev = platform_get_drvdata(pdev);
 
 	sysfs_remove_group(&pdev->dev.kobj, &aclmtr_attr_group);
-	del_timer_sync(&lf1000_aclmtr_dev->input_timer);
+	lf1000_aclmtr_dev->do_enable = 0;
+	hrtimer_cancel(&lf1000_aclmtr_dev->input_timer);
 	destroy_workqueue(lf1000_aclmtr_dev->input_tasks);
 	input_unregister_device(lf1000_aclmtr_dev->input);
 	kfree(lf1000_aclmtr_dev);
@@ -30,6 +30,9 @@
 #include <linux/sysfs.h>
 
 #define TOUCHSCREEN_SAMPLING_J	HZ / 100  // sample touchscreen every 10 ms
+#define TOUCHSCREEN_IDLE_PROBE_J	HZ / 20	  // pen-down probe without IRQ
+
+#define TS_MAX_AVERAGING	8	// max ADC samples per reading
 
 #define TOUCHSCREEN_MAJOR	247
 
@@ -146,6 +149,9 @@ struct touch {
 	struct	work_struct       touchscreen_work;	// check touchscreen
 
 	int	stop_timer;	          // non-zero = stop timer reload
+	int	pen_irq;		  // non-zero = pen-down IRQ in use
+	int	pen_active;		  // non-zero = sampling, else idle
+	int	pen_wakeups;		  // idle to sampling transitions
 	int	sample_rate_in_jiffies;	  // screen sample rate
 	int	debounce_in_samples_down; // samples before stylus down declared
 	int	debounce_in_samples_up;   // samples before stylus up declared
@@ -265,6 +271,12 @@ struct touch {
 
 struct touch * t_dev = &touch_dev;
 
+/* touch sampling goes ahead of other ADC users such as battery monitoring */
+static struct adc_client ts_adc = {
+	.name		= "touchscreen",
+	.priority	= ADC_PRIORITY_HIGH,
+};
+
 /*
  * sysfs Interface
  */
@@ -445,7 +457,7 @@ static ssize_t set_averaging(struct device *dev, struct device_attribute *attr,
 	struct touch *lf1000_touch_dev = (struct touch *)dev->driver_data;
 	if(sscanf(buf, "%i", &temp) != 1)
 		return -EINVAL;
-	lf1000_touch_dev->averaging = temp;
+	lf1000_touch_dev->averaging = min(temp, TS_MAX_AVERAGING);
 	dev_dbg(dev, "%s.%s:%d averaging=%d\n", __FILE__, __FUNCTION__, 
 			__LINE__, lf1000_touch_dev->averaging);
 	return(count);
@@ -684,6 +696,17 @@ static DEVICE_ATTR(stylus_down_count, \
 	S_IRUSR|S_IRGRP|S_IROTH,
 	show_stylus_down_count, NULL);
 
+static ssize_t show_pen_wakeups(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct touch *lf1000_touch_dev = (struct touch *)dev->driver_data;
+	return sprintf(buf, "%d\n", lf1000_touch_dev->pen_wakeups);
+}
+
+static DEVICE_ATTR(pen_wakeups, \
+	S_IRUSR|S_IRGRP|S_IROTH,
+	show_pen_wakeups, NULL);
+
 static ssize_t show_min_x(struct device *dev, struct device_attribute *attr,
 			char *buf)
 {
@@ -992,6 +1015,7 @@ static struct attribute *touchscreen_attributes[] = {
 	&dev_attr_debounce_in_samples_down.attr,
 	&dev_attr_debounce_in_samples_up.attr,
 	&dev_attr_stylus_down_count.attr,
+	&dev_attr_pen_wakeups.attr,
 	&dev_attr_min_x.attr,
 	&dev_attr_max_x.attr,
 	&dev_attr_min_y.attr,
@@ -1013,7 +1037,6 @@ static struct attribute_group touchscreen_attr_group = {
 };
 
 
-#ifdef CONFIG_TOUCHSCREEN_LF1000_PRESSURE
 /* experimental version suggested by Rob (from Sam)
  * configure one sheet's terminals as inputs with pullup
  * configure the other sheet's terminals as outputs with level 0.
@@ -1037,13 +1060,15 @@ void set_read_tnt(void) // touch / no-touch
 	gpio_configure_pin(lf1000_l2p_port(TOUCHSCREEN_Y2),
 		                lf1000_l2p_pin(TOUCHSCREEN_Y2), GPIO_GPIOFN, 1, 0, 0);
 }
+
+#ifdef CONFIG_TOUCHSCREEN_LF1000_PRESSURE
 static void read_first_tnt(void)
 {
-	t_dev->adc_tnt1 = adc_GetReading(t_dev->first_adc);     // read X1 ADC
+	t_dev->adc_tnt1 = adc_GetClientReading(&ts_adc, t_dev->first_adc); // X1
 }
 static void read_second_tnt(void)
 {
-	t_dev->adc_tnt2 = adc_GetReading(t_dev->first_adc);     // read X1 ADC
+	t_dev->adc_tnt2 = adc_GetClientReading(&ts_adc, t_dev->first_adc); // X1
 }
 /* NOTE: there is no delay before the first reading of tnt1, because the gpios
  *       have been properly configured since tnt2 was read at the end of the
@@ -1156,6 +1181,50 @@ void set_read_y(void)
                 	    lf1000_l2p_pin(TOUCHSCREEN_X2), GPIO_GPIOFN, 1, 0, 0);
 }
 
+/*
+ * Average a batch of ADC samples.  With three or more samples the highest
+ * and lowest are dropped first, which gets rid of the odd conversion taken
+ * while the screen was still settling.
+ */
+static int ts_filter(const int *v, int n, int stride)
+{
+	int sum = 0, lo = INT_MAX, hi = INT_MIN, i;
+
+	for (i = 0; i < n; i++, v += stride) {
+		sum += *v;
+		lo = min(lo, *v);
+		hi = max(hi, *v);
+	}
+	if (n >= 3)
+		return (sum - lo - hi) / (n - 2);
+	return sum / n;
+}
+
+/*
+ * Read two ADC channels t_dev->averaging times each as one chained ADC
+ * sequence, and filter the batch down to one reading per channel.
+ */
+static void ts_read_pair(int ch1, int ch2, int *v1, int *v2)
+{
+	u8 ch[2*TS_MAX_AVERAGING];
+	int r[2*TS_MAX_AVERAGING];
+	int n = clamp(t_dev->averaging, 1, TS_MAX_AVERAGING);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ch[2*i] = ch1;
+		ch[2*i+1] = ch2;
+	}
+
+	if (adc_GetClientReadings(&ts_adc, ch, r, 2*n) < 0) {
+		*v1 = *v2 = 0;		// out of range, reads as stylus UP
+		return;
+	}
+
+	*v1 = ts_filter(&r[0], n, 2);
+	*v2 = ts_filter(&r[1], n, 2);
+}
+
 
 #ifdef CONFIG_TOUCHSCREEN_LF1000_PRESSURE
 /*
@@ -1219,22 +1288,8 @@ static int read_xy(void)
 	t_dev->adc_x2_pre[1] = adc_GetReading(t_dev->first_adc + 2); // read X2 ADC
 #endif
 	udelay(t_dev->delay_in_us);	// Let the screen settle and charge up
-	if (t_dev->averaging > 1)
-	{
-		int s1=0, s2=0, i;
-		for (i=0; i<t_dev->averaging; i++)
-		{
-			s1 += adc_GetReading(t_dev->first_adc);     // read X1 ADC
-			s2 += adc_GetReading(t_dev->first_adc + 2); // read X2 ADC
-		}
-		t_dev->adc_x  = s1 / t_dev->averaging;
-		t_dev->adc_x2 = s2 / t_dev->averaging;
-	}
-	else
-	{
-		t_dev->adc_x  = adc_GetReading(t_dev->first_adc);     // read X1 ADC
-		t_dev->adc_x2 = adc_GetReading(t_dev->first_adc + 2); // read X2 ADC
-	}
+	ts_read_pair(t_dev->first_adc, t_dev->first_adc + 2,	// X1, X2 ADC
+		     &t_dev->adc_x, &t_dev->adc_x2);
 
 	/*
 	 * read voltages for y
@@ -1249,23 +1304,8 @@ static int read_xy(void)
 	t_dev->adc_y2_pre[1] = adc_GetReading(t_dev->first_adc + 3); // read Y2 ADC
 #endif
 	udelay(t_dev->delay_in_us);	// Let the screen settle and charge up
-	if (t_dev->averaging > 1)
-	{
-		int s1=0, s2=0, i;
-		for (i=0; i<t_dev->averaging; i++)
-		{
-			s1 += adc_GetReading(t_dev->first_adc + 1); // read Y1 ADC
-			s2 += adc_GetReading(t_dev->first_adc + 3); // read Y2 ADC
-
-		}
-		t_dev->adc_y  = s1 / t_dev->averaging;
-		t_dev->adc_y2 = s2 / t_dev->averaging;
-	}
-	else
-	{
-		t_dev->adc_y  = adc_GetReading(t_dev->first_adc + 1); // read Y1 ADC
-		t_dev->adc_y2 = adc_GetReading(t_dev->first_adc + 3); // read Y2 ADC
-	}
+	ts_read_pair(t_dev->first_adc + 1, t_dev->first_adc + 3, // Y1, Y2 ADC
+		     &t_dev->adc_y, &t_dev->adc_y2);
 
 #ifdef READ_Z1Z2_PRESSURE
 	/*
@@ -1281,22 +1321,8 @@ static int read_xy(void)
 	t_dev->adc_p2_pre[1]  = adc_GetReading(t_dev->first_adc + 1); // read Y1 ADC
 	udelay(t_dev->delay_in_us);
 #endif
-	if (t_dev->averaging > 1)
-	{
-		int s1=0, s2=0, i;
-		for (i=0; i<t_dev->averaging; i++)
-		{
-			s1 += adc_GetReading(t_dev->first_adc+2);       // read X2 ADC
-			s2 += adc_GetReading(t_dev->first_adc+1);       // read Y1 ADC
-		}
-		t_dev->adc_p1 = s1 / t_dev->averaging;
-		t_dev->adc_p2 = s2 / t_dev->averaging;
-	}
-	else
-	{
-		t_dev->adc_p1 = adc_GetReading(t_dev->first_adc+2);       // read X2 ADC
-		t_dev->adc_p2 = adc_GetReading(t_dev->first_adc+1);       // read Y1 ADC
-	}
+	ts_read_pair(t_dev->first_adc + 2, t_dev->first_adc + 1, // X2, Y1 ADC
+		     &t_dev->adc_p1, &t_dev->adc_p2);
 #endif
 
     /* second touch/no-touch reading */
@@ -1338,12 +1364,12 @@ static int read_xy(void)
 	 */
 	set_read_x();			// set GPIO pins to read X value
 	udelay(t_dev->delay_in_us);	// Let the screen settle and charge up
-	t_dev->adc_x  = adc_GetReading(t_dev->first_adc);     // read X ADC
-	t_dev->adc_x2 = adc_GetReading(t_dev->first_adc + 2); // read X ADC
+	ts_read_pair(t_dev->first_adc, t_dev->first_adc + 2,	// read X ADC
+		     &t_dev->adc_x, &t_dev->adc_x2);
 	set_read_y();			// set GPIO pins to read Y value
 	udelay(t_dev->delay_in_us);	// Let the screen settle and charge up
-	t_dev->adc_y  = adc_GetReading(t_dev->first_adc + 1); // read Y ADC
-	t_dev->adc_y2 = adc_GetReading(t_dev->first_adc + 3); // read Y ADC
+	ts_read_pair(t_dev->first_adc + 1, t_dev->first_adc + 3, // read Y ADC
+		     &t_dev->adc_y, &t_dev->adc_y2);
 
 	/* check for valid point */
 	if (t_dev->adc_x  < t_dev->min_x || t_dev->max_x < t_dev->adc_x  ||
@@ -1369,12 +1395,12 @@ static int read_yx(void)
 	 */
 	set_read_y();			// set GPIO pins to read Y value
 	udelay(t_dev->delay_in_us);	// Let the screen settle and charge up
-	t_dev->adc_y  = adc_GetReading(t_dev->first_adc + 1); // read Y ADC
-	t_dev->adc_y2 = adc_GetReading(t_dev->first_adc + 3); // read Y ADC
+	ts_read_pair(t_dev->first_adc + 1, t_dev->first_adc + 3, // read Y ADC
+		     &t_dev->adc_y, &t_dev->adc_y2);
 	set_read_x();			// set GPIO pins to read X value
 	udelay(t_dev->delay_in_us);	// Let the screen settle and charge up
-	t_dev->adc_x  = adc_GetReading(t_dev->first_adc);     // read X ADC
-	t_dev->adc_x2 = adc_GetReading(t_dev->first_adc + 2); // read X ADC
+	ts_read_pair(t_dev->first_adc, t_dev->first_adc + 2,	// read X ADC
+		     &t_dev->adc_x, &t_dev->adc_x2);
 
 	/* check for valid point */
 	if (t_dev->adc_x  < t_dev->min_x || t_dev->max_x < t_dev->adc_x  ||
@@ -1386,6 +1412,73 @@ static int read_yx(void)
 	return 1;			// stylus DOWN
 }
 
+/*
+ * Pen-down detection.  While idle the screen is left in the touch/no-touch
+ * configuration: X1 is pulled up and the Y sheet is driven low, so a touch
+ * pulls X1 low.  That edge wakes the sampling pipeline from the GPIO
+ * interrupt, or from a cheap GPIO probe on boards where the interrupt
+ * can't be had.  No ADC conversions are done while idle.
+ */
+static int ts_pen_down(void)
+{
+	return !gpio_get_val(lf1000_l2p_port(TOUCHSCREEN_X1),
+			     lf1000_l2p_pin(TOUCHSCREEN_X1));
+}
+
+/* start sampling, called from IRQ, timer or work context */
+static void ts_wake(void)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	if (t_dev->pen_irq)
+		gpio_set_int(lf1000_l2p_port(TOUCHSCREEN_X1),
+			     lf1000_l2p_pin(TOUCHSCREEN_X1), 0);
+	if (!t_dev->pen_active && !t_dev->stop_timer) {
+		t_dev->pen_active = 1;
+		t_dev->pen_wakeups++;
+		queue_work(t_dev->touchscreen_tasks, &t_dev->touchscreen_work);
+		mod_timer(&t_dev->touchscreen_timer,
+			  jiffies + t_dev->sample_rate_in_jiffies);
+	}
+	local_irq_restore(flags);
+}
+
+/* stop sampling once the stylus is up, and wait for the next pen-down */
+static void ts_go_idle(void)
+{
+	unsigned long flags;
+
+	set_read_tnt();
+	udelay(t_dev->delay_in_us);	// Let the screen settle and charge up
+
+	local_irq_save(flags);
+	t_dev->pen_active = 0;
+	if (t_dev->pen_irq) {
+		gpio_clear_pend(lf1000_l2p_port(TOUCHSCREEN_X1),
+				lf1000_l2p_pin(TOUCHSCREEN_X1));
+		gpio_set_int(lf1000_l2p_port(TOUCHSCREEN_X1),
+			     lf1000_l2p_pin(TOUCHSCREEN_X1), 1);
+	}
+	local_irq_restore(flags);
+
+	/* don't miss a touch that landed before the interrupt was armed */
+	if (t_dev->pen_irq && ts_pen_down())
+		ts_wake();
+}
+
+static irqreturn_t ts_pen_irq(enum gpio_port port, enum gpio_pin pin,
+			      void *priv)
+{
+	if (!gpio_get_pend(port, pin))
+		return IRQ_NONE;
+
+	gpio_set_int(port, pin, 0);
+	gpio_clear_pend(port, pin);
+	ts_wake();
+	return IRQ_HANDLED;
+}
+
 
 #ifdef CONFIG_TOUCHSCREEN_LF1000_PRESSURE
 
@@ -1910,6 +2003,9 @@ static void get_touch(struct work_struct *work)
 		       t_dev->adc_pressure);
 
 	}
+
+	if (t_dev->ts_state == TSTATE_UP && t_dev->touch_button == RXY_UP)
+		ts_go_idle();
 }
 #else
 
@@ -2005,22 +2101,37 @@ static void get_touch(struct work_struct *work)
 
 	if (report_events & 1<<0)	/* report sync */
 		input_sync(t_dev->i_dev);
-	
+
+	if (0 == t_dev->stylus_down_count)
+		ts_go_idle();
 }
 #endif /*CONFIG_TOUCHSCREEN_LF1000_PRESSURE */
 
 
 
+/*
+ * Sampling clock.  Runs every sample period while the stylus is down.  When
+ * idle it stops if the pen-down IRQ is in use, and otherwise just probes the
+ * pen-down GPIO at a low rate.
+ */
 void touchscreen_monitor_task(unsigned long data)
 {
 	struct touch *t_dev = (struct touch *)data;
 
-	if (!t_dev->stop_timer) {	// not stopping, reload timer
+	if (t_dev->stop_timer)		// stopping, don't reload timer
+		return;
+
+	if (t_dev->pen_active) {
 		queue_work(t_dev->touchscreen_tasks, &t_dev->touchscreen_work);
-		t_dev->touchscreen_timer.expires += t_dev->sample_rate_in_jiffies;
-		t_dev->touchscreen_timer.function = touchscreen_monitor_task;
-		t_dev->touchscreen_timer.data = data;
-		add_timer(&t_dev->touchscreen_timer);
+		mod_timer(&t_dev->touchscreen_timer,
+			  t_dev->touchscreen_timer.expires +
+			  t_dev->sample_rate_in_jiffies);
+	} else if (!t_dev->pen_irq) {
+		if (ts_pen_down())
+			ts_wake();
+		else
+			mod_timer(&t_dev->touchscreen_timer,
+				  jiffies + TOUCHSCREEN_IDLE_PROBE_J);
 	}
 }
 
@@ -2127,6 +2238,8 @@ static int lf1000_ts_probe(struct platform_device *pdev)
 	if(error)
 		goto err_free_devs;
 
+	adc_RegisterClient(&ts_adc);
+
 	/* setup work queue */
 	t_dev->touchscreen_tasks = create_singlethread_workqueue("touchscreen"
 								 " tasks");
@@ -2167,10 +2280,24 @@ static int lf1000_ts_probe(struct platform_device *pdev)
 #endif /*CONFIG_TOUCHSCREEN_LF1000_PRESSURE */
 	setup_timer(&t_dev->touchscreen_timer, touchscreen_monitor_task,
 		    (unsigned long)t_dev);
-	t_dev->touchscreen_timer.expires = get_jiffies_64()
-		                                + t_dev->sample_rate_in_jiffies;
 
-	add_timer(&t_dev->touchscreen_timer);	/*run*/
+	/* wake up on pen-down, falling back to probing for it */
+	if (gpio_request_irq(lf1000_l2p_port(TOUCHSCREEN_X1),
+			     lf1000_l2p_pin(TOUCHSCREEN_X1),
+			     ts_pen_irq, t_dev) == 0) {
+		gpio_set_int_mode(lf1000_l2p_port(TOUCHSCREEN_X1),
+				  lf1000_l2p_pin(TOUCHSCREEN_X1),
+				  GPIO_IMODE_FALLING_EDGE);
+		t_dev->pen_irq = 1;
+	} else {
+		dev_info(&t_dev->i_dev->dev, "no pen-down IRQ, probing\n");
+		t_dev->pen_irq = 0;
+	}
+
+	ts_go_idle();				/*run*/
+	if (!t_dev->pen_irq)
+		mod_timer(&t_dev->touchscreen_timer,
+			  jiffies + TOUCHSCREEN_IDLE_PROBE_J);
 
 	sysfs_create_group(&pdev->dev.kobj, &touchscreen_attr_group);
 #ifdef CONFIG_TOUCHSCREEN_LF1000_PRESSURE
@@ -2201,6 +2328,14 @@ static int lf1000_ts_remove(struct platform_device *pdev)
 	}
 
 	destroy_workqueue(t_dev->touchscreen_tasks);
+	adc_UnregisterClient(&ts_adc);
+
+	if (t_dev->pen_irq) {
+		gpio_set_int(lf1000_l2p_port(TOUCHSCREEN_X1),
+			     lf1000_l2p_pin(TOUCHSCREEN_X1), 0);
+		gpio_free_irq(lf1000_l2p_port(TOUCHSCREEN_X1),
+			      lf1000_l2p_pin(TOUCHSCREEN_X1), ts_pen_irq);
+	}
 
 	sysfs_remove_group(&pdev->dev.kobj, &touchscreen_attr_group);
 
@@ -17,19 +17,71 @@
 #include <linux/cdev.h>
 #include <linux/types.h>
 #include <linux/platform_device.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hrtimer.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 
 #include <mach/platform.h>
+#include <mach/fence.h>
+#include <linux/lf1000/ga3d_ioctl.h>
 
 #define GA3D_MAJOR 	249	
 
+#define GA3D_MAX_QUEUED		16		/* lists waiting to run */
+#define GA3D_TIMEOUT		(HZ/2)		/* per list */
+#define GA3D_SPINS		100		/* busy polls before sleeping */
+#define GA3D_POLL_NS		(50 * NSEC_PER_USEC)	/* then between polls */
+#define GA3D_FAILED		16		/* failed lists remembered */
+
+/* A submitted command list, copied out of the caller. */
+struct ga3d_list {
+	struct list_head list;
+	u32 fence;
+	unsigned int count;
+	struct ga3d_cmd cmds[0];
+};
+
+struct ga3d_stats {
+	u32 lists;
+	u32 cmds;
+	u32 irqs;
+	u32 timeouts;
+	u32 errors;
+	u32 max_queued;
+};
+
 struct ga3d_device {
 	void __iomem *mem;
 	struct cdev *cdev;
 	dev_t dev;
 	int major;
 	struct proc_dir_entry *proc;
+
+	struct device *device;
+	unsigned long size;
+	int irq;
+	bool irq_armed;
+	struct completion irq_done;
+
+	spinlock_t lock;		/* queue, fences and irq_armed */
+	struct list_head queue;		/* head is the list being run */
+	unsigned int queued;
+	u32 failed[GA3D_FAILED];	/* fences of the last failed lists */
+	unsigned int failed_next;
+	wait_queue_head_t space_wait;
+	struct workqueue_struct *wq;
+	struct work_struct work;
+
+	struct dentry *debug;
+	struct ga3d_stats stats;
 };
 
 /* device private data */
@@ -37,6 +89,285 @@ static struct ga3d_device ga3d = {
 	.mem = NULL,
 	.cdev = NULL,
 	.major = GA3D_MAJOR,
+	.irq = -1,
+};
+
+/* per open file */
+struct ga3d_client {
+	u32 last_fence;			/* last list submitted */
+};
+
+/***********************
+ * command list engine *
+ ***********************/
+
+/*
+ * The engine interrupt is kept disabled unless a list is sleeping on it, so
+ * that userspace still driving the registers through mmap() is not
+ * disturbed, and so that a source we do not know how to clear cannot storm.
+ */
+static irqreturn_t ga3d_irq(int irq, void *dev_id)
+{
+	spin_lock(&ga3d.lock);
+	if (ga3d.irq_armed) {
+		ga3d.irq_armed = false;
+		disable_irq_nosync(irq);
+	}
+	ga3d.stats.irqs++;
+	spin_unlock(&ga3d.lock);
+
+	complete(&ga3d.irq_done);
+	return IRQ_HANDLED;
+}
+
+static void ga3d_irq_disarm(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ga3d.lock, flags);
+	if (ga3d.irq_armed) {
+		ga3d.irq_armed = false;
+		disable_irq_nosync(ga3d.irq);
+	}
+	spin_unlock_irqrestore(&ga3d.lock, flags);
+}
+
+/* Engine waits are usually short, so after a few busy polls sleep on a high
+ * resolution timer rather than for a whole jiffy. */
+static int ga3d_poll_reg(void __iomem *reg, u32 mask, u32 value,
+		unsigned long deadline)
+{
+	int spins = 0;
+	ktime_t t;
+
+	while ((readl(reg) & mask) != value) {
+		if (time_after(jiffies, deadline))
+			return -ETIMEDOUT;
+		if (++spins < GA3D_SPINS) {
+			cpu_relax();
+		} else {
+			t = ktime_set(0, GA3D_POLL_NS);
+			set_current_state(TASK_UNINTERRUPTIBLE);
+			schedule_hrtimeout_range(&t, GA3D_POLL_NS,
+					HRTIMER_MODE_REL);
+		}
+	}
+	return 0;
+}
+
+static int ga3d_wait_irq(void __iomem *reg, u32 mask, unsigned long deadline)
+{
+	long left;
+
+	if (ga3d.irq < 0)
+		return ga3d_poll_reg(reg, mask, mask, deadline);
+
+	while (!(readl(reg) & mask)) {
+		left = deadline - jiffies;
+		if (left <= 0)
+			return -ETIMEDOUT;
+
+		INIT_COMPLETION(ga3d.irq_done);
+		spin_lock_irq(&ga3d.lock);
+		ga3d.irq_armed = true;
+		enable_irq(ga3d.irq);
+		spin_unlock_irq(&ga3d.lock);
+
+		if (!wait_for_completion_timeout(&ga3d.irq_done, left)) {
+			ga3d_irq_disarm();
+			if (!(readl(reg) & mask))
+				return -ETIMEDOUT;
+		}
+	}
+	ga3d_irq_disarm();
+	return 0;
+}
+
+static int ga3d_run_list(struct ga3d_list *l)
+{
+	unsigned long deadline = jiffies + GA3D_TIMEOUT;
+	struct ga3d_cmd *c;
+	void __iomem *reg;
+	int i, ret = 0;
+
+	for (i = 0; i < l->count && !ret; i++) {
+		c = &l->cmds[i];
+		reg = ga3d.mem + (c->op & GA3D_OP_REG_MASK);
+
+		switch (c->op & ~GA3D_OP_REG_MASK) {
+		case GA3D_OP_WRITE:
+			writel(c->value, reg);
+			break;
+		case GA3D_OP_WRITE_MASKED:
+			writel((readl(reg) & ~c->mask) | c->value, reg);
+			break;
+		case GA3D_OP_WAIT:
+			ret = ga3d_poll_reg(reg, c->mask, c->value, deadline);
+			break;
+		case GA3D_OP_WAIT_IRQ:
+			ret = ga3d_wait_irq(reg, c->mask, deadline);
+			if (!ret)
+				writel(c->mask, reg);
+			break;
+		}
+	}
+
+	if (ret)
+		dev_dbg(ga3d.device, "list %u failed at %d: %d\n",
+				l->fence, i - 1, ret);
+	return ret;
+}
+
+/* Run queued lists in order, signalling each fence as its list retires. */
+static void ga3d_work(struct work_struct *work)
+{
+	struct ga3d_list *l;
+	unsigned long flags;
+	int ret;
+
+	for (;;) {
+		spin_lock_irqsave(&ga3d.lock, flags);
+		if (list_empty(&ga3d.queue)) {
+			spin_unlock_irqrestore(&ga3d.lock, flags);
+			break;
+		}
+		l = list_first_entry(&ga3d.queue, struct ga3d_list, list);
+		spin_unlock_irqrestore(&ga3d.lock, flags);
+
+		ret = ga3d_run_list(l);
+
+		spin_lock_irqsave(&ga3d.lock, flags);
+		list_del(&l->list);
+		ga3d.queued--;
+		ga3d.stats.lists++;
+		ga3d.stats.cmds += l->count;
+		if (ret) {
+			ga3d.failed[ga3d.failed_next] = l->fence;
+			ga3d.failed_next = (ga3d.failed_next + 1) % GA3D_FAILED;
+			if (ret == -ETIMEDOUT)
+				ga3d.stats.timeouts++;
+			else
+				ga3d.stats.errors++;
+		}
+		spin_unlock_irqrestore(&ga3d.lock, flags);
+
+		lf1000_fence_signal(l->fence);
+		wake_up_interruptible(&ga3d.space_wait);
+		kfree(l);
+	}
+}
+
+static int ga3d_check_cmd(struct ga3d_cmd *c)
+{
+	u32 reg = c->op & GA3D_OP_REG_MASK;
+
+	if (reg >= ga3d.size || (reg & 3))
+		return -EINVAL;
+	if ((c->op & ~GA3D_OP_REG_MASK) > GA3D_OP_WAIT_IRQ)
+		return -EINVAL;
+	return 0;
+}
+
+static int ga3d_submit(struct ga3d_client *client, struct ga3d_submit *sub,
+		bool nonblock)
+{
+	struct ga3d_list *l;
+	unsigned long flags;
+	int i, ret;
+
+	if (sub->count == 0 || sub->count > GA3D_MAX_CMDS)
+		return -EINVAL;
+
+	l = kmalloc(sizeof(*l) + sub->count * sizeof(struct ga3d_cmd),
+			GFP_KERNEL);
+	if (!l)
+		return -ENOMEM;
+	l->count = sub->count;
+	if (copy_from_user(l->cmds, (void __user *)sub->cmds,
+				sub->count * sizeof(struct ga3d_cmd))) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+	for (i = 0; i < l->count; i++) {
+		ret = ga3d_check_cmd(&l->cmds[i]);
+		if (ret)
+			goto out_free;
+	}
+
+	spin_lock_irqsave(&ga3d.lock, flags);
+	while (ga3d.queued >= GA3D_MAX_QUEUED) {
+		spin_unlock_irqrestore(&ga3d.lock, flags);
+		if (nonblock) {
+			ret = -EAGAIN;
+			goto out_free;
+		}
+		ret = wait_event_interruptible(ga3d.space_wait,
+				ga3d.queued < GA3D_MAX_QUEUED);
+		if (ret)
+			goto out_free;
+		spin_lock_irqsave(&ga3d.lock, flags);
+	}
+
+	l->fence = sub->fence = client->last_fence = lf1000_fence_issue();
+	list_add_tail(&l->list, &ga3d.queue);
+	if (++ga3d.queued > ga3d.stats.max_queued)
+		ga3d.stats.max_queued = ga3d.queued;
+	spin_unlock_irqrestore(&ga3d.lock, flags);
+
+	queue_work(ga3d.wq, &ga3d.work);
+	return 0;
+
+out_free:
+	kfree(l);
+	return ret;
+}
+
+static int ga3d_wait(struct ga3d_wait *w)
+{
+	unsigned long flags;
+	int i, ret;
+
+	if (!lf1000_fence_valid(w->fence))
+		return -EINVAL;
+	ret = lf1000_fence_wait(w->fence, msecs_to_jiffies(w->timeout_ms));
+	if (ret || !w->fence)
+		return ret;
+
+	spin_lock_irqsave(&ga3d.lock, flags);
+	for (i = 0; i < GA3D_FAILED; i++)
+		if (ga3d.failed[i] == w->fence)
+			ret = -EIO;
+	spin_unlock_irqrestore(&ga3d.lock, flags);
+	return ret;
+}
+
+static int ga3d_show_stats(struct seq_file *s, void *v)
+{
+	struct ga3d_stats *st = &ga3d.stats;
+
+	seq_printf(s, "lists:\t\t%u\n", st->lists);
+	seq_printf(s, "cmds:\t\t%u\n", st->cmds);
+	seq_printf(s, "irqs:\t\t%u\n", st->irqs);
+	seq_printf(s, "timeouts:\t%u\n", st->timeouts);
+	seq_printf(s, "errors:\t\t%u\n", st->errors);
+	seq_printf(s, "queued:\t\t%u\n", ga3d.queued);
+	seq_printf(s, "max_queued:\t%u\n", st->max_queued);
+	seq_printf(s, "fence:\t\t%u/%u\n", lf1000_fence_last(),
+			lf1000_fence_issued());
+	return 0;
+}
+
+static int lf1000_ga3d_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ga3d_show_stats, inode->i_private);
+}
+
+static const struct file_operations lf1000_ga3d_stats_fops = {
+	.owner          = THIS_MODULE,
+	.open           = lf1000_ga3d_stats_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
 };
 
 /*******************************
@@ -45,6 +376,60 @@ static struct ga3d_device ga3d = {
 
 static int ga3d_open(struct inode *inode, struct file *filp)
 {
+	struct ga3d_client *client;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+	filp->private_data = client;
+	return 0;
+}
+
+static int ga3d_release(struct inode *inode, struct file *filp)
+{
+	kfree(filp->private_data);
+	return 0;
+}
+
+static int ga3d_ioctl(struct inode *inode, struct file *filp,
+		unsigned int cmd, unsigned long arg)
+{
+	struct ga3d_client *client = filp->private_data;
+	void __user *argp = (void __user *)arg;
+	struct ga3d_submit sub;
+	struct ga3d_wait w;
+	int ret;
+
+	switch (cmd) {
+	case GA3D_IOCSUBMIT:
+		if (copy_from_user(&sub, argp, sizeof(sub)))
+			return -EFAULT;
+		ret = ga3d_submit(client, &sub, filp->f_flags & O_NONBLOCK);
+		if (ret)
+			return ret;
+		if (copy_to_user(argp, &sub, sizeof(sub)))
+			return -EFAULT;
+		return 0;
+
+	case GA3D_IOCWAIT:
+		if (copy_from_user(&w, argp, sizeof(w)))
+			return -EFAULT;
+		return ga3d_wait(&w);
+
+	case GA3D_IOCQFENCE:
+		return put_user(lf1000_fence_last(), (unsigned int __user *)argp);
+	}
+	return -ENOTTY;
+}
+
+/* readable once everything this file submitted has run */
+static unsigned int ga3d_poll(struct file *filp, poll_table *wait)
+{
+	struct ga3d_client *client = filp->private_data;
+
+	lf1000_fence_poll_wait(filp, wait);
+	if (lf1000_fence_done(client->last_fence))
+		return POLLIN | POLLRDNORM;
 	return 0;
 }
 
@@ -89,6 +474,9 @@ static int ga3d_mmap(struct file *filp, struct vm_area_struct *vma)
 static struct file_operations ga3d_fops = {
 	.owner = THIS_MODULE,
 	.open  = ga3d_open,
+	.release = ga3d_release,
+	.ioctl = ga3d_ioctl,
+	.poll = ga3d_poll,
 	.mmap = ga3d_mmap,
 };
 
@@ -119,6 +507,29 @@ static int lf1000_ga3d_probe(struct platform_device *pdev)
 		ret = -ENOMEM;
 		goto fail_remap;
 	}
+	ga3d.device = &pdev->dev;
+	ga3d.size = (res->end - res->start) + 1;
+
+	spin_lock_init(&ga3d.lock);
+	INIT_LIST_HEAD(&ga3d.queue);
+	init_waitqueue_head(&ga3d.space_wait);
+	init_completion(&ga3d.irq_done);
+	INIT_WORK(&ga3d.work, ga3d_work);
+	ga3d.wq = create_singlethread_workqueue("ga3d");
+	if (!ga3d.wq) {
+		ret = -ENOMEM;
+		goto fail_wq;
+	}
+
+	ga3d.irq = platform_get_irq(pdev, 0);
+	if (ga3d.irq >= 0) {
+		/* the line is marked IRQF_NOAUTOEN by the machine IRQ setup,
+		 * and only enabled while a wait has armed it */
+		if (request_irq(ga3d.irq, ga3d_irq, 0, "ga3d", &ga3d)) {
+			dev_err(&pdev->dev, "failed to get IRQ %d\n", ga3d.irq);
+			ga3d.irq = -1;
+		}
+	}
 
 	ret = register_chrdev(ga3d.major, "ga3d", &ga3d_fops);
 	if(ret < 0) {
@@ -136,11 +547,23 @@ static int lf1000_ga3d_probe(struct platform_device *pdev)
 		goto fail_add;
 	}
 
+	ga3d.debug = debugfs_create_dir("lf1000-ga3d", NULL);
+	if (!ga3d.debug || IS_ERR(ga3d.debug))
+		ga3d.debug = NULL;
+	else
+		debugfs_create_file("stats", S_IRUSR, ga3d.debug, &ga3d,
+				&lf1000_ga3d_stats_fops);
+
 	return 0;
 
 fail_add:
 	unregister_chrdev(ga3d.major, "ga3d");
 fail_dev:
+	if (ga3d.irq >= 0)
+		free_irq(ga3d.irq, &ga3d);
+	destroy_workqueue(ga3d.wq);
+fail_wq:
+	iounmap(ga3d.mem);
 fail_remap:
 	release_mem_region(res->start, (res->end - res->start) + 1);
 
@@ -151,9 +574,20 @@ static int lf1000_ga3d_remove(struct platform_device *pdev)
 {
 	struct resource *res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 
+	if (ga3d.debug) {
+		debugfs_remove_recursive(ga3d.debug);
+		ga3d.debug = NULL;
+	}
+
 	unregister_chrdev(ga3d.major, "ga3d");
 	if(ga3d.cdev != NULL)
 		cdev_del(ga3d.cdev);
+
+	/* no more submissions: let the queue drain */
+	flush_workqueue(ga3d.wq);
+	destroy_workqueue(ga3d.wq);
+	if (ga3d.irq >= 0)
+		free_irq(ga3d.irq, &ga3d);
 	
 	if(ga3d.mem != NULL)
 		iounmap(ga3d.mem);
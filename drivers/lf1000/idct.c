@@ -17,10 +17,16 @@
 #include <linux/platform_device.h>
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
+#include <linux/dma-mapping.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 
 #include <mach/platform.h>
+#include <linux/lf1000/idct_ioctl.h>
 
 /* Register offsets */
 #define IDCT_BUF_DATA           (0x00)
@@ -31,12 +37,60 @@
 
 #define IDCT_MAJOR      248
 
+#define IDCT_BLOCK_WORDS	(IDCT_BLOCK_SIZE / 4)
+#define IDCT_SLICE		32		/* blocks before giving way */
+#define IDCT_POLL_LOOPS		10000		/* per block */
+
+/*
+ * A client is one open file: it owns a write-combined ring of coefficient
+ * blocks that userspace fills through mmap() and the block transforms in
+ * place.  Batches from the same client are serialized by its lock.
+ */
+struct idct_client {
+	u32 *ring;
+	dma_addr_t ring_dma;
+	struct mutex lock;
+};
+
+struct idct_job {
+	struct idct_client *client;
+	unsigned int first;
+	unsigned int count;
+	unsigned int done;
+	u32 control;
+	u32 done_mask;
+};
+
+struct idct_stats {
+	unsigned long batches;
+	unsigned long blocks;
+	unsigned long timeouts;
+	u64 busy_us;
+};
+
+struct idct_bench {
+	unsigned int blocks;
+	s64 hw_us;
+	s64 sw_us;
+	int max_diff;
+	int status;
+};
+
 struct idct_device {
 	void __iomem *mem;
 	struct cdev *cdev;
 	dev_t dev;
 	int major;
 	struct dentry *debug;
+	struct device *device;
+
+	struct mutex lock;		/* owner of the block */
+
+	struct idct_stats stats;
+	struct mutex bench_lock;
+	struct idct_bench bench;
+	u32 bench_control;		/* CONTROL and INT_PEND values for */
+	u32 bench_done;			/* the benchmark, set in debugfs */
 };
 
 static struct idct_device idct = {
@@ -83,15 +137,399 @@ static const struct file_operations lf1000_idct_regs_fops = {
 	.release        = single_release,
 };
 
+/*******************
+ * batch submission *
+ *******************/
+
+static inline u32 *idct_block(struct idct_job *job)
+{
+	unsigned int n = (job->first + job->done) % IDCT_RING_BLOCKS;
+
+	return job->client->ring + n * IDCT_BLOCK_WORDS;
+}
+
+/* load the job's next block into BUF_DATA and start it */
+static void idct_load(struct idct_job *job)
+{
+	u32 *blk = idct_block(job);
+	int i;
+
+	for (i = 0; i < IDCT_BLOCK_WORDS; i++)
+		writel(blk[i], idct.mem + IDCT_BUF_DATA + (i << 2));
+	writel(job->control, idct.mem + IDCT_CONTROL);
+}
+
+/* copy the finished block back over its coefficients */
+static void idct_unload(struct idct_job *job)
+{
+	u32 *blk = idct_block(job);
+	int i;
+
+	for (i = 0; i < IDCT_BLOCK_WORDS; i++)
+		blk[i] = readl(idct.mem + IDCT_BUF_DATA + (i << 2));
+	job->done++;
+}
+
+static int idct_wait_done(u32 mask)
+{
+	int i;
+
+	for (i = 0; i < IDCT_POLL_LOOPS; i++) {
+		if (readl(idct.mem + IDCT_INT_PEND) & mask) {
+			writel(mask, idct.mem + IDCT_INT_PEND);
+			return 0;
+		}
+		cpu_relax();
+	}
+	return -ETIMEDOUT;
+}
+
+/*
+ * No interrupt is described for the block, so the submitting task drives it
+ * and polls INT_PEND for each block, just as a decoder did through mmap().
+ * That saves a decoder the register mapping and a system call per block, not
+ * CPU time.  The block is given up every IDCT_SLICE blocks so that other
+ * clients waiting on the lock get their turn.
+ */
+static int idct_run(struct idct_job *job)
+{
+	int ret = 0;
+
+	mutex_lock(&idct.lock);
+	writel(job->done_mask, idct.mem + IDCT_INT_PEND);
+	while (job->done < job->count) {
+		idct_load(job);
+		ret = idct_wait_done(job->done_mask);
+		if (ret) {
+			idct.stats.timeouts++;
+			break;
+		}
+		idct_unload(job);
+
+		if (!(job->done % IDCT_SLICE) && job->done < job->count) {
+			mutex_unlock(&idct.lock);
+			cond_resched();
+			mutex_lock(&idct.lock);
+			writel(job->done_mask, idct.mem + IDCT_INT_PEND);
+		}
+	}
+	mutex_unlock(&idct.lock);
+
+	return ret;
+}
+
+static int idct_submit(struct idct_client *client, struct idct_batch *b)
+{
+	struct idct_job job;
+	ktime_t start;
+	int ret;
+
+	if (!client->ring)
+		return -EINVAL;
+	if (b->count == 0)
+		return 0;
+	if (b->first >= IDCT_RING_BLOCKS || b->count > IDCT_RING_BLOCKS ||
+			!b->done)
+		return -EINVAL;
+
+	memset(&job, 0, sizeof(job));
+	job.client = client;
+	job.first = b->first;
+	job.count = b->count;
+	job.control = b->control;
+	job.done_mask = b->done;
+
+	start = ktime_get();
+	ret = idct_run(&job);
+
+	idct.stats.batches++;
+	idct.stats.blocks += job.done;
+	idct.stats.busy_us += ktime_us_delta(ktime_get(), start);
+
+	if (ret)
+		dev_dbg(idct.device, "batch of %u stopped after %u: %d\n",
+				job.count, job.done, ret);
+	return ret;
+}
+
+static int idct_alloc_ring(struct idct_client *client)
+{
+	if (client->ring)
+		return 0;
+	client->ring = dma_alloc_writecombine(idct.device, IDCT_RING_SIZE,
+			&client->ring_dma, GFP_KERNEL);
+	return client->ring ? 0 : -ENOMEM;
+}
+
+static void idct_free_ring(struct idct_client *client)
+{
+	if (client->ring)
+		dma_free_writecombine(idct.device, IDCT_RING_SIZE,
+				client->ring, client->ring_dma);
+	client->ring = NULL;
+}
+
+/*************************************
+ * software reference and benchmark  *
+ *************************************/
+
+/* 4096 * cos(k * pi / 16), k = 0..8 */
+static const int idct_cos[9] = {
+	4096, 4017, 3784, 3406, 2896, 2276, 1567, 799, 0,
+};
+
+static int idct_m[8][8];
+
+/* 4096 * C(u) * cos((2x + 1) * u * pi / 16) */
+static int __init idct_coef(int x, int u)
+{
+	int k = ((2 * x + 1) * u) % 32;
+	int sign = 1;
+
+	if (u == 0)
+		return idct_cos[4];
+	if (k > 16)
+		k = 32 - k;
+	if (k > 8) {
+		k = 16 - k;
+		sign = -1;
+	}
+	return sign * idct_cos[k];
+}
+
+/*
+ * Plain separable 8x8 inverse DCT, two fixed point passes of a matrix
+ * product.  This is the straightforward reference rather than a fast
+ * factorization, so the comparison against it is a best case for the block.
+ */
+static void idct_soft(s16 *blk)
+{
+	int tmp[64];
+	int x, y, u;
+
+	for (y = 0; y < 8; y++)
+		for (x = 0; x < 8; x++) {
+			int sum = 0;
+
+			for (u = 0; u < 8; u++)
+				sum += idct_m[x][u] * blk[y * 8 + u];
+			tmp[y * 8 + x] = (sum + (1 << 10)) >> 11;
+		}
+
+	for (x = 0; x < 8; x++)
+		for (y = 0; y < 8; y++) {
+			int sum = 0;
+
+			for (u = 0; u < 8; u++)
+				sum += idct_m[y][u] * tmp[u * 8 + x];
+			blk[y * 8 + x] = (sum + (1 << 14)) >> 15;
+		}
+}
+
+/* sparse blocks, roughly what a video decoder hands over */
+static void idct_bench_fill(s16 *blk)
+{
+	int i;
+
+	memset(blk, 0, IDCT_BLOCK_SIZE);
+	blk[0] = (random32() & 0x7FF) - 1024;
+	for (i = 0; i < 4; i++)
+		blk[random32() & 63] += (int)(random32() & 0x7F) - 64;
+}
+
+static int idct_benchmark(unsigned int blocks)
+{
+	struct idct_client client;
+	struct idct_batch b;
+	s16 *src, *ref;
+	unsigned int done, n, i;
+	ktime_t start;
+	int ret = 0;
+
+	memset(&idct.bench, 0, sizeof(idct.bench));
+	if (!idct.bench_done) {
+		/* we don't know the block's bits: tell us what a decoder uses */
+		ret = -EINVAL;
+		goto out_status;
+	}
+	memset(&client, 0, sizeof(client));
+	mutex_init(&client.lock);
+
+	src = kmalloc(IDCT_RING_SIZE, GFP_KERNEL);
+	ref = kmalloc(IDCT_RING_SIZE, GFP_KERNEL);
+	if (!src || !ref || idct_alloc_ring(&client)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < IDCT_RING_BLOCKS; i++)
+		idct_bench_fill(src + i * 64);
+
+	for (done = 0; done < blocks && !ret; done += n) {
+		n = min_t(unsigned int, blocks - done, IDCT_RING_BLOCKS);
+
+		memcpy(client.ring, src, n * IDCT_BLOCK_SIZE);
+		b.first = 0;
+		b.count = n;
+		b.control = idct.bench_control;
+		b.done = idct.bench_done;
+		start = ktime_get();
+		ret = idct_submit(&client, &b);
+		idct.bench.hw_us += ktime_us_delta(ktime_get(), start);
+
+		memcpy(ref, src, n * IDCT_BLOCK_SIZE);
+		start = ktime_get();
+		for (i = 0; i < n; i++)
+			idct_soft(ref + i * 64);
+		idct.bench.sw_us += ktime_us_delta(ktime_get(), start);
+	}
+
+	/* agreement on the last batch, in case CONTROL was set up wrong */
+	if (!ret) {
+		s16 *hw = (s16 *)client.ring;
+
+		for (i = 0; i < n * 64; i++)
+			idct.bench.max_diff = max_t(int, idct.bench.max_diff,
+					abs(hw[i] - ref[i]));
+	}
+	idct.bench.blocks = done;
+
+out:
+	idct_free_ring(&client);
+	kfree(ref);
+	kfree(src);
+out_status:
+	idct.bench.status = ret;
+	return ret;
+}
+
+static int idct_show_stats(struct seq_file *s, void *v)
+{
+	struct idct_stats *st = &idct.stats;
+	u64 rate = 0;
+
+	if (st->busy_us) {
+		rate = (u64)st->blocks * USEC_PER_SEC;
+		do_div(rate, st->busy_us);
+	}
+
+	seq_printf(s, "batches:\t%lu\n", st->batches);
+	seq_printf(s, "blocks:\t\t%lu\n", st->blocks);
+	seq_printf(s, "timeouts:\t%lu\n", st->timeouts);
+	seq_printf(s, "busy_us:\t%llu\n", st->busy_us);
+	seq_printf(s, "blocks/s:\t%llu\n", rate);
+	return 0;
+}
+
+static int lf1000_idct_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, idct_show_stats, inode->i_private);
+}
+
+static const struct file_operations lf1000_idct_stats_fops = {
+	.owner          = THIS_MODULE,
+	.open           = lf1000_idct_stats_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+
+static int idct_show_bench(struct seq_file *s, void *v)
+{
+	struct idct_bench *b = &idct.bench;
+
+	mutex_lock(&idct.bench_lock);
+	seq_printf(s, "blocks:\t\t%u\n", b->blocks);
+	seq_printf(s, "status:\t\t%d\n", b->status);
+	seq_printf(s, "hw_us:\t\t%lld\n", b->hw_us);
+	seq_printf(s, "sw_us:\t\t%lld\n", b->sw_us);
+	seq_printf(s, "max_diff:\t%d\n", b->max_diff);
+	mutex_unlock(&idct.bench_lock);
+	return 0;
+}
+
+static int lf1000_idct_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, idct_show_bench, inode->i_private);
+}
+
+/* write the number of blocks to run through both implementations */
+static ssize_t lf1000_idct_bench_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	char tmp[16];
+	unsigned long blocks;
+	int ret;
+
+	if (count >= sizeof(tmp))
+		return -EINVAL;
+	if (copy_from_user(tmp, buf, count))
+		return -EFAULT;
+	tmp[count] = '\0';
+	if (strict_strtoul(strstrip(tmp), 0, &blocks) || blocks == 0 ||
+			blocks > 1000000)
+		return -EINVAL;
+
+	mutex_lock(&idct.bench_lock);
+	ret = idct_benchmark(blocks);
+	mutex_unlock(&idct.bench_lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations lf1000_idct_bench_fops = {
+	.owner          = THIS_MODULE,
+	.open           = lf1000_idct_bench_open,
+	.read           = seq_read,
+	.write          = lf1000_idct_bench_write,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+
 /*******************************
  * character device operations *
  *******************************/
 
 static int idct_open(struct inode *inode, struct file *filp)
 {
+	struct idct_client *client;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+	mutex_init(&client->lock);
+	filp->private_data = client;
 	return 0;
 }
 
+static int idct_release(struct inode *inode, struct file *filp)
+{
+	struct idct_client *client = filp->private_data;
+
+	idct_free_ring(client);
+	kfree(client);
+	return 0;
+}
+
+static int idct_ioctl(struct inode *inode, struct file *filp,
+		unsigned int cmd, unsigned long arg)
+{
+	struct idct_client *client = filp->private_data;
+	struct idct_batch b;
+	int ret;
+
+	switch (cmd) {
+	case IDCT_IOCSBATCH:
+		if (copy_from_user(&b, (void __user *)arg, sizeof(b)))
+			return -EFAULT;
+		mutex_lock(&client->lock);
+		ret = idct_submit(client, &b);
+		mutex_unlock(&client->lock);
+		return ret;
+	}
+	return -ENOTTY;
+}
+
 static void idct_vma_open(struct vm_area_struct *vma)
 {
 }
@@ -105,9 +543,32 @@ static struct vm_operations_struct idct_vm_ops = {
 	.close = idct_vma_close,
 };
 
+/* the client's block ring, mapped write-combined like the kernel side */
+static int idct_mmap_ring(struct idct_client *client,
+		struct vm_area_struct *vma)
+{
+	int ret;
+
+	if (vma->vm_end - vma->vm_start > IDCT_RING_SIZE)
+		return -EINVAL;
+
+	mutex_lock(&client->lock);
+	ret = idct_alloc_ring(client);
+	mutex_unlock(&client->lock);
+	if (ret)
+		return ret;
+
+	vma->vm_pgoff = 0;
+	return dma_mmap_writecombine(idct.device, vma, client->ring,
+			client->ring_dma, vma->vm_end - vma->vm_start);
+}
+
 static int idct_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	int ret;
+
+	if (vma->vm_pgoff == (IDCT_RING_OFFSET >> PAGE_SHIFT))
+		return idct_mmap_ring(filp->private_data, vma);
 	
 	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
 	vma->vm_ops = &idct_vm_ops;
@@ -128,6 +589,8 @@ static int idct_mmap(struct file *filp, struct vm_area_struct *vma)
 static struct file_operations idct_fops = {
 	.owner = THIS_MODULE,
 	.open  = idct_open,
+	.release = idct_release,
+	.ioctl = idct_ioctl,
 	.mmap = idct_mmap,
 };
 
@@ -159,6 +622,10 @@ static int lf1000_idct_probe(struct platform_device *pdev)
 		goto fail_remap;
 	}
 
+	idct.device = &pdev->dev;
+	mutex_init(&idct.lock);
+	mutex_init(&idct.bench_lock);
+
 	ret = register_chrdev(idct.major, "idct", &idct_fops);
 	if(ret < 0) {
 		dev_err(&pdev->dev, "failed to get a device\n");
@@ -178,15 +645,25 @@ static int lf1000_idct_probe(struct platform_device *pdev)
 	idct.debug = debugfs_create_dir("lf1000-idct", NULL);
 	if (!idct.debug || IS_ERR(idct.debug))
 		idct.debug = NULL;
-	else
+	else {
 		debugfs_create_file("registers", S_IRUSR, idct.debug, &idct,
 				&lf1000_idct_regs_fops);
+		debugfs_create_file("stats", S_IRUSR, idct.debug, &idct,
+				&lf1000_idct_stats_fops);
+		debugfs_create_file("benchmark", S_IRUSR|S_IWUSR, idct.debug,
+				&idct, &lf1000_idct_bench_fops);
+		debugfs_create_x32("bench_control", S_IRUSR|S_IWUSR,
+				idct.debug, &idct.bench_control);
+		debugfs_create_x32("bench_done", S_IRUSR|S_IWUSR,
+				idct.debug, &idct.bench_done);
+	}
 
 	return 0;
 
 fail_add:
 	unregister_chrdev(idct.major, "idct");
 fail_dev:
+	iounmap(idct.mem);
 fail_remap:
 	release_mem_region(res->start, (res->end - res->start) + 1);
 
@@ -205,7 +682,7 @@ static int lf1000_idct_remove(struct platform_device *pdev)
 	unregister_chrdev(idct.major, "idct");
 	if(idct.cdev != NULL)
 		cdev_del(idct.cdev);
-	
+
 	if(idct.mem != NULL)
 		iounmap(idct.mem);
 
@@ -225,6 +702,12 @@ static struct platform_driver lf1000_idct_driver = {
 
 static int __init idct_init(void)
 {
+	int x, u;
+
+	for (x = 0; x < 8; x++)
+		for (u = 0; u < 8; u++)
+			idct_m[x][u] = idct_coef(x, u);
+
 	return platform_driver_register(&lf1000_idct_driver);
 }
 
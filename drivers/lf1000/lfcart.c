@@ -12,12 +12,13 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/device.h>
-#include <linux/kthread.h>
-#include <linux/delay.h>
+#include <linux/workqueue.h>
 #include <linux/debugfs.h>
 #include <mach/gpio.h>
 #include <mach/nand.h> /* TODO: move defs out */
 
+#define LFCART_SAMPLE_J	msecs_to_jiffies(60)
+
 enum lfcart_state {
 	LFCART_IDLE,
 	LFCART_INSERTING,
@@ -30,8 +31,9 @@ struct lfcart_priv {
 	struct device		cartridge;
 	enum lfcart_state	state;
 	unsigned		debounce, debounce_level;
-	struct task_struct 	*detect_thread;
-	struct semaphore	detect_thread_done;
+	bool			irq;
+	struct delayed_work	detect;
+	u32			wakeups;
 
 	struct dentry		*debug;
 };
@@ -74,62 +76,93 @@ static void lfcart_report_remove(struct lfcart_priv *priv)
 	memset(&priv->cartridge, 0, sizeof(priv->cartridge));
 }
 
-static int lfcart_detect(void *data)
+/*
+ * Between changes the detect pin waits on a level interrupt for the level
+ * that would change the state (low means a cartridge is in), and only
+ * samples every 60ms while debouncing.
+ */
+static void lfcart_arm(struct lfcart_priv *priv)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	gpio_set_int_mode(NAND_CART_DETECT_PORT, NAND_CART_DETECT_PIN,
+			priv->inserted ? GPIO_IMODE_HIGH_LEVEL :
+			GPIO_IMODE_LOW_LEVEL);
+	gpio_clear_pend(NAND_CART_DETECT_PORT, NAND_CART_DETECT_PIN);
+	gpio_set_int(NAND_CART_DETECT_PORT, NAND_CART_DETECT_PIN, 1);
+	local_irq_restore(flags);
+}
+
+static irqreturn_t lfcart_irq(enum gpio_port port, enum gpio_pin pin,
+		void *data)
 {
 	struct lfcart_priv *priv = (struct lfcart_priv *)data;
-	int cur;
 
-	while (1) {
-		if (!priv->run) {
-			up(&priv->detect_thread_done);
-			do_exit(0);
-		}
-
-		cur = !gpio_get_val(NAND_CART_DETECT_PORT,
-				NAND_CART_DETECT_PIN);
-
-		switch (priv->state) {
-			case LFCART_IDLE:
-				if (cur != priv->inserted)
-					priv->state = cur ?
-						LFCART_INSERTING :
-						LFCART_REMOVING;
-				break;
-			case LFCART_INSERTING:
-				if (cur)
-					priv->debounce++;
-				else {
-					priv->debounce = 0;
-					priv->state = LFCART_IDLE;
-				}
-				break;
-			case LFCART_REMOVING:
-				if (!cur)
-					priv->debounce++;
-				else {
-					priv->debounce = 0;
-					priv->state = LFCART_IDLE;
-				}
-				break;
-		}
-
-		if (priv->state > LFCART_IDLE &&
-				priv->debounce >= priv->debounce_level) {
+	if (!gpio_get_pend(port, pin))
+		return IRQ_NONE;
+
+	gpio_set_int(port, pin, 0);
+	gpio_clear_pend(port, pin);
+	priv->wakeups++;
+	schedule_delayed_work(&priv->detect, 0);
+	return IRQ_HANDLED;
+}
 
+static void lfcart_detect(struct work_struct *work)
+{
+	struct lfcart_priv *priv = container_of(work, struct lfcart_priv,
+			detect.work);
+	int cur;
+
+	cur = !gpio_get_val(NAND_CART_DETECT_PORT,
+			NAND_CART_DETECT_PIN);
+
+	switch (priv->state) {
+		case LFCART_IDLE:
+			if (cur != priv->inserted)
+				priv->state = cur ?
+					LFCART_INSERTING :
+					LFCART_REMOVING;
+			break;
+		case LFCART_INSERTING:
 			if (cur)
-				lfcart_report_insert(priv);
-			else
-				lfcart_report_remove(priv);
+				priv->debounce++;
+			else {
+				priv->debounce = 0;
+				priv->state = LFCART_IDLE;
+			}
+			break;
+		case LFCART_REMOVING:
+			if (!cur)
+				priv->debounce++;
+			else {
+				priv->debounce = 0;
+				priv->state = LFCART_IDLE;
+			}
+			break;
+	}
+
+	if (priv->state > LFCART_IDLE &&
+			priv->debounce >= priv->debounce_level) {
 
-			priv->state = LFCART_IDLE;
-			priv->debounce = 0;
-			priv->inserted = cur;
-		}
+		if (cur)
+			lfcart_report_insert(priv);
+		else
+			lfcart_report_remove(priv);
 
-		msleep(60);
+		priv->state = LFCART_IDLE;
+		priv->debounce = 0;
+		priv->inserted = cur;
 	}
 
-	return 0;
+	if (!priv->run)
+		return;
+
+	if (priv->state == LFCART_IDLE && priv->irq)
+		lfcart_arm(priv);
+	else
+		schedule_delayed_work(&priv->detect, LFCART_SAMPLE_J);
 }
 
 /*
@@ -154,18 +187,29 @@ int __init lfcart_init(void)
 	if (ret)
 		return ret;
 
-	sema_init(&lfcart->detect_thread_done, 0);
+	INIT_DELAYED_WORK(&lfcart->detect, lfcart_detect);
 	lfcart->run = 1;
-	lfcart->detect_thread = kthread_run(lfcart_detect, (void *)lfcart,
-			"lfcart-detect");
+
+	/* without the interrupt, keep sampling every 60ms */
+	if (gpio_request_irq(NAND_CART_DETECT_PORT, NAND_CART_DETECT_PIN,
+				lfcart_irq, lfcart))
+		printk(KERN_INFO "lfcart: detect IRQ busy, polling\n");
+	else
+		lfcart->irq = 1;
+
+	/* the first pass picks up a cartridge that's already in */
+	schedule_delayed_work(&lfcart->detect, 0);
 
 	lfcart->debug = debugfs_create_dir("lfcart", NULL);
 	if (IS_ERR(lfcart->debug))
 		lfcart->debug = NULL;
 
-	if (lfcart->debug)
+	if (lfcart->debug) {
 		debugfs_create_u32("debounce", S_IRWXUGO, lfcart->debug,
 				&lfcart->debounce_level);
+		debugfs_create_u32("wakeups", S_IRUGO, lfcart->debug,
+				&lfcart->wakeups);
+	}
 
 	return 0;
 }
@@ -173,12 +217,17 @@ int __init lfcart_init(void)
 void __exit lfcart_exit(void)
 {
 	lfcart->run = 0;
-	down(&lfcart->detect_thread_done);
+	if (lfcart->irq) {
+		gpio_set_int(NAND_CART_DETECT_PORT, NAND_CART_DETECT_PIN, 0);
+		gpio_free_irq(NAND_CART_DETECT_PORT, NAND_CART_DETECT_PIN,
+				lfcart_irq);
+	}
+	cancel_delayed_work_sync(&lfcart->detect);
 	if (lfcart->inserted)
 		lfcart_report_remove(lfcart);
 	bus_unregister(&lfcart_bus_type);
 	if (lfcart->debug)
-		debugfs_remove(lfcart->debug);
+		debugfs_remove_recursive(lfcart->debug);
 	kfree(lfcart);
 }
 
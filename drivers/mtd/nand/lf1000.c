@@ -23,9 +23,13 @@
 #include <linux/sysfs.h>
 #include <linux/device.h>
 #include <linux/leds.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
 #include <mach/platform.h>
 #include <mach/common.h>
 #include <mach/nand.h>
+#include <mach/dma.h>
 #include <asm/io.h>
 #include <asm/sizes.h>
 #include "../ubi/ubi-media.h"
@@ -51,6 +55,29 @@ static u32 total_erases;
 static u32 total_reads;
 static u32 total_writes;
 static u32 total_bitflips;
+static u32 total_dma_xfers;	/* data transfers done by the DMA controller */
+static u64 total_dma_bytes;
+static u32 total_pio_xfers;	/* data transfers done with readl()/readb() */
+static u64 total_pio_bytes;
+static u32 total_dma_wxfers;	/* the same for page programming */
+static u64 total_dma_wbytes;
+static u32 total_pio_wxfers;
+static u64 total_pio_wbytes;
+
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+static int read_cache_enabled = 1;
+static u32 read_cache_hits;	/* pages read without waiting for tR */
+static u32 read_cache_misses;	/* pages that needed a READ0 and tR */
+static u32 read_pagebuf_hits;	/* pages copied from chip->pagebuf */
+#endif
+
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+static int interleave_enabled = 1;
+static u32 two_plane_erases;	/* block pairs erased by one command */
+static u32 two_plane_writes;	/* page pairs programmed by one command */
+static u32 bus_yields;		/* times the other bank used the controller
+				 * while a chip was erasing or programming */
+#endif
 
 #define MAX_ECC_BYTES_PER_PAGE	(56)		
 	/* this is for 4KB page with 4-bit ECC / 512 bytes */
@@ -152,6 +179,12 @@ extern struct nand_ecclayout nand_oob_128;
 //#define TIME_NAND_WRITE_PARTS   1
 #define TIME_NAND_WRITE_ENTIRE  1
 
+/* If TIME_NAND_FF_HELPERS is defined, the probe routine times the erased-page
+ * helpers (all_bytes_ff(), lf1000_zero_bits()) against plain byte and bit
+ * loops and reports the results.
+ */
+#define TIME_NAND_FF_HELPERS  1
+
 
 #define TIMER32(r)	REG32(IO_ADDRESS(TIMER_BASE+r))
 
@@ -217,6 +250,17 @@ u32 nand_write_calc_time;
  *  controller is the control structure for the LF1000's NAND hardware controller
  */
 
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+/* where a chip's data output is, see lf1000_nand_command() */
+struct lf1000_nand_read_pos {
+	void	(*cmdfunc)(struct mtd_info *mtd, unsigned command, int column,
+			   int page_addr);
+	int	command;	/* last read command, or -1 */
+	int	column;		/* where read_buf() is up to */
+	int	page;
+};
+#endif
+
 struct lf1000_nand_device {
 	void __iomem	       * mem;
 	struct mtd_info        * mtd_onboard;
@@ -230,12 +274,29 @@ struct lf1000_nand_device {
 
 	u32			 base_nand_props;	
 	u32			 cart_nand_props;	
+
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	unsigned int		 dma_ch;	/* 0 if no channel was granted */
+	u32			 dma_fifo;	/* physical address of NFDATA */
+	struct completion	 dma_done;
+	struct lf1000_nand_read_pos rd[2];	/* [0] base, [1] cart */
+	int			 dma_write_failed; /* page data incomplete */
+	int			 dma_read_failed;  /* read_buf() data lost */
+#endif
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+	int			 busy_banks;	/* bit 0 base, bit 1 cart: busy
+						 * with the controller released */
+#endif
 #define NAND_SUPPORTS_INTERNAL_ECC	1
 #define NAND_INTERNAL_ECC_ENABLED	2
 #define NAND_SUPPORTS_ONFI		4
+#define NAND_SUPPORTS_READ_CACHE	8
+#define NAND_SUPPORTS_TWO_PLANE		16
 
 #define NAND_INTERNAL_ECC_ENABLED_SHIFT	1
 #define NAND_SUPPORTS_ONFI_SHIFT	2
+#define NAND_SUPPORTS_READ_CACHE_SHIFT	3
+#define NAND_SUPPORTS_TWO_PLANE_SHIFT	4
 };
 
 static struct lf1000_nand_device nand = {
@@ -503,7 +564,8 @@ static ssize_t show_write_stats(struct device *dev,
 				struct device_attribute *attr, char *buf)
 {
 	int x=0, i;
-	static char *title[] = {"Read ", "Write", "Erase", "Lock "};
+	static char *title[] = {"Read ", "Write", "Erase", "Lock ",
+				"RdDMA", "RdPIO", "WrDMA", "WrPIO"};
 	for (i=0; i<NS_MAX; i++) {
 		if (ws_n[i]) {
 			x += sprintf (buf+x, "%s N=%ld %ld/%ld/%ld\n", 
@@ -545,6 +607,14 @@ static ssize_t show_nand_accesses(struct device *dev,
 	x = sprintf (buf, "NAND accesses: page reads %d, "
 			  "page writes %d, block erasures %d, bitflips %d\n", 
 		     total_reads, total_writes, total_erases, total_bitflips);
+	x += sprintf (buf+x, "NAND reads: DMA %u (%llu bytes), "
+			     "PIO %u (%llu bytes)\n",
+		      total_dma_xfers, total_dma_bytes,
+		      total_pio_xfers, total_pio_bytes);
+	x += sprintf (buf+x, "NAND writes: DMA %u (%llu bytes), "
+			     "PIO %u (%llu bytes)\n",
+		      total_dma_wxfers, total_dma_wbytes,
+		      total_pio_wxfers, total_pio_wbytes);
 	return x;
 }
 
@@ -557,6 +627,14 @@ static ssize_t clear_nand_accesses(struct device *dev,
     total_reads    = 0;
     total_writes   = 0;
     total_bitflips = 0;
+	total_dma_xfers = 0;
+	total_dma_bytes = 0;
+	total_pio_xfers = 0;
+	total_pio_bytes = 0;
+	total_dma_wxfers = 0;
+	total_dma_wbytes = 0;
+	total_pio_wxfers = 0;
+	total_pio_wbytes = 0;
 	return count;
 }
 
@@ -564,6 +642,75 @@ static DEVICE_ATTR(nand_accesses,
 		   S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH, 	
 		   show_nand_accesses, clear_nand_accesses);
 
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+static ssize_t show_read_cache(struct device *dev, 
+			       struct device_attribute *attr, char *buf)
+{
+	return sprintf (buf, "enabled %d (base %d, cart %d)\n"
+			     "hits %u\nmisses %u\npagebuf hits %u\n",
+			read_cache_enabled,
+			!!(nand.base_nand_props & NAND_SUPPORTS_READ_CACHE),
+			!!(nand.cart_nand_props & NAND_SUPPORTS_READ_CACHE),
+			read_cache_hits, read_cache_misses, read_pagebuf_hits);
+}
+
+/* writing 0 or 1 turns cache reads off or on and clears the counters */
+static ssize_t set_read_cache(struct device *dev, 
+			      struct device_attribute *attr, 
+			      const char *buf, size_t count)
+{
+	int value;
+
+	if(sscanf(buf, "%d", &value) != 1)
+		return -EINVAL;
+
+	read_cache_enabled = !!value;
+	read_cache_hits    = 0;
+	read_cache_misses  = 0;
+	read_pagebuf_hits  = 0;
+	return count;
+}
+
+static DEVICE_ATTR(read_cache, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH,
+		   show_read_cache, set_read_cache);
+#endif /* CONFIG_MTD_NAND_LF1000_READ_CACHE */
+
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+static ssize_t show_interleave(struct device *dev, 
+			       struct device_attribute *attr, char *buf)
+{
+	return sprintf (buf, "enabled %d (base %d, cart %d)\n"
+			     "two-plane erases %u\ntwo-plane writes %u\n"
+			     "bus yields %u\n",
+			interleave_enabled,
+			!!(nand.base_nand_props & NAND_SUPPORTS_TWO_PLANE),
+			!!(nand.cart_nand_props & NAND_SUPPORTS_TWO_PLANE),
+			two_plane_erases, two_plane_writes, bus_yields);
+}
+
+/* writing 0 or 1 turns two-plane operations and bus sharing off or on and
+ * clears the counters
+ */
+static ssize_t set_interleave(struct device *dev, 
+			      struct device_attribute *attr, 
+			      const char *buf, size_t count)
+{
+	int value;
+
+	if(sscanf(buf, "%d", &value) != 1)
+		return -EINVAL;
+
+	interleave_enabled = !!value;
+	two_plane_erases   = 0;
+	two_plane_writes   = 0;
+	bus_yields         = 0;
+	return count;
+}
+
+static DEVICE_ATTR(interleave, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH,
+		   show_interleave, set_interleave);
+#endif /* CONFIG_MTD_NAND_LF1000_INTERLEAVE */
+
 #ifdef CONFIG_MTD_NAND_LF1000_READ_DELAY
 static volatile int read_delay = 0;
 
@@ -623,6 +770,37 @@ static DEVICE_ATTR(stress, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH,
 
 #endif /* ifdef CONFIG_MTD_NAND_LF1000_STRESS_TEST */
 
+#ifdef CONFIG_MTD_NAND_LF1000_BCH_SELFTEST
+ssize_t lf1000_bch_selftest(char *buf, int trials);
+
+static char bch_selftest_result[128] = "not run\n";
+
+static ssize_t show_bch_selftest(struct device *dev, 
+				 struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s", bch_selftest_result);
+}
+
+static ssize_t set_bch_selftest(struct device *dev, 
+				struct device_attribute *attr, 
+				const char *buf, size_t count)
+{
+	int trials;
+	ssize_t ret;
+
+	if(sscanf(buf, "%d", &trials) != 1 || trials <= 0)
+		return -EINVAL;
+
+	ret = lf1000_bch_selftest(bch_selftest_result, trials);
+	if(ret < 0)
+		return ret;
+	return count;
+}
+
+static DEVICE_ATTR(bch_selftest, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR,
+		   show_bch_selftest, set_bch_selftest);
+#endif /* ifdef CONFIG_MTD_NAND_LF1000_BCH_SELFTEST */
+
 static ssize_t show_cart_ecc_mode(struct device *dev, 
 				  struct device_attribute *attr, char *buf)
 {
@@ -1006,6 +1184,9 @@ static struct attribute *nand_attributes[] = {
 #endif
 #ifdef CONFIG_MTD_NAND_LF1000_STRESS_TEST
 	&dev_attr_stress.attr,
+#endif
+#ifdef CONFIG_MTD_NAND_LF1000_BCH_SELFTEST
+	&dev_attr_bch_selftest.attr,
 #endif
 	&dev_attr_cart_ecc_mode.attr,
 	&dev_attr_nor_write_addr_threshold.attr,
@@ -1014,6 +1195,12 @@ static struct attribute *nand_attributes[] = {
 	&dev_attr_cart_hotswap.attr,
 #endif	
 	&dev_attr_nand_accesses.attr,
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+	&dev_attr_read_cache.attr,
+#endif
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+	&dev_attr_interleave.attr,
+#endif
 	&dev_attr_base_nand_internal_ecc_support.attr,
 	&dev_attr_base_nand_internal_ecc_enabled.attr,
 	&dev_attr_base_nand_ecc_mode.attr,
@@ -1031,10 +1218,42 @@ static struct attribute_group nand_attr_group = {
  * 3) send a NAND_CMD_STATUS to then NAND chip, test the response against
  *    the mask 0x40
  */
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+static void lf1000_select_cart(struct mtd_info *mtd, int chipnr);
+
+static inline int lf1000_nand_bank(struct nand_chip *chip)
+{
+	return (chip->select_chip == lf1000_select_cart) ? 1 : 0;
+}
+
+/* The controller has one RnB input for both banks, so while the other bank is erasing or
+ * programming it says nothing about the selected chip.  Ask the chip itself
+ * (method 3) and, if this is a page read, put it back into data output.
+ */
+static int lf1000_nand_status_ready(struct mtd_info *mtd)
+{
+	struct nand_chip *chip = mtd->priv;
+	int ready;
+
+	chip->cmd_ctrl(mtd, NAND_CMD_STATUS, 
+		       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	ready = chip->read_byte(mtd) & NAND_STATUS_READY;
+	if (ready && chip->state == FL_READING)
+		chip->cmd_ctrl(mtd, NAND_CMD_READ0, 
+			       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	return ready;
+}
+#endif
+
 static int lf1000_nand_ready(struct mtd_info *mtd)
 {
-	u32 ctl = readl((tpIO)(NAND_BASE+NFCONTROL));
+	u32 ctl;
 
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+	if (nand.busy_banks & ~(1 << lf1000_nand_bank(mtd->priv)))
+		return lf1000_nand_status_ready(mtd);
+#endif
+	ctl = readl((tpIO)(NAND_BASE+NFCONTROL));
 	if(IS_SET(ctl,RnB))
 		return 1;	/* ready */
 	return 0;		/* busy */
@@ -1159,54 +1378,155 @@ static int lf1000_cart_remove(void)
 	return 0;
 }
 
+/*
+ * Erased-page helpers.  Erased and nearly erased pages are read very often
+ * (UBI's scans, UBIFS's free space checks), so these fetch the data with ldm,
+ * four words at a time, and count bits with hweight32() rather than with
+ * loops over bytes and bits.
+ */
+
+/* AND of the four words at p, fetched with a single ldm */
+static inline u32 lf1000_ldm_and4(const u32 *p)
+{
+	u32 acc;
+
+	__asm__("ldmia	%1, {r4, r5, r6, r7}\n\t"
+		"and	%0, r4, r5\n\t"
+		"and	%0, %0, r6\n\t"
+		"and	%0, %0, r7"
+		: "=&r" (acc)
+		: "r" (p), "m" (*(const u32 (*)[4])p)
+		: "r4", "r5", "r6", "r7");
+	return acc;
+}
+
+/*
+ * lf1000_and_bytes - AND together 'len' bytes at 'buf', spread over a word
+ * so that the result is 0xFFFFFFFF exactly when every byte is FF.  If 'stop'
+ * is nonzero, return as soon as the answer is known not to be 0xFFFFFFFF.
+ */
+static u32 lf1000_and_bytes(const uint8_t *buf, int len, int stop)
+{
+	u32 acc = 0xFFFFFFFF;
+	const u32 *p;
+
+	for ( ; (len > 0) && (3 & (unsigned int)buf); --len)
+		if (*buf++ != 0xFF)
+			return 0;
+
+	for (p = (const u32 *)buf; len >= 32; len -= 32, p += 8) {
+		acc &= lf1000_ldm_and4(p) & lf1000_ldm_and4(p + 4);
+		if (stop && (acc != 0xFFFFFFFF))
+			return acc;
+	}
+	for ( ; len > 3; len -= 4)
+		acc &= *p++;
+	for (buf = (const uint8_t *)p; len > 0; --len)
+		if (*buf++ != 0xFF)
+			return 0;
+	return acc;
+}
+
     /* returns 1 if all 'len' bytes at buf are 0xff;
      *         0 if at least one of the first 'len' bytes at buf is not 0xff
      */
-static int all_bytes_ff( const uint8_t * buf, int len)
+static inline int all_bytes_ff(const uint8_t *buf, int len)
 {
-	int rem   = (3 & (unsigned int)buf);
-	int allFF = 1;
+	return lf1000_and_bytes(buf, len, 1) == 0xFFFFFFFF;
+}
 
-	if (rem) {
-		while ( (len > 0) && (rem < 4)) {
-			if (*buf++ != 0xFF) {
-				allFF = 0;
-				break;
-			}
-			++rem;
-			--len;
-		}
-	}
-	if (allFF) {
-		if (0 == (3 & (unsigned int)buf)) {
-			u32 * p = (u32 *)buf;
+/*
+ * lf1000_zero_bits - count the 0 bits in 'len' bytes at 'buf', giving up
+ * once there are more than 'limit' of them.  'buf' must be word aligned.
+ */
+static int lf1000_zero_bits(const uint8_t *buf, int len, int limit)
+{
+	const u32 *p = (const u32 *)buf;
+	int count = 0;
+	u32 w;
 
-			for ( ; len > 3; len -= 4) {
-				if (*p++ != 0xFFFFFFFF) {
-					allFF = 0;
-					break;
-				}
-			}
-			if (allFF) {
-				for (buf = (uint8_t *)p; len > 0; --len) {
-					if (*buf++ != 0xFF) {
-						allFF = 0;
-						break;
-					}
-				}
-			}
-		} else {
-			dev_info(&nand.pdev->dev, "!@#$ all_bytes_ff()\n");
-			for ( ; len > 0; --len) {
-				if (*buf++ != 0xFF) {
-					allFF = 0;
-					break;
-				}
-			}
-		}
+	for ( ; len >= 16; len -= 16, p += 4) {
+		if (lf1000_ldm_and4(p) == 0xFFFFFFFF)
+			continue;
+		count += hweight32(~p[0]) + hweight32(~p[1])
+		       + hweight32(~p[2]) + hweight32(~p[3]);
+		if (count > limit)
+			return count;
 	}
-	return allFF;
+	for ( ; len > 3; len -= 4) {
+		w = *p++;
+		count += hweight32(~w);
+	}
+	for (buf = (const uint8_t *)p; len > 0; --len)
+		count += hweight8((u8)~*buf++);
+	return count;
+}
+
+#ifdef TIME_NAND_FF_HELPERS
+#define FF_BENCH_LEN	4096
+#define FF_BENCH_LOOPS	100
+
+static int ff_bench_bytes(const uint8_t *buf, int len)
+{
+	while (len-- > 0)
+		if (*buf++ != 0xFF)
+			return 0;
+	return 1;
+}
+
+static int ff_bench_bits(const uint8_t *buf, int len, int limit)
+{
+	int count = 0;
+	u8 v;
+
+	for ( ; (len > 0) && (count <= limit); --len)
+		for (v = ~*buf++; v; v >>= 1)
+			count += v & 1;
+	return count;
+}
+
+/* Time each helper on an erased page, and on one with 3 flipped bits near
+ * its end (the worst case for the zero-bit count).  Results are in ~1us
+ * ticks for FF_BENCH_LOOPS calls.
+ */
+static void lf1000_time_ff_helpers(void)
+{
+	uint8_t *buf;
+	u32 t_loop, t_ldm, c_loop, c_ldm;
+	int i, n = 0;
+
+	buf = kmalloc(FF_BENCH_LEN, GFP_KERNEL);
+	if (!buf)
+		return;
+	memset(buf, 0xFF, FF_BENCH_LEN);
+
+	timer_start();
+	for (i = 0; i < FF_BENCH_LOOPS; i++)
+		n += ff_bench_bytes(buf, FF_BENCH_LEN);
+	t_loop = timer_stop();
+	timer_start();
+	for (i = 0; i < FF_BENCH_LOOPS; i++)
+		n += all_bytes_ff(buf, FF_BENCH_LEN);
+	t_ldm = timer_stop();
+
+	buf[FF_BENCH_LEN - 100] = 0xFE;
+	buf[FF_BENCH_LEN - 10]  = 0x7D;
+	timer_start();
+	for (i = 0; i < FF_BENCH_LOOPS; i++)
+		n += ff_bench_bits(buf, FF_BENCH_LEN, 4);
+	c_loop = timer_stop();
+	timer_start();
+	for (i = 0; i < FF_BENCH_LOOPS; i++)
+		n += lf1000_zero_bits(buf, FF_BENCH_LEN, 4);
+	c_ldm = timer_stop();
+
+	kfree(buf);
+	dev_info(&nand.pdev->dev, "erased-page check of %d bytes x %d: "
+		 "byte loop %u, ldm %u; zero-bit count: bit loop %u, "
+		 "hweight %u (%d)\n", FF_BENCH_LEN, FF_BENCH_LOOPS,
+		 t_loop, t_ldm, c_loop, c_ldm, n);
 }
+#endif /* TIME_NAND_FF_HELPERS */
 
 /**
  * lf1000_nand_erase - [MTD Interface] erase block(s)
@@ -1226,6 +1546,41 @@ static int all_bytes_ff( const uint8_t * buf, int len)
  *       Its erasures will not be added to the profile data.
  */
 #define BBT_PAGE_MASK	0xffffff3f
+
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+#define NAND_CMD_PLANE_CONFIRM	0xd1	/* ends the first half of a two-plane
+					 * erase (after 60h) */
+#define NAND_CMD_PLANE_PROG	0x11	/* ends the first half of a two-plane
+					 * program (after 80h) */
+
+static int lf1000_nand_two_plane(struct mtd_info *mtd)
+{
+	u32 props = (mtd == nand.mtd_onboard) ? nand.base_nand_props
+					      : nand.cart_nand_props;
+
+	return interleave_enabled && (props & NAND_SUPPORTS_TWO_PLANE);
+}
+
+/* Start erasing block 'page' (an even block) and the odd block after it.
+ * The plane address is the lowest bit of the block address, so the two
+ * blocks sit in different planes at the same offset as the chip requires.
+ */
+static void lf1000_nand_erase_two_plane(struct mtd_info *mtd, int page)
+{
+	struct nand_chip *chip = mtd->priv;
+	int pages_per_block = 1 << (chip->phys_erase_shift - chip->page_shift);
+
+	chip->cmdfunc(mtd, NAND_CMD_ERASE1, -1, page);
+	chip->cmd_ctrl(mtd, NAND_CMD_PLANE_CONFIRM, 
+		       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	chip->cmd_ctrl(mtd, NAND_CMD_NONE, NAND_NCE | NAND_CTRL_CHANGE);
+	ndelay(100);		/* tWB, then tDBSY */
+	nand_wait_ready(mtd);
+	chip->cmdfunc(mtd, NAND_CMD_ERASE1, -1, page + pages_per_block);
+	chip->cmdfunc(mtd, NAND_CMD_ERASE2, -1, -1);
+}
+#endif /* CONFIG_MTD_NAND_LF1000_INTERLEAVE */
+
 static int lf1000_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 {
 	int page, status, pages_per_block, ret, chipnr;
@@ -1233,6 +1588,12 @@ static int lf1000_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 	loff_t rewrite_bbt[NAND_MAX_CHIPS]={0};
 	unsigned int bbt_masked_page = 0xffffffff;
 	loff_t len;
+	int planes = 1;		/* blocks erased by this pass of the loop */
+	int i;
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+	int single = 0;		/* blocks to redo one at a time after a 
+				 * failed two-plane erase */
+#endif
 #ifdef CONFIG_MTD_NAND_LF1000_STRESS_TEST
 	int power = 0;
 #endif
@@ -1317,12 +1678,27 @@ static int lf1000_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 			instr->state = MTD_ERASE_FAILED;
 			goto erase_exit;
 		}
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+		/* An even block followed by a good odd block that is also to
+		 * be erased can go in one two-plane erase.
+		 */
+		planes = 1;
+		if (single)
+			single--;
+		else if (lf1000_nand_two_plane(mtd)
+			 && !(page & pages_per_block)
+			 && len >= (2 << chip->phys_erase_shift)
+			 && !nand_block_checkbad(mtd, 
+				((loff_t)(page + pages_per_block)) 
+						<< chip->page_shift, 0, 0))
+			planes = 2;
+#endif
 		/*
 		 * Invalidate the page cache, if we erase the block which
 		 * contains the current cached page
 		 */
 		if (page <= chip->pagebuf 
-		    && chip->pagebuf < (page + pages_per_block))
+		    && chip->pagebuf < (page + planes * pages_per_block))
 			chip->pagebuf = -1;
 
 #ifdef CONFIG_MTD_NAND_LF1000_PROF
@@ -1339,12 +1715,21 @@ static int lf1000_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 
 			stress_config_power();
 		}
+#endif
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+		if (planes == 2) {
+			lf1000_nand_erase_two_plane(mtd, page & chip->pagemask);
+			two_plane_erases++;
+		} else
 #endif
 		chip->erase_cmd(mtd, page & chip->pagemask);
-		eb_index = (page & chip->pagemask) / pages_per_block;
-		if (eb_index < MAX_NUM_ERASE_BLOCKS) {
-			block_erase_counts[ eb_index ] += 1;
-			total_erases++;
+		for (i = 0; i < planes; i++) {
+			eb_index = (page & chip->pagemask) / pages_per_block 
+				   + i;
+			if (eb_index < MAX_NUM_ERASE_BLOCKS) {
+				block_erase_counts[ eb_index ] += 1;
+				total_erases++;
+			}
 		}
 
 #ifdef CONFIG_MTD_NAND_LF1000_STRESS_TEST
@@ -1364,6 +1749,15 @@ static int lf1000_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 			status = chip->errstat(mtd, chip, FL_ERASING,
 					       status, page);
 
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+		/* The status doesn't say which plane failed; erase the two
+		 * blocks again one at a time to find out.
+		 */
+		if ((status & NAND_STATUS_FAIL) && planes == 2) {
+			single = 2;
+			continue;
+		}
+#endif
 		/* See if block erase succeeded */
 		if (status & NAND_STATUS_FAIL) {
 			DEBUG(MTD_DEBUG_LEVEL0, "nand_erase: "
@@ -1378,14 +1772,18 @@ static int lf1000_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 		 * If BBT requires refresh, set the BBT rewrite flag to the
 		 * page being erased
 		 */
-		if (bbt_masked_page != 0xffffffff 
-		    && (page & BBT_PAGE_MASK) == bbt_masked_page)
-			rewrite_bbt[chipnr] =
-					((loff_t)page << chip->page_shift);
+		for (i = 0; i < planes; i++) {
+			int p = page + i * pages_per_block;
+
+			if (bbt_masked_page != 0xffffffff 
+			    && (p & BBT_PAGE_MASK) == bbt_masked_page)
+				rewrite_bbt[chipnr] =
+					((loff_t)p << chip->page_shift);
+		}
 
 		/* Increment page address and decrement length */
-		len -= (1 << chip->phys_erase_shift);
-		page += pages_per_block;
+		len -= (planes << chip->phys_erase_shift);
+		page += planes * pages_per_block;
 
 		/* Check, if we cross a chip boundary */
 		if (len && !(page & chip->pagemask)) {
@@ -1434,35 +1832,6 @@ erase_exit:
 	return ret;
 }
 
-static inline int num_zero_bits_u8(uint8_t val) {
-	int count;
-    
-	if (val == 0) {
-		count = 8;
-	} else {
-		for (val = ~val, count = 0; val; val >>= 1) {
-			if (val & 1) {
-				++count;
-			}
-		}        
-	}
-	return count;
-}
-
-static inline int num_zero_bits_u32(uint32_t val) {
-	int count;
-    
-	if (val == 0) {
-		count = 32;
-	} else {
-		for (val = ~val, count = 0; val; val >>= 1) {
-			if (val & 1) {
-				++count;
-			}
-		}        
-	}
-	return count;
-}
 
 
 /* 
@@ -1495,9 +1864,194 @@ static inline int num_zero_bits_u32(uint32_t val) {
 		      ||     (chip->ecc.mode == NAND_ECC_INTERNAL))
 #endif
 
+/*
+ * Account for 'len' bytes moved through the NAND data register by either the
+ * DMA controller or the CPU.  Reported through the nand_accesses attribute.
+ */
+static inline void lf1000_nand_count_read(int dma, int len)
+{
+	if (dma) {
+		total_dma_xfers++;
+		total_dma_bytes += len;
+	} else {
+		total_pio_xfers++;
+		total_pio_bytes += len;
+	}
+}
+
+static inline void lf1000_nand_count_write(int dma, int len)
+{
+	if (dma) {
+		total_dma_wxfers++;
+		total_dma_wbytes += len;
+	} else {
+		total_pio_wxfers++;
+		total_pio_wbytes += len;
+	}
+}
+
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+/* Below this size it is cheaper to readl() the data than to set up a
+ * descriptor and take the completion interrupt.
+ */
+#define NAND_DMA_MIN_LEN	512
+#define NAND_DMA_TIMEOUT	(HZ / 10)
+
+static irqreturn_t lf1000_nand_dma_irq(int ch, void *data)
+{
+	complete(&nand.dma_done);
+	return IRQ_HANDLED;
+}
+
+/*
+ * lf1000_nand_dma_start - start moving 'len' bytes between 'buf' and NFDATA
+ * with the DMA controller; 'dir' is DMA_FROM_DEVICE for reads and
+ * DMA_TO_DEVICE for writes.  Returns 0 if the transfer was started (the
+ * caller must then call lf1000_nand_dma_finish() with the same 'sg'), or a
+ * negative value if it wasn't and the caller has to use PIO: no channel, a
+ * short transfer, a buffer that isn't word aligned, or a buffer outside the
+ * kernel's linear mapping (e.g. vmalloc'd by UBI).
+ */
+static int lf1000_nand_dma_start(const uint8_t *buf, int len,
+				 enum dma_data_direction dir,
+				 struct scatterlist *sg)
+{
+	struct dma_control ctrl;
+	int ret;
+
+	if (!nand.dma_ch || (len < NAND_DMA_MIN_LEN) || (len & 3)
+	    || (3 & (unsigned int)buf)
+	    || !virt_addr_valid(buf) || !virt_addr_valid(buf + len - 1))
+		return -EINVAL;
+
+	sg_init_one(sg, buf, len);
+	if (!dma_map_sg(&nand.pdev->dev, sg, 1, dir))
+		return -ENOMEM;
+
+	memset(&ctrl, 0, sizeof(struct dma_control));
+	ctrl.interrupt  = DMA_INT_LAST_BLOCK;
+	ctrl.src_width  = 4;
+	ctrl.dest_width = 4;
+
+	INIT_COMPLETION(nand.dma_done);
+	dma_transfer_init(nand.dma_ch, DMA_MEM_IO);
+	if (dir == DMA_FROM_DEVICE) {
+		ctrl.transfer = DMA_FIFO_TO_MEM;
+		ret = dma_sg_read(nand.dma_ch, nand.dma_fifo, sg, 1, &ctrl);
+	} else {
+		ctrl.transfer = DMA_MEM_TO_FIFO;
+		ret = dma_sg_write(nand.dma_ch, sg, nand.dma_fifo, 1, &ctrl);
+	}
+	if (!ret)
+		ret = dma_start(nand.dma_ch);
+	if (ret) {
+		/* nothing has touched the chip yet; PIO can still do it */
+		dma_unmap_sg(&nand.pdev->dev, sg, 1, dir);
+		return ret;
+	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum ((dir == DMA_FROM_DEVICE) ? NS_READ_DMA : NS_WRITE_DMA,
+			  1);
+#endif
+	return 0;
+}
+
+/*
+ * lf1000_nand_dma_finish - wait for a transfer begun by
+ * lf1000_nand_dma_start() and hand the buffer back to the CPU.
+ */
+static int lf1000_nand_dma_finish(struct scatterlist *sg,
+				  enum dma_data_direction dir)
+{
+	int ret = 0;
+
+	if (!wait_for_completion_timeout(&nand.dma_done, NAND_DMA_TIMEOUT)) {
+		/* The chip's column pointer is now somewhere in the page, so
+		 * PIO can't just take over: the caller has to go back to the
+		 * start of the transfer or give up on the page.
+		 */
+		dev_err(&nand.pdev->dev, "DMA %s of %u bytes timed out\n",
+			(dir == DMA_FROM_DEVICE) ? "read" : "write",
+			sg->length);
+		dma_stop(nand.dma_ch);
+		dma_reset(nand.dma_ch);
+		ret = -ETIMEDOUT;
+	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum ((dir == DMA_FROM_DEVICE) ? NS_READ_DMA : NS_WRITE_DMA,
+			  0);
+#endif
+	dma_unmap_sg(&nand.pdev->dev, sg, 1, dir);
+	if (ret)
+		return ret;
+	if (dir == DMA_FROM_DEVICE)
+		lf1000_nand_count_read(1, sg->length);
+	else
+		lf1000_nand_count_write(1, sg->length);
+	return 0;
+}
+
+/*
+ * lf1000_nand_dma_read - move 'len' bytes from NFDATA into 'buf' with the
+ * DMA controller.  Returns 0 if the data was transferred, -ETIMEDOUT if the
+ * transfer started but didn't finish (the data is lost), or another
+ * negative value if the caller has to use PIO.
+ */
+static int lf1000_nand_dma_read(struct mtd_info *mtd, uint8_t *buf, int len)
+{
+	struct scatterlist sg;
+
+	if (lf1000_nand_dma_start(buf, len, DMA_FROM_DEVICE, &sg))
+		return -EINVAL;
+	return lf1000_nand_dma_finish(&sg, DMA_FROM_DEVICE);
+}
+
+/*
+ * lf1000_nand_dma_write - move 'len' bytes from 'buf' into NFDATA with the
+ * DMA controller.  Returns 0 if the data was transferred, -ETIMEDOUT if the
+ * transfer started but didn't finish, or another negative value if the
+ * caller has to use PIO.
+ */
+static int lf1000_nand_dma_write(struct mtd_info *mtd, const uint8_t *buf,
+				 int len)
+{
+	struct scatterlist sg;
+
+	if (lf1000_nand_dma_start(buf, len, DMA_TO_DEVICE, &sg))
+		return -EINVAL;
+	return lf1000_nand_dma_finish(&sg, DMA_TO_DEVICE);
+}
+
+#endif /* CONFIG_MTD_NAND_LF1000_DMA */
+
 #include "lf1000_MLC_BCH.c"
 #include "lf1000_internal_ECC.c"
 
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+#define NAND_CMD_READCACHESEQ	0x31
+#define NAND_CMD_READCACHEEND	0x3f
+
+/*
+ * Cache reads are used for multi-page reads of data only, from chips whose
+ * ONFI parameter page says they have the commands.  Internal-ECC parts are
+ * left alone: they correct the page while it moves into the cache register,
+ * and we still want to see their per-page status.
+ */
+static int lf1000_nand_can_read_cache(struct mtd_info *mtd, 
+				      struct nand_chip *chip,
+				      struct mtd_oob_ops *ops)
+{
+	u32 props = (mtd == nand.mtd_onboard) ? nand.base_nand_props
+					      : nand.cart_nand_props;
+
+	return read_cache_enabled
+	    && (props & NAND_SUPPORTS_READ_CACHE)
+	    && !ops->oobbuf
+	    && (ops->mode != MTD_OOB_RAW)
+	    && (chip->ecc.mode != NAND_ECC_INTERNAL);
+}
+#endif /* CONFIG_MTD_NAND_LF1000_READ_CACHE */
+
 /**
  * lf1000_nand_do_read_ops - Leapfrog replacement for nand_do_read_ops()
  *
@@ -1512,6 +2066,8 @@ static inline int num_zero_bits_u32(uint32_t val) {
  *   code for counting and timing read operations
  *   use of CONFIG_MTD_NAND_LF1000_MLC_SCRUB_THRESHOLD
  *   calls to dev_info() in order to report errors.
+ *   use of READ CACHE SEQUENTIAL for consecutive pages in a block, so the
+ *     chip loads the next page while the current one is transferred.
  */
 static int lf1000_nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			           struct mtd_oob_ops *ops)
@@ -1526,6 +2082,10 @@ static int lf1000_nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 	uint32_t oobreadlen = ops->ooblen;
 	uint8_t *bufpoi, *oob, *buf;
 	uint32_t numCorrected;
+	int cache_read = 0;	/* nonzero while a cache read sequence is open */
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+	int can_cache_read = lf1000_nand_can_read_cache(mtd, chip, ops);
+#endif
 
 	stats	     = mtd->ecc_stats;
 	numCorrected = stats.corrected;
@@ -1547,8 +2107,10 @@ static int lf1000_nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 		bytes   = min(mtd->writesize - col, readlen);
 		aligned = (bytes == mtd->writesize);
 
-		/* Is the current page in the buffer ? */
-		if (realpage != chip->pagebuf || oob) {
+		/* Is the current page in the buffer ?  (Even if it is, a cache
+		 * read sequence has to be stepped through it.)
+		 */
+		if (realpage != chip->pagebuf || oob || cache_read) {
 			bufpoi = aligned ? buf : chip->buffers->databuf;
 
 #ifdef CONFIG_MTD_NAND_LF1000_PROF
@@ -1570,8 +2132,38 @@ static int lf1000_nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 					chip->cmdfunc(mtd, NAND_CMD_READ0, 
 						      0x00, page);
 				sndcmd = 0;
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+				read_cache_misses++;
+				/* worth it only if the next page is wanted
+				 * and is in the same block
+				 */
+				cache_read = can_cache_read
+					  && (readlen > bytes)
+					  && ((page + 1) & blkcheck);
+			} else if (cache_read) {
+				read_cache_hits++;
+#endif
 			}
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+			/* 31h moves this page to the cache register and starts
+			 * loading the next one; 3Fh moves the last one without
+			 * starting another.  Either way the wait is only tRCBSY.
+			 */
+			if (cache_read) {
+				if ((readlen > bytes) && ((page + 1) & blkcheck))
+					chip->cmdfunc(mtd, NAND_CMD_READCACHESEQ,
+						      -1, -1);
+				else {
+					chip->cmdfunc(mtd, NAND_CMD_READCACHEEND,
+						      -1, -1);
+					cache_read = 0;
+				}
+			}
+#endif
 			/* Now read the page into the buffer */
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+			nand.dma_read_failed = 0;
+#endif
 			if (unlikely(ops->mode == MTD_OOB_RAW))
 				ret = chip->ecc.read_page_raw(mtd, chip, bufpoi);
 			else if (!aligned && NAND_SUBPAGE_READ(chip) && !oob) {
@@ -1599,6 +2191,10 @@ static int lf1000_nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 				        nand_num_reads, nand_read_time);
 #endif
 			}
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+			if (nand.dma_read_failed)
+				ret = -EIO;
+#endif
 			eb_index = realpage / (blkcheck + 1);
 			if (eb_index < MAX_NUM_ERASE_BLOCKS) {
 				block_read_counts[ eb_index ] += 1;
@@ -1664,6 +2260,9 @@ static int lf1000_nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			nand_stats_accum (NS_READ, 0);
 #endif
 		} else {
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+			read_pagebuf_hits++;
+#endif
 			memcpy(buf, chip->buffers->databuf + col, bytes);
 			buf += bytes;
 		}
@@ -1688,8 +2287,19 @@ static int lf1000_nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 		 */
 		if (!NAND_CANAUTOINCR(chip) || !(page & blkcheck))
 			sndcmd = 1;
+		/* the next page is already on its way */
+		if (cache_read)
+			sndcmd = 0;
 	}
 
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+	/* after an error, close the sequence before the chip gets another
+	 * command; the page it is loading is simply dropped.
+	 */
+	if (cache_read)
+		chip->cmdfunc(mtd, NAND_CMD_READCACHEEND, -1, -1);
+#endif
+
 	ops->retlen = ops->len - (size_t) readlen;
 	if (oob)
 		ops->oobretlen = ops->ooblen - oobreadlen;
@@ -1803,9 +2413,16 @@ static int lf1000_nand_read_oob(struct mtd_info *mtd, loff_t from,
 	default:
 		goto out;
 	}
-	if (!ops->datbuf)
+	if (!ops->datbuf) {
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		nand.dma_read_failed = 0;
+#endif
 		ret = nand_do_read_oob(mtd, from, ops);
-	else
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		if (nand.dma_read_failed)
+			ret = -EIO;
+#endif
+	} else
 		ret = lf1000_nand_do_read_ops(mtd, from, ops);
 out:
 	nand_release_device(mtd);
@@ -1813,6 +2430,30 @@ out:
 }
 
 
+/*
+ * Load a page into the chip with ecc.write_page().  Returns -EIO, with the
+ * chip reset and nothing programmed, if the data didn't all get there.
+ */
+static int lf1000_nand_load_page(struct mtd_info *mtd, struct nand_chip *chip,
+				 const uint8_t *buf, int raw)
+{
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	nand.dma_write_failed = 0;
+#endif
+	if (unlikely(raw))
+		chip->ecc.write_page_raw(mtd, chip, buf);
+	else
+		chip->ecc.write_page(mtd, chip, buf);
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	if (nand.dma_write_failed) {
+		dev_err(&nand.pdev->dev, "page data timed out, not programmed\n");
+		chip->cmdfunc(mtd, NAND_CMD_RESET, -1, -1);
+		return -EIO;
+	}
+#endif
+	return 0;
+}
+
 /**
  * lf1000_nand_write_page - write one page; replaces nand_write_page()
  * @mtd:	MTD device structure
@@ -1858,10 +2499,12 @@ static int lf1000_nand_write_page(struct mtd_info  *mtd,
 		}
 	    	chip->cmdfunc(mtd, NAND_CMD_SEQIN, 0x00, page);
 
-    		if (unlikely(raw))
-    			chip->ecc.write_page_raw(mtd, chip, buf);
-    		else
-    			chip->ecc.write_page(mtd, chip, buf);
+		if (lf1000_nand_load_page(mtd, chip, buf, raw)) {
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+			nand_stats_accum (NS_WRITE, 0);
+#endif
+			return -EIO;
+		}
 
 		/*
 		 * Cached progamming disabled for now, Not sure if its worth the
@@ -1934,6 +2577,147 @@ static int lf1000_nand_write_page(struct mtd_info  *mtd,
 	return 0;
 }
 
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+/*
+ * lf1000_nand_write_page_pair - program one page in each plane
+ * @mtd:	MTD device structure
+ * @chip:	NAND chip descriptor
+ * @buf0:	data for 'page', in an even block
+ * @buf1:	data for the same page of the odd block that follows
+ * @page:	page number in the even block
+ *
+ * Both pages are loaded (80h ... 11h, 80h ... 10h) before the chip starts
+ * programming, so the pair costs one tPROG instead of two.  If either page
+ * is all FF they are handed to lf1000_nand_write_page() one at a time so
+ * that the FF page is skipped as usual.
+ */
+static int lf1000_nand_write_page_pair(struct mtd_info  *mtd, 
+				       struct nand_chip *chip,
+				       const uint8_t    *buf0, 
+				       const uint8_t    *buf1, 
+				       int		 page)
+{
+	int pages_per_block = 1 << (chip->phys_erase_shift - chip->page_shift);
+	u32 eb_index;
+	int status;
+
+	if (all_bytes_ff(buf0, mtd->writesize) 
+	    || all_bytes_ff(buf1, mtd->writesize)) {
+		status = chip->write_page(mtd, chip, buf0, page, 0, 0);
+		if (!status)
+			status = chip->write_page(mtd, chip, buf1, 
+						  page + pages_per_block, 0, 0);
+		return status;
+	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_WRITE, 1);
+#endif
+	eb_index = (page & chip->pagemask) / pages_per_block;
+	if (eb_index + 1 < MAX_NUM_ERASE_BLOCKS) {
+		block_write_counts[ eb_index ]     += 1;
+		block_write_counts[ eb_index + 1 ] += 1;
+		total_writes += 2;
+	}
+	chip->cmdfunc(mtd, NAND_CMD_SEQIN, 0x00, page);
+	if (lf1000_nand_load_page(mtd, chip, buf0, 0))
+		goto aborted;
+	chip->cmd_ctrl(mtd, NAND_CMD_PLANE_PROG, 
+		       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	chip->cmd_ctrl(mtd, NAND_CMD_NONE, NAND_NCE | NAND_CTRL_CHANGE);
+	ndelay(100);		/* tWB, then tDBSY */
+	nand_wait_ready(mtd);
+
+	chip->cmdfunc(mtd, NAND_CMD_SEQIN, 0x00, page + pages_per_block);
+	if (lf1000_nand_load_page(mtd, chip, buf1, 0))
+		goto aborted;
+	chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
+	status = chip->waitfunc(mtd, chip);
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_WRITE, 0);
+#endif
+	two_plane_writes++;
+
+	if ((status & NAND_STATUS_FAIL) && (chip->errstat))
+		status = chip->errstat(mtd, chip, FL_WRITING, status, page);
+	if (status & NAND_STATUS_FAIL)
+		return -EIO;
+
+#ifdef CONFIG_MTD_NAND_VERIFY_WRITE
+	chip->cmdfunc(mtd, NAND_CMD_READ0, 0, page);
+	if (chip->verify_buf(mtd, buf0, mtd->writesize))
+		return -EIO;
+	chip->cmdfunc(mtd, NAND_CMD_READ0, 0, page + pages_per_block);
+	if (chip->verify_buf(mtd, buf1, mtd->writesize))
+		return -EIO;
+#endif
+	return 0;
+
+aborted:
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_WRITE, 0);
+#endif
+	return -EIO;
+}
+
+/*
+ * lf1000_nand_write - [MTD Interface] write with two-plane programming
+ *
+ * The part of the request made of whole pairs of blocks, starting on an 
+ * even block, is written a page pair at a time; anything else, and every
+ * write on chips without two-plane program, goes to nand_write().
+ */
+static int lf1000_nand_write(struct mtd_info *mtd, loff_t to, size_t len,
+			     size_t *retlen, const uint8_t *buf)
+{
+	struct nand_chip *chip = mtd->priv;
+	size_t blocksize = 1 << chip->phys_erase_shift;
+	int pages_per_block = 1 << (chip->phys_erase_shift - chip->page_shift);
+	size_t done = 0;
+	size_t rest;
+	int page, i, ret = 0;
+
+	if (!lf1000_nand_two_plane(mtd) || (to & (2 * blocksize - 1)) 
+	    || len < 2 * blocksize || (to + len) > mtd->size)
+		return nand_write(mtd, to, len, retlen, buf);
+
+	nand_get_device(chip, mtd, FL_WRITING);
+	chip->select_chip(mtd, (int)(to >> chip->chip_shift));
+
+	if (nand_check_wp(mtd)) {
+		ret = -EIO;
+		goto out;
+	}
+
+	while (len - done >= 2 * blocksize) {
+		page = (int)((to + done) >> chip->page_shift) & chip->pagemask;
+		if (page <= chip->pagebuf 
+		    && chip->pagebuf < (page + 2 * pages_per_block))
+			chip->pagebuf = -1;
+
+		for (i = 0; i < pages_per_block; i++) {
+			/* as nand_do_write_ops(): no OOB data of our own */
+			memset(chip->oob_poi, 0xff, mtd->oobsize);
+			ret = lf1000_nand_write_page_pair(mtd, chip, 
+				buf + done + (i << chip->page_shift),
+				buf + done + blocksize + (i << chip->page_shift),
+				page + i);
+			if (ret)
+				goto out;
+		}
+		done += 2 * blocksize;
+	}
+out:
+	nand_release_device(mtd);
+	*retlen = done;
+
+	if (!ret && done < len) {
+		ret = nand_write(mtd, to + done, len - done, &rest, buf + done);
+		*retlen += rest;
+	}
+	return ret;
+}
+#endif /* CONFIG_MTD_NAND_LF1000_INTERLEAVE */
+
 
 
 /**
@@ -2052,6 +2836,57 @@ static int lf1000_nand_read_page_swecc( struct mtd_info *mtd,
 }
 
 
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+/*
+ * Each chip's last read command and how far read_buf() has got into the
+ * data since, so that a read whose DMA timed out can be done again with PIO.
+ * lf1000_nand_command() sits in front of the chip's cmdfunc to keep track.
+ */
+#define lf1000_nand_rd(mtd)	(&nand.rd[(mtd) == nand.mtd_cart])
+
+static void lf1000_nand_command(struct mtd_info *mtd, unsigned command,
+				int column, int page_addr)
+{
+	struct lf1000_nand_read_pos *rd = lf1000_nand_rd(mtd);
+
+	switch (command) {
+	case NAND_CMD_READ0:
+	case NAND_CMD_READOOB:
+	case NAND_CMD_RNDOUT:
+		rd->command = command;
+		rd->column  = column;
+		rd->page    = page_addr;
+		break;
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+	case NAND_CMD_READCACHESEQ:
+	case NAND_CMD_READCACHEEND:
+		/* data output starts at the beginning of the cache register */
+		rd->command = NAND_CMD_RNDOUT;
+		rd->column  = 0;
+		rd->page    = -1;
+		break;
+#endif
+	default:
+		rd->command = -1;
+		break;
+	}
+	rd->cmdfunc(mtd, command, column, page_addr);
+}
+
+/* put the chip's column pointer back to the start of the last read_buf() */
+static int lf1000_nand_reread(struct mtd_info *mtd)
+{
+	struct lf1000_nand_read_pos *rd = lf1000_nand_rd(mtd);
+
+	if (rd->command < 0) {
+		dev_err(&nand.pdev->dev, "can't repeat the read\n");
+		return -EIO;
+	}
+	rd->cmdfunc(mtd, rd->command, rd->column, rd->page);
+	return 0;
+}
+#endif /* CONFIG_MTD_NAND_LF1000_DMA */
+
 /**
  * lf1000_nand_read_buf - read chip data into buffer
  * @mtd:	MTD device structure
@@ -2069,6 +2904,9 @@ extern void lf1000_select_cart(struct mtd_info *mtd, int chipnr);
 static void lf1000_nand_read_buf(struct mtd_info *mtd, uint8_t *buf, int len)
 {
 	int i;
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	int ret;
+#endif
 	uint8_t *b   = buf;
 	int      rem = (3 & (unsigned int)b);
 	struct nand_chip    *chip = mtd->priv;
@@ -2080,6 +2918,23 @@ static void lf1000_nand_read_buf(struct mtd_info *mtd, uint8_t *buf, int len)
 		stress_cut_cart(1);
 	}
 #endif
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	ret = lf1000_nand_dma_read(mtd, buf, len);
+	/* a timed out transfer left the column pointer somewhere in the
+	 * data: go back to where it started and read it again with PIO */
+	if (ret == -ETIMEDOUT && lf1000_nand_reread(mtd)) {
+		/* can't; the data is lost, and the caller has to know */
+		nand.dma_read_failed = 1;
+		ret = 0;
+	}
+	lf1000_nand_rd(mtd)->column += len;
+	if (!ret)
+		return;
+#endif
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_READ_PIO, 1);
+#endif
+	lf1000_nand_count_read(0, len);
 	if (rem) {
 	        while ( (len > 0) && (rem < 4)) {
 			*b++ = readb(A);
@@ -2103,6 +2958,9 @@ static void lf1000_nand_read_buf(struct mtd_info *mtd, uint8_t *buf, int len)
 		for (i = 0; i < len; i++)
 			*b++ = readb(A);
 	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_READ_PIO, 0);
+#endif
 }
 
 
@@ -2124,11 +2982,29 @@ static void lf1000_nand_write_buf(struct mtd_info * mtd,
 	int i;
 	struct nand_chip *chip = mtd->priv;
 	int rem = (3 & (unsigned int)buf);
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	int ret;
+#endif
 
 	/* NOTE:   This function is called many times  
 	 *          (Currently 8 times per page: 4 for 512-byte subpages and
 	 *           4 for 7-byte ECC codes.
+	 *          With DMA enabled, lf1000_nand_write_page_BCH() sends the
+	 *          subpages itself and only the ECC bytes come through here.
 	 */
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	/* after a timeout the page can't be finished with PIO; the page
+	 * write resets the chip instead of programming it */
+	ret = lf1000_nand_dma_write(mtd, buf, len);
+	if (ret == -ETIMEDOUT)
+		nand.dma_write_failed = 1;
+	if (!ret || ret == -ETIMEDOUT)
+		return;
+#endif
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_WRITE_PIO, 1);
+#endif
+	lf1000_nand_count_write(0, len);
 	if ((rem == 0) && (0 == (3 & len))) {
 		/* we'll use 32-bit access if buffer is on a 4-byte boundary
 		 * and len is a multiple of 4
@@ -2142,6 +3018,9 @@ static void lf1000_nand_write_buf(struct mtd_info * mtd,
 	        for (i = 0; i < len; i++)
 		        writeb(buf[i], chip->IO_ADDR_W);
 	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_WRITE_PIO, 0);
+#endif
 }
 
 
@@ -2158,6 +3037,71 @@ static void lf1000_nand_write_buf(struct mtd_info * mtd,
  * ndelay(100).  The additional delay seemed to make 32-bit writes to the
  * LF1000's NAND Flash Data register work ok.
  */
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+/* Let go of the controller while this chip is busy so that the other bank
+ * can be read or written, then take it back.  chip->state stays FL_ERASING
+ * or FL_WRITING meanwhile, which keeps other users of this chip out.  The
+ * controller is handed straight to the other chip rather than left free, as
+ * a user of this chip waiting in nand_get_device() would otherwise claim it
+ * for this chip and lock the other bank out again.  While the other chip is
+ * still FL_READY nobody has taken it up, and we can have it back.
+ */
+static void lf1000_nand_yield(struct mtd_info *mtd, struct nand_chip *chip)
+{
+	struct nand_hw_control *controller = chip->controller;
+	int bank = 1 << lf1000_nand_bank(chip);
+	struct nand_chip *other = (bank == 1) ? nand.mtd_cart->priv
+					      : nand.mtd_onboard->priv;
+	int waited = 0;
+	DECLARE_WAITQUEUE(wait, current);
+
+	chip->select_chip(mtd, -1);
+	spin_lock(&controller->lock);
+	nand.busy_banks |= bank;
+	controller->active = other;
+	wake_up(&controller->wq);
+	spin_unlock(&controller->lock);
+
+	cond_resched();
+
+	spin_lock(&controller->lock);
+	while (controller->active == other && other->state != FL_READY) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		add_wait_queue(&controller->wq, &wait);
+		spin_unlock(&controller->lock);
+		schedule();
+		remove_wait_queue(&controller->wq, &wait);
+		spin_lock(&controller->lock);
+		waited = 1;
+	}
+	if (waited)
+		bus_yields++;
+	controller->active = chip;
+	nand.busy_banks &= ~bank;
+	spin_unlock(&controller->lock);
+	chip->select_chip(mtd, 0);
+}
+
+/* lf1000_nand_wait() for when the other bank has a chip: poll the status
+ * register, giving the controller away between polls.
+ */
+static int lf1000_nand_wait_shared(struct mtd_info *mtd, 
+				   struct nand_chip *chip,
+				   unsigned long timeo)
+{
+	int status;
+
+	for (;;) {
+		chip->cmdfunc(mtd, NAND_CMD_STATUS, -1, -1);
+		status = (int)chip->read_byte(mtd);
+		if ((status & NAND_STATUS_READY) || time_after(jiffies, timeo))
+			break;
+		lf1000_nand_yield(mtd, chip);
+	}
+	return status;
+}
+#endif /* CONFIG_MTD_NAND_LF1000_INTERLEAVE */
+
 static int lf1000_nand_wait(struct mtd_info *mtd, struct nand_chip *chip)
 {
 
@@ -2175,6 +3119,14 @@ static int lf1000_nand_wait(struct mtd_info *mtd, struct nand_chip *chip)
 	 * any case on any machine. */
 	ndelay(2000);
 
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+	if (interleave_enabled && nand.mtd_onboard && nand.mtd_cart 
+	    && (state == FL_ERASING || state == FL_WRITING)) {
+		status = lf1000_nand_wait_shared(mtd, chip, timeo);
+		led_trigger_event(nand_led_trigger, LED_OFF);
+		return status;
+	}
+#endif
 	if ((state == FL_ERASING) && (chip->options & NAND_IS_AND))
 		chip->cmdfunc(mtd, NAND_CMD_STATUS_MULTI, -1, -1);
 	else
@@ -2503,7 +3455,11 @@ static int lf1000_nand_scan_tail(struct mtd_info *mtd)
 	mtd->point = NULL;
 	mtd->unpoint = NULL;
 	mtd->read = lf1000_nand_read;
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+	mtd->write = lf1000_nand_write;
+#else
 	mtd->write = nand_write;
+#endif
 	mtd->read_oob = lf1000_nand_read_oob;
 	mtd->write_oob = nand_write_oob;
 	mtd->sync = nand_sync;
@@ -2538,6 +3494,65 @@ static void lf1000_init_for_SLC_nand(struct mtd_info *mtd,
 
 
 
+#if defined(CONFIG_MTD_NAND_LF1000_READ_CACHE) \
+ || defined(CONFIG_MTD_NAND_LF1000_INTERLEAVE)
+#define NAND_CMD_PARAM		0xec
+#define ONFI_FEATURE_INTERLEAVE	(1 << 3)
+#define ONFI_OPT_CMD_READ_CACHE	(1 << 1)
+
+/* Look in the chip's ONFI parameter page for the READ CACHE commands and
+ * for two-plane (interleaved) operations and record what's there in 
+ * *p_nand_props.
+ */
+static void lf1000_nand_probe_onfi(struct mtd_info  * mtd, 
+				   struct nand_chip * chip,
+				   u32		    * p_nand_props)
+{
+	u8 param[102];
+	int i;
+
+	*p_nand_props &= ~(NAND_SUPPORTS_READ_CACHE | NAND_SUPPORTS_TWO_PLANE);
+
+	chip->select_chip(mtd, 0);
+	chip->cmdfunc(mtd, NAND_CMD_READID, 0x20, -1);
+	for (i = 0; i < 4; i++)
+		param[i] = chip->read_byte(mtd);
+	if (memcmp(param, "ONFI", 4))
+		goto out;
+
+	/* READ PARAMETER PAGE takes a single address cycle */
+	chip->cmd_ctrl(mtd, NAND_CMD_PARAM, 
+		       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	chip->cmd_ctrl(mtd, 0x00, NAND_NCE | NAND_ALE | NAND_CTRL_CHANGE);
+	chip->cmd_ctrl(mtd, NAND_CMD_NONE, NAND_NCE | NAND_CTRL_CHANGE);
+	ndelay(100);
+	nand_wait_ready(mtd);
+
+	for (i = 0; i < sizeof(param); i++)
+		param[i] = chip->read_byte(mtd);
+	if (memcmp(param, "ONFI", 4))
+		goto out;
+#ifdef CONFIG_MTD_NAND_LF1000_READ_CACHE
+	/* bytes 8-9: optional commands supported */
+	if (param[8] & ONFI_OPT_CMD_READ_CACHE)
+		*p_nand_props |= NAND_SUPPORTS_READ_CACHE;
+#endif
+#ifdef CONFIG_MTD_NAND_LF1000_INTERLEAVE
+	/* bytes 6-7: features supported; byte 101: number of interleaved
+	 * (plane) address bits.  Only two planes are handled here.
+	 */
+	if ((param[6] & ONFI_FEATURE_INTERLEAVE) && (param[101] & 0x0f) == 1)
+		*p_nand_props |= NAND_SUPPORTS_TWO_PLANE;
+#endif
+out:
+	chip->select_chip(mtd, -1);
+	dev_info(&nand.pdev->dev, "READ CACHE %ssupported, "
+				  "two-plane %ssupported\n",
+		 (*p_nand_props & NAND_SUPPORTS_READ_CACHE) ? "" : "not ",
+		 (*p_nand_props & NAND_SUPPORTS_TWO_PLANE) ? "" : "not ");
+}
+#endif
+
 /* Leapfrog-specific version of standard nand_scan() function.
  * This function calls the standard nand_scan_ident() and nand_scan_tail(),
  * but between those calls it performs initialization that's appropriate for
@@ -2558,6 +3573,12 @@ static int lf1000_nand_scan(struct mtd_info * mtd,
 	if (!ret) {
 		struct nand_chip *chip = mtd->priv;
 
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		lf1000_nand_rd(mtd)->cmdfunc = chip->cmdfunc;
+		lf1000_nand_rd(mtd)->command = -1;
+		chip->cmdfunc = lf1000_nand_command;
+#endif
+
 			/* if cartridge has OTP, use standard code */
 		if (cart_nand && (chip->ecc.mode == NAND_ECC_NONE)) {
 			ret = nand_scan_tail(mtd);
@@ -2573,6 +3594,10 @@ static int lf1000_nand_scan(struct mtd_info * mtd,
 			} else {
 				lf1000_init_for_SLC_nand( mtd, chip );
 			}
+#if defined(CONFIG_MTD_NAND_LF1000_READ_CACHE) \
+ || defined(CONFIG_MTD_NAND_LF1000_INTERLEAVE)
+			lf1000_nand_probe_onfi(mtd, chip, p_nand_props);
+#endif
 			dev_info(&nand.pdev->dev, " subpage_sft %d, "
 						  "subpagesize %d\n",
 			       mtd->subpage_sft, chip->subpagesize);
@@ -2603,6 +3628,9 @@ static int lf1000_nand_probe(struct platform_device *pdev)
 	struct mtd_partition *cart_parts    = NULL;
 
 	nand.pdev = pdev;
+#ifdef TIME_NAND_FF_HELPERS
+	lf1000_time_ff_helpers();
+#endif
 
 	/* check if a cartridge is inserted */
 	gpio_configure_pin(NAND_CART_DETECT_PORT, NAND_CART_DETECT_PIN,
@@ -2637,6 +3665,19 @@ static int lf1000_nand_probe(struct platform_device *pdev)
 	
 	printk(KERN_INFO "MTD: Controller Initialized\n");
 
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	/* Leave the level 1 channels to audio; fall back to PIO if none of
+	 * the level 0 channels is free.
+	 */
+	init_completion(&nand.dma_done);
+	nand.dma_fifo = res->start + NFDATA;
+	if (dma_request("nand", DMA_PRIORITY_LV0, lf1000_nand_dma_irq,
+			&nand, &nand.dma_ch)) {
+		dev_warn(&pdev->dev, "no DMA channel, using PIO\n");
+		nand.dma_ch = 0;
+	}
+#endif
+
 	/* Allocate memory for onboard NAND MTD device structure and private data */
 	lf1000_init_mtd_info(&nand.mtd_onboard, res->start);
 	if(!nand.mtd_onboard) {
@@ -2711,6 +3752,12 @@ static int lf1000_nand_probe(struct platform_device *pdev)
 	return 0;
 
 fail_mem_onboard:
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	if (nand.dma_ch) {
+		dma_release(nand.dma_ch);
+		nand.dma_ch = 0;
+	}
+#endif
 	iounmap(nand.mem);
 fail_remap:
 	release_mem_region(res->start, (res->end - res->start) + 1);
@@ -2723,6 +3770,12 @@ static int lf1000_nand_remove(struct platform_device *pdev)
 
 	sysfs_remove_group(&pdev->dev.kobj, &nand_attr_group);
 
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	if (nand.dma_ch) {
+		dma_release(nand.dma_ch);
+		nand.dma_ch = 0;
+	}
+#endif
 	/* Release resources, unregister device */
 	nand_release(nand.mtd_onboard);
 	if(nand.mtd_cart)
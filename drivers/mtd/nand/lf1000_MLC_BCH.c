@@ -41,6 +41,137 @@ static struct nand_ecclayout nand_oob_128_BCH = {
 		 .length = 70}}
 };
 
+/**
+ * lf1000_nand_read_section_pio - read one ECC section from the NAND data
+ *                                register with CPU loads
+ * @mtd:	mtd info structure
+ * @buf:	buffer to store read data
+ * @len:	number of bytes to read (normally chip->ecc.size)
+ *
+ * Returns the AND of all the data read, which is 0xFFFFFFFF if all bytes
+ * were FF, so the callers can recognize erased sections without another
+ * pass over the buffer.
+ */
+static uint32_t lf1000_nand_read_section_pio(struct mtd_info *mtd,
+					     uint8_t         *buf,
+					     int              len)
+{
+	struct nand_chip *chip = mtd->priv;
+	tpIO     A   = chip->IO_ADDR_R;
+	uint8_t *b   = buf;
+	int      rem = (3 & (unsigned int)b);
+	uint8_t  val8;
+	uint32_t val32;
+	uint32_t allFF;
+
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_READ_PIO, 1);
+#endif
+	lf1000_nand_count_read(0, len);
+	if (rem) {
+		allFF = 0x000000FF;
+		while ( (len > 0) && (rem < 4)) {
+			val8   = readb(A);
+			allFF &= val8;
+			*b++   = val8;
+			++rem;
+			--len;
+		}
+		if (allFF == 0x000000FF)
+			allFF = 0xFFFFFFFF;
+	}
+	else
+		allFF = 0xFFFFFFFF;
+
+	if (0 == (3 & (unsigned int)b)) {
+		u32 * p = (u32 *)b;
+
+		for (; len > 63; len -= 64) {
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+		}
+		for (; len > 3; len -= 4) {
+			val32 = readl(A); allFF &= val32; *p++ = val32;
+		}
+		b = (uint8_t *)p;
+		while (len-- > 0) {
+			val8 = readb(A);
+			if (val8 != 0xFF)
+				allFF = 0;
+			*b++ = val8;
+		}
+	}
+	else { /* unexpected condition (unaligned pointer) */
+		dev_info(&nand.pdev->dev,
+			 "!@#$ lf1000_nand_read_section_pio()\n");
+		allFF = 0x000000FF;
+		for ( ; len > 0; --len) {
+			val8   = readb(A);
+			allFF &= val8;
+			*b++   = val8;
+		}
+		if (allFF == 0x000000FF)
+			allFF = 0xFFFFFFFF;
+	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_READ_PIO, 0);
+#endif
+	return allFF;
+}
+
+/**
+ * lf1000_nand_write_section_pio - write one ECC section to the NAND data
+ *                                 register with CPU loads and stores
+ * @mtd:	mtd info structure
+ * @buf:	data to write
+ * @len:	number of bytes to write (normally chip->ecc.size)
+ *
+ * Returns the AND of all the data written, so that the caller can tell an
+ * all-FF section without reading it again.
+ */
+static uint32_t lf1000_nand_write_section_pio(struct mtd_info *mtd,
+					      const uint8_t   *buf,
+					      int              len)
+{
+	struct nand_chip *chip = mtd->priv;
+	tpIO      A   = chip->IO_ADDR_W;
+	const u32 *p  = (const u32 *)buf;
+	uint32_t  w0, w1, w2, w3;
+	uint32_t  allFF = 0xFFFFFFFF;
+
+	if ((3 & (unsigned int)buf) || (15 & len)) {
+		chip->write_buf(mtd, buf, len);
+		return lf1000_and_bytes(buf, len, 0);
+	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_WRITE_PIO, 1);
+#endif
+	lf1000_nand_count_write(0, len);
+	for ( ; len > 0; len -= 16) {
+		w0 = *p++; w1 = *p++; w2 = *p++; w3 = *p++;
+		writel(w0, A); writel(w1, A); writel(w2, A); writel(w3, A);
+		allFF &= w0 & w1 & w2 & w3;
+	}
+#ifdef CONFIG_MTD_NAND_LF1000_PROF
+	nand_stats_accum (NS_WRITE_PIO, 0);
+#endif
+	return allFF;
+}
+
 /**
  * lf1000_nand_read_subpage_BCH  Leapfrog's version for nand_read_subpage()
  *                               for use with BCH ECC
@@ -82,7 +213,10 @@ static int lf1000_nand_read_subpage_BCH(struct mtd_info  *mtd,
 	uint32_t allFF;
 	uint8_t  eccAllFF;
 	uint32_t hdweFoundErrors;
-	tpIO A = chip->IO_ADDR_R;
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	int      dma_section;
+	int      dma_ret;
+#endif
 
 
 	    /* Column address within the page aligned to ECC size */
@@ -107,10 +241,6 @@ static int lf1000_nand_read_subpage_BCH(struct mtd_info  *mtd,
 	for (i = 0; i < num_steps; 
 	     ++i, data_col_addr += eccsize, eccOffset += eccbytes)
 	{
-       		int      len;
-	        uint8_t *b;
-		int      rem;
-		uint8_t  val8;
 		uint32_t val32;
 		int	 eccSubIndex;
 		uint8_t *pecc;
@@ -129,73 +259,17 @@ static int lf1000_nand_read_subpage_BCH(struct mtd_info  *mtd,
         	        + (sectionECC[eccOffset+6] << 16);
         	writel(val32, (tpIO)(NAND_BASE+NFORGECCH)); 
 
-		/* Read 512 bytes into the current section of 'buf'*/
-        	len = eccsize;
-		b   = buf;
-		rem = (3 & (unsigned int)b);
-
-		if (rem) {
-			allFF = 0x000000FF;
-			while ( (len > 0) && (rem < 4)) {
-				val8   = readb((tpIO)A);
-				allFF &= val8;
-				*b++   = val8;
-				++rem;
-				--len;
-			}
-			if (allFF == 0x000000FF) {
-				allFF = 0xFFFFFFFF;
-			}
-		}
-		else {
-			allFF = 0xFFFFFFFF;
-		}
-		if (0 == (3 & (unsigned int)b)) {
-			u32 * p = (u32 *)b;
-
-			for (; len > 63; len -= 64) {
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-			}
-			for (; len > 3; len -= 4) {
-				val32 = readl(A); allFF &= val32; *p++ = val32;
-			}
-			b = (uint8_t *)p;
-			while (len-- > 0) {
-				val8 = readb(A);
-				if (val8 != 0xFF) {
-					allFF = 0;
-				}
-				*b++ = val8;
-			}
-		}
-		else {
-			dev_info(&nand.pdev->dev, 
-				"!@#$ lf1000_nand_read_subpage_BCH()\n");
-			allFF = 0x000000FF;
-			for ( ; len > 0; --len) {
-				val8   = readb(A);
-				allFF &= val8;
-				*b++   = val8;
-			}
-			if (allFF == 0x000000FF) {
-				allFF = 0xFFFFFFFF;
-			}
-		}
+		/* Read 512 bytes into the current section of 'buf' */
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		dma_ret = lf1000_nand_dma_read(mtd, buf, eccsize);
+		if (dma_ret == -ETIMEDOUT)
+			return -EIO;	/* the ECC engine has seen part of it */
+		dma_section = !dma_ret;
+		if (dma_section)
+			allFF = 0;	/* worked out below, if it's needed */
+		else
+#endif
+			allFF = lf1000_nand_read_section_pio(mtd, buf, eccsize);
 		/* Wait until the NFECCDECDONE bit is set in the 
 		 * NFECCSTATUS register.
 		 */
@@ -216,6 +290,10 @@ static int lf1000_nand_read_subpage_BCH(struct mtd_info  *mtd,
 		 */
 		hdweFoundErrors = IS_SET(readl((tpIO)(NAND_BASE+NFECCSTATUS)),
 					 NFCHECKERROR);
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		if (dma_section && hdweFoundErrors)
+			allFF = lf1000_and_bytes(buf, eccsize, 0);
+#endif
 		/* Check for eccAllFF and a few non-FF data bytes
 		 * if lf1000 hdwe indicates error 
 		 *   AND either data or ecc contains non-FF bytes,
@@ -232,18 +310,10 @@ static int lf1000_nand_read_subpage_BCH(struct mtd_info  *mtd,
 			 * to FF and report corrected ECC errors.
 			*/
 			if (   (eccAllFF == 0xFF)
-			    && (num_zero_bits_u32(allFF) <= 4)) 
+			    && (32 - hweight32(allFF) <= 4)) 
 			{
-				uint8_t *b   = buf;
-				int      count;
-				int      j;
-				/* NOTE: this can be speeded up if necessary;
-				 *       keeping it simple and short for now.
-				 */
-				count = 0;
-				for (j = 0; (j < eccsize) && (count < 5); j++) {
-					count += num_zero_bits_u8(*b++);
-				}
+				int count = lf1000_zero_bits(buf, eccsize, 4);
+
 				/* Now if count < 5, it's the number of zero
 				 * data bits in the buffer.  Treat this as an
 				 * erased section in which a few bits have been
@@ -333,14 +403,16 @@ static int lf1000_nand_read_page_BCH( struct mtd_info  * mtd,
 	int eccsize  = chip->ecc.size;
 	int eccbytes = chip->ecc.bytes;
 	int eccsteps = chip->ecc.steps;
-	tpIO A = chip->IO_ADDR_R;
-	int j;
 	uint32_t *eccpos = chip->ecc.layout->eccpos;
 	uint8_t sectionECC[MAX_ECC_BYTES_PER_PAGE]; 
                                 /* buffer for all of the page's ECC bytes */
 	uint32_t allFF;
 	uint8_t  eccAllFF;
 	uint32_t hdweFoundErrors;
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	int      dma_section;
+	int      dma_ret;
+#endif
 
 	dataOffset = 0;
 	eccOffset  = mtd->writesize + *eccpos;
@@ -370,75 +442,17 @@ static int lf1000_nand_read_page_BCH( struct mtd_info  * mtd,
 		        + (sectionECC[eccOffset+6] << 16);
 		writel(val32, (tpIO)(NAND_BASE+NFORGECCH)); 
 
-		    /* Read 512 bytes and store them into the current section 
-		     * of 'buf'*/
-	        {
-		int      len = eccsize;
-	        uint8_t *b   = buf;
-		int      rem = (3 & (unsigned int)b);
-		uint8_t  val8;
-		uint32_t val32;
-
-		if (rem) {
-			allFF = 0x000000FF;
-                	while ( (len > 0) && (rem < 4)) {
-                		val8   = readb(A);
-		                allFF &= val8;
-				*b++   = val8;
-		                ++rem;
-		                --len;
-	                }
-	                if (allFF == 0x000000FF)
-	                    allFF = 0xFFFFFFFF;
-		}
-	        else allFF = 0xFFFFFFFF;
-
-		if (0 == (3 & (unsigned int)b)) {
-	                u32 * p = (u32 *)b;
-
-		        for (; len > 63; len -= 64) {
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        	val32 = readl(A); allFF &= val32; *p++ = val32;
-		        }
-			for (; len > 3; len -= 4) {
-		            val32 = readl(A); allFF &= val32; *p++ = val32;
-		        }
-		        b = (uint8_t *)p;
-			while (len-- > 0) {
-		        	val8 = readb(A);
-		        	if (val8 != 0xFF) {
-		        	        allFF = 0;
-		        	}
-				*b++ = val8;
-		        }
-		}
-		else { /* unexpected condition (unaligned pointer) */
-		        dev_info(&nand.pdev->dev, 
-				 "!@#$ lf1000_nand_read_page_BCH()\n");
-		        allFF = 0x000000FF;
-			for ( ; len > 0; --len) {
-				val8   = readb(A);
-			        allFF &= val8;
-				*b++   = val8;
-			}
-		        if (allFF == 0x000000FF)
-		            allFF = 0xFFFFFFFF;
-		}
-        	}
+		/* Read 512 bytes into the current section of 'buf' */
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		dma_ret = lf1000_nand_dma_read(mtd, buf, eccsize);
+		if (dma_ret == -ETIMEDOUT)
+			return -EIO;	/* the ECC engine has seen part of it */
+		dma_section = !dma_ret;
+		if (dma_section)
+			allFF = 0;	/* worked out below, if it's needed */
+		else
+#endif
+			allFF = lf1000_nand_read_section_pio(mtd, buf, eccsize);
 		    /* Wait until the NFECCDECDONE bit is set in the 
 		     * NFECCSTATUS register.
 		     */
@@ -463,6 +477,10 @@ static int lf1000_nand_read_page_BCH( struct mtd_info  * mtd,
 		 */
 	        hdweFoundErrors = IS_SET(readl((tpIO)(NAND_BASE+NFECCSTATUS)),
         	                         NFCHECKERROR);
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		if (dma_section && hdweFoundErrors)
+			allFF = lf1000_and_bytes(buf, eccsize, 0);
+#endif
             	/* Check for eccAllFF and a few non-FF data bytes
         	 * if lf1000 hdwe indicates error 
         	 *   AND either data or ecc contains non-FF bytes,
@@ -479,17 +497,9 @@ static int lf1000_nand_read_page_BCH( struct mtd_info  * mtd,
 			 * to FF and report corrected ECC errors.
 			 */
 		        if (   (eccAllFF == 0xFF)
-			    && (num_zero_bits_u32(allFF) <= 4)) {
-	        		uint8_t *b   = buf;
-                		int      count;
+			    && (32 - hweight32(allFF) <= 4)) {
+				int count = lf1000_zero_bits(buf, eccsize, 4);
 
-				/* NOTE: this can be speeded up if necessary;
-				 *       keeping it simple and short for now.
-				 */
-				count = 0;
-				for (j = 0; (j < eccsize) && (count < 5); j++) {
-				    count += num_zero_bits_u8(*b++);
-				}
 				/* Now if count < 5, it's the number of zero 
 				 * data bits in the buffer.  Treat this as an
 				 * erased section in which a few bits have been
@@ -585,8 +595,11 @@ static int lf1000_nand_read_page_BCH( struct mtd_info  * mtd,
  * 		Sets the ECCRST bit in the NFCONTROL register, resetting the ECC
  *      calculation hardware.
  *	
- *		Next the routine calls chip->write_buf() to write the 512 data bytes
- *		to the device.
+ *		Next the routine writes the 512 data bytes to the device,
+ *		noting on the way whether they are all FF.  When DMA is
+ *		available the section is instead
+ *		handed to the DMA controller, and the CPU checks the section for
+ *		all-FF data while it streams into the chip.
  *
  *		After the NAND controller completes its calculation of the ECC bytes
  *		for the section's data, this routine reads the values from the 
@@ -599,6 +612,8 @@ static int lf1000_nand_read_page_BCH( struct mtd_info  * mtd,
  *
  * This routine does not send a Start Programming command to the device.  It
  * depends on its caller to do that and to check if the write was completed ok.
+ * If a section's DMA times out it stops there and sets nand.dma_write_failed
+ * for the caller.
  */
 
 /*
@@ -620,6 +635,20 @@ static void lf1000_nand_write_page_BCH( struct mtd_info  * mtd,
 	int eccbytes = chip->ecc.bytes;
 	int eccsteps = chip->ecc.steps;
 	int *eccpos  = chip->ecc.layout->eccpos;
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+	struct scatterlist sg;
+	int dma_section;
+
+	/* UBI's buffers are vmalloc'd and out of the DMA controller's reach;
+	 * stage those in the chip's own page buffer.  That buffer may hold
+	 * a cached page, so drop the reference to it.
+	 */
+	if (nand.dma_ch && !virt_addr_valid(buf)) {
+		memcpy(chip->buffers->databuf, buf, mtd->writesize);
+		chip->pagebuf = -1;
+		buf = chip->buffers->databuf;
+	}
+#endif
 
 	dataOffset = 0;
 	eccOffset  = 0;	    /* offset into eccbuf */
@@ -627,12 +656,19 @@ static void lf1000_nand_write_page_BCH( struct mtd_info  * mtd,
 	for (i = 0; i < eccsteps; ++i, dataOffset += eccsize,
 					eccOffset += eccbytes) {
 	        int allFF;
+		uint32_t sectionAND = 0;
 
     		u32 ctl = readl((tpIO)(NAND_BASE+NFCONTROL));
         	writel( (ctl & (NFC_NFTYPE_MASK | NFC_NFBANK_MASK))
 			 | NFC_ECCRST_MASK, 
 	                (tpIO)(NAND_BASE+NFCONTROL)); 
-		chip->write_buf(mtd, buf + dataOffset, eccsize);
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		dma_section = !lf1000_nand_dma_start(buf + dataOffset, eccsize,
+						     DMA_TO_DEVICE, &sg);
+		if (!dma_section)
+#endif
+			sectionAND = lf1000_nand_write_section_pio(mtd,
+						buf + dataOffset, eccsize);
 
 		/* This routine won't be called to write a buffer with all FFs 
 		 * to NAND, but subsections of the buffer might contain only 
@@ -654,9 +690,25 @@ static void lf1000_nand_write_page_BCH( struct mtd_info  * mtd,
 		 * of the block's first page.
 		 */
 	        allFF = 0;
-		if (mtd->subpage_sft != 0)
-		        allFF = all_bytes_ff( &buf[dataOffset], eccsize);
+		if (mtd->subpage_sft != 0) {
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+			/* the CPU hasn't seen a DMA section's data yet */
+			if (dma_section)
+				sectionAND = lf1000_and_bytes(&buf[dataOffset],
+							      eccsize, 1);
+#endif
+			allFF = (sectionAND == 0xFFFFFFFF);
+		}
 
+#ifdef CONFIG_MTD_NAND_LF1000_DMA
+		/* the rest of the page can't follow a section that didn't
+		 * make it; lf1000_nand_write_page() will reset the chip
+		 * rather than program it */
+		if (dma_section && lf1000_nand_dma_finish(&sg, DMA_TO_DEVICE)) {
+			nand.dma_write_failed = 1;
+			return;
+		}
+#endif
 	        while(IS_CLR(readl((tpIO)(NAND_BASE+NFECCSTATUS)), NFECCENCDONE))
 	        	;
 
@@ -15,6 +15,9 @@
 #include <mach/platform.h>
 #include <mach/common.h>
 #include <mach/nand.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
 #include <asm/io.h>
 #include <asm/sizes.h>
 
@@ -37,6 +40,7 @@
  * MES_NAND_GetErrorLocation( int *pLocation )
  ******************************************************************************/
 
+#ifdef CONFIG_MTD_NAND_LF1000_BCH_SELFTEST
 extern const short BCH_AlphaToTable[8192];
 extern const short BCH_IndexOfTable[8192];
 extern const unsigned int BCH_TGRTable[52][2];
@@ -219,6 +223,337 @@ int lf1000_GetErrorLocation (int *pLocation, u16 s1, u16 s3, u16 s5, u16 s7)
 	}
 }
 
+#endif /* CONFIG_MTD_NAND_LF1000_BCH_SELFTEST */
+
+/******************************************************************************
+ * Table-free BCH error locator
+ *
+ * The code is a 4-bit correcting BCH code over GF(2^13) (primitive polynomial
+ * x^13 + x^10 + x^8 + x^7 + x^5 + x^3 + x^2 + x + 1) shortened to 4096 data
+ * bits plus 52 parity bits.  lf1000_GetErrorLocation() above does all of its
+ * field arithmetic through two 16 KB log/antilog tables and then tries all
+ * 8191 field elements, which evicts most of the ARM926's 16 KB D-cache every
+ * time a section has a bitflip.
+ *
+ * Here field elements stay in polynomial form.  Multiplying by alpha^s is a
+ * shift by s plus a reduction of the s bits shifted out of the top; the
+ * reduction of up to 8 such bits is the only table (bch_red[], 512 bytes).
+ * General products are shift/xor multiplies reduced the same way.  The Chien
+ * search only visits the 4148 positions that are actually in the shortened
+ * codeword, packs two consecutive positions into the halves of each 32-bit
+ * register so that every pass evaluates two roots, and stops as soon as it
+ * has found as many roots as the error locator polynomial has.
+ ******************************************************************************/
+
+#define BCH_M		13
+#define BCH_N		8191			/* 2^13 - 1 */
+#define BCH_MASK	0x1fff
+#define BCH_T		4			/* correctable errors */
+#define BCH_PARITY_BITS	52
+#define BCH_DATA_BITS	4096
+#define BCH_CW_BITS	(BCH_DATA_BITS + BCH_PARITY_BITS)
+#define BCH_LANE_MASK	0x00010001		/* 1 in both halves */
+#define BCH_POLY_LEN	(2 * BCH_T + 2)
+
+/* bch_red[h] = h(x) * x^13 mod p(x), for the 8 bits above a product */
+static const u16 bch_red[256] =
+{
+	   0, 1455, 2910, 3825, 5820, 4883, 7650, 6221, 2263, 3448,  905, 1574, 7787, 7108, 5429, 4250,	//   0 ~  15
+	4526, 5121, 6896, 8031, 1810,  701, 3148, 2531, 6521, 7382, 4647, 6024, 4037, 2666, 1179,  308,	//  16 ~  31
+	1779,  860, 3501, 2050, 4175, 5600, 6929, 7870, 3620, 2955, 1402,  213, 6296, 7479, 5062, 5737,	//  32 ~  47
+	5981, 4850, 7171, 6572,  481, 1102, 2751, 3856, 8074, 6693, 5332, 4475, 2358, 3225,  616, 1991,	//  48 ~  63
+	3558, 2121, 1720,  791, 7002, 7925, 4100, 5547, 1329,  158, 3695, 3008, 5005, 5666, 6355, 7548,	//  64 ~  79
+	7240, 6631, 5910, 4793, 2804, 3931,  426, 1029, 5279, 4400, 8129, 6766,  547, 1932, 2429, 3282,	//  80 ~  95
+	2837, 3770,   75, 1508, 7593, 6150, 5879, 4952,  962, 1645, 2204, 3379, 5502, 4305, 7712, 7055,	//  96 ~ 111
+	6843, 7956, 4581, 5194, 3079, 2472, 1881,  758, 4716, 6083, 6450, 7325, 1232,  383, 3982, 2593,	// 112 ~ 127
+	7116, 7779, 4242, 5437, 3440, 2271, 1582,  897, 4891, 5812, 6213, 7658, 1447,    8, 3833, 2902,	// 128 ~ 143
+	2658, 4045,  316, 1171, 7390, 6513, 6016, 4655,  693, 1818, 2539, 3140, 5129, 4518, 8023, 6904,	// 144 ~ 159
+	7487, 6288, 5729, 5070, 2947, 3628,  221, 1394, 5608, 4167, 7862, 6937,  852, 1787, 2058, 3493,	// 160 ~ 175
+	3217, 2366, 1999,  608, 6701, 8066, 4467, 5340, 1094,  489, 3864, 2743, 4858, 5973, 6564, 7179,	// 176 ~ 191
+	5674, 4997, 7540, 6363,  150, 1337, 3016, 3687, 7933, 6994, 5539, 4108, 2113, 3566,  799, 1712,	// 192 ~ 207
+	1924,  555, 3290, 2421, 4408, 5271, 6758, 8137, 3923, 2812, 1037,  418, 6639, 7232, 4785, 5918,	// 208 ~ 223
+	4313, 5494, 7047, 7720, 1637,  970, 3387, 2196, 6158, 7585, 4944, 5887, 3762, 2845, 1516,   67,	// 224 ~ 239
+	 375, 1240, 2601, 3974, 6091, 4708, 7317, 6458, 2464, 3087,  766, 1873, 7964, 6835, 5186, 4589,	// 240 ~ 255
+};
+
+static u32 bch_mul(u32 a, u32 b)
+{
+	u32 p = 0;
+
+	if (!a || !b)
+		return 0;
+	for ( ; b; b >>= 1, a <<= 1)
+		if (b & 1)
+			p ^= a;
+
+	/* p has at most 25 bits: fold bits 17..24, then bits 13..16 */
+	p = (p & 0x1ffff) ^ (bch_red[p >> 17] << 4);
+	return (p & BCH_MASK) ^ bch_red[p >> BCH_M];
+}
+
+static u32 bch_pow(u32 a, unsigned int n)
+{
+	u32 r = 1;
+
+	for (n %= BCH_N; n; n >>= 1) {
+		if (n & 1)
+			r = bch_mul(r, a);
+		a = bch_mul(a, a);
+	}
+	return r;
+}
+
+/* Multiply a Berlekamp-Massey scratch polynomial by x^2 */
+static inline void bch_shift2(u32 *B)
+{
+	memmove(B + 2, B, (BCH_POLY_LEN - 2) * sizeof(*B));
+	B[0] = B[1] = 0;
+}
+
+/* a^-1 = a^(2^13 - 2) */
+static inline u32 bch_inv(u32 a)
+{
+	return bch_pow(a, BCH_N - 1);
+}
+
+/* Convert a codeword bit position to the layout TryToCorrectBCH_Errors uses:
+ * 0..4095 are data bits, 4096..4147 are parity bits.
+ */
+static inline int bch_storage_bit(int loc)
+{
+	if (loc >= BCH_PARITY_BITS)
+		return BCH_DATA_BITS - 1 - (loc - BCH_PARITY_BITS);
+	return loc + BCH_DATA_BITS;
+}
+
+/**
+ * lf1000_bch_locate - find the bit errors described by a set of syndromes
+ * @pLocation: receives up to 4 error bit positions
+ * @s1: syndromes read from NFSYNDRONE31 and NFSYNDRONE75
+ * @s3:
+ * @s5:
+ * @s7:
+ *
+ * Drop-in replacement for lf1000_GetErrorLocation(): returns the number of
+ * errors found (0 to 4), or -1 if they cannot be corrected.
+ */
+int lf1000_bch_locate(int *pLocation, u16 s1, u16 s3, u16 s5, u16 s7)
+{
+	u32 s[2 * BCH_T];
+	u32 elp[BCH_POLY_LEN], B[BCH_POLY_LEN], t[BCH_POLY_LEN];
+	u32 reg[BCH_T + 1], lmask[BCH_T + 1];
+	u32 Delta, sum, inv;
+	int L, r, i, j, count;
+
+	s[0] = s1;
+	s[2] = s3;
+	s[4] = s5;
+	s[6] = s7;
+
+	/* Even syndrome = (odd syndrome) ** 2 */
+	for (i = 1, j = 0; i < 2 * BCH_T; i += 2, j++)
+		s[i] = bch_mul(s[j], s[j]);
+
+	/*
+	 * Binary Berlekamp-Massey, two syndromes per step.  The update applied
+	 * at each step is Delta * x^2 * B.  Unlike lf1000_GetErrorLocation(),
+	 * this also copes with S1 == 0 (possible with three or four errors),
+	 * for which the first step is skipped rather than dividing by zero.
+	 */
+	memset(elp, 0, sizeof(elp));
+	memset(B, 0, sizeof(B));
+	elp[0] = 1;
+	if (s[0]) {
+		elp[1] = s[0];
+		B[0] = bch_inv(s[0]);
+		L = 1;
+	} else {
+		B[1] = 1;
+		L = 0;
+	}
+
+	for (r = 3; r <= 2 * BCH_T - 1; r += 2) {
+		Delta = s[r-1];
+		for (i = 1; i <= L; i++)
+			Delta ^= bch_mul(s[r-i-1], elp[i]);
+
+		if (Delta == 0) {
+			bch_shift2(B);
+			continue;
+		}
+
+		/* new error locator polynomial */
+		t[0] = elp[0];
+		t[1] = elp[1];
+		for (i = 2; i < BCH_POLY_LEN; i++)
+			t[i] = elp[i] ^ bch_mul(Delta, B[i-2]);
+
+		/* new scratch polynomial and register length */
+		if (2 * L >= r) {
+			bch_shift2(B);
+		} else {
+			inv = bch_inv(Delta);
+			for (i = 0; i < BCH_POLY_LEN; i++)
+				B[i] = bch_mul(elp[i], inv);
+			L = r - L;
+		}
+		memcpy(elp, t, sizeof(elp));
+	}
+
+	if (L > BCH_T)
+		return -1;
+	if (L == 0)
+		return 0;
+
+	/*
+	 * Chien search over the codeword only.  Position i (alpha^i a root)
+	 * is codeword bit 8191 - i, so bits 4147..0 are i = 4044..8191.  The
+	 * low half of reg[j] holds elp[j] * alpha^(i*j) and the high half the
+	 * same term for i + 1; both step by alpha^(2j) per pass.
+	 */
+	i = BCH_N - (BCH_CW_BITS - 1);
+	for (j = 1; j <= L; j++) {
+		u32 lo = bch_mul(elp[j], bch_pow(2, i * j));
+
+		reg[j] = lo | (bch_mul(lo, bch_pow(2, j)) << 16);
+		lmask[j] = ((1 << (BCH_M - 2 * j)) - 1) * BCH_LANE_MASK;
+	}
+
+	count = 0;
+	for ( ; i < BCH_N; i += 2) {
+		sum = BCH_LANE_MASK;
+		for (j = 1; j <= L; j++)
+			sum ^= reg[j];
+
+		if (unlikely(!(sum & BCH_MASK) || !(sum >> 16))) {
+			if (!(sum & BCH_MASK))
+				pLocation[count++] = bch_storage_bit(BCH_N - i);
+			if (!(sum >> 16) && count < L)
+				pLocation[count++] = bch_storage_bit(BCH_N - i - 1);
+			if (count == L)
+				break;
+		}
+
+		for (j = 1; j <= L; j++) {
+			u32 v = reg[j];
+			int sh = 2 * j;
+			u32 hm = (1 << sh) - 1;
+
+			reg[j] = ((v & lmask[j]) << sh) ^
+				bch_red[(v >> (BCH_M - sh)) & hm] ^
+				(bch_red[(v >> (16 + BCH_M - sh)) & hm] << 16);
+		}
+	}
+
+	/* Number of roots != degree of ELP => more than 4 errors */
+	return count == L ? L : -1;
+}
+
+#ifdef CONFIG_MTD_NAND_LF1000_BCH_SELFTEST
+/* Inverse of bch_storage_bit() */
+static inline int bch_codeword_bit(int bit)
+{
+	if (bit < BCH_DATA_BITS)
+		return BCH_PARITY_BITS + (BCH_DATA_BITS - 1 - bit);
+	return bit - BCH_DATA_BITS;
+}
+
+static int bch_cmp_locations(const int *a, int na, const int *b, int nb)
+{
+	int i, j;
+
+	if (na != nb)
+		return 1;
+	for (i = 0; i < na; i++) {
+		for (j = 0; j < nb; j++)
+			if (a[i] == b[j])
+				break;
+		if (j == nb)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * lf1000_bch_selftest - check lf1000_bch_locate() against the table locator
+ * @buf: sysfs buffer for the report
+ * @trials: number of 512-byte sectors to corrupt
+ *
+ * Each trial fills a sector with random data, flips 1 to 4 random bits of
+ * the 4148-bit codeword, computes the syndromes the controller would report
+ * and runs both locators on them.  A trial fails if applying the corrections
+ * lf1000_bch_locate() reports does not restore the sector; "differ" counts
+ * the trials on which the table locator gave another answer (it cannot
+ * handle S1 == 0, for instance).
+ */
+ssize_t lf1000_bch_selftest(char *buf, int trials)
+{
+	u8 *orig, *data;
+	int bits[BCH_T], loc_tab[BCH_T], loc_new[BCH_T];
+	int n, i, j, k, r_tab, r_new, failed = 0, differ = 0;
+	u32 s[BCH_T];
+	s64 us_tab = 0, us_new = 0;
+	ktime_t t0, t1, t2;
+
+	orig = kmalloc(2 * 512, GFP_KERNEL);
+	if (!orig)
+		return -ENOMEM;
+	data = orig + 512;
+
+	for (n = 0; n < trials; n++) {
+		for (i = 0; i < 512; i += 4)
+			*(u32 *)(orig + i) = random32();
+		memcpy(data, orig, 512);
+
+		/* pick 1..4 distinct bits, flip the ones that are data bits */
+		k = 1 + (n % BCH_T);
+		for (i = 0; i < k; i++) {
+			do {
+				bits[i] = random32() % BCH_CW_BITS;
+				for (j = 0; j < i; j++)
+					if (bits[j] == bits[i])
+						break;
+			} while (j < i);
+			if (bits[i] < BCH_DATA_BITS)
+				data[bits[i] >> 3] ^= 1 << (bits[i] & 7);
+		}
+
+		/* S(2m+1) = sum of alpha^((2m+1) * codeword bit) */
+		memset(s, 0, sizeof(s));
+		for (i = 0; i < k; i++)
+			for (j = 0; j < BCH_T; j++)
+				s[j] ^= bch_pow(2, (2 * j + 1) *
+						bch_codeword_bit(bits[i]));
+
+		t0 = ktime_get();
+		r_tab = lf1000_GetErrorLocation(loc_tab, s[0], s[1], s[2], s[3]);
+		t1 = ktime_get();
+		r_new = lf1000_bch_locate(loc_new, s[0], s[1], s[2], s[3]);
+		t2 = ktime_get();
+		us_tab += ktime_us_delta(t1, t0);
+		us_new += ktime_us_delta(t2, t1);
+
+		if (bch_cmp_locations(loc_tab, r_tab, loc_new, r_new))
+			differ++;
+		if (r_new != k) {
+			failed++;
+			continue;
+		}
+		for (i = 0; i < r_new; i++)
+			if (loc_new[i] < BCH_DATA_BITS)
+				data[loc_new[i] >> 3] ^= 1 << (loc_new[i] & 7);
+		if (memcmp(data, orig, 512))
+			failed++;
+	}
+	kfree(orig);
+
+	return sprintf(buf, "trials %d failed %d differ %d\n"
+			    "table locator %lld us\n"
+			    "table-free locator %lld us\n",
+			trials, failed, differ, us_tab, us_new);
+}
+#endif /* CONFIG_MTD_NAND_LF1000_BCH_SELFTEST */
+
     /* returns 0 if no errors
      *      N >0 if N errors were corrected
      *        <0 if uncorrectable errors
@@ -239,7 +574,7 @@ int TryToCorrectBCH_Errors( u8 * pData )
     s3 = (x >> SYNDROM3) & 0x1fff;
     s1 = (x >> SYNDROM1) & 0x1fff;
 
-    numErrors = lf1000_GetErrorLocation( &errorLocations[0], s1, s3, s5, s7);
+    numErrors = lf1000_bch_locate( &errorLocations[0], s1, s3, s5, s7);
 	    /* If there is one or more correctable errors 		 
          * ('numErrors' is the number of correctable errors)
 	     */
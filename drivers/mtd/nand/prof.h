@@ -14,7 +14,8 @@
 /* Nand profiling support */
 
 /* Define the types of nand operations we can accumulate data on */
-enum prof_type { NS_READ, NS_WRITE, NS_ERASE, NS_LOCK, NS_MAX };
+enum prof_type { NS_READ, NS_WRITE, NS_ERASE, NS_LOCK,
+		 NS_READ_DMA, NS_READ_PIO, NS_WRITE_DMA, NS_WRITE_PIO, NS_MAX };
 
 /* The collector function */
 extern void nand_stats_accum (enum prof_type type, int in);
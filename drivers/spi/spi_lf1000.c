@@ -26,9 +26,16 @@
 #include <linux/lf1000/spi_ioctl.h>
 #include <linux/spinlock.h>
 #include <linux/sysfs.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/scatterlist.h>
+#include <linux/mm.h>
 
 #include <mach/common.h>
 #include <mach/gpio.h>
+#ifdef CONFIG_SPI_LF1000_DMA
+#include <mach/dma.h>
+#endif
 #include <mach/platform.h>
 
 #include "spi_lf1000_hal.h"
@@ -43,6 +50,22 @@
 #define LF1000_SPI_MAX_FREQ		25000000
 #define LF1000_SPI_FIFO_DEPTH		32
 
+/*
+ * Transfers up to a FIFO's worth are sent with PIO.  Longer ones are fed a
+ * FIFO at a time from the SPI interrupt, and from LF1000_SPI_DMA_MIN bytes
+ * on the DMA controller moves them in runs of up to LF1000_SPI_DMA_MAX.
+ */
+#define LF1000_SPI_DMA_MIN		256
+#define LF1000_SPI_DMA_MAX		PAGE_SIZE
+#define LF1000_SPI_TIMEOUT		(HZ/2)
+
+enum lf1000_spi_mode {
+	LF1000_SPI_PIO = 0,
+	LF1000_SPI_IRQ,
+	LF1000_SPI_DMA,
+	LF1000_SPI_MODES,
+};
+
 extern void lf1000_dpc_register_spi(struct spi_device *slave);
 
 static int lf1000_spi_setup_transfer(struct spi_device *spi, struct spi_transfer *t);
@@ -91,6 +114,32 @@ struct lf1000_spi {
 	struct list_head	msg_queue;
 	
 	struct spi_master	*master;
+	struct device		*dev;
+
+	/* interrupt and DMA transfers */
+	struct completion	done;
+	int			irq_busy;
+	int			wide;		// 16-bit words
+	const void		*tx;
+	void			*rx;
+	unsigned int		left;		// bytes not yet in the TX FIFO
+	unsigned int		pending;	// bytes in flight
+#ifdef CONFIG_SPI_LF1000_DMA
+	unsigned int		dma_tx;
+	unsigned int		dma_rx;
+	void			*dma_sink;	// RX data nobody asked for
+	struct scatterlist	tx_sg;
+	struct scatterlist	rx_sg;
+#endif
+
+	/* per-message timing, see the "timing" attribute */
+	u32			messages;
+	u32			timeouts;
+	u32			last_us;
+	u32			max_us;
+	u64			total_us;
+	u32			xfers[LF1000_SPI_MODES];
+	u32			bytes[LF1000_SPI_MODES];
 
 #ifdef CONFIG_PROC_FS
 	struct proc_dir_entry	*proc_port;
@@ -131,8 +180,66 @@ static ssize_t show_registers(struct device *dev, struct device_attribute *attr,
 
 static DEVICE_ATTR(registers, S_IRUSR|S_IRGRP, show_registers, NULL);
 
+static ssize_t show_timing(struct device *dev, struct device_attribute *attr,
+				char *buf)
+{
+	static const char *mode_names[LF1000_SPI_MODES] = {
+		[LF1000_SPI_PIO] = "pio",
+		[LF1000_SPI_IRQ] = "irq",
+		[LF1000_SPI_DMA] = "dma",
+	};
+	ssize_t len = 0;
+	struct spi_master	*master;
+	struct lf1000_spi	*lf1000spi;
+	u64			avg;
+	int			i;
+
+	master = dev_get_drvdata(dev);
+	lf1000spi = spi_master_get_devdata(master);
+
+	avg = lf1000spi->total_us;
+	if(lf1000spi->messages)
+		do_div(avg, lf1000spi->messages);
+
+	len += sprintf(buf+len,"messages   = %u\n", lf1000spi->messages);
+	len += sprintf(buf+len,"timeouts   = %u\n", lf1000spi->timeouts);
+	len += sprintf(buf+len,"last_us    = %u\n", lf1000spi->last_us);
+	len += sprintf(buf+len,"max_us     = %u\n", lf1000spi->max_us);
+	len += sprintf(buf+len,"avg_us     = %u\n", (u32)avg);
+	for(i = 0; i < LF1000_SPI_MODES; i++)
+		len += sprintf(buf+len,"%s        = %u transfers, %u bytes\n",
+			mode_names[i], lf1000spi->xfers[i],
+			lf1000spi->bytes[i]);
+
+	return len;
+}
+
+/* any write clears the counters */
+static ssize_t set_timing(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct spi_master	*master;
+	struct lf1000_spi	*lf1000spi;
+
+	master = dev_get_drvdata(dev);
+	lf1000spi = spi_master_get_devdata(master);
+
+	lf1000spi->messages = 0;
+	lf1000spi->timeouts = 0;
+	lf1000spi->last_us = 0;
+	lf1000spi->max_us = 0;
+	lf1000spi->total_us = 0;
+	memset(lf1000spi->xfers, 0, sizeof(lf1000spi->xfers));
+	memset(lf1000spi->bytes, 0, sizeof(lf1000spi->bytes));
+
+	return count;
+}
+
+static DEVICE_ATTR(timing, S_IRUSR|S_IRGRP|S_IWUSR, show_timing, set_timing);
+
 static struct attribute *spi_attributes[] = {
 	&dev_attr_registers.attr,
+	&dev_attr_timing.attr,
 	NULL
 };
 
@@ -144,23 +251,100 @@ static struct attribute_group spi_attr_group = {
 /**********************
  * Interrupt Handling *
  *********************/
+/*
+ * Only the "RX, TX completed" interrupt is used: it fires once everything
+ * in the TX FIFO has been shifted out, by which time the matching RX data
+ * is in the RX FIFO.  Pending status is cleared either way, so enable this
+ * before filling the FIFO.
+ */
 static void lf1000_spi_interrupt(struct lf1000_spi *lf1000spi, u8 en) {
 	u16 reg = ioread16(lf1000spi->base+SSPSPISTATE);
 
-	if(en) {
+	if(en)
 		BIT_SET(reg, IRQEENB);			// RX, TX completed
-		BIT_SET(reg, IRQWENB);			// TX Buffer Empty
-		BIT_SET(reg, IRQRENB);			// RX Buffer Full
-		BIT_SET(reg, IRQE);			// clear status bits
-		BIT_SET(reg, IRQW);
-		BIT_SET(reg, IRQR);
+	else
+		BIT_CLR(reg, IRQEENB);
+	BIT_CLR(reg, IRQWENB);				// TX Buffer Empty
+	BIT_CLR(reg, IRQRENB);				// RX Buffer Full
+	BIT_SET(reg, IRQE);				// clear status bits
+	BIT_SET(reg, IRQW);
+	BIT_SET(reg, IRQR);
+	iowrite16(reg, lf1000spi->base+SSPSPISTATE);
+}
+
+/* wait for the TX FIFO to go out and throw away stale RX data */
+static void lf1000_spi_flush(struct lf1000_spi *lf1000spi)
+{
+	void __iomem *status = lf1000spi->base + SSPSPISTATE;
+
+	while(IS_CLR(ioread16(status), WFFEMPTY) ) ;
+	while(IS_CLR(ioread16(status), RFFEMPTY) )
+		ioread16(lf1000spi->base + SSPSPIDATA);
+}
+
+/* drive CE# for a whole message, see lf1000_spi_work() */
+static void lf1000_spi_cs(struct lf1000_spi *lf1000spi, int active)
+{
+	const struct lf1000_pin_cfg *frm = &pins[lf1000spi->master->bus_num].frm;
+
+	gpio_set_val(frm->port, frm->pin, active ? 0 : 1);
+}
+
+/* queue up to a FIFO's worth of the current interrupt mode transfer */
+static void lf1000_spi_fill(struct lf1000_spi *lf1000spi)
+{
+	void __iomem	*data = lf1000spi->base + SSPSPIDATA;
+	unsigned int	n = MIN(lf1000spi->left, LF1000_SPI_FIFO_DEPTH);
+
+	lf1000spi->left -= n;
+	lf1000spi->pending = n;
+
+	if(lf1000spi->wide) {
+		const u16 *tx = lf1000spi->tx;
+
+		for(; n; n -= 2)
+			iowrite16(tx ? *tx++ : 0, data);
+		lf1000spi->tx = tx;
+	} else {
+		const u8 *tx = lf1000spi->tx;
+
+		for(; n; n--)
+			iowrite8(tx ? *tx++ : 0, data);
+		lf1000spi->tx = tx;
 	}
-	else {
-		BIT_CLR(reg, IRQEENB);			// RX, TX completed
-		BIT_CLR(reg, IRQWENB);			// TX Buffer Empty
-		BIT_CLR(reg, IRQRENB);			// RX Buffer Full
+}
+
+/* collect the RX data for what lf1000_spi_fill() queued */
+static void lf1000_spi_drain(struct lf1000_spi *lf1000spi)
+{
+	void __iomem	*data = lf1000spi->base + SSPSPIDATA;
+	void __iomem	*status = lf1000spi->base + SSPSPISTATE;
+	unsigned int	n = lf1000spi->pending;
+
+	if(lf1000spi->wide) {
+		u16 *rx = lf1000spi->rx;
+
+		for(; n; n -= 2) {
+			while(IS_SET(ioread16(status), RFFEMPTY) ) ;
+			if(rx != NULL)
+				*rx++ = ioread16(data);
+			else
+				ioread16(data);
+		}
+		lf1000spi->rx = rx;
+	} else {
+		u8 *rx = lf1000spi->rx;
+
+		for(; n; n--) {
+			while(IS_SET(ioread16(status), RFFEMPTY) ) ;
+			if(rx != NULL)
+				*rx++ = ioread8(data);
+			else
+				ioread8(data);
+		}
+		lf1000spi->rx = rx;
 	}
-	iowrite16(reg, lf1000spi->base+SSPSPISTATE);
+	lf1000spi->pending = 0;
 }
 
 static irqreturn_t lf1000_spi_irq(int irq, void *dev_id)
@@ -177,7 +361,17 @@ static irqreturn_t lf1000_spi_irq(int irq, void *dev_id)
 	}
 
 	lf1000_spi_interrupt(lf1000spi, 0);
-//	wake_up_interruptible(&lf1000spi->intqueue);	/* wake any tasks */
+	if(!lf1000spi->irq_busy)
+		return(IRQ_HANDLED);
+
+	lf1000_spi_drain(lf1000spi);
+	if(lf1000spi->left) {
+		lf1000_spi_interrupt(lf1000spi, 1);
+		lf1000_spi_fill(lf1000spi);
+	} else {
+		lf1000spi->irq_busy = 0;
+		complete(&lf1000spi->done);
+	}
 	return(IRQ_HANDLED);
 }
 
@@ -210,8 +404,7 @@ lf1000_spi_txrx_pio(struct spi_device *spi, struct spi_transfer *xfer)
 	 */
 
 	/* wait for FIFOs */
-	while(IS_CLR(ioread16(status), WFFEMPTY) ) ;
-	while(IS_CLR(ioread16(status), RFFEMPTY) ) ioread16(txrx_reg);
+	lf1000_spi_flush(lf1000spi);
 
 	if(spi->bits_per_word <= 8)
 	{
@@ -311,6 +504,189 @@ lf1000_spi_txrx_pio(struct spi_device *spi, struct spi_transfer *xfer)
 	return count - c;
 }
 
+/*
+ * Medium transfers: the SPI interrupt drains the RX FIFO and refills the
+ * TX FIFO, so the worker sleeps instead of polling the FIFO flags.
+ */
+static int lf1000_spi_txrx_irq(struct lf1000_spi *lf1000spi,
+		struct spi_transfer *xfer)
+{
+	unsigned long flags;
+
+	lf1000_spi_flush(lf1000spi);
+
+	lf1000spi->tx = xfer->tx_buf;
+	lf1000spi->rx = xfer->rx_buf;
+	lf1000spi->left = xfer->len;
+	lf1000spi->pending = 0;
+	INIT_COMPLETION(lf1000spi->done);
+	lf1000spi->irq_busy = 1;
+
+	/* the handler refills too: don't let it in until the first fill */
+	local_irq_save(flags);
+	lf1000_spi_interrupt(lf1000spi, 1);
+	lf1000_spi_fill(lf1000spi);
+	local_irq_restore(flags);
+
+	if(wait_for_completion_timeout(&lf1000spi->done, LF1000_SPI_TIMEOUT))
+		return 0;
+
+	local_irq_save(flags);
+	lf1000_spi_interrupt(lf1000spi, 0);
+	lf1000spi->irq_busy = 0;
+	local_irq_restore(flags);
+	return -ETIMEDOUT;
+}
+
+#ifdef CONFIG_SPI_LF1000_DMA
+/* the RX channel finishes last: every word sent has been received */
+static irqreturn_t lf1000_spi_dma_irq(int ch, void *data)
+{
+	struct lf1000_spi *lf1000spi = data;
+
+	complete(&lf1000spi->done);
+	return IRQ_HANDLED;
+}
+
+static int lf1000_spi_dma_buf_ok(const void *buf, unsigned int len, int wide)
+{
+	if(buf == NULL)
+		return 1;
+	if(wide && ((unsigned long)buf & 1))
+		return 0;
+	return virt_addr_valid(buf) && virt_addr_valid(buf + len - 1);
+}
+
+/*
+ * Large transfers: the TX and RX channels move the data between memory and
+ * the SPI data register on the SPI's DMA requests.  A missing TX buffer
+ * sends zeros from the zero page and a missing RX buffer is received into
+ * dma_sink, so runs are at most a page long.
+ */
+static int lf1000_spi_txrx_dma(struct lf1000_spi *lf1000spi,
+		struct spi_transfer *xfer)
+{
+	unsigned int		chan = lf1000spi->master->bus_num;
+	unsigned int		data = lf1000spi->phys + SSPSPIDATA;
+	unsigned int		done = 0, n;
+	struct dma_control	tx_ctrl, rx_ctrl;
+	const void		*tx;
+	void			*rx;
+	u16			cont0;
+	int			ret = 0;
+
+	memset(&tx_ctrl, 0, sizeof(struct dma_control));
+	tx_ctrl.transfer = DMA_MEM_TO_IO;
+	tx_ctrl.interrupt = DMA_INT_DISABLE;
+	tx_ctrl.request_id = (enum dma_request_id)(DMA_PERI_SPI0TX + 2*chan);
+	tx_ctrl.src_width = lf1000spi->wide ? 2 : 1;
+	tx_ctrl.dest_width = tx_ctrl.src_width;
+
+	memcpy(&rx_ctrl, &tx_ctrl, sizeof(struct dma_control));
+	rx_ctrl.transfer = DMA_IO_TO_MEM;
+	rx_ctrl.interrupt = DMA_INT_LAST_BLOCK;
+	rx_ctrl.request_id = (enum dma_request_id)(DMA_PERI_SPI0RX + 2*chan);
+
+	lf1000_spi_flush(lf1000spi);
+
+	cont0 = ioread16(lf1000spi->base+SSPSPICONT0);
+	iowrite16(cont0 | (1<<DMAENB), lf1000spi->base+SSPSPICONT0);
+
+	while(done < xfer->len && !ret) {
+		n = MIN(xfer->len - done, LF1000_SPI_DMA_MAX);
+
+		tx = xfer->tx_buf ? xfer->tx_buf + done :
+			page_address(ZERO_PAGE(0));
+		rx = xfer->rx_buf ? xfer->rx_buf + done : lf1000spi->dma_sink;
+
+		sg_init_one(&lf1000spi->tx_sg, tx, n);
+		sg_init_one(&lf1000spi->rx_sg, rx, n);
+		dma_map_sg(lf1000spi->dev, &lf1000spi->tx_sg, 1, DMA_TO_DEVICE);
+		dma_map_sg(lf1000spi->dev, &lf1000spi->rx_sg, 1,
+				DMA_FROM_DEVICE);
+
+		dma_transfer_init(lf1000spi->dma_rx, DMA_MEM_IO);
+		dma_transfer_init(lf1000spi->dma_tx, DMA_MEM_IO);
+		if(dma_sg_read(lf1000spi->dma_rx, data, &lf1000spi->rx_sg, 1,
+					&rx_ctrl) ||
+		   dma_sg_write(lf1000spi->dma_tx, &lf1000spi->tx_sg, data, 1,
+			   		&tx_ctrl)) {
+			ret = -EIO;
+			goto unmap;
+		}
+
+		INIT_COMPLETION(lf1000spi->done);
+		dma_start(lf1000spi->dma_rx);
+		dma_start(lf1000spi->dma_tx);
+
+		if(!wait_for_completion_timeout(&lf1000spi->done,
+					LF1000_SPI_TIMEOUT)) {
+			dma_stop(lf1000spi->dma_tx);
+			dma_stop(lf1000spi->dma_rx);
+			ret = -ETIMEDOUT;
+		}
+unmap:
+		dma_unmap_sg(lf1000spi->dev, &lf1000spi->rx_sg, 1,
+				DMA_FROM_DEVICE);
+		dma_unmap_sg(lf1000spi->dev, &lf1000spi->tx_sg, 1,
+				DMA_TO_DEVICE);
+		done += n;
+	}
+
+	iowrite16(cont0 & ~(1<<DMAENB), lf1000spi->base+SSPSPICONT0);
+	return ret;
+}
+#endif /* CONFIG_SPI_LF1000_DMA */
+
+static int lf1000_spi_txrx(struct spi_device *spi, struct spi_transfer *xfer)
+{
+	struct lf1000_spi	*lf1000spi = spi_master_get_devdata(spi->master);
+	enum lf1000_spi_mode	mode = LF1000_SPI_PIO;
+	u8			bits = spi->bits_per_word;
+	int			ret = 0;
+
+	if(xfer->bits_per_word)
+		bits = xfer->bits_per_word;
+	lf1000spi->wide = bits > 8;
+
+	if(xfer->len > LF1000_SPI_FIFO_DEPTH &&
+	   !(lf1000spi->wide && (xfer->len & 1)))
+		mode = LF1000_SPI_IRQ;
+#ifdef CONFIG_SPI_LF1000_DMA
+	if(mode == LF1000_SPI_IRQ && xfer->len >= LF1000_SPI_DMA_MIN &&
+	   lf1000spi->dma_tx && lf1000spi->dma_rx &&
+	   lf1000_spi_dma_buf_ok(xfer->tx_buf, xfer->len, lf1000spi->wide) &&
+	   lf1000_spi_dma_buf_ok(xfer->rx_buf, xfer->len, lf1000spi->wide))
+		mode = LF1000_SPI_DMA;
+#endif
+
+	switch(mode) {
+	case LF1000_SPI_PIO:
+		if(lf1000_spi_txrx_pio(spi, xfer) != xfer->len)
+			ret = -EIO;
+		break;
+	case LF1000_SPI_IRQ:
+		ret = lf1000_spi_txrx_irq(lf1000spi, xfer);
+		break;
+#ifdef CONFIG_SPI_LF1000_DMA
+	case LF1000_SPI_DMA:
+		ret = lf1000_spi_txrx_dma(lf1000spi, xfer);
+		break;
+#endif
+	default:
+		ret = -EINVAL;
+	}
+
+	if(ret == -ETIMEDOUT) {
+		dev_err(lf1000spi->dev, "%u byte transfer timed out\n",
+				xfer->len);
+		lf1000spi->timeouts++;
+	}
+	lf1000spi->xfers[mode]++;
+	lf1000spi->bytes[mode] += xfer->len;
+	return ret;
+}
+
 static void lf1000_spi_work(struct work_struct *work)
 {
 	struct lf1000_spi	*lf1000spi;
@@ -325,6 +701,8 @@ static void lf1000_spi_work(struct work_struct *work)
 		struct spi_transfer	*t = NULL;
 		int			par_override = 0;
 		int			status = 0;
+		ktime_t			start;
+		u32			us;
 		
 		m = container_of(lf1000spi->msg_queue.next, struct spi_message,
 		                 queue);
@@ -334,6 +712,14 @@ static void lf1000_spi_work(struct work_struct *work)
 
 		spi = m->spi;
 
+		/*
+		 * CE# is a GPIO held low for the whole message, so slaves see
+		 * one command even across transfers, FIFO refills and DMA
+		 * runs.  cs_change drops it between two transfers.
+		 */
+		start = ktime_get();
+		lf1000_spi_cs(lf1000spi, 1);
+
 		list_for_each_entry(t, &m->transfers, transfer_list)
 		{
 			if(t->tx_buf == NULL && t->rx_buf == NULL && t->len)
@@ -352,27 +738,39 @@ static void lf1000_spi_work(struct work_struct *work)
 
 			if(t->len)
 			{
-				unsigned	count;
-				count = lf1000_spi_txrx_pio(spi, t);
-
-				if(count != t->len)
-				{
-					status = -EIO;
+				status = lf1000_spi_txrx(spi, t);
+				if(status < 0)
 					break;
-				}
+				m->actual_length += t->len;
 			}
 
 			if(t->delay_usecs)
 				udelay(t->delay_usecs);
 
+			if(t->cs_change &&
+			   !list_is_last(&t->transfer_list, &m->transfers))
+			{
+				lf1000_spi_cs(lf1000spi, 0);
+				udelay(1);
+				lf1000_spi_cs(lf1000spi, 1);
+			}
 		}
 
+		lf1000_spi_cs(lf1000spi, 0);
+
 		if(par_override)
 		{
 			par_override = 0;
 			status = lf1000_spi_setup_transfer(spi, NULL);
 		}
 
+		us = (u32)ktime_us_delta(ktime_get(), start);
+		lf1000spi->messages++;
+		lf1000spi->last_us = us;
+		lf1000spi->total_us += us;
+		if(us > lf1000spi->max_us)
+			lf1000spi->max_us = us;
+
 		m->status = status;
 		m->complete(m->context);
 
@@ -504,6 +902,7 @@ static int lf1000_spi_probe(struct platform_device *pdev)
 
 	lf1000spi = spi_master_get_devdata(master);
 	lf1000spi->master = master;
+	lf1000spi->dev = &pdev->dev;
 
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if(!res) {
@@ -531,6 +930,7 @@ static int lf1000_spi_probe(struct platform_device *pdev)
 
 	spin_lock_init(&lf1000spi->lock);
 	INIT_LIST_HEAD(&lf1000spi->msg_queue);
+	init_completion(&lf1000spi->done);
 
 	div = lf1000_CalcDivider(get_pll_freq(SPI_CLK_SRC), SPI_SRC_HZ);
 	if(div < 0) {
@@ -563,9 +963,10 @@ static int lf1000_spi_probe(struct platform_device *pdev)
 	gpio_configure_pin( pins[chan].clk.port,
 	                    pins[chan].clk.pin,
 	                    pins[chan].clk.fn, 1, 0, 0);
+	/* CE# is driven by software, see lf1000_spi_cs() */
 	gpio_configure_pin( pins[chan].frm.port,
 	                    pins[chan].frm.pin,
-	                    pins[chan].frm.fn, 1, 0, 1);
+	                    GPIO_GPIOFN, 1, 0, 1);
 
 	lf1000spi->irq = platform_get_irq(pdev, 0);
 	if(lf1000spi->irq < 0) {
@@ -580,6 +981,27 @@ static int lf1000_spi_probe(struct platform_device *pdev)
 		goto fail_irq;
 	}
 
+#ifdef CONFIG_SPI_LF1000_DMA
+	/* Without both channels large transfers use the interrupt mode. */
+	lf1000spi->dma_sink = (void *)__get_free_page(GFP_KERNEL);
+	if(lf1000spi->dma_sink != NULL) {
+		char name[12];
+
+		sprintf(name, "spi%d-rx", chan);
+		if(dma_request(name, DMA_PRIORITY_LV2 | DMA_PRIORITY_LV3,
+				lf1000_spi_dma_irq, lf1000spi,
+				&lf1000spi->dma_rx))
+			lf1000spi->dma_rx = 0;
+		sprintf(name, "spi%d-tx", chan);
+		if(lf1000spi->dma_rx &&
+		   dma_request(name, DMA_PRIORITY_LV2 | DMA_PRIORITY_LV3,
+				NULL, NULL, &lf1000spi->dma_tx))
+			lf1000spi->dma_tx = 0;
+	}
+	if(!lf1000spi->dma_tx)
+		dev_warn(&pdev->dev, "no DMA channels, not using DMA\n");
+#endif
+
 #ifdef CONFIG_SPI_DEBUG
 	sysfs_create_group(&pdev->dev.kobj, &spi_attr_group);
 #endif
@@ -616,6 +1038,15 @@ static int lf1000_spi_remove(struct platform_device *pdev)
 	if(lf1000spi->irq != -1)
 		free_irq(lf1000spi->irq, master);
 
+#ifdef CONFIG_SPI_LF1000_DMA
+	if(lf1000spi->dma_tx)
+		dma_release(lf1000spi->dma_tx);
+	if(lf1000spi->dma_rx)
+		dma_release(lf1000spi->dma_rx);
+	if(lf1000spi->dma_sink != NULL)
+		free_page((unsigned long)lf1000spi->dma_sink);
+#endif
+
 	if(lf1000spi->base != NULL)
 		iounmap(lf1000spi->base);
 
@@ -39,6 +39,8 @@
 
 #include <linux/debugfs.h>
 #include <linux/input.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
 
 #include <linux/usb.h>
 #include <linux/usb/gadget.h>
@@ -52,6 +54,7 @@
 #include <asm/mach-types.h>
 
 #include <mach/gpio.h>
+#include <mach/dma.h>
 
 #include "lf1000_udc.h"
 
@@ -283,6 +286,46 @@ static void done(struct lf1000_ep *ep, struct lf1000_request *req, int status)
 	ep->halted = halted;
 }
 
+#ifdef CONFIG_USB_LF1000_DMA
+/*
+ * Bulk endpoints move whole packets with the DMA controller: the UDC is put
+ * in DMA demand mode with DTCR set to the packet size and DTTCR to the
+ * length of the run, and raises the endpoint's DMA request for each packet.
+ * A run covers up to LF1000_UDC_DMA_MAX bytes of one request; a short tail
+ * and zero length packets are left to write_req()/read_req().  While a run
+ * is in progress handle_ep() leaves the endpoint alone apart from acking
+ * the per-packet TPS (IN) and catching a short packet (OUT).
+ */
+#define LF1000_UDC_DMA_MAX	(32 * 1024)
+
+/* take the endpoint out of DMA mode and give the buffer back to the CPU */
+static void lf1000_ep_dma_stop(struct lf1000_ep *ep, unsigned int len)
+{
+	struct lf1000_udc *udc = ep->dev;
+	struct lf1000_request *req = ep->dma_req;
+
+	writew(ep->num, udc->base_addr + UDC_EPINDEX);
+	clear_mask(udc, (1<<DEN)|(1<<DMDE)|(1<<TDR)|(1<<RDR), UDC_DCR);
+	dma_unmap_sg(&udc->pdev->dev, &ep->dma_sg, 1,
+			ep->is_in ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	req->req.actual += len;
+	udc->dma_bytes += len;
+	ep->dma_req = NULL;
+}
+
+/* cancel a run: the request is being dequeued or the endpoint reset */
+static void lf1000_ep_dma_abort(struct lf1000_ep *ep)
+{
+	struct lf1000_udc *udc = ep->dev;
+
+	if (!ep->dma_req)
+		return;
+	dma_abort(ep->dma_ch);
+	lf1000_ep_dma_stop(ep, 0);
+	set_mask(udc, (1<<FLUSH), UDC_EPCTL);
+}
+#endif /* CONFIG_USB_LF1000_DMA */
+
 static void nuke(struct lf1000_ep *ep, int status)
 {
 	struct lf1000_request  *req;
@@ -290,6 +333,10 @@ static void nuke(struct lf1000_ep *ep, int status)
 	if (&ep->queue == NULL) /* FIXME */
 		return;
 
+#ifdef CONFIG_USB_LF1000_DMA
+	lf1000_ep_dma_abort(ep);
+#endif
+
 	while (!list_empty (&ep->queue)) {
 		req = list_entry(ep->queue.next, struct lf1000_request, queue);
 		done(ep, req, status);
@@ -633,14 +680,192 @@ int read_req(struct lf1000_ep *ep, struct lf1000_request *req)
 	if (pkt_len == 0 && req->req.actual == 0)
 		return 0;
 
+	/* A short packet ends the request.  If the gadget set short_not_ok
+	 * that is an error, for PIO as well as DMA reads: earlier versions of
+	 * this driver completed it with 0, which gadget drivers asking for
+	 * short_not_ok couldn't tell from a full read. */
 	if (is_short || req->req.actual == req->req.length) {
 		dprintk(DEBUG_VERBOSE, "Transfer complete.\n");
-		done(ep, req, 0);
+		done(ep, req, (is_short && req->req.short_not_ok &&
+				req->req.actual < req->req.length) ?
+				-EREMOTEIO : 0);
 		return 1;
 	}
 	return 0;
 }
 
+#ifdef CONFIG_USB_LF1000_DMA
+/*
+ * Start a DMA run for as many whole packets of 'req' as we can.  Returns 1
+ * if the run was started, 0 if the caller should use PIO: no channel, not
+ * a bulk endpoint, fewer than two packets left, or a buffer that's odd or
+ * outside the kernel's linear mapping.
+ */
+static int lf1000_ep_dma_start(struct lf1000_ep *ep, struct lf1000_request *req)
+{
+	struct lf1000_udc *udc = ep->dev;
+	unsigned int maxp = ep->ep.maxpacket;
+	unsigned int len = req->req.length - req->req.actual;
+	char *buf = req->req.buf + req->req.actual;
+	enum dma_data_direction dir;
+	struct dma_control ctrl;
+	u32 fifo;
+	int ret;
+
+	if (!ep->dma_ch || ep->dma_req || !ep->desc || !maxp ||
+	    (ep->desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) !=
+	    USB_ENDPOINT_XFER_BULK)
+		return 0;
+
+	if (len > LF1000_UDC_DMA_MAX)
+		len = LF1000_UDC_DMA_MAX;
+	len -= len % maxp;
+	if (len < 2 * maxp || ((unsigned long)buf & 1) ||
+	    !virt_addr_valid(buf) || !virt_addr_valid(buf + len - 1))
+		return 0;
+
+	dir = ep->is_in ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	sg_init_one(&ep->dma_sg, buf, len);
+	if (!dma_map_sg(&udc->pdev->dev, &ep->dma_sg, 1, dir))
+		return 0;
+
+	memset(&ctrl, 0, sizeof(struct dma_control));
+	ctrl.interrupt = DMA_INT_LAST_BLOCK;
+	ctrl.request_id = (ep->num == 1) ? DMA_PERI_USBEP1 : DMA_PERI_USBEP2;
+	ctrl.src_width = 2;
+	ctrl.dest_width = 2;
+
+	fifo = udc->res->start + UDC_EPBUFS + 2*ep->num;
+	dma_transfer_init(ep->dma_ch, DMA_MEM_IO);
+	if (ep->is_in) {
+		ctrl.transfer = DMA_MEM_TO_IO;
+		ret = dma_sg_write(ep->dma_ch, &ep->dma_sg, fifo, 1, &ctrl);
+	} else {
+		ctrl.transfer = DMA_IO_TO_MEM;
+		ret = dma_sg_read(ep->dma_ch, fifo, &ep->dma_sg, 1, &ctrl);
+	}
+	if (ret)
+		goto unmap;
+
+	ep->dma_req = req;
+	ep->dma_len = len;
+
+	writew(ep->num, udc->base_addr + UDC_EPINDEX);
+	writew(maxp, udc->base_addr + UDC_DTCR);
+	writew(len, udc->base_addr + UDC_DTTCR);
+	writew((1<<DEN)|(1<<DMDE)|(1<<(ep->is_in ? TDR : RDR)),
+			udc->base_addr + UDC_DCR);
+
+	if (dma_start(ep->dma_ch)) {
+		writew(0, udc->base_addr + UDC_DCR);
+		ep->dma_req = NULL;
+		goto unmap;
+	}
+	udc->dma_runs++;
+	dprintk(DEBUG_VERBOSE, "ep%d: DMA %s %d bytes\n", ep->num,
+			ep->is_in ? "in" : "out", len);
+	return 1;
+
+unmap:
+	dma_unmap_sg(&udc->pdev->dev, &ep->dma_sg, 1, dir);
+	return 0;
+}
+#endif /* CONFIG_USB_LF1000_DMA */
+
+/* start (or continue) the request at the head of the queue */
+static void lf1000_ep_kick(struct lf1000_ep *ep)
+{
+	struct lf1000_request *req;
+
+	if (list_empty(&ep->queue))
+		return;
+	req = list_entry(ep->queue.next, struct lf1000_request, queue);
+
+#ifdef CONFIG_USB_LF1000_DMA
+	if (lf1000_ep_dma_start(ep, req))
+		return;
+#endif
+	if (ep->bEndpointAddress & USB_DIR_IN)
+		write_req(ep, req);
+	else
+		read_req(ep, req);
+}
+
+#ifdef CONFIG_USB_LF1000_DMA
+/* the DMA controller has moved the last byte of a run */
+static irqreturn_t lf1000_udc_dma_irq(int ch, void *data)
+{
+	struct lf1000_ep *ep = data;
+	struct lf1000_udc *udc = ep->dev;
+	struct lf1000_request *req = ep->dma_req;
+	u16 idx;
+
+	if (!req)
+		return IRQ_HANDLED;
+
+	idx = readw(udc->base_addr + UDC_EPINDEX);
+	lf1000_ep_dma_stop(ep, ep->dma_len);
+
+	if (req->req.actual == req->req.length &&
+	    !(ep->is_in && req->req.zero)) {
+		/* like write_req(), an IN request is done once it's all in
+		 * the FIFO */
+		done(ep, req, 0);
+		lf1000_ep_kick(ep);
+	} else if (ep->is_in) {
+		/* a short tail or a zero length packet is left; send it now
+		 * if the last packet is gone, otherwise on its TPS */
+		if (!((readw(udc->base_addr + UDC_EPSTAT)>>PSIF) & 0x3))
+			write_req(ep, req);
+	} else {
+		/* pick up a packet that came in behind the run, if any */
+		lf1000_ep_kick(ep);
+	}
+
+	writew(idx, udc->base_addr + UDC_EPINDEX);
+	return IRQ_HANDLED;
+}
+
+/*
+ * Endpoint interrupt while a DMA run is in progress.  The FIFO belongs to
+ * the DMA, so just ack IN packets.  An OUT packet shorter than maxpacket
+ * ends the transfer: the UDC won't ask the DMA to move it, so stop the run
+ * where it got to and read the short packet with PIO.
+ */
+static void handle_ep_dma(struct lf1000_ep *ep, u32 ep_status)
+{
+	struct lf1000_udc *udc = ep->dev;
+	struct lf1000_request *req = ep->dma_req;
+	unsigned int pkt_len, moved;
+	int left;
+
+	if (ep->is_in) {
+		if (IS_SET(ep_status, TPS))
+			writew(1<<TPS, udc->base_addr + UDC_EPSTAT);
+		return;
+	}
+
+	if (!IS_SET(ep_status, RPS))
+		return;
+	pkt_len = 2*readw(udc->base_addr + UDC_BRCR);
+	if (IS_SET(ep_status, EPLWO))
+		pkt_len--;
+	if (pkt_len >= ep->ep.maxpacket)
+		return;
+
+	/* the whole packets the run moved before the short one */
+	left = dma_abort(ep->dma_ch);
+	if (left < 0 || left > ep->dma_len)
+		left = 0;
+	moved = ep->dma_len - left;
+	lf1000_ep_dma_stop(ep, moved);
+	udc->dma_short++;
+
+	read_req(ep, req);
+	writew(1<<RPS, udc->base_addr + UDC_EPSTAT);
+}
+#endif /* CONFIG_USB_LF1000_DMA */
+
 /* Return the recommended next state */
 static int handle_setup(struct lf1000_udc *udc, struct lf1000_ep *ep, u32 csr)
 {
@@ -875,6 +1100,13 @@ static void handle_ep(struct lf1000_ep *ep)
 		writew(1<<FFS, udc->base_addr + UDC_EPSTAT);
 	}
 
+#ifdef CONFIG_USB_LF1000_DMA
+	if (ep->dma_req) {
+		handle_ep_dma(ep, ep_status);
+		return;
+	}
+#endif
+
 	if (IS_SET(ep_status, TPS)) {
 		/* handle IN success */
 		writew(1<<TPS, udc->base_addr + UDC_EPSTAT);
@@ -883,12 +1115,7 @@ static void handle_ep(struct lf1000_ep *ep)
 				/* if we just completed a req, and there is
 				 * another pending, we must launch it.
 				 */
-				if(!list_empty(&ep->queue)) {
-					req = list_entry(ep->queue.next,
-							 struct lf1000_request,
-							 queue);
-					write_req(ep, req);
-				}
+				lf1000_ep_kick(ep);
 			}
 		} else {
 			/* should we stall? */
@@ -897,6 +1124,11 @@ static void handle_ep(struct lf1000_ep *ep)
 
 	if(IS_SET(ep_status, RPS)) {
 		/* handle OUT success */
+#ifdef CONFIG_USB_LF1000_DMA
+		/* leave the packet for the DMA if it'll take the request */
+		if (req != NULL && !ep->halted && lf1000_ep_dma_start(ep, req))
+			return;
+#endif
 		if(req != NULL)
 			read_req(ep, req);
 
@@ -1275,13 +1507,8 @@ static int lf1000_queue(struct usb_ep *_ep, struct usb_request *_req, gfp_t gf)
 			launch = 1;
 		}
 		list_add_tail(&req->queue, &ep->queue);
-		if(launch == 1) {
-			if(ep->bEndpointAddress & USB_DIR_IN) {
-				write_req(ep, req);
-			} else {
-				read_req(ep, req);
-			}
-		}
+		if(launch == 1)
+			lf1000_ep_kick(ep);
 	}
 
 	local_irq_restore(flags);
@@ -1294,6 +1521,7 @@ static int lf1000_dequeue(struct usb_ep *_ep, struct usb_request *_req)
 	struct lf1000_ep *ep = container_of(_ep, struct lf1000_ep, ep);
 	struct lf1000_udc *udc = ep->dev;
 	struct lf1000_request *req = NULL;
+	unsigned long flags;
 
     	dprintk(DEBUG_VERBOSE,"lf1000_dequeue(ep=%p,req=%p)\n", _ep, _req);
 
@@ -1303,8 +1531,13 @@ static int lf1000_dequeue(struct usb_ep *_ep, struct usb_request *_req)
 	if (!_ep || !_req)
 		return retval;
 
+	local_irq_save(flags);
 	list_for_each_entry (req, &ep->queue, queue) {
 		if (&req->req == _req) {
+#ifdef CONFIG_USB_LF1000_DMA
+			if (ep->dma_req == req)
+				lf1000_ep_dma_abort(ep);
+#endif
 			list_del_init (&req->queue);
 			_req->status = -ECONNRESET;
 			retval = 0;
@@ -1318,6 +1551,7 @@ static int lf1000_dequeue(struct usb_ep *_ep, struct usb_request *_req)
 
 		done(ep, req, -ECONNRESET);
 	}
+	local_irq_restore(flags);
 
 	return retval;
 }
@@ -1679,11 +1913,23 @@ EXPORT_SYMBOL(usb_gadget_unregister_driver);
 static int lf1000_udc_remove(struct platform_device *pdev)
 {
 	struct lf1000_udc *udc = platform_get_drvdata(pdev);
+#ifdef CONFIG_USB_LF1000_DMA
+	int i;
+#endif
 
 	dev_info(&pdev->dev, "remove\n");
 
 	if (udc->debug)
-		debugfs_remove(udc->debug);
+		debugfs_remove_recursive(udc->debug);
+
+#ifdef CONFIG_USB_LF1000_DMA
+	for (i = 1; i < LF1000_ENDPOINTS; i++) {
+		if (udc->ep[i].dma_ch) {
+			dma_release(udc->ep[i].dma_ch);
+			udc->ep[i].dma_ch = 0;
+		}
+	}
+#endif
 
 	device_remove_file(&pdev->dev, &dev_attr_vbus);
 
@@ -1714,6 +1960,9 @@ static int lf1000_udc_probe(struct platform_device *pdev)
 {
 	struct lf1000_udc *udc;
 	int retval = 0;
+#ifdef CONFIG_USB_LF1000_DMA
+	int i;
+#endif
 
 	dev_info(&pdev->dev, "probe\n");
 
@@ -1830,6 +2079,22 @@ static int lf1000_udc_probe(struct platform_device *pdev)
 
 	device_create_file(&pdev->dev, &dev_attr_vbus);
 
+#ifdef CONFIG_USB_LF1000_DMA
+	/* Leave the level 0 and 1 channels to NAND and audio; an endpoint
+	 * that doesn't get a channel uses PIO.
+	 */
+	for (i = 1; i < LF1000_ENDPOINTS; i++) {
+		if (dma_request((char *)udc->ep[i].ep.name,
+				DMA_PRIORITY_LV2 | DMA_PRIORITY_LV3,
+				lf1000_udc_dma_irq, &udc->ep[i],
+				&udc->ep[i].dma_ch)) {
+			dev_warn(&pdev->dev, "no DMA channel for %s, "
+				"using PIO\n", udc->ep[i].ep.name);
+			udc->ep[i].dma_ch = 0;
+		}
+	}
+#endif
+
 	udc->debug = debugfs_create_dir("lf1000-usb-gadget", NULL);
 	if (udc->debug && udc->debug != ERR_PTR(-ENODEV)) {
 		debugfs_create_bool("vbus", S_IRUGO, udc->debug,
@@ -1846,6 +2111,14 @@ static int lf1000_udc_probe(struct platform_device *pdev)
 				&udc->vbus_report_low);
 		debugfs_create_file("regs", S_IRUGO, udc->debug, udc,
 				&lf1000_udc_regs_fops);
+#ifdef CONFIG_USB_LF1000_DMA
+		debugfs_create_u32("dma_runs", S_IRUGO, udc->debug,
+				&udc->dma_runs);
+		debugfs_create_u32("dma_bytes", S_IRUGO, udc->debug,
+				&udc->dma_bytes);
+		debugfs_create_u32("dma_short", S_IRUGO, udc->debug,
+				&udc->dma_short);
+#endif
 	} else {
 		dev_err(&pdev->dev, "can't create debugfs files\n");
 		udc->debug = NULL;
@@ -204,6 +204,14 @@ struct lf1000_ep {
 	unsigned			setup_stage : 1;
 	unsigned short			status;
 	unsigned int			is_in;
+
+#ifdef CONFIG_USB_LF1000_DMA
+	unsigned int			dma_ch;		/* 0 if no channel */
+	struct lf1000_request		*dma_req;	/* request the DMA is
+							 * moving data for */
+	unsigned int			dma_len;	/* bytes in this run */
+	struct scatterlist		dma_sg;
+#endif
 };
 
 
@@ -269,6 +277,13 @@ struct lf1000_udc {
 	u32				vbus_report_high;	// reported high
 	u32				vbus_report_low;	// reported low
 
+#ifdef CONFIG_USB_LF1000_DMA
+	u32				dma_runs;	/* DMA runs started */
+	u32				dma_bytes;	/* bytes moved by DMA */
+	u32				dma_short;	/* OUT runs ended early by
+							 * a short packet */
+#endif
+
 	struct lf1000_request		statreq;
 
 	struct input_dev		*input;
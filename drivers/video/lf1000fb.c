@@ -25,10 +25,16 @@
 #include <linux/ioctl.h>
 #include <linux/interrupt.h>
 #include <linux/mm.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/console.h>
+#include <linux/notifier.h>
+#include <linux/timer.h>
 #include <linux/lf1000/lf1000fb.h>
 #include <mach/platform.h>
 #include <mach/screen.h>
 #include <mach/gpio.h>
+#include <mach/fence.h>
 #include <asm/uaccess.h>
 #include <asm/cputype.h>
 #include <plat/hardware.h>
@@ -42,6 +48,21 @@
  */
 
 #define LF1000_FB_NUM_BUFFERS	3	/* buffers per layer */
+#define LF1000_FB_FENCE_TIMEOUT	HZ	/* longest a commit waits for a fence */
+#define LF1000_FB_EVENT_TIMEOUT	(LF1000_FB_FENCE_TIMEOUT + HZ/10)
+
+/* With nothing changing on screen, run the panel at a lower refresh rate so
+ * the MLC reads the frame buffers from SDRAM less often.  A client drawing
+ * straight into the frame buffer gives us no sign of it, so this only starts
+ * once something has reported damage with LF1000FB_IOCDAMAGE. */
+static unsigned int idle_ms = 1000;
+module_param(idle_ms, uint, 0644);
+MODULE_PARM_DESC(idle_ms, "Lower the refresh rate after this long without "
+		"screen updates, 0 to never");
+
+static unsigned int idle_div = 2;
+module_param(idle_div, uint, 0644);
+MODULE_PARM_DESC(idle_div, "Refresh rate divider while idle");
 
 /* The YUV layer is always last.  The other layers are RGB. */
 #define IS_YUV_LAYER(l)		(l->index == l->parent->num_layers-1)
@@ -61,6 +82,26 @@ struct lf1000fb_layer {
 
 	u32			hsrc;
 	u32			vsrc;
+
+	/* last commit touching this layer, protected by parent->commit_lock */
+	u32			flip_done;	/* last commit latched */
+	u32			flip_vblank;	/* vblank count at flip_done */
+	u32			flip_read;	/* last commit reported */
+	u32			flips;		/* commits latched */
+};
+
+/* A queued multi-layer update, with addresses and scaler settings already
+ * worked out so that it can be written from the interrupt handler. */
+struct lf1000fb_commit {
+	u32				sequence;
+	u32				fence;		/* GA3D fence, or 0 */
+	bool				held;		/* waiting for the fence */
+	unsigned long			held_since;	/* jiffies */
+	unsigned			count;
+	struct lf1000fb_commit_layer	layers[LF1000FB_COMMIT_MAX_LAYERS];
+	u32				address[LF1000FB_COMMIT_MAX_LAYERS];
+	u32				hscale;
+	u32				vscale;
 };
 
 struct lf1000fb_info {
@@ -73,6 +114,31 @@ struct lf1000fb_info {
 	void __iomem			*mlc;
 	int 				irq;
 	unsigned int			nirq;
+	wait_queue_head_t		vsync_wait;
+
+	/* commit queue: commits[commit_head] is the oldest entry, and is
+	 * being latched by the MLC if commit_latching is set; commit_lock
+	 * also covers every MLC register update, since a commit is written
+	 * out from the interrupt handler */
+	spinlock_t			commit_lock;
+	struct lf1000fb_commit		commits[LF1000FB_COMMIT_QUEUE+1];
+	unsigned			commit_head;
+	unsigned			commit_count;
+	bool				commit_latching;
+	u32				commit_seq;
+	u32				commit_busy;	/* refused with EBUSY */
+	u32				commit_fenced;	/* held for a fence */
+	u32				commit_expired;	/* fence never came */
+	struct notifier_block		fence_nb;
+
+	/* refresh rate: the DPC clock is slowed by refresh_div, changed to
+	 * refresh_want on the next vertical blank; protected by commit_lock */
+	struct timer_list		idle_timer;
+	unsigned			refresh_div;
+	unsigned			refresh_want;
+	u32				idle_entries;	/* times slowed down */
+	u32				damage_reports;
+	u32				damage_pixels;
 
 	struct fb_info			**fbs;
 	unsigned			num_layers;
@@ -249,16 +315,20 @@ static void mlc_set_dirty(struct lf1000fb_layer *fbi)
 	writel(tmp | (1<<4), control);
 }
 
-static bool mlc_is_dirty(struct lf1000fb_layer *fbi)
+/* Check whether a layer update is still waiting to be latched, on both MLCs
+ * when cloning to TV out.  This doesn't go through mlc_select() so it's safe
+ * from the interrupt handler. */
+static bool mlc_layer_busy(struct lf1000fb_layer *layer)
 {
-	void __iomem *control;
-	
-	if (IS_YUV_LAYER(fbi))
-		control = mlc_reg(fbi, YUVCONTROL);
-	else
-		control = mlc_reg(fbi, RGBCONTROL);
-
-	return !!(readl(control) & (1<<4));
+	u32 reg = IS_YUV_LAYER(layer) ? YUVCONTROL : RGBCONTROL;
+	void __iomem *control = layer->parent->mlc +
+		layer->index*RGBREGLEN + reg + 0xC;
+
+	if (readl(control) & (1<<4))
+		return true;
+	if (gpio_have_tvout() && (readl(control + MLCSECONDARY) & (1<<4)))
+		return true;
+	return false;
 }
 
 static u32 linear_to_xy(u32 addr)
@@ -307,7 +377,7 @@ static void set_invert(struct lf1000fb_layer *fbi, u8 en)
 	writel(val, mlc_reg(fbi, RGBCONTROL));
 }
 
-static void set_blend(struct lf1000fb_layer *fbi, u8 en, u8 alpha)
+static void __set_blend(struct lf1000fb_layer *fbi, u8 en, u8 alpha)
 {
 	void __iomem *control;
 	void __iomem *tpcolor;
@@ -329,7 +399,11 @@ static void set_blend(struct lf1000fb_layer *fbi, u8 en, u8 alpha)
 		writel(val | (1<<2), control);
 	else
 		writel(val & ~(1<<2), control);
+}
 
+static void set_blend(struct lf1000fb_layer *fbi, u8 en, u8 alpha)
+{
+	__set_blend(fbi, en, alpha);
 	mlc_set_dirty(fbi);
 }
 
@@ -804,9 +878,10 @@ static int set_rgb(struct fb_info *fbi, struct fb_var_screeninfo *var,
 	return 0;
 }
 
-/* The YUV layer has a scaler so we can configure it for desired resolutions */
-static int set_video_scaler(struct lf1000fb_layer *fbi, u32 xres, u32 yres,
-		bool apply)
+/* The YUV layer has a scaler so we can configure it for desired resolutions.
+ * Work out the scaler register values for a given source size. */
+static int video_scaler_regs(struct lf1000fb_layer *fbi, u32 xres, u32 yres,
+		u32 *hreg, u32 *vreg)
 {
 	struct fb_var_screeninfo *var = &fbi->fbinfo->var;
 	u32 hscale, vscale, hround, vround;
@@ -814,9 +889,6 @@ static int set_video_scaler(struct lf1000fb_layer *fbi, u32 xres, u32 yres,
 	if (!IS_YUV_LAYER(fbi))
 		return -EINVAL;
 
-	fbi->hsrc = xres;
-	fbi->vsrc = yres;
-
 	/* Enable adjusted ratio with bilinear filter for upscaling or just
 	 * downscale.  The height scales independant of the width. 
 	 * Use rounding of scaler ratio to support get_video_scaler. */
@@ -826,11 +898,11 @@ static int set_video_scaler(struct lf1000fb_layer *fbi, u32 xres, u32 yres,
 		hround = hscale & 1;
 		hscale >>= 1;
 		hscale += hround;
-		writel((1<<28) | hscale, mlc_reg(fbi, YUVHSCALE));
+		*hreg = (1<<28) | hscale;
 	} else {
 		if (xres > var->xres_virtual/2)
 			return -EINVAL;
-		writel((xres<<11)/var->xres, mlc_reg(fbi, YUVHSCALE));
+		*hreg = (xres<<11)/var->xres;
 	}
 
 	if (yres < var->yres) {
@@ -838,13 +910,31 @@ static int set_video_scaler(struct lf1000fb_layer *fbi, u32 xres, u32 yres,
 		vround = vscale & 1;
 		vscale >>= 1;
 		vscale += vround;
-		writel((1<<28) | vscale, mlc_reg(fbi, YUVVSCALE));
+		*vreg = (1<<28) | vscale;
 	} else {
 		if (yres > var->yres_virtual)
 			return -EINVAL;
-		writel((yres<<11)/var->yres, mlc_reg(fbi, YUVVSCALE));
+		*vreg = (yres<<11)/var->yres;
 	}
 
+	return 0;
+}
+
+static int set_video_scaler(struct lf1000fb_layer *fbi, u32 xres, u32 yres,
+		bool apply)
+{
+	u32 hscale, vscale;
+	int ret;
+
+	ret = video_scaler_regs(fbi, xres, yres, &hscale, &vscale);
+	if (ret)
+		return ret;
+
+	fbi->hsrc = xres;
+	fbi->vsrc = yres;
+	writel(hscale, mlc_reg(fbi, YUVHSCALE));
+	writel(vscale, mlc_reg(fbi, YUVVSCALE));
+
 	if (apply)
 		mlc_set_dirty(fbi);
 	return 0;
@@ -876,11 +966,15 @@ static int get_video_scaler(struct lf1000fb_layer *fbi, u32 *xres, u32 *yres)
 static void schedule_palette_update(struct lf1000fb_layer *fbi,
 		unsigned int regno, unsigned int val)
 {
+	unsigned long flags;
+
 	if (IS_YUV_LAYER(fbi))
 		return;
 
+	spin_lock_irqsave(&fbi->parent->commit_lock, flags);
 	writel((regno<<24)|((u16)val), mlc_reg(fbi, RGBPALETTE));
 	mlc_set_dirty(fbi);
+	spin_unlock_irqrestore(&fbi->parent->commit_lock, flags);
 }
 
 static unsigned int chan_to_field(unsigned int chan, struct fb_bitfield *bf)
@@ -1051,11 +1145,13 @@ static int lf1000fb_set_par(struct fb_info *info)
 {
 	struct lf1000fb_layer *layer = info->par;
 	struct fb_var_screeninfo *var = &info->var;
+	unsigned long flags;
 	int ret = 0;
 
 	if (layer->index >= layer->parent->num_layers)
 		return -EINVAL;
 
+	spin_lock_irqsave(&layer->parent->commit_lock, flags);
 	set_resolution(layer);
 
 	/* a hardware bug prevents us from supporting rotation/flipping in
@@ -1104,6 +1200,7 @@ static int lf1000fb_set_par(struct fb_info *info)
 
 out_set:
 	mlc_set_dirty(layer);
+	spin_unlock_irqrestore(&layer->parent->commit_lock, flags);
 	return ret;
 }
 
@@ -1111,6 +1208,7 @@ static int lf1000fb_blank(int blank, struct fb_info *info)
 {
 	struct lf1000fb_layer *layer = info->par;
 	void __iomem *control;
+	unsigned long flags;
 	u32 reg;
 	
 	if (layer->index >= layer->parent->num_layers)
@@ -1121,6 +1219,7 @@ static int lf1000fb_blank(int blank, struct fb_info *info)
 	else
 		control = mlc_reg(layer, RGBCONTROL);
 
+	spin_lock_irqsave(&layer->parent->commit_lock, flags);
 	reg = readl(control);
 
 	switch (blank) {
@@ -1135,9 +1234,16 @@ static int lf1000fb_blank(int blank, struct fb_info *info)
 			reg &= ~(1<<5);
 			reg |= (1<<4);
 			writel(reg, control);
+
+			/* wait for the latch without holding off the vertical
+			 * blank interrupt */
+			spin_unlock_irqrestore(&layer->parent->commit_lock,
+					flags);
 			do {
 				reg = readl(control);
 			} while (reg & (1<<4));
+			spin_lock_irqsave(&layer->parent->commit_lock, flags);
+			reg = readl(control);
 
 			/* enable sleep */
 			reg &= ~(1<<14);
@@ -1176,50 +1282,412 @@ static int lf1000fb_blank(int blank, struct fb_info *info)
 		mlc_set_dirty(layer);
 		mlc_select(layer, 0);
 	}
+	spin_unlock_irqrestore(&layer->parent->commit_lock, flags);
 
 	return 0;
 }
 
-static int lf1000fb_pan_display(struct fb_var_screeninfo *var,
-		struct fb_info *info)
+/* The screen is changing: back to the full refresh rate, and slow down again
+ * once updates stop for idle_ms if a client is reporting its damage. */
+static void lf1000fb_activity(struct lf1000fb_info *info)
 {
-	struct lf1000fb_layer *layer = info->par;
-	u32 address;
-	u32 offset;
+	unsigned long flags;
 
-	if (layer->index >= layer->parent->num_layers)
+	spin_lock_irqsave(&info->commit_lock, flags);
+	info->refresh_want = 1;
+	spin_unlock_irqrestore(&info->commit_lock, flags);
+
+	if (idle_ms && info->damage_reports)
+		mod_timer(&info->idle_timer,
+				jiffies + msecs_to_jiffies(idle_ms));
+}
+
+static void lf1000fb_idle(unsigned long data)
+{
+	struct lf1000fb_info *info = (struct lf1000fb_info *)data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&info->commit_lock, flags);
+	info->refresh_want = max(idle_div, 1U);
+	spin_unlock_irqrestore(&info->commit_lock, flags);
+}
+
+/* Take note of redrawn areas of a layer.  No supported panel has frame
+ * memory of its own, so the whole frame is still scanned out; the report
+ * only keeps the refresh rate up and is counted. */
+static int lf1000fb_damage(struct lf1000fb_layer *layer,
+		struct lf1000fb_damage_cmd *cmd)
+{
+	struct lf1000fb_info *info = layer->parent;
+	struct fb_var_screeninfo *var = &layer->fbinfo->var;
+	struct lf1000fb_rect *r;
+	u32 pixels = 0;
+	int i;
+
+	if (cmd->count > LF1000FB_DAMAGE_MAX_RECTS)
 		return -EINVAL;
-	
-	address = layer->fbinfo->fix.smem_start;
+
+	for (i = 0; i < cmd->count; i++) {
+		r = &cmd->rects[i];
+		if (r->x >= var->xres || r->y >= var->yres)
+			return -EINVAL;
+		pixels += min(r->width, var->xres - r->x) *
+			min(r->height, var->yres - r->y);
+	}
+
+	info->damage_reports++;
+	info->damage_pixels += pixels;
+	lf1000fb_activity(info);
+	return 0;
+}
+
+/* Work out the layer address for the given pan offsets. */
+static int lf1000fb_pan_address(struct lf1000fb_layer *layer, u32 xoffset,
+		u32 yoffset, u32 *address)
+{
+	u32 offset;
+
+	*address = layer->fbinfo->fix.smem_start;
 
  	if (IS_YUV_LAYER(layer)) {
-		offset = var->xoffset + layer->vstride * var->yoffset;
+		offset = xoffset + layer->vstride * yoffset;
 	} else {	
-		offset = var->xoffset + layer->vstride * var->yoffset;
+		offset = xoffset + layer->vstride * yoffset;
 		if (layer->vflip)
-			address += layer->vstride * (layer->fbinfo->var.yres);
+			*address += layer->vstride * (layer->fbinfo->var.yres);
 	}
 
-	if (address >= layer->fbinfo->fix.smem_start +
+	if (*address >= layer->fbinfo->fix.smem_start +
 			layer->fbinfo->fix.smem_len)
 		return -EINVAL;
 
+	*address += offset;
+	return 0;
+}
+
+static int lf1000fb_pan_display(struct fb_var_screeninfo *var,
+		struct fb_info *info)
+{
+	struct lf1000fb_layer *layer = info->par;
+	unsigned long flags;
+	u32 address;
+
+	if (layer->index >= layer->parent->num_layers)
+		return -EINVAL;
+
+	if (lf1000fb_pan_address(layer, var->xoffset, var->yoffset, &address))
+		return -EINVAL;
+
+	spin_lock_irqsave(&layer->parent->commit_lock, flags);
 	layer->fbinfo->var.xoffset = var->xoffset;
 	layer->fbinfo->var.yoffset = var->yoffset;
-	mlc_set_address(layer, address+offset);
+	mlc_set_address(layer, address);
 	mlc_set_dirty(layer);
 
 	/* clone secondary MLC for TV out */
 	if (gpio_have_tvout()) {
 		mlc_select(layer, 1);
-		mlc_set_address(layer, address+offset);
+		mlc_set_address(layer, address);
 		mlc_set_dirty(layer);
 		mlc_select(layer, 0);
 	}
+	spin_unlock_irqrestore(&layer->parent->commit_lock, flags);
+
+	lf1000fb_activity(layer->parent);
+	return 0;
+}
+
+/* Block until the next vertical blank, and until any register update pending
+ * on this layer has been latched by the MLC. */
+static int lf1000fb_wait_vsync(struct lf1000fb_layer *layer)
+{
+	struct lf1000fb_info *info = layer->parent;
+	unsigned int count = info->nirq;
+	long ret;
+
+	ret = wait_event_interruptible_timeout(info->vsync_wait,
+			info->nirq != count && !mlc_layer_busy(layer), HZ/10);
+	if (ret < 0)
+		return ret;
+	return ret ? 0 : -ETIMEDOUT;
+}
+
+/* Write out a commit on both MLCs, then set all the dirty bits in one sweep
+ * so every layer in it is latched on the same vertical blank.  Called with
+ * commit_lock held and interrupts off.  The register base is saved and
+ * restored so this can interrupt an mlc_select() section. */
+static void lf1000fb_commit_apply(struct lf1000fb_info *info,
+		struct lf1000fb_commit *commit)
+{
+	void __iomem *mlcreg = info->mlcreg;
+	bool prisec = info->prisec;
+	struct lf1000fb_commit_layer *cl;
+	struct lf1000fb_layer *layer;
+	int i, mlc;
+
+	for (i = 0; i < commit->count; i++) {
+		cl = &commit->layers[i];
+		layer = info->fbs[cl->layer]->par;
+
+		if (cl->flags & LF1000FB_COMMIT_SCALE) {
+			layer->hsrc = cl->sizex;
+			layer->vsrc = cl->sizey;
+		}
+		if (cl->flags & LF1000FB_COMMIT_ADDRESS) {
+			layer->fbinfo->var.xoffset = cl->xoffset;
+			layer->fbinfo->var.yoffset = cl->yoffset;
+		}
+	}
+
+	for (mlc = 0; mlc < (gpio_have_tvout() ? 2 : 1); mlc++) {
+		info->prisec = mlc;
+		info->mlcreg = mlc ? info->mlc + MLCSECONDARY : info->mlc;
+
+		for (i = 0; i < commit->count; i++) {
+			cl = &commit->layers[i];
+			layer = info->fbs[cl->layer]->par;
+
+			if (cl->flags & LF1000FB_COMMIT_SCALE) {
+				writel(commit->hscale, mlc_reg(layer, YUVHSCALE));
+				writel(commit->vscale, mlc_reg(layer, YUVVSCALE));
+			}
+			if (cl->flags & LF1000FB_COMMIT_ADDRESS)
+				mlc_set_address(layer, commit->address[i]);
+			if (cl->flags & LF1000FB_COMMIT_POSITION)
+				set_position(layer, cl->left, cl->top,
+						cl->right, cl->bottom, 0);
+			if (cl->flags & LF1000FB_COMMIT_ALPHA)
+				__set_blend(layer, cl->blend_enable, cl->alpha);
+		}
+
+		for (i = 0; i < commit->count; i++)
+			mlc_set_dirty(info->fbs[commit->layers[i].layer]->par);
+	}
+
+	info->prisec = prisec;
+	info->mlcreg = mlcreg;
+}
+
+/* Retire the commit being latched once the MLC has taken all of it, and
+ * start on the next one.  Called with commit_lock held and interrupts off. */
+static void lf1000fb_commit_advance(struct lf1000fb_info *info)
+{
+	struct lf1000fb_commit *commit;
+	struct lf1000fb_layer *layer;
+	int i;
+
+	if (info->commit_latching) {
+		commit = &info->commits[info->commit_head];
+
+		for (i = 0; i < commit->count; i++) {
+			layer = info->fbs[commit->layers[i].layer]->par;
+			if (mlc_layer_busy(layer))
+				return;
+		}
+
+		for (i = 0; i < commit->count; i++) {
+			layer = info->fbs[commit->layers[i].layer]->par;
+			layer->flip_done = commit->sequence;
+			layer->flip_vblank = info->nirq;
+			layer->flips++;
+		}
+
+		info->commit_latching = false;
+		info->commit_head = (info->commit_head + 1) %
+			ARRAY_SIZE(info->commits);
+		info->commit_count--;
+	}
+
+	if (info->commit_count) {
+		commit = &info->commits[info->commit_head];
+		if (!lf1000_fence_done(commit->fence)) {
+			if (!commit->held) {
+				commit->held = true;
+				commit->held_since = jiffies;
+				info->commit_fenced++;
+				return;
+			}
+			/* don't let a lost GA3D list wedge the queue */
+			if (time_before(jiffies, commit->held_since +
+						LF1000_FB_FENCE_TIMEOUT))
+				return;
+			info->commit_expired++;
+		}
+		lf1000fb_commit_apply(info, commit);
+		info->commit_latching = true;
+	}
+}
+
+/* A GA3D list finished: a commit may have been waiting on its fence. */
+static int lf1000fb_fence_notify(struct notifier_block *nb,
+		unsigned long fence, void *unused)
+{
+	struct lf1000fb_info *info = container_of(nb, struct lf1000fb_info,
+			fence_nb);
+	unsigned long flags;
+
+	spin_lock_irqsave(&info->commit_lock, flags);
+	if (!info->commit_latching)
+		lf1000fb_commit_advance(info);
+	spin_unlock_irqrestore(&info->commit_lock, flags);
+
+	return NOTIFY_OK;
+}
+
+/* Check a commit from user space and work out its register values. */
+static int lf1000fb_commit_prepare(struct lf1000fb_info *info,
+		struct lf1000fb_commit_cmd *cmd, struct lf1000fb_commit *commit)
+{
+	struct lf1000fb_commit_layer *cl;
+	struct lf1000fb_layer *layer;
+	struct fb_var_screeninfo *var;
+	unsigned mask = 0;
+	int i;
+
+	if (cmd->count == 0 || cmd->count > LF1000FB_COMMIT_MAX_LAYERS)
+		return -EINVAL;
+
+	/* a fence that was never issued would hold the queue forever */
+	if (!lf1000_fence_valid(cmd->fence))
+		return -EINVAL;
+
+	commit->count = cmd->count;
+	commit->fence = cmd->fence;
+	commit->held = false;
+	for (i = 0; i < cmd->count; i++) {
+		cl = &cmd->layers[i];
+
+		if (cl->layer >= info->num_layers || !info->fbs[cl->layer])
+			return -EINVAL;
+		if (mask & (1<<cl->layer))
+			return -EINVAL;
+		mask |= 1<<cl->layer;
+
+		layer = info->fbs[cl->layer]->par;
+		var = &layer->fbinfo->var;
+
+		if (cl->flags & LF1000FB_COMMIT_SCALE) {
+			if (video_scaler_regs(layer, cl->sizex, cl->sizey,
+						&commit->hscale, &commit->vscale))
+				return -EINVAL;
+		}
+
+		if (cl->flags & LF1000FB_COMMIT_ADDRESS) {
+			if (cl->xoffset + var->xres > var->xres_virtual ||
+			    cl->yoffset + var->yres > var->yres_virtual)
+				return -EINVAL;
+			if (lf1000fb_pan_address(layer, cl->xoffset,
+						cl->yoffset, &commit->address[i]))
+				return -EINVAL;
+		}
+
+		commit->layers[i] = *cl;
+	}
+
+	return 0;
+}
+
+/* Queue a commit, waiting for a free slot unless asked not to.  If nothing
+ * is being latched it's written right away rather than on the next vertical
+ * blank. */
+static int lf1000fb_commit(struct lf1000fb_info *info,
+		struct lf1000fb_commit_cmd *cmd)
+{
+	struct lf1000fb_commit commit;
+	unsigned long flags;
+	long ret;
+
+	ret = lf1000fb_commit_prepare(info, cmd, &commit);
+	if (ret)
+		return ret;
+	lf1000fb_activity(info);
+
+	spin_lock_irqsave(&info->commit_lock, flags);
+	while (info->commit_count == ARRAY_SIZE(info->commits)) {
+		spin_unlock_irqrestore(&info->commit_lock, flags);
+
+		if (cmd->flags & LF1000FB_COMMIT_NONBLOCK) {
+			info->commit_busy++;
+			return -EBUSY;
+		}
+
+		ret = wait_event_interruptible_timeout(info->vsync_wait,
+			info->commit_count < ARRAY_SIZE(info->commits), HZ/10);
+		if (ret < 0)
+			return ret;
+		if (ret == 0)
+			return -ETIMEDOUT;
+
+		spin_lock_irqsave(&info->commit_lock, flags);
+	}
+
+	commit.sequence = cmd->sequence = ++info->commit_seq;
+	info->commits[(info->commit_head + info->commit_count) %
+		ARRAY_SIZE(info->commits)] = commit;
+	info->commit_count++;
+	if (!info->commit_latching)
+		lf1000fb_commit_advance(info);
+	spin_unlock_irqrestore(&info->commit_lock, flags);
 
 	return 0;
 }
 
+/* A page flip is a single-layer commit that never blocks. */
+static int lf1000fb_flip(struct lf1000fb_layer *layer,
+		struct lf1000fb_flip_cmd *flip)
+{
+	struct lf1000fb_commit_cmd cmd;
+	int ret;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.count = 1;
+	cmd.flags = LF1000FB_COMMIT_NONBLOCK;
+	cmd.layers[0].layer = layer->index;
+	cmd.layers[0].flags = LF1000FB_COMMIT_ADDRESS;
+	cmd.layers[0].xoffset = flip->xoffset;
+	cmd.layers[0].yoffset = flip->yoffset;
+	cmd.fence = flip->fence;
+
+	ret = lf1000fb_commit(layer->parent, &cmd);
+	flip->sequence = cmd.sequence;
+	return ret;
+}
+
+static int lf1000fb_get_flip_event(struct lf1000fb_layer *layer,
+		struct lf1000fb_flip_event *ev)
+{
+	struct lf1000fb_info *info = layer->parent;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&info->commit_lock, flags);
+	if (layer->flip_read == layer->flip_done) {
+		ret = -EAGAIN;
+	} else {
+		ev->sequence = layer->flip_done;
+		ev->vblank = layer->flip_vblank;
+		layer->flip_read = layer->flip_done;
+	}
+	spin_unlock_irqrestore(&info->commit_lock, flags);
+
+	return ret;
+}
+
+/* Block until a flip or commit touching the layer reaches the screen, or
+ * for as long as a held commit and the queue behind it could take. */
+static int lf1000fb_wait_flip_event(struct lf1000fb_layer *layer,
+		struct lf1000fb_flip_event *ev)
+{
+	long ret;
+
+	ret = wait_event_interruptible_timeout(layer->parent->vsync_wait,
+			layer->flip_read != layer->flip_done,
+			LF1000_FB_EVENT_TIMEOUT);
+	if (ret < 0)
+		return ret;
+	return lf1000fb_get_flip_event(layer, ev) ? -ETIMEDOUT : 0;
+}
+
 /* This SoC has a few few features that don't fit into the standard FB API so
  * we extend that here as needed. */
 static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd,
@@ -1228,6 +1696,7 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd,
 	void __user *argp = (void __user *)arg;
 	union lf1000fb_cmd c;
 	struct lf1000fb_layer *fbi = info->par;
+	unsigned long flags;
 
 	if (fbi->index >= fbi->parent->num_layers)
 		return -EINVAL;
@@ -1248,14 +1717,77 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd,
 			break;
 
 		case FBIO_WAITFORVSYNC:
-			if (gpio_have_tvout()) {
-				int r;
-				mlc_select(fbi, 1);
-				r = mlc_is_dirty(fbi);
-				mlc_select(fbi, 0);
-				return r;
+			lf1000fb_activity(fbi->parent);
+			return lf1000fb_wait_vsync(fbi);
+
+		case LF1000FB_IOCDAMAGE:
+			if (!(_IOC_DIR(cmd) & _IOC_WRITE))
+				return -EINVAL;
+			if (copy_from_user((void *)&c, argp,
+					sizeof(struct lf1000fb_damage_cmd)))
+				return -EFAULT;
+			return lf1000fb_damage(fbi, &c.damage);
+
+		case LF1000FB_IOCFLIP:
+			{
+			int ret;
+
+			if (!(_IOC_DIR(cmd) & _IOC_WRITE))
+				return -EINVAL;
+			if (copy_from_user((void *)&c, argp,
+					sizeof(struct lf1000fb_flip_cmd)))
+				return -EFAULT;
+			ret = lf1000fb_flip(fbi, &c.flip);
+			if (ret)
+				return ret;
+			if (copy_to_user(argp, (void *)&c,
+					sizeof(struct lf1000fb_flip_cmd)))
+				return -EFAULT;
+			}
+			break;
+
+		case LF1000FB_IOCGFLIPEVENT:
+			if (!(_IOC_DIR(cmd) & _IOC_READ))
+				return -EINVAL;
+			if (lf1000fb_get_flip_event(fbi, &c.flip_event))
+				return -EAGAIN;
+			if (copy_to_user(argp, (void *)&c,
+					sizeof(struct lf1000fb_flip_event)))
+				return -EFAULT;
+			break;
+
+		case LF1000FB_IOCWFLIPEVENT:
+			{
+			int ret;
+
+			if (!(_IOC_DIR(cmd) & _IOC_READ))
+				return -EINVAL;
+			ret = lf1000fb_wait_flip_event(fbi, &c.flip_event);
+			if (ret)
+				return ret;
+			if (copy_to_user(argp, (void *)&c,
+					sizeof(struct lf1000fb_flip_event)))
+				return -EFAULT;
+			}
+			break;
+
+		case LF1000FB_IOCCOMMIT:
+			{
+			int ret;
+
+			if (!(_IOC_DIR(cmd) & _IOC_WRITE))
+				return -EINVAL;
+			if (copy_from_user((void *)&c, argp,
+					sizeof(struct lf1000fb_commit_cmd)))
+				return -EFAULT;
+			ret = lf1000fb_commit(fbi->parent, &c.commit);
+			if (ret)
+				return ret;
+			if (copy_to_user(argp, (void *)&c,
+					sizeof(struct lf1000fb_commit_cmd)))
+				return -EFAULT;
 			}
-			return mlc_is_dirty(fbi);
+			break;
 
 		case LF1000FB_IOCSALPHA:
 			if (!(_IOC_DIR(cmd) & _IOC_WRITE))
@@ -1263,12 +1795,14 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd,
 			if (copy_from_user((void *)&c, argp,
 					sizeof(struct lf1000fb_blend_cmd)))
 				return -EFAULT;
+			spin_lock_irqsave(&fbi->parent->commit_lock, flags);
 			set_blend(fbi, c.blend.enable, c.blend.alpha);
 			if (gpio_have_tvout()) {
 				mlc_select(fbi, 1);
 				set_blend(fbi, c.blend.enable, c.blend.alpha);
 				mlc_select(fbi, 0);
 			}
+			spin_unlock_irqrestore(&fbi->parent->commit_lock, flags);
 			break;
 
 		case LF1000FB_IOCGALPHA:
@@ -1286,6 +1820,7 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd,
 			if (copy_from_user((void *)&c, argp,
 					sizeof(struct lf1000fb_position_cmd)))
 				return -EFAULT;
+			spin_lock_irqsave(&fbi->parent->commit_lock, flags);
 			set_position(fbi, c.position.left, c.position.top,
 					c.position.right, c.position.bottom,
 					c.position.apply);
@@ -1296,6 +1831,7 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd,
 						c.position.apply);
 				mlc_select(fbi, 0);
 			}
+			spin_unlock_irqrestore(&fbi->parent->commit_lock, flags);
 			break;
 
 		case LF1000FB_IOCGPOSTION:
@@ -1314,15 +1850,20 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd,
 			if (copy_from_user((void *)&c, argp,
 					sizeof(struct lf1000fb_vidscale_cmd)))
 				return -EFAULT;
+			spin_lock_irqsave(&fbi->parent->commit_lock, flags);
 			if (set_video_scaler(fbi, c.vidscale.sizex,
-					c.vidscale.sizey, c.vidscale.apply))
+					c.vidscale.sizey, c.vidscale.apply)) {
+				spin_unlock_irqrestore(&fbi->parent->commit_lock,
+						flags);
 				return -EINVAL;
+			}
 			if (gpio_have_tvout()) {
 				mlc_select(fbi, 1);
 				set_video_scaler(fbi, c.vidscale.sizex,
 						c.vidscale.sizey, c.vidscale.apply);
 				mlc_select(fbi, 0);
 			}
+			spin_unlock_irqrestore(&fbi->parent->commit_lock, flags);
 			break;
 
 		case LF1000FB_IOCGVIDSCALE:
@@ -1364,6 +1905,16 @@ static irqreturn_t lf1000fb_irq(int irq, void *dev_id)
 	if (lf1000_dpc_int_pending()) {
 		info->nirq++;
 		lf1000_dpc_clear_int();
+		spin_lock(&info->commit_lock);
+		lf1000fb_commit_advance(info);
+		if (info->refresh_want != info->refresh_div) {
+			if (info->refresh_div == 1)
+				info->idle_entries++;
+			info->refresh_div = info->refresh_want =
+				lf1000_dpc_set_refresh_div(info->refresh_want);
+		}
+		spin_unlock(&info->commit_lock);
+		wake_up_interruptible(&info->vsync_wait);
 	}
 
 	return IRQ_HANDLED;
@@ -1431,6 +1982,7 @@ static void __init init_debugfs(struct lf1000fb_layer *layer)
 	debugfs_create_u8("format", S_IRUSR, dir, (u8 *)&layer->format);
 	debugfs_create_u32("vstride", S_IRUSR, dir, &layer->vstride);
 	debugfs_create_u8("hstride", S_IRUSR, dir, &layer->hstride);
+	debugfs_create_u32("flips", S_IRUSR, dir, &layer->flips);
 }
 
 static int __init lf1000fb_probe_layer(struct lf1000fb_info *info, u8 index)
@@ -1607,6 +2159,11 @@ static int __init lf1000fb_probe(struct platform_device *pdev)
 		goto out_layers;
 	}
 
+	init_waitqueue_head(&info->vsync_wait);
+	spin_lock_init(&info->commit_lock);
+	setup_timer(&info->idle_timer, lf1000fb_idle, (unsigned long)info);
+	info->refresh_div = info->refresh_want = 1;
+
 	info->irq = platform_get_irq(pdev, 0);
 	if (info->irq < 0) {
 		dev_err(&pdev->dev, "failed to get an IRQ number\n");
@@ -1641,6 +2198,21 @@ static int __init lf1000fb_probe(struct platform_device *pdev)
 	else {
 		info->debug = dir;
 		debugfs_create_u32("nirq", S_IRUSR, dir, (u32 *)&info->nirq);
+		debugfs_create_u32("commits", S_IRUSR, dir, &info->commit_seq);
+		debugfs_create_u32("commit_busy", S_IRUSR, dir,
+				&info->commit_busy);
+		debugfs_create_u32("commit_fenced", S_IRUSR, dir,
+				&info->commit_fenced);
+		debugfs_create_u32("commit_expired", S_IRUSR, dir,
+				&info->commit_expired);
+		debugfs_create_u32("refresh_div", S_IRUSR, dir,
+				(u32 *)&info->refresh_div);
+		debugfs_create_u32("idle_entries", S_IRUSR, dir,
+				&info->idle_entries);
+		debugfs_create_u32("damage_reports", S_IRUSR, dir,
+				&info->damage_reports);
+		debugfs_create_u32("damage_pixels", S_IRUSR, dir,
+				&info->damage_pixels);
 		debugfs_create_file("registers", S_IRUSR, dir, info,
 			&lf1000_mlc_regs_fops);
 	}
@@ -1679,6 +2251,11 @@ static int __init lf1000fb_probe(struct platform_device *pdev)
 	info->nirq = 0;
 	lf1000_dpc_enable_int(1);
 
+	info->fence_nb.notifier_call = lf1000fb_fence_notify;
+	lf1000_fence_register_notifier(&info->fence_nb);
+
+	lf1000fb_activity(info);
+
 	return 0;
 
 out_fb:
@@ -1700,8 +2277,17 @@ static int lf1000fb_remove(struct platform_device *pdev)
 	struct fb_info *fbinfo = platform_get_drvdata(pdev);
 	struct lf1000fb_info *info = fbinfo->par;
 	struct lf1000fb_layer *layer;
+	unsigned long flags;
 	int i;
 
+	lf1000_fence_unregister_notifier(&info->fence_nb);
+
+	del_timer_sync(&info->idle_timer);
+	spin_lock_irqsave(&info->commit_lock, flags);
+	info->refresh_div = info->refresh_want =
+		lf1000_dpc_set_refresh_div(1);
+	spin_unlock_irqrestore(&info->commit_lock, flags);
+
 	if (info->debug)
 		debugfs_remove_recursive(info->debug);
 
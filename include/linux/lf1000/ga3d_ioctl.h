@@ -0,0 +1,56 @@
+/* LF1000 3D accelerator (GA3D) driver
+ *
+ * ga3d_ioctl.h -- Command list submission and fences.
+ *
+ * A command list is a sequence of register writes and waits that the driver
+ * copies into its command buffer and runs against the GA3D registers in
+ * submission order, on behalf of every client.  Each list is given a fence
+ * which is signalled once the list has run; fences can be waited on, polled
+ * with poll() (readable once the caller's last list is done), or handed to
+ * lf1000fb flips and commits to hold them back until the frame is drawn.
+ *
+ * Mapping the registers with mmap() still works, but should not be mixed
+ * with submitted lists.
+ */
+
+#ifndef GA3D_IOCTL_H
+#define GA3D_IOCTL_H
+
+#define GA3D_IOC_MAGIC		'3'
+
+/* ga3d_cmd.op: operation in the top bits, register offset in the rest */
+#define GA3D_OP_SHIFT		28
+#define GA3D_OP_REG_MASK	((1 << GA3D_OP_SHIFT) - 1)
+
+#define GA3D_OP_WRITE		(0 << GA3D_OP_SHIFT)	/* reg = value */
+#define GA3D_OP_WRITE_MASKED	(1 << GA3D_OP_SHIFT)	/* reg = (reg & ~mask) | value */
+#define GA3D_OP_WAIT		(2 << GA3D_OP_SHIFT)	/* until (reg & mask) == value */
+#define GA3D_OP_WAIT_IRQ	(3 << GA3D_OP_SHIFT)	/* sleep until reg & mask, then
+							   write mask to reg to clear it */
+
+struct ga3d_cmd {
+	unsigned int	op;
+	unsigned int	mask;
+	unsigned int	value;
+};
+
+#define GA3D_MAX_CMDS		1024	/* per list */
+
+struct ga3d_submit {
+	const struct ga3d_cmd	*cmds;
+	unsigned int		count;
+	unsigned int		fence;		/* on return */
+};
+
+struct ga3d_wait {
+	unsigned int		fence;
+	unsigned int		timeout_ms;
+};
+
+#define GA3D_IOCSUBMIT		_IOWR(GA3D_IOC_MAGIC, 0, struct ga3d_submit)
+/* GA3D_IOCWAIT returns -EIO for a list that timed out or failed, as long as
+ * it is one of the last 16 lists to fail; older failures read as success. */
+#define GA3D_IOCWAIT		_IOW(GA3D_IOC_MAGIC, 1, struct ga3d_wait)
+#define GA3D_IOCQFENCE		_IOR(GA3D_IOC_MAGIC, 2, unsigned int)	/* last done */
+
+#endif
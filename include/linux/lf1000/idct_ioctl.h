@@ -0,0 +1,37 @@
+/* LF1000 IDCT Macro Block Decoder driver
+ *
+ * idct_ioctl.h -- Batch submission interface.
+ *
+ * Each open file descriptor owns a ring of IDCT_RING_BLOCKS coefficient
+ * blocks, mapped into the caller with mmap() at offset IDCT_RING_OFFSET.
+ * A block is 64 signed 16-bit coefficients laid out exactly as they are
+ * written to the BUF_DATA registers, and is transformed in place.
+ * Mapping offset 0 still gives the raw register window, as before.
+ *
+ * The block has no interrupt we can use, so the driver polls INT_PEND for
+ * each block on the caller's behalf.  A batch costs one system call rather
+ * than one register sequence per block, but no less CPU time.
+ */
+
+#ifndef IDCT_IOCTL_H
+#define IDCT_IOCTL_H
+
+#define IDCT_IOC_MAGIC		'x'
+
+#define IDCT_BLOCK_SIZE		(64 * 2)	/* bytes per 8x8 block */
+#define IDCT_RING_BLOCKS	256
+#define IDCT_RING_SIZE		(IDCT_RING_BLOCKS * IDCT_BLOCK_SIZE)
+#define IDCT_RING_OFFSET	0x10000		/* mmap() offset of the ring */
+
+struct idct_batch {
+	unsigned int first;	/* ring index of the first block */
+	unsigned int count;	/* number of blocks, wraps around the ring */
+	unsigned int control;	/* CONTROL value that starts each block */
+	unsigned int done;	/* INT_PEND bits set when a block is done;
+				   written back to clear them */
+};
+
+/* Transform a batch of blocks; returns once all of them are done. */
+#define IDCT_IOCSBATCH		_IOW(IDCT_IOC_MAGIC, 0, struct idct_batch)
+
+#endif
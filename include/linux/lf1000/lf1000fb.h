@@ -73,10 +73,96 @@ struct lf1000fb_vidscale_cmd {
 	unsigned	apply : 1;	/* on set: apply right away */
 };
 
+/* lf1000fb_flip_cmd: queue a page flip to the given pan offsets without
+ * waiting for it.  This is a single-layer commit (see below) that fails with
+ * EBUSY rather than blocking when the commit queue is full. */
+struct lf1000fb_flip_cmd {
+	__u32		xoffset;
+	__u32		yoffset;
+	__u32		sequence;	/* on return: number of this flip */
+	__u32		fence;		/* GA3D fence to wait for, or 0 */
+};
+
+/* lf1000fb_flip_event: the most recently completed flip or commit touching a
+ * layer.  LF1000FB_IOCGFLIPEVENT returns EAGAIN if it has been collected
+ * already; LF1000FB_IOCWFLIPEVENT waits for the next one instead, failing
+ * with ETIMEDOUT if nothing reaches the screen within a little over a
+ * second. */
+struct lf1000fb_flip_event {
+	__u32		sequence;	/* flip or commit that reached the screen */
+	__u32		vblank;		/* vblank count when it did */
+};
+
+/* lf1000fb_commit_cmd: update several layers at once.  All changes are
+ * latched on the same vertical blank.  Commits are queued, with at most
+ * LF1000FB_COMMIT_QUEUE waiting behind the one being latched, and the call
+ * blocks for a free slot unless LF1000FB_COMMIT_NONBLOCK is set.  A commit
+ * with a GA3D fence (see ga3d_ioctl.h) is held in the queue until the fence
+ * is signalled, so a flip can be queued as soon as its frame is submitted.
+ * The fence must have been handed out already (EINVAL otherwise), and a
+ * commit is held for at most a second. */
+#define LF1000FB_COMMIT_MAX_LAYERS	3
+#define LF1000FB_COMMIT_QUEUE		2
+
+/* lf1000fb_commit_layer.flags: which settings to change */
+#define LF1000FB_COMMIT_ADDRESS		(1<<0)	/* xoffset, yoffset */
+#define LF1000FB_COMMIT_POSITION	(1<<1)	/* left, top, right, bottom */
+#define LF1000FB_COMMIT_ALPHA		(1<<2)	/* blend_enable, alpha */
+#define LF1000FB_COMMIT_SCALE		(1<<3)	/* sizex, sizey (YUV only) */
+
+/* lf1000fb_commit_cmd.flags */
+#define LF1000FB_COMMIT_NONBLOCK	(1<<0)
+
+struct lf1000fb_commit_layer {
+	__u32		layer;		/* fb layer index */
+	__u32		flags;
+	__u32		xoffset;
+	__u32		yoffset;
+	__s32		left;
+	__s32		top;
+	__s32		right;
+	__s32		bottom;
+	__u8		blend_enable;
+	__u8		alpha;
+	__u32		sizex;
+	__u32		sizey;
+};
+
+struct lf1000fb_commit_cmd {
+	__u32				count;	/* entries in layers[] */
+	__u32				flags;
+	__u32				sequence; /* on return */
+	struct lf1000fb_commit_layer	layers[LF1000FB_COMMIT_MAX_LAYERS];
+	__u32				fence;	/* GA3D fence, or 0 */
+};
+
+/* lf1000fb_damage_cmd: report the parts of a layer that have been redrawn,
+ * in pixels of the visible area.  Damage reports, flips, commits, pans and
+ * vsync waits all keep the screen at its full refresh rate; when they stop
+ * for a while the refresh rate is lowered until the next one.  The refresh
+ * rate is never lowered until the first damage report. */
+#define LF1000FB_DAMAGE_MAX_RECTS	8
+
+struct lf1000fb_rect {
+	__u32		x;
+	__u32		y;
+	__u32		width;
+	__u32		height;
+};
+
+struct lf1000fb_damage_cmd {
+	__u32			count;	/* entries in rects[] */
+	struct lf1000fb_rect	rects[LF1000FB_DAMAGE_MAX_RECTS];
+};
+
 union lf1000fb_cmd {
 	struct lf1000fb_blend_cmd	blend;
 	struct lf1000fb_position_cmd	position;
 	struct lf1000fb_vidscale_cmd	vidscale;
+	struct lf1000fb_flip_cmd	flip;
+	struct lf1000fb_flip_event	flip_event;
+	struct lf1000fb_commit_cmd	commit;
+	struct lf1000fb_damage_cmd	damage;
 };
 
 #define LF1000FB_IOCSALPHA	_IOW('m', 1, struct lf1000fb_alpha_cmd  *)
@@ -85,6 +171,11 @@ union lf1000fb_cmd {
 #define LF1000FB_IOCGPOSTION	_IOR('m', 4, struct lf1000fb_position_cmd *)
 #define LF1000FB_IOCSVIDSCALE	_IOW('m', 5, struct lf1000fb_vidscale_cmd *)
 #define LF1000FB_IOCGVIDSCALE	_IOR('m', 6, struct lf1000fb_vidscale_cmd *)
+#define LF1000FB_IOCFLIP	_IOWR('m', 7, struct lf1000fb_flip_cmd *)
+#define LF1000FB_IOCGFLIPEVENT	_IOR('m', 8, struct lf1000fb_flip_event *)
+#define LF1000FB_IOCCOMMIT	_IOWR('m', 9, struct lf1000fb_commit_cmd *)
+#define LF1000FB_IOCDAMAGE	_IOW('m', 10, struct lf1000fb_damage_cmd *)
+#define LF1000FB_IOCWFLIPEVENT	_IOR('m', 11, struct lf1000fb_flip_event *)
 
 #ifndef FBIO_WAITFORVSYNC
 #define FBIO_WAITFORVSYNC	 _IOW('F', 0x20, __u32)
@@ -185,6 +185,33 @@ static const struct file_operations lf1000_i2s_regs_fops = {
 	.release	= single_release,
 };
 
+/* Loop the I2S output back to its input, so that latency can be measured by
+ * playing and capturing at the same time without a codec in the path.
+ */
+static int lf1000_i2s_loopback_get(void *data, u64 *val)
+{
+	struct lf1000_i2s_info *lf1000_i2s = data;
+
+	*val = !!(readw(lf1000_i2s->adi_base + I2S_CONFIG) & LOOP_BACK);
+	return 0;
+}
+
+static int lf1000_i2s_loopback_set(void *data, u64 val)
+{
+	struct lf1000_i2s_info *lf1000_i2s = data;
+	unsigned int regs = readw(lf1000_i2s->adi_base + I2S_CONFIG);
+
+	if (val)
+		regs |= LOOP_BACK;
+	else
+		regs &= ~LOOP_BACK;
+	writew(regs, lf1000_i2s->adi_base + I2S_CONFIG);
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(lf1000_i2s_loopback_fops, lf1000_i2s_loopback_get,
+			lf1000_i2s_loopback_set, "%llu\n");
+
 static irqreturn_t lf1000_i2s_irq(int irq, void *dev_id)
 {
 	struct lf1000_i2s_info *lf1000_i2s = dev_id;
@@ -557,6 +584,9 @@ static int lf1000_i2s_probe(struct platform_device *pdev,
 				&lf1000_i2s.rate);
 		debugfs_create_u32("div", S_IRUSR, lf1000_i2s.debug,
 				&lf1000_i2s.div);
+		debugfs_create_file("loopback", S_IRUSR | S_IWUSR,
+			lf1000_i2s.debug, &lf1000_i2s,
+			&lf1000_i2s_loopback_fops);
 	}
 	dbg("%s.%d leaving\n", __FUNCTION__, __LINE__);
 	return 0;
@@ -0,0 +1,575 @@
+/*
+ * sound/soc/lf1000/lf1000-mixer.c
+ *
+ * In-kernel software mixer for the LF1000 SoC audio.
+ *
+ * The I2S output has a single playback substream.  This adds a second PCM
+ * device with several playback substreams; while any of them is open, the
+ * mixer holds the hardware substream open itself and, each time the DMA
+ * finishes a period, mixes the running substreams straight into that
+ * period of the DMA buffer.  Samples are scaled by the per-substream
+ * volume and saturated to 16 bits in the same pass, so nothing in user
+ * space needs to wake up per period to mix and copy.
+ *
+ * Copyright (c) 2010 LeapFrog Enterprises Inc.
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ */
+
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+
+#include <sound/core.h>
+#include <sound/control.h>
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+
+#include <sound/soc.h>
+
+#include "lf1000-pcm.h"
+
+#define DRIVER_NAME	"lf1000-mixer"
+
+#ifdef CONFIG_SND_LF1000_SOC_DEBUG
+#define dbg(x...)	printk(KERN_ALERT DRIVER_NAME ": " x)
+#else
+#define dbg(x...)
+#endif
+
+#define LF1000_MIXER_MAX_STREAMS	8
+#define LF1000_MIXER_UNITY		256	/* volume is Q8 */
+#define LF1000_MIXER_BUFFER_MAX		(64 * 1024)
+
+static int mixer_substreams = 4;
+module_param(mixer_substreams, int, 0444);
+MODULE_PARM_DESC(mixer_substreams, "Playback substreams on the mixer device");
+
+static int mixer_rate = 32000;
+module_param(mixer_rate, int, 0644);
+MODULE_PARM_DESC(mixer_rate, "Sample rate the mixer runs the I2S output at");
+
+static int mixer_period = 256;
+module_param(mixer_period, int, 0644);
+MODULE_PARM_DESC(mixer_period, "Mixer period, in frames");
+
+static int mixer_periods = 4;
+module_param(mixer_periods, int, 0644);
+MODULE_PARM_DESC(mixer_periods, "Periods in the hardware ring");
+
+struct lf1000_mixer_stream {
+	struct snd_pcm_substream *substream;
+	struct list_head list;		/* on lf1000_mixer.streams while open */
+	int running;
+	snd_pcm_uframes_t pos;		/* next frame to mix, in the buffer */
+	snd_pcm_uframes_t period_pos;	/* frames mixed in this period */
+};
+
+struct lf1000_mixer {
+	struct snd_pcm *hw_pcm;		/* the ASoC PCM on the I2S DAI */
+	struct snd_pcm *pcm;		/* our multi-substream PCM */
+	struct mutex open_lock;		/* users, hw */
+	int users;
+	struct snd_pcm_substream *hw;	/* held open while users > 0 */
+	struct file file;		/* stands in for the file hw is open on */
+	spinlock_t lock;		/* streams, fill */
+	struct list_head streams;
+	unsigned int fill;		/* hardware period to mix into next;
+					 * the ones up to the DMA's are due */
+	unsigned int volume[LF1000_MIXER_MAX_STREAMS][2];
+};
+
+static struct lf1000_mixer *lf1000_mixer;
+
+static inline s16 lf1000_mixer_clip(s32 v)
+{
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return v;
+}
+
+/*
+ * Mix 'frames' frames of one substream into the stereo period at 'dst'.
+ * The first substream stores; the others add.  Either way the volume is
+ * applied and the result saturated as it is written.
+ */
+static void lf1000_mixer_add(struct lf1000_mixer *mixer,
+		struct lf1000_mixer_stream *ms, s16 *dst,
+		snd_pcm_uframes_t frames, int first)
+{
+	struct snd_pcm_runtime *runtime = ms->substream->runtime;
+	unsigned int *volume = mixer->volume[ms->substream->number];
+	s32 vl = volume[0], vr = volume[1];
+	int stereo = runtime->channels == 2;
+	snd_pcm_uframes_t pos = ms->pos;
+
+	while (frames) {
+		snd_pcm_uframes_t n = min(frames, runtime->buffer_size - pos);
+		s16 *src = (s16 *)runtime->dma_area + pos * runtime->channels;
+		s32 l, r;
+
+		frames -= n;
+		pos += n;
+		if (pos == runtime->buffer_size)
+			pos = 0;
+
+		while (n--) {
+			l = *src++;
+			r = stereo ? *src++ : l;
+			l = (l * vl) >> 8;
+			r = (r * vr) >> 8;
+			if (!first) {
+				l += dst[0];
+				r += dst[1];
+			}
+			*dst++ = lf1000_mixer_clip(l);
+			*dst++ = lf1000_mixer_clip(r);
+		}
+	}
+	ms->pos = pos;
+}
+
+/*
+ * Mix the running substreams into the hardware period at 'dst' and move
+ * their positions on.  Called with mixer->lock held.
+ */
+static void lf1000_mixer_fill(struct lf1000_mixer *mixer, s16 *dst,
+		snd_pcm_uframes_t frames)
+{
+	struct lf1000_mixer_stream *ms;
+	int first = 1;
+
+	list_for_each_entry(ms, &mixer->streams, list) {
+		if (!ms->running)
+			continue;
+		lf1000_mixer_add(mixer, ms, dst, frames, first);
+		first = 0;
+	}
+	if (first)
+		memset(dst, 0, frames_to_bytes(mixer->hw->runtime, frames));
+
+	/*
+	 * The trigger callback doesn't take mixer->lock, so the substreams
+	 * can be told about their periods without dropping it; that keeps
+	 * close from freeing a runtime under us.
+	 */
+	list_for_each_entry(ms, &mixer->streams, list) {
+		if (!ms->running)
+			continue;
+		ms->period_pos += frames;
+		if (ms->period_pos >= ms->substream->runtime->period_size) {
+			ms->period_pos -= ms->substream->runtime->period_size;
+			snd_pcm_period_elapsed(ms->substream);
+		}
+	}
+}
+
+/*
+ * Called by lf1000-pcm each time the DMA finishes a period of a stream.
+ * If that stream is the one the mixer holds open, refill the periods the
+ * DMA has played since the last call from the running substreams.  Which
+ * ones those are comes from the DMA pointer rather than from counting
+ * calls, so a late or missed callback doesn't leave the mixer writing
+ * into the period being played.
+ */
+void lf1000_mixer_period(struct snd_pcm_substream *substream)
+{
+	struct lf1000_mixer *mixer = lf1000_mixer;
+	struct snd_pcm_runtime *hw;
+	snd_pcm_uframes_t frames;
+	unsigned long flags;
+	unsigned int playing;
+
+	if (!mixer || substream != mixer->hw)
+		return;
+
+	hw = substream->runtime;
+	frames = hw->period_size;
+	playing = substream->ops->pointer(substream) / frames;
+	if (playing >= hw->periods)
+		playing = 0;
+
+	spin_lock_irqsave(&mixer->lock, flags);
+	while (mixer->fill != playing) {
+		lf1000_mixer_fill(mixer, (s16 *)(hw->dma_area +
+				frames_to_bytes(hw, mixer->fill * frames)),
+				frames);
+		if (++mixer->fill >= hw->periods)
+			mixer->fill = 0;
+	}
+	spin_unlock_irqrestore(&mixer->lock, flags);
+}
+
+static void lf1000_mixer_set(struct snd_pcm_hw_params *params,
+		snd_pcm_hw_param_t var, unsigned int val)
+{
+	if (hw_is_mask(var)) {
+		snd_mask_none(hw_param_mask(params, var));
+		snd_mask_set(hw_param_mask(params, var), val);
+	} else {
+		struct snd_interval *i = hw_param_interval(params, var);
+
+		i->min = i->max = val;
+		i->openmin = i->openmax = 0;
+		i->integer = 1;
+		i->empty = 0;
+	}
+}
+
+/* open, configure and start the hardware substream, like OSS emulation */
+static int lf1000_mixer_hw_open(struct lf1000_mixer *mixer)
+{
+	struct snd_pcm_hw_params *params;
+	struct snd_pcm_sw_params *sw;
+	struct snd_pcm_substream *hw;
+	int ret;
+
+	params = kmalloc(sizeof(*params), GFP_KERNEL);
+	sw = kzalloc(sizeof(*sw), GFP_KERNEL);
+	if (!params || !sw) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	mutex_lock(&mixer->hw_pcm->open_mutex);
+	ret = snd_pcm_open_substream(mixer->hw_pcm, SNDRV_PCM_STREAM_PLAYBACK,
+			&mixer->file, &hw);
+	mutex_unlock(&mixer->hw_pcm->open_mutex);
+	if (ret < 0) {
+		dbg("%s: I2S playback busy (%d)\n", __FUNCTION__, ret);
+		goto out;
+	}
+
+	_snd_pcm_hw_params_any(params);
+	lf1000_mixer_set(params, SNDRV_PCM_HW_PARAM_ACCESS,
+			SNDRV_PCM_ACCESS_MMAP_INTERLEAVED);
+	lf1000_mixer_set(params, SNDRV_PCM_HW_PARAM_FORMAT,
+			SNDRV_PCM_FORMAT_S16_LE);
+	lf1000_mixer_set(params, SNDRV_PCM_HW_PARAM_CHANNELS, 2);
+	lf1000_mixer_set(params, SNDRV_PCM_HW_PARAM_RATE, mixer_rate);
+	lf1000_mixer_set(params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, mixer_period);
+	lf1000_mixer_set(params, SNDRV_PCM_HW_PARAM_PERIODS, mixer_periods);
+	ret = snd_pcm_kernel_ioctl(hw, SNDRV_PCM_IOCTL_HW_PARAMS, params);
+	if (ret < 0) {
+		printk(KERN_ERR DRIVER_NAME ": can't run I2S at %d Hz, "
+			"%d x %d frames (%d)\n", mixer_rate, mixer_periods,
+			mixer_period, ret);
+		goto release;
+	}
+
+	/* nothing writes the hardware stream's appl_ptr, so never stop it */
+	sw->tstamp_mode = SNDRV_PCM_TSTAMP_NONE;
+	sw->period_step = 1;
+	sw->avail_min = hw->runtime->period_size;
+	sw->start_threshold = 1;
+	sw->stop_threshold = hw->runtime->boundary;
+	ret = snd_pcm_kernel_ioctl(hw, SNDRV_PCM_IOCTL_SW_PARAMS, sw);
+	if (ret < 0)
+		goto release;
+
+	ret = snd_pcm_kernel_ioctl(hw, SNDRV_PCM_IOCTL_PREPARE, NULL);
+	if (ret < 0)
+		goto release;
+
+	memset(hw->runtime->dma_area, 0,
+		frames_to_bytes(hw->runtime, hw->runtime->buffer_size));
+	mixer->fill = 0;
+	mixer->hw = hw;
+
+	ret = snd_pcm_kernel_ioctl(hw, SNDRV_PCM_IOCTL_START, NULL);
+	if (ret < 0) {
+		mixer->hw = NULL;
+		goto release;
+	}
+	dbg("%s: I2S running at %u Hz, %lu x %lu frames\n", __FUNCTION__,
+		hw->runtime->rate, (unsigned long)hw->runtime->periods,
+		hw->runtime->period_size);
+	goto out;
+
+release:
+	mutex_lock(&mixer->hw_pcm->open_mutex);
+	snd_pcm_release_substream(hw);
+	mutex_unlock(&mixer->hw_pcm->open_mutex);
+out:
+	kfree(sw);
+	kfree(params);
+	return ret;
+}
+
+static void lf1000_mixer_hw_close(struct lf1000_mixer *mixer)
+{
+	struct snd_pcm_substream *hw = mixer->hw;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mixer->lock, flags);
+	mixer->hw = NULL;
+	spin_unlock_irqrestore(&mixer->lock, flags);
+
+	mutex_lock(&mixer->hw_pcm->open_mutex);
+	snd_pcm_release_substream(hw);
+	mutex_unlock(&mixer->hw_pcm->open_mutex);
+}
+
+static struct snd_pcm_hardware lf1000_mixer_hardware = {
+	.info			= SNDRV_PCM_INFO_MMAP |
+				  SNDRV_PCM_INFO_BLOCK_TRANSFER |
+				  SNDRV_PCM_INFO_MMAP_VALID |
+				  SNDRV_PCM_INFO_INTERLEAVED |
+				  SNDRV_PCM_INFO_PAUSE |
+				  SNDRV_PCM_INFO_RESUME,
+	.formats		= SNDRV_PCM_FMTBIT_S16_LE,
+	.rates			= SNDRV_PCM_RATE_CONTINUOUS,
+	.rate_min		= 8000,
+	.rate_max		= 48000,
+	.channels_min		= 1,
+	.channels_max		= 2,
+	.period_bytes_min	= 64,
+	.period_bytes_max	= 1024 * 16,
+	.periods_min		= 2,
+	.periods_max		= 32,
+	.buffer_bytes_max	= LF1000_MIXER_BUFFER_MAX,
+};
+
+static int lf1000_mixer_open(struct snd_pcm_substream *substream)
+{
+	struct lf1000_mixer *mixer = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct lf1000_mixer_stream *ms;
+	unsigned long flags;
+	unsigned int period;
+	int ret = 0;
+
+	ms = kzalloc(sizeof(*ms), GFP_KERNEL);
+	if (!ms)
+		return -ENOMEM;
+	ms->substream = substream;
+
+	mutex_lock(&mixer->open_lock);
+	if (mixer->users == 0)
+		ret = lf1000_mixer_hw_open(mixer);
+	if (ret) {
+		mutex_unlock(&mixer->open_lock);
+		kfree(ms);
+		return ret;
+	}
+	mixer->users++;
+
+	/*
+	 * Substreams run at the rate the I2S is running at and move on a
+	 * whole hardware period at a time.
+	 */
+	period = mixer->hw->runtime->period_size;
+	runtime->hw = lf1000_mixer_hardware;
+	runtime->hw.rate_min = runtime->hw.rate_max = mixer->hw->runtime->rate;
+	runtime->private_data = ms;
+	snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIODS);
+	snd_pcm_hw_constraint_step(runtime, 0,
+			SNDRV_PCM_HW_PARAM_PERIOD_SIZE, period);
+	snd_pcm_hw_constraint_step(runtime, 0,
+			SNDRV_PCM_HW_PARAM_BUFFER_SIZE, period);
+
+	spin_lock_irqsave(&mixer->lock, flags);
+	list_add_tail(&ms->list, &mixer->streams);
+	spin_unlock_irqrestore(&mixer->lock, flags);
+	mutex_unlock(&mixer->open_lock);
+	return 0;
+}
+
+static int lf1000_mixer_close(struct snd_pcm_substream *substream)
+{
+	struct lf1000_mixer *mixer = snd_pcm_substream_chip(substream);
+	struct lf1000_mixer_stream *ms = substream->runtime->private_data;
+	unsigned long flags;
+
+	mutex_lock(&mixer->open_lock);
+	spin_lock_irqsave(&mixer->lock, flags);
+	list_del(&ms->list);
+	spin_unlock_irqrestore(&mixer->lock, flags);
+	if (--mixer->users == 0)
+		lf1000_mixer_hw_close(mixer);
+	mutex_unlock(&mixer->open_lock);
+
+	kfree(ms);
+	return 0;
+}
+
+static int lf1000_mixer_hw_params(struct snd_pcm_substream *substream,
+		struct snd_pcm_hw_params *params)
+{
+	return snd_pcm_lib_malloc_pages(substream, params_buffer_bytes(params));
+}
+
+static int lf1000_mixer_hw_free(struct snd_pcm_substream *substream)
+{
+	return snd_pcm_lib_free_pages(substream);
+}
+
+static int lf1000_mixer_prepare(struct snd_pcm_substream *substream)
+{
+	struct lf1000_mixer_stream *ms = substream->runtime->private_data;
+
+	ms->pos = 0;
+	ms->period_pos = 0;
+	return 0;
+}
+
+/* called with the stream lock held; must not take mixer->lock */
+static int lf1000_mixer_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct lf1000_mixer_stream *ms = substream->runtime->private_data;
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+	case SNDRV_PCM_TRIGGER_RESUME:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		ms->running = 1;
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		ms->running = 0;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static snd_pcm_uframes_t lf1000_mixer_pointer(
+		struct snd_pcm_substream *substream)
+{
+	struct lf1000_mixer_stream *ms = substream->runtime->private_data;
+
+	return ms->pos;
+}
+
+static struct snd_pcm_ops lf1000_mixer_ops = {
+	.open		= lf1000_mixer_open,
+	.close		= lf1000_mixer_close,
+	.ioctl		= snd_pcm_lib_ioctl,
+	.hw_params	= lf1000_mixer_hw_params,
+	.hw_free	= lf1000_mixer_hw_free,
+	.prepare	= lf1000_mixer_prepare,
+	.trigger	= lf1000_mixer_trigger,
+	.pointer	= lf1000_mixer_pointer,
+};
+
+/* "Mixer Playback Volume", one element per substream, left and right */
+static int lf1000_mixer_volume_info(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 2;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = LF1000_MIXER_UNITY;
+	return 0;
+}
+
+static int lf1000_mixer_volume_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct lf1000_mixer *mixer = snd_kcontrol_chip(kcontrol);
+	unsigned int *volume =
+		mixer->volume[snd_ctl_get_ioff(kcontrol, &ucontrol->id)];
+
+	ucontrol->value.integer.value[0] = volume[0];
+	ucontrol->value.integer.value[1] = volume[1];
+	return 0;
+}
+
+static int lf1000_mixer_volume_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct lf1000_mixer *mixer = snd_kcontrol_chip(kcontrol);
+	unsigned int *volume =
+		mixer->volume[snd_ctl_get_ioff(kcontrol, &ucontrol->id)];
+	unsigned int l = ucontrol->value.integer.value[0];
+	unsigned int r = ucontrol->value.integer.value[1];
+	int changed;
+
+	if (l > LF1000_MIXER_UNITY || r > LF1000_MIXER_UNITY)
+		return -EINVAL;
+	changed = volume[0] != l || volume[1] != r;
+	volume[0] = l;
+	volume[1] = r;
+	return changed;
+}
+
+static struct snd_kcontrol_new lf1000_mixer_volume = {
+	.iface	= SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name	= "Mixer Playback Volume",
+	.info	= lf1000_mixer_volume_info,
+	.get	= lf1000_mixer_volume_get,
+	.put	= lf1000_mixer_volume_put,
+};
+
+static void lf1000_mixer_free(struct snd_pcm *pcm)
+{
+	struct lf1000_mixer *mixer = pcm->private_data;
+
+	if (lf1000_mixer == mixer)
+		lf1000_mixer = NULL;
+	kfree(mixer);
+}
+
+/*
+ * Called from lf1000_pcm_new() with the PCM on the I2S DAI.  The mixer is
+ * the next PCM device on the card.
+ */
+int lf1000_mixer_new(struct snd_card *card, struct snd_pcm *hw_pcm)
+{
+	struct lf1000_mixer *mixer;
+	struct snd_pcm *pcm;
+	int i, ret;
+
+	if (mixer_substreams < 1 || mixer_substreams > LF1000_MIXER_MAX_STREAMS) {
+		printk(KERN_ERR DRIVER_NAME ": mixer_substreams must be "
+			"1 to %d\n", LF1000_MIXER_MAX_STREAMS);
+		return -EINVAL;
+	}
+
+	mixer = kzalloc(sizeof(*mixer), GFP_KERNEL);
+	if (!mixer)
+		return -ENOMEM;
+	mixer->hw_pcm = hw_pcm;
+	mutex_init(&mixer->open_lock);
+	spin_lock_init(&mixer->lock);
+	INIT_LIST_HEAD(&mixer->streams);
+	mixer->file.f_flags = O_WRONLY;
+	for (i = 0; i < LF1000_MIXER_MAX_STREAMS; i++)
+		mixer->volume[i][0] = mixer->volume[i][1] = LF1000_MIXER_UNITY;
+
+	ret = snd_pcm_new(card, "LF1000 Mixer", hw_pcm->device + 1,
+			mixer_substreams, 0, &pcm);
+	if (ret) {
+		kfree(mixer);
+		return ret;
+	}
+	pcm->private_data = mixer;
+	pcm->private_free = lf1000_mixer_free;
+	strcpy(pcm->name, "LF1000 Mixer");
+	mixer->pcm = pcm;
+	snd_pcm_set_ops(pcm, SNDRV_PCM_STREAM_PLAYBACK, &lf1000_mixer_ops);
+
+	ret = snd_pcm_lib_preallocate_pages_for_all(pcm,
+			SNDRV_DMA_TYPE_CONTINUOUS,
+			snd_dma_continuous_data(GFP_KERNEL),
+			LF1000_MIXER_BUFFER_MAX, LF1000_MIXER_BUFFER_MAX);
+	if (ret)
+		return ret;
+
+	lf1000_mixer_volume.count = mixer_substreams;
+	ret = snd_ctl_add(card, snd_ctl_new1(&lf1000_mixer_volume, mixer));
+	if (ret)
+		return ret;
+
+	lf1000_mixer = mixer;
+	dbg("%s: %d substreams on pcm%d\n", __FUNCTION__, mixer_substreams,
+		pcm->device);
+	return 0;
+}
@@ -15,6 +15,8 @@
 
 #include <linux/dma-mapping.h>
 #include <linux/interrupt.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
@@ -45,8 +47,171 @@ struct lf1000_runtime_data {
 	unsigned int dma_ch;
 	dma_addr_t dma_buf;
 	struct lf1000_pcm_dma_params *params;
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	struct dma_chan *chan;		/* low-latency mode: dmaengine channel */
+	struct lf1000_dma_slave slave;
+	unsigned int boundary;		/* buffer offset where the period being
+					 * played ends */
+	u32 last_ptr;			/* last position the DMA reported */
+	bool replay;			/* restarted: the DMA is going over the
+					 * period before last_ptr again */
+#endif
+};
+
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+/*
+ * Low-latency mode.  The ring runs as a cyclic dmaengine transfer, so the
+ * next period is already in the DMA channel's command buffer when one
+ * ends and small periods (64-128 frames) don't underrun waiting for an
+ * interrupt.  The pointer is read from the DMA length register rather
+ * than rounded to the period, and neither the period callback nor the
+ * pointer takes prtd->lock.
+ */
+static int low_latency = 1;
+module_param(low_latency, bool, 0644);
+MODULE_PARM_DESC(low_latency, "Use the low-latency DMA path for new streams");
+
+/* how late period callbacks are, per direction; in lf1000-pcm/ in debugfs */
+struct lf1000_pcm_latency {
+	u32 rate;
+	u32 period_frames;
+	u32 buffer_frames;
+	u32 periods;		/* callbacks since the stream was prepared */
+	u32 late_max;		/* frames the DMA had moved past the end of
+				 * the period when its callback ran */
+	u64 late_sum;
+	u32 late_periods;	/* callbacks a whole period or more late */
 };
 
+static struct lf1000_pcm_latency lf1000_pcm_latency[LF1000_PCM_NUM_STREAMS];
+static struct dentry *lf1000_pcm_debug;
+
+static u32 lf1000_pcm_frames_to_us(u32 frames, u32 rate)
+{
+	return rate ? div_u64((u64)frames * 1000000, rate) : 0;
+}
+
+static int lf1000_pcm_latency_show(struct seq_file *s, void *v)
+{
+	struct lf1000_pcm_latency *lat = s->private;
+	u32 avg = lat->periods ? div_u64(lat->late_sum, lat->periods) : 0;
+
+	seq_printf(s, "rate %u, period %u frames, buffer %u frames (%u us)\n",
+		lat->rate, lat->period_frames, lat->buffer_frames,
+		lf1000_pcm_frames_to_us(lat->buffer_frames, lat->rate));
+	seq_printf(s, "periods %u\n", lat->periods);
+	seq_printf(s, "callback late by: max %u frames (%u us), "
+		"avg %u frames (%u us)\n",
+		lat->late_max, lf1000_pcm_frames_to_us(lat->late_max, lat->rate),
+		avg, lf1000_pcm_frames_to_us(avg, lat->rate));
+	seq_printf(s, "callbacks a period or more late %u\n",
+		lat->late_periods);
+	return 0;
+}
+
+static int lf1000_pcm_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lf1000_pcm_latency_show, inode->i_private);
+}
+
+static const struct file_operations lf1000_pcm_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lf1000_pcm_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int lf1000_pcm_dma_ptr(struct snd_pcm_substream *substream)
+{
+	struct lf1000_runtime_data *prtd = substream->runtime->private_data;
+	unsigned int addr, ptr, start;
+
+	if (lf1000_dma_position(prtd->chan, &addr))
+		return prtd->last_ptr;
+	ptr = addr - prtd->dma_buf;
+	if (ptr >= snd_pcm_lib_buffer_bytes(substream))
+		return prtd->last_ptr;
+
+	/* don't let the pointer go back while a restarted stream catches
+	 * up with where it stopped */
+	if (prtd->replay) {
+		start = prtd->last_ptr - prtd->last_ptr %
+			snd_pcm_lib_period_bytes(substream);
+		if (ptr >= start && ptr < prtd->last_ptr)
+			return prtd->last_ptr;
+		prtd->replay = false;
+	}
+	prtd->last_ptr = ptr;
+	return ptr;
+}
+
+/* dmaengine callback, once per period */
+static void lf1000_pcm_period_done(void *data)
+{
+	struct snd_pcm_substream *substream = data;
+	struct lf1000_runtime_data *prtd = substream->runtime->private_data;
+	struct lf1000_pcm_latency *lat = &lf1000_pcm_latency[substream->stream];
+	unsigned int buffer = snd_pcm_lib_buffer_bytes(substream);
+	unsigned int late;
+
+	late = (lf1000_pcm_dma_ptr(substream) + buffer - prtd->boundary)
+		% buffer;
+	late = bytes_to_frames(substream->runtime, late);
+	lat->periods++;
+	lat->late_sum += late;
+	if (late > lat->late_max)
+		lat->late_max = late;
+	if (late >= lat->period_frames)
+		lat->late_periods++;
+
+	prtd->boundary += snd_pcm_lib_period_bytes(substream);
+	if (prtd->boundary >= buffer)
+		prtd->boundary -= buffer;
+
+#ifdef CONFIG_SND_LF1000_SOC_MIXER
+	lf1000_mixer_period(substream);
+#endif
+	snd_pcm_period_elapsed(substream);
+}
+
+/*
+ * Build the ring and start it.  A new stream starts at the beginning of the
+ * buffer.  After a pause or suspend ('resume' set) the ring starts with the
+ * period the stream stopped in, which is played or captured again from its
+ * beginning: the DMA can only start on a period.
+ */
+static int lf1000_pcm_ll_start(struct snd_pcm_substream *substream,
+		int resume)
+{
+	struct lf1000_runtime_data *prtd = substream->runtime->private_data;
+	unsigned int period = snd_pcm_lib_period_bytes(substream);
+	struct dma_async_tx_descriptor *desc;
+	unsigned int start;
+
+	if (!resume)
+		prtd->last_ptr = 0;
+	start = prtd->last_ptr - prtd->last_ptr % period;
+
+	desc = lf1000_dma_prep_cyclic(prtd->chan, prtd->dma_buf,
+		snd_pcm_lib_buffer_bytes(substream), period, start,
+		substream->stream == SNDRV_PCM_STREAM_PLAYBACK ?
+			DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	if (!desc)
+		return -ENOMEM;
+
+	prtd->replay = (prtd->last_ptr != start);
+	prtd->boundary = start + period;
+	if (prtd->boundary >= snd_pcm_lib_buffer_bytes(substream))
+		prtd->boundary = 0;
+	desc->callback = lf1000_pcm_period_done;
+	desc->callback_param = substream;
+	desc->tx_submit(desc);
+	dma_async_issue_pending(prtd->chan);
+	return 0;
+}
+#endif /* CONFIG_SND_LF1000_SOC_LOW_LATENCY */
+
 static const struct snd_pcm_hardware lf1000_pcm_hardware = {
 	.info			= SNDRV_PCM_INFO_MMAP |
 				  SNDRV_PCM_INFO_BLOCK_TRANSFER |
@@ -73,8 +238,12 @@ static irqreturn_t lf1000_pcm_irqhandler(int ch, void *data)
 
 	dbg("%s.%d enter\n", __FUNCTION__, __LINE__);
 
-	if (substream)
+	if (substream) {
+#ifdef CONFIG_SND_LF1000_SOC_MIXER
+		lf1000_mixer_period(substream);
+#endif
 		snd_pcm_period_elapsed(substream);
+	}
 	
 	return IRQ_HANDLED;
 }
@@ -97,6 +266,28 @@ static int lf1000_pcm_hw_params(struct snd_pcm_substream *substream,
 		return 0;
 	}
 
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	if (low_latency && prtd->params == NULL) {
+		dma_cap_mask_t mask;
+
+		prtd->slave.priority = DMA_PRIORITY_LV1;
+		prtd->slave.fifo = dma->dma_addr;
+		prtd->slave.request_id =
+			(substream->stream == SNDRV_PCM_STREAM_PLAYBACK) ?
+			DMA_PERI_PCMOUT : DMA_PERI_PCMIN;
+		prtd->slave.pool_depth = lf1000_pcm_hardware.periods_max;
+
+		dma_cap_zero(mask);
+		dma_cap_set(DMA_SLAVE, mask);
+		prtd->chan = dma_request_channel(mask, lf1000_dma_filter,
+				&prtd->slave);
+		if (!prtd->chan)
+			dbg("%s.%d no dmaengine channel, using dma_request\n",
+				__FUNCTION__, __LINE__);
+	}
+	if (prtd->chan)
+		prtd->params = dma;
+#endif
 	/* this may get called several times by oss emulation with different params -HW */
 	if (prtd->params == NULL) {
 
@@ -125,6 +316,14 @@ static int lf1000_pcm_hw_free(struct snd_pcm_substream *substream)
 	struct lf1000_runtime_data *prtd = substream->runtime->private_data;
 
 	dbg("%s.%d enter\n", __FUNCTION__, __LINE__);
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	if (prtd->chan) {
+		snd_pcm_set_runtime_buffer(substream, NULL);
+		dma_release_channel(prtd->chan);
+		prtd->chan = NULL;
+		prtd->params = NULL;
+	}
+#endif
 	if (prtd->dma_ch) {
 		snd_pcm_set_runtime_buffer(substream, NULL);
 		dma_release(prtd->dma_ch);
@@ -149,6 +348,21 @@ static int lf1000_pcm_prepare(struct snd_pcm_substream *substream)
 		return 0;
 	}
 
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	if (prtd->chan) {
+		struct lf1000_pcm_latency *lat =
+			&lf1000_pcm_latency[substream->stream];
+
+		/* the ring itself is built when the stream starts */
+		prtd->slave.width = runtime->frame_bits / 8;
+		memset(lat, 0, sizeof(*lat));
+		lat->rate = runtime->rate;
+		lat->period_frames = runtime->period_size;
+		lat->buffer_frames = runtime->buffer_size;
+		return 0;
+	}
+#endif
+
 	// get one frame size (bytes)
 	size = frames_to_bytes(runtime, runtime->period_size);
 	/* insert data */
@@ -216,6 +430,24 @@ static int lf1000_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 
 	dbg("%s.%d enter\n", __FUNCTION__, __LINE__);
 
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	if (prtd->chan) {
+		switch (cmd) {
+		case SNDRV_PCM_TRIGGER_START:
+			return lf1000_pcm_ll_start(substream, 0);
+		case SNDRV_PCM_TRIGGER_RESUME:
+		case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+			return lf1000_pcm_ll_start(substream, 1);
+		case SNDRV_PCM_TRIGGER_STOP:
+		case SNDRV_PCM_TRIGGER_SUSPEND:
+		case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+			prtd->chan->device->device_terminate_all(prtd->chan);
+			return 0;
+		}
+		return -EINVAL;
+	}
+#endif
+
 	spin_lock(&prtd->lock);
 
 	switch (cmd) {
@@ -251,6 +483,11 @@ static snd_pcm_uframes_t lf1000_pcm_pointer(struct snd_pcm_substream *substream)
 
 	dbg("%s.%d enter\n", __FUNCTION__, __LINE__);
 
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	if (prtd->chan)
+		return bytes_to_frames(runtime, lf1000_pcm_dma_ptr(substream));
+#endif
+
 	spin_lock(&prtd->lock);
 
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
@@ -402,6 +639,13 @@ static int lf1000_pcm_new(struct snd_card *card, struct snd_soc_dai *dai,
 				SNDRV_PCM_STREAM_PLAYBACK);
 		if (ret)
 			return ret;
+#ifdef CONFIG_SND_LF1000_SOC_MIXER
+		ret = lf1000_mixer_new(card, pcm);
+		if (ret)
+			printk(KERN_ERR DRIVER_NAME ": no mixer device (%d)\n",
+				ret);
+		ret = 0;
+#endif
 	}
 	
 	if (dai->capture.channels_min) {
@@ -457,12 +701,31 @@ EXPORT_SYMBOL_GPL(lf1000_soc_platform);
 
 static int __init lf1000_soc_platform_init(void)
 {
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	lf1000_pcm_debug = debugfs_create_dir(DRIVER_NAME, NULL);
+	if (IS_ERR(lf1000_pcm_debug))
+		lf1000_pcm_debug = NULL;
+	if (lf1000_pcm_debug) {
+		debugfs_create_file("playback_latency", S_IRUSR,
+			lf1000_pcm_debug,
+			&lf1000_pcm_latency[SNDRV_PCM_STREAM_PLAYBACK],
+			&lf1000_pcm_latency_fops);
+		debugfs_create_file("capture_latency", S_IRUSR,
+			lf1000_pcm_debug,
+			&lf1000_pcm_latency[SNDRV_PCM_STREAM_CAPTURE],
+			&lf1000_pcm_latency_fops);
+	}
+#endif
 	return snd_soc_register_platform(&lf1000_soc_platform);
 }
 
 static void __exit lf1000_soc_platform_exit(void)
 {
 	snd_soc_unregister_platform(&lf1000_soc_platform);
+#ifdef CONFIG_SND_LF1000_SOC_LOW_LATENCY
+	if (lf1000_pcm_debug)
+		debugfs_remove_recursive(lf1000_pcm_debug);
+#endif
 }
 
 module_init(lf1000_soc_platform_init);
@@ -27,4 +27,10 @@ struct lf1000_pcm_dma_params {
 
 extern struct snd_soc_platform lf1000_soc_platform;
 
+#ifdef CONFIG_SND_LF1000_SOC_MIXER
+/* lf1000-mixer.c */
+int lf1000_mixer_new(struct snd_card *card, struct snd_pcm *hw_pcm);
+void lf1000_mixer_period(struct snd_pcm_substream *substream);
+#endif
+
 #endif /* __LF1000_PCM_H__ */